@@ -0,0 +1,82 @@
+#include <benchmark/benchmark.h>
+
+#include "./Activation.h"
+#include "./Benchmark.h"
+
+// ____________________________________________________________________________
+// Shapes {rows, cols} of layer outputs: small batch, large batch, wide layer
+// and a 10 class output.
+void activationShapes(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"rows", "cols"});
+  // Large outputs are split between the pool threads: time the wall clock.
+  b->UseRealTime();
+  b->Args({1, 256});
+  b->Args({64, 512});
+  b->Args({1024, 1024});
+  b->Args({4096, 10});
+}
+
+// ____________________________________________________________________________
+// An activation as a function returning a new matrix.
+void BM_Activation(benchmark::State &state,
+                   Matrix<float> (*activation)(const Matrix<float> &)) {
+  const size_t rows = state.range(0);
+  const size_t cols = state.range(1);
+  Matrix<float> X(rows, cols, InitState::RANDOM);
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    Matrix<float> A = activation(X);
+    benchmark::DoNotOptimize(A.data());
+  }
+  setCounters(state, 0, 2.0 * sizeof(float) * rows * cols, before);
+}
+BENCHMARK_CAPTURE(BM_Activation, relu, &relu<float>)->Apply(activationShapes);
+BENCHMARK_CAPTURE(BM_Activation, step, &step<float>)->Apply(activationShapes);
+BENCHMARK_CAPTURE(BM_Activation, sigmoid, &sigmoid<float>)
+    ->Apply(activationShapes);
+BENCHMARK_CAPTURE(BM_Activation, tanh, &tanh<float>)->Apply(activationShapes);
+BENCHMARK_CAPTURE(BM_Activation, softmax, &softmax<float>)
+    ->Apply(activationShapes);
+
+// ____________________________________________________________________________
+// Derivative of an activation into a preallocated matrix, as in training.
+void BM_ActivationDerivative(benchmark::State &state, Activation activation) {
+  const size_t rows = state.range(0);
+  const size_t cols = state.range(1);
+  Matrix<float> X(rows, cols, InitState::RANDOM);
+  Matrix<float> out(rows, cols, InitState::EMPTY);
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    activationDerivative(activation, X, out);
+    benchmark::DoNotOptimize(out.data());
+  }
+  setCounters(state, 0, 2.0 * sizeof(float) * rows * cols, before);
+}
+BENCHMARK_CAPTURE(BM_ActivationDerivative, relu, Activation::relu)
+    ->Apply(activationShapes);
+BENCHMARK_CAPTURE(BM_ActivationDerivative, sigmoid, Activation::sigmoid)
+    ->Apply(activationShapes);
+BENCHMARK_CAPTURE(BM_ActivationDerivative, tanh, Activation::tanh)
+    ->Apply(activationShapes);
+BENCHMARK_CAPTURE(BM_ActivationDerivative, softmax, Activation::softmax)
+    ->Apply(activationShapes);
+
+// ____________________________________________________________________________
+// Fused softmax cross-entropy and its gradient (one-hot targets), as the
+// output layer of a classifier computes it in training.
+void BM_SoftmaxCrossEntropy(benchmark::State &state) {
+  const size_t rows = state.range(0);
+  const size_t cols = state.range(1);
+  Matrix<float> Z(rows, cols, InitState::RANDOM);
+  Matrix<float> Y(rows, cols, InitState::ZERO);
+  for (size_t row = 0; row < rows; ++row) {
+    Y[row][row % cols] = 1.0f;
+  }
+  Matrix<float> gradient(rows, cols, InitState::EMPTY);
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(softmaxCrossEntropy(Z, Y, gradient));
+  }
+  setCounters(state, 0, 3.0 * sizeof(float) * rows * cols, before);
+}
+BENCHMARK(BM_SoftmaxCrossEntropy)->Apply(activationShapes);
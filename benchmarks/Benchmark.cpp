@@ -0,0 +1,49 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "./AlignedAllocator.h"
+#include "./Benchmark.h"
+
+// ____________________________________________________________________________
+// Counting operator new for the "allocs" counter. (GCC does not see that
+// operator delete is replaced as well.)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+namespace {
+std::atomic<std::size_t> numNewCalls{0};
+} // namespace
+
+void *operator new(std::size_t size) {
+  numNewCalls.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+// ____________________________________________________________________________
+std::size_t numAllocations() {
+  return numNewCalls.load(std::memory_order_relaxed) +
+         numAlignedAllocations.load(std::memory_order_relaxed);
+}
+
+// ____________________________________________________________________________
+void setCounters(benchmark::State &state, double flopsPerIteration,
+                 double bytesPerIteration, std::size_t allocationsBefore) {
+  const double iterations = static_cast<double>(state.iterations());
+  const double allocations =
+      static_cast<double>(numAllocations() - allocationsBefore);
+  if (flopsPerIteration > 0) {
+    state.counters["flops"] = benchmark::Counter(
+        flopsPerIteration, benchmark::Counter::kIsIterationInvariantRate);
+  }
+  state.SetBytesProcessed(
+      static_cast<int64_t>(bytesPerIteration * iterations));
+  state.counters["allocs"] = allocations / iterations;
+}
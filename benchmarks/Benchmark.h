@@ -0,0 +1,19 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+#include <cstddef>
+
+// ____________________________________________________________________________
+// Shared helpers of the benchmarks.
+
+// Returns the number of allocations so far: operator new (replaced in
+// Benchmark.cpp) and matrix buffers (see AlignedAllocator.h).
+std::size_t numAllocations();
+
+// Sets the counters of a finished benchmark:
+// "flops": floating point operations per second (flopsPerIteration per
+// iteration), bytes_per_second: memory traffic (bytesPerIteration per
+// iteration), "allocs": allocations per iteration since allocationsBefore
+// (numAllocations() before the benchmark loop).
+void setCounters(benchmark::State &state, double flopsPerIteration,
+                 double bytesPerIteration, std::size_t allocationsBefore);
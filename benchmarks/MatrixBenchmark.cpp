@@ -0,0 +1,206 @@
+#include <benchmark/benchmark.h>
+
+#include "./Benchmark.h"
+#include "./Expression.h"
+#include "./Matrix.h"
+
+// ____________________________________________________________________________
+// Matrix shapes {m, k, n} of the products in an MLP (m x k times k x n).
+void mlpShapes(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"m", "k", "n"});
+  // The GEMM runs on the thread pool, CPU time of the caller would be short.
+  b->UseRealTime();
+  // Small batch inference.
+  b->Args({1, 256, 256});
+  b->Args({8, 784, 128});
+  b->Args({16, 512, 512});
+  // Large batch training.
+  b->Args({256, 784, 256});
+  b->Args({512, 512, 512});
+  b->Args({1024, 256, 128});
+  // Skinny (few features / outputs, weight gradients).
+  b->Args({4096, 32, 8});
+  b->Args({64, 4096, 64});
+  b->Args({4096, 64, 512});
+  // Square.
+  b->Args({128, 128, 128});
+  b->Args({1024, 1024, 1024});
+}
+
+// ____________________________________________________________________________
+// Elementwise shapes {rows, cols}.
+void elementwiseShapes(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"rows", "cols"});
+  b->UseRealTime();
+  b->Args({1, 256});
+  b->Args({64, 128});
+  b->Args({256, 512});
+  b->Args({1024, 1024});
+  b->Args({4096, 10});
+}
+
+// ____________________________________________________________________________
+void BM_Dot(benchmark::State &state) {
+  const size_t m = state.range(0);
+  const size_t k = state.range(1);
+  const size_t n = state.range(2);
+  Matrix<float> A(m, k, InitState::RANDOM);
+  Matrix<float> B(k, n, InitState::RANDOM);
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    Matrix<float> C = dot(A, B);
+    benchmark::DoNotOptimize(C.data());
+  }
+  setCounters(state, 2.0 * m * n * k, sizeof(float) * (m * k + k * n + m * n),
+              before);
+}
+BENCHMARK(BM_Dot)->Apply(mlpShapes)->Unit(benchmark::kMicrosecond);
+
+// ____________________________________________________________________________
+void BM_TransposeDot(benchmark::State &state) {
+  // Weight gradient A^T * delta (A is m x k, delta m x n).
+  const size_t m = state.range(0);
+  const size_t k = state.range(1);
+  const size_t n = state.range(2);
+  Matrix<float> A(m, k, InitState::RANDOM);
+  Matrix<float> B(m, n, InitState::RANDOM);
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    Matrix<float> C = transposeDot(A, B);
+    benchmark::DoNotOptimize(C.data());
+  }
+  setCounters(state, 2.0 * m * n * k, sizeof(float) * (m * k + m * n + k * n),
+              before);
+}
+BENCHMARK(BM_TransposeDot)->Apply(mlpShapes)->Unit(benchmark::kMicrosecond);
+
+// ____________________________________________________________________________
+void BM_Add(benchmark::State &state) {
+  const size_t rows = state.range(0);
+  const size_t cols = state.range(1);
+  Matrix<float> A(rows, cols, InitState::RANDOM);
+  Matrix<float> B(rows, cols, InitState::RANDOM);
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    A.add(B);
+    benchmark::DoNotOptimize(A.data());
+  }
+  setCounters(state, 1.0 * rows * cols, 3.0 * sizeof(float) * rows * cols,
+              before);
+}
+BENCHMARK(BM_Add)->Apply(elementwiseShapes);
+
+// ____________________________________________________________________________
+void BM_AddBias(benchmark::State &state) {
+  // Broadcast of a 1 x cols row (the bias) over all rows.
+  const size_t rows = state.range(0);
+  const size_t cols = state.range(1);
+  Matrix<float> A(rows, cols, InitState::RANDOM);
+  Matrix<float> b(1, cols, InitState::RANDOM);
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    A.add(b);
+    benchmark::DoNotOptimize(A.data());
+  }
+  setCounters(state, 1.0 * rows * cols, 2.0 * sizeof(float) * rows * cols,
+              before);
+}
+BENCHMARK(BM_AddBias)->Apply(elementwiseShapes);
+
+// ____________________________________________________________________________
+void BM_Transpose(benchmark::State &state) {
+  const size_t rows = state.range(0);
+  const size_t cols = state.range(1);
+  Matrix<float> A(rows, cols, InitState::RANDOM);
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    Matrix<float> T = A.transpose_copy();
+    benchmark::DoNotOptimize(T.data());
+  }
+  setCounters(state, 0, 2.0 * sizeof(float) * rows * cols, before);
+}
+BENCHMARK(BM_Transpose)->Apply(elementwiseShapes);
+
+// ____________________________________________________________________________
+void BM_Sum(benchmark::State &state) {
+  const size_t rows = state.range(0);
+  const size_t cols = state.range(1);
+  Matrix<float> A(rows, cols, InitState::RANDOM);
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(sum(A));
+  }
+  setCounters(state, 1.0 * rows * cols, 1.0 * sizeof(float) * rows * cols,
+              before);
+}
+BENCHMARK(BM_Sum)->Apply(elementwiseShapes);
+
+// ____________________________________________________________________________
+// Squared error sum((y - out) * (y - out)), eager (two temporaries) and as
+// an expression (see Expression.h).
+void BM_SquaredErrorEager(benchmark::State &state) {
+  const size_t rows = state.range(0);
+  const size_t cols = state.range(1);
+  Matrix<float> y(rows, cols, InitState::RANDOM);
+  Matrix<float> out(rows, cols, InitState::RANDOM);
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    Matrix<float> diff = sub(y, out);
+    benchmark::DoNotOptimize(sum(dotElementWise(diff, diff)));
+  }
+  setCounters(state, 3.0 * rows * cols, 2.0 * sizeof(float) * rows * cols,
+              before);
+}
+BENCHMARK(BM_SquaredErrorEager)->Apply(elementwiseShapes);
+
+// ____________________________________________________________________________
+void BM_SquaredErrorLazy(benchmark::State &state) {
+  const size_t rows = state.range(0);
+  const size_t cols = state.range(1);
+  Matrix<float> y(rows, cols, InitState::RANDOM);
+  Matrix<float> out(rows, cols, InitState::RANDOM);
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    auto diff = lazy(y) - lazy(out);
+    benchmark::DoNotOptimize(sum(diff * diff));
+  }
+  setCounters(state, 3.0 * rows * cols, 2.0 * sizeof(float) * rows * cols,
+              before);
+}
+BENCHMARK(BM_SquaredErrorLazy)->Apply(elementwiseShapes);
+
+// ____________________________________________________________________________
+// Dense layer epilogue sigmoid(Z + b) with a broadcast bias, written in
+// place, eager and as an expression.
+void BM_BiasSigmoidEager(benchmark::State &state) {
+  const size_t rows = state.range(0);
+  const size_t cols = state.range(1);
+  Matrix<float> Z(rows, cols, InitState::RANDOM);
+  Matrix<float> b(1, cols, InitState::RANDOM);
+  Matrix<float> out(rows, cols, InitState::ZERO);
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    out = sigmoid(add(Z, b));
+    benchmark::DoNotOptimize(out.data());
+  }
+  setCounters(state, 2.0 * rows * cols, 2.0 * sizeof(float) * rows * cols,
+              before);
+}
+BENCHMARK(BM_BiasSigmoidEager)->Apply(elementwiseShapes);
+
+// ____________________________________________________________________________
+void BM_BiasSigmoidLazy(benchmark::State &state) {
+  const size_t rows = state.range(0);
+  const size_t cols = state.range(1);
+  Matrix<float> Z(rows, cols, InitState::RANDOM);
+  Matrix<float> b(1, cols, InitState::RANDOM);
+  Matrix<float> out(rows, cols, InitState::ZERO);
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    assign(out, activation(lazy(Z) + b, Activation::sigmoid));
+    benchmark::DoNotOptimize(out.data());
+  }
+  setCounters(state, 2.0 * rows * cols, 2.0 * sizeof(float) * rows * cols,
+              before);
+}
+BENCHMARK(BM_BiasSigmoidLazy)->Apply(elementwiseShapes);
@@ -0,0 +1,393 @@
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "./Benchmark.h"
+#include "./FixedNetwork.h"
+#include "./MicroBatcher.h"
+#include "./NeuralNetwork.h"
+#include "./Sequential.h"
+#include "./ThreadPool.h"
+
+namespace {
+
+// MLPs (layer sizes) of the end-to-end benchmarks, by index.
+const std::vector<std::vector<size_t>> kNetworks = {
+    {784, 128, 10},
+    {784, 512, 256, 10},
+    {32, 64, 64, 1},
+};
+
+// ____________________________________________________________________________
+// Returns the network with index i of kNetworks (relu hidden layers, sigmoid
+// output).
+NeuralNetwork<float> makeNetwork(size_t i) {
+  const std::vector<size_t> &layers = kNetworks[i];
+  std::vector<Activation> activations(layers.size() - 1, Activation::relu);
+  activations.back() = Activation::sigmoid;
+  return NeuralNetwork<float>(layers, activations, 0.01f, InitState::RANDOM);
+}
+
+// ____________________________________________________________________________
+// Multiply-adds of one sample through network i, and the bytes of its
+// weights.
+double flopsPerSample(size_t i) {
+  const std::vector<size_t> &layers = kNetworks[i];
+  double flops = 0;
+  for (size_t l = 0; l + 1 < layers.size(); ++l) {
+    flops += 2.0 * layers[l] * layers[l + 1];
+  }
+  return flops;
+}
+
+double weightBytes(size_t i) {
+  return sizeof(float) * flopsPerSample(i) / 2;
+}
+
+// ____________________________________________________________________________
+// Arguments {network, batch size}.
+void trainShapes(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"net", "batch"});
+  // Wall time, the steps run on all threads of the pool.
+  b->UseRealTime();
+  for (int64_t net = 0; net < static_cast<int64_t>(kNetworks.size()); ++net) {
+    for (int64_t batch : {32, 256, 1024}) {
+      b->Args({net, batch});
+    }
+  }
+}
+
+void inferenceShapes(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"net", "batch"});
+  b->UseRealTime();
+  for (int64_t net = 0; net < static_cast<int64_t>(kNetworks.size()); ++net) {
+    for (int64_t batch : {1, 16, 256}) {
+      b->Args({net, batch});
+    }
+  }
+}
+
+} // namespace
+
+// ____________________________________________________________________________
+// One training step (forward and backward pass) on a batch.
+void BM_Train(benchmark::State &state) {
+  const size_t net = state.range(0);
+  const size_t batch = state.range(1);
+  NeuralNetwork<float> nn = makeNetwork(net);
+  Matrix<float> X(batch, kNetworks[net].front(), InitState::RANDOM);
+  Matrix<float> y(batch, kNetworks[net].back(), InitState::RANDOM);
+  nn.train(X, y, 0.01f, 1);
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    nn.train(X, y, 0.01f, 1);
+  }
+  // The backward pass costs about twice the forward pass.
+  setCounters(state, 3.0 * flopsPerSample(net) * batch,
+              3.0 * weightBytes(net), before);
+  state.counters["samples"] =
+      benchmark::Counter(static_cast<double>(batch),
+                         benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_Train)->Apply(trainShapes)->Unit(benchmark::kMicrosecond);
+
+// ____________________________________________________________________________
+// One training step with Adam (the update reads and writes the weights,
+// gradients and two state matrices).
+void BM_TrainAdam(benchmark::State &state) {
+  const size_t net = state.range(0);
+  const size_t batch = state.range(1);
+  NeuralNetwork<float> nn = makeNetwork(net);
+  OptimizerSettings settings;
+  settings.type = OptimizerType::ADAM;
+  nn.setOptimizer(settings);
+  Matrix<float> X(batch, kNetworks[net].front(), InitState::RANDOM);
+  Matrix<float> y(batch, kNetworks[net].back(), InitState::RANDOM);
+  nn.train(X, y, 0.001f, 1);
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    nn.train(X, y, 0.001f, 1);
+  }
+  setCounters(state, 3.0 * flopsPerSample(net) * batch,
+              6.0 * weightBytes(net), before);
+  state.counters["samples"] =
+      benchmark::Counter(static_cast<double>(batch),
+                         benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_TrainAdam)->Apply(trainShapes)->Unit(benchmark::kMicrosecond);
+
+// ____________________________________________________________________________
+// BM_Train with the same dense layers as a Sequential network (layers
+// dispatched through std::visit).
+void BM_TrainSequential(benchmark::State &state) {
+  const size_t net = state.range(0);
+  const size_t batch = state.range(1);
+  Sequential<float> seq(makeNetwork(net));
+  Matrix<float> X(batch, kNetworks[net].front(), InitState::RANDOM);
+  Matrix<float> y(batch, kNetworks[net].back(), InitState::RANDOM);
+  seq.train(X, y, 0.01f, 1);
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    seq.train(X, y, 0.01f, 1);
+  }
+  setCounters(state, 3.0 * flopsPerSample(net) * batch,
+              3.0 * weightBytes(net), before);
+  state.counters["samples"] =
+      benchmark::Counter(static_cast<double>(batch),
+                         benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_TrainSequential)
+    ->Apply(trainShapes)
+    ->Unit(benchmark::kMicrosecond);
+
+// ____________________________________________________________________________
+// One training step of a deep network (16 hidden layers of 256) on a batch
+// of 256 rows, keeping every activation (budget 0) or with the checkpoints
+// planned for a budget of that many percent of their memory.
+void BM_TrainCheckpointed(benchmark::State &state) {
+  const size_t percent = state.range(0);
+  const size_t batch = 256;
+  std::vector<size_t> layers(18, 256);
+  layers.back() = 10;
+  std::vector<Activation> activations(layers.size() - 1, Activation::relu);
+  activations.back() = Activation::sigmoid;
+  NeuralNetwork<float> nn(layers, activations, 0.001f, InitState::RANDOM);
+  const size_t all = batchBytes<float>(layers, batch);
+  Checkpointing checkpointing;
+  checkpointing.memoryBudget = all * percent / 100;
+  nn.setCheckpointing(checkpointing);
+  Matrix<float> X(batch, layers.front(), InitState::RANDOM);
+  Matrix<float> y(batch, layers.back(), InitState::RANDOM);
+  nn.train(X, y, 0.001f, 1);
+  for (auto _ : state) {
+    nn.train(X, y, 0.001f, 1);
+  }
+  const std::vector<size_t> checkpoints =
+      percent == 0 ? std::vector<size_t>()
+                   : planCheckpoints<float>(layers, batch,
+                                            checkpointing.memoryBudget);
+  state.counters["MiB"] =
+      static_cast<double>(batchBytes<float>(layers, batch, checkpoints)) /
+      (1 << 20);
+  state.counters["segments"] = static_cast<double>(checkpoints.size() + 1);
+}
+BENCHMARK(BM_TrainCheckpointed)
+    ->ArgName("budget")
+    ->Arg(0)
+    ->Arg(50)
+    ->Arg(30)
+    ->Unit(benchmark::kMillisecond);
+
+// ____________________________________________________________________________
+// One epoch of Hogwild training on sparse rows (8 of 1024 inputs set) in
+// batches of 16 rows, on 1 to 8 threads (the argument).
+void BM_TrainHogwild(benchmark::State &state) {
+  const size_t threads = state.range(0);
+  const size_t rows = 4096;
+  Matrix<float> X(rows, 1024, InitState::ZERO);
+  Matrix<float> y(rows, 1, InitState::RANDOM);
+  for (size_t row = 0; row < rows; ++row) {
+    for (size_t k = 0; k < 8; ++k) {
+      X[row][(row * 131 + k * 127) % 1024] = 1.0f;
+    }
+  }
+  NeuralNetwork<float> nn(std::vector<size_t>({1024, 64, 1}),
+                          {Activation::relu, Activation::sigmoid}, 0.01f,
+                          InitState::RANDOM);
+  const size_t before = getNumThreads();
+  setNumThreads(threads);
+  HogwildStats stats;
+  for (auto _ : state) {
+    stats = nn.trainHogwild(X, y, 0.01f, 1, 16);
+  }
+  setNumThreads(before);
+  state.counters["staleness"] = stats.meanStaleness;
+  state.counters["samples"] =
+      benchmark::Counter(static_cast<double>(rows),
+                         benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_TrainHogwild)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->Arg(8)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// ____________________________________________________________________________
+// Training on hashed features: 16 non-zeros per row out of inputs (e.g. a
+// bag of words), as a CSR matrix or dense (sparse = 0).
+void BM_TrainSparse(benchmark::State &state) {
+  const size_t inputs = state.range(0);
+  const bool sparse = state.range(1) != 0;
+  const size_t rows = 256;
+  std::vector<size_t> offsets = {0};
+  std::vector<std::uint32_t> columns;
+  for (size_t row = 0; row < rows; ++row) {
+    for (size_t k = 0; k < 16; ++k) {
+      columns.push_back(static_cast<std::uint32_t>(
+          (row * 2654435761u + k * (inputs / 16)) % inputs));
+    }
+    std::sort(columns.end() - 16, columns.end());
+    offsets.push_back(columns.size());
+  }
+  const SparseMatrix<float> X(rows, inputs, offsets, columns,
+                              std::vector<float>(columns.size(), 1.0f));
+  const Matrix<float> denseX = sparse ? Matrix<float>() : X.toDense();
+  Matrix<float> y(rows, 1, InitState::RANDOM);
+  NeuralNetwork<float> nn(std::vector<size_t>({inputs, 32, 1}),
+                          {Activation::relu, Activation::sigmoid}, 0.01f,
+                          InitState::RANDOM);
+  for (auto _ : state) {
+    if (sparse) {
+      nn.train(X, y, 0.01f, 1, false, 64);
+    } else {
+      nn.train(denseX, y, 0.01f, 1, false, 64);
+    }
+  }
+  state.counters["samples"] =
+      benchmark::Counter(static_cast<double>(rows),
+                         benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_TrainSparse)
+    ->ArgNames({"inputs", "sparse"})
+    ->Args({1 << 16, 0})
+    ->Args({1 << 16, 1})
+    ->Args({1 << 20, 1})
+    ->Unit(benchmark::kMillisecond);
+
+// ____________________________________________________________________________
+// Inference on a batch.
+void BM_Act(benchmark::State &state) {
+  const size_t net = state.range(0);
+  const size_t batch = state.range(1);
+  NeuralNetwork<float> nn = makeNetwork(net);
+  Matrix<float> X(batch, kNetworks[net].front(), InitState::RANDOM);
+  benchmark::DoNotOptimize(nn.act(X).data());
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    Matrix<float> out = nn.act(X);
+    benchmark::DoNotOptimize(out.data());
+  }
+  setCounters(state, flopsPerSample(net) * batch, weightBytes(net), before);
+  state.counters["samples"] =
+      benchmark::Counter(static_cast<double>(batch),
+                         benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_Act)->Apply(inferenceShapes)->Unit(benchmark::kMicrosecond);
+
+// ____________________________________________________________________________
+// Inference on a batch with the int8 quantized network (a quarter of the
+// weight bytes).
+void BM_ActInt8(benchmark::State &state) {
+  const size_t net = state.range(0);
+  const size_t batch = state.range(1);
+  NeuralNetwork<float> nn = makeNetwork(net);
+  Matrix<float> X(batch, kNetworks[net].front(), InitState::RANDOM);
+  nn.quantize(X);
+  benchmark::DoNotOptimize(nn.act(X).data());
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    Matrix<float> out = nn.act(X);
+    benchmark::DoNotOptimize(out.data());
+  }
+  setCounters(state, flopsPerSample(net) * batch,
+              nn.getQuantized()->getWeightBytes(), before);
+  state.counters["samples"] =
+      benchmark::Counter(static_cast<double>(batch),
+                         benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_ActInt8)->Apply(inferenceShapes)->Unit(benchmark::kMicrosecond);
+
+// ____________________________________________________________________________
+// Inference on a batch with bfloat16 weights (half the weight bytes).
+void BM_ActBf16(benchmark::State &state) {
+  const size_t net = state.range(0);
+  const size_t batch = state.range(1);
+  NeuralNetwork<float> nn = makeNetwork(net);
+  nn.setPrecision(Precision::BFLOAT16);
+  Matrix<float> X(batch, kNetworks[net].front(), InitState::RANDOM);
+  benchmark::DoNotOptimize(nn.act(X).data());
+  const size_t before = numAllocations();
+  for (auto _ : state) {
+    Matrix<float> out = nn.act(X);
+    benchmark::DoNotOptimize(out.data());
+  }
+  setCounters(state, flopsPerSample(net) * batch, weightBytes(net) / 2,
+              before);
+  state.counters["samples"] =
+      benchmark::Counter(static_cast<double>(batch),
+                         benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_ActBf16)->Apply(inferenceShapes)->Unit(benchmark::kMicrosecond);
+
+// ____________________________________________________________________________
+// Single-row inference from several threads at once, one act per row.
+void BM_ActRow(benchmark::State &state) {
+  static const NeuralNetwork<float> nn = makeNetwork(1);
+  Matrix<float> row(1, kNetworks[1].front(), InitState::RANDOM);
+  for (auto _ : state) {
+    Matrix<float> out = nn.act(row);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.counters["samples"] = benchmark::Counter(
+      1.0, benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_ActRow)
+    ->ThreadRange(1, 32)
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// ____________________________________________________________________________
+// One sample through the XOR network (2-4-1, sigmoid) of
+// NeuralNetworkMain.cpp: NeuralNetwork::act, and its FixedNetwork.
+NeuralNetwork<float> makeXor() {
+  return NeuralNetwork<float>(
+      std::vector<size_t>({2, 4, 1}),
+      std::vector<Activation>({Activation::sigmoid, Activation::sigmoid}));
+}
+
+void BM_ActXor(benchmark::State &state) {
+  const NeuralNetwork<float> nn = makeXor();
+  Matrix<float> row(1, 2, InitState::RANDOM);
+  for (auto _ : state) {
+    Matrix<float> out = nn.act(row);
+    benchmark::DoNotOptimize(out.data());
+  }
+}
+BENCHMARK(BM_ActXor);
+
+void BM_FixedXor(benchmark::State &state) {
+  using Xor = FixedNetwork<float, FixedDense<2, 4, Activation::sigmoid>,
+                           FixedDense<4, 1, Activation::sigmoid>>;
+  const Xor fixed(makeXor());
+  Xor::Input input = {0.25f, 0.75f};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(input);
+    Xor::Output out = fixed.act(input);
+    benchmark::DoNotOptimize(out);
+  }
+}
+BENCHMARK(BM_FixedXor);
+
+// ____________________________________________________________________________
+// The same requests combined into batches of up to 32 rows by a
+// MicroBatcher.
+void BM_MicroBatcher(benchmark::State &state) {
+  static const NeuralNetwork<float> nn = makeNetwork(1);
+  static MicroBatcher<float> batcher(nn, 32, std::chrono::microseconds(200));
+  Matrix<float> row(1, kNetworks[1].front(), InitState::RANDOM);
+  for (auto _ : state) {
+    Matrix<float> out = batcher.submit(row).get();
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.counters["samples"] = benchmark::Counter(
+      1.0, benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_MicroBatcher)
+    ->ThreadRange(1, 32)
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
@@ -1,5 +1,9 @@
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
 
 #include "./Activation.h"
+#include "./Simd.h"
 #include "./Utils.h"
 
 // ____________________________________________________________________________
@@ -12,157 +16,220 @@ template <typename T> Matrix<T> linear_derivative(const Matrix<T> &X) {
   return Matrix<T>(X.getRows(), X.getCols(), InitState::ONES);
 }
 
+// ____________________________________________________________________________
+// Applies an elementwise kernel (see Simd.h) to X.
+template <typename T>
+Matrix<T> applyKernel(const Matrix<T> &X, UnaryKernel<T> kernel) {
+  Matrix<T> result(X.getRows(), X.getCols(), InitState::EMPTY);
+  forEachRow(X, result, kernel);
+  return result;
+}
+
+// ____________________________________________________________________________
+// Sets every element of X to v.
+template <typename T> void fillRows(Matrix<T> &X, T v) {
+  for (size_t row = 0; row < X.getRows(); ++row) {
+    std::fill(X[row], X[row] + X.getCols(), v);
+  }
+}
+
 // ____________________________________________________________________________
 // Relu
 template <typename T> Matrix<T> relu(const Matrix<T> &X) {
-  Matrix<T> result = X;
-  result.maximum(value<T>::zero());
-  return result;
+  return applyKernel(X, simdKernels<T>().relu);
 }
 
 // ____________________________________________________________________________
 // Relu derivative
 template <typename T> Matrix<T> relu_derivative(const Matrix<T> &X) {
-  Matrix<T> result(X.getRows(), X.getCols(), InitState::EMPTY);
-  for (size_t row = 0; row < X.getRows(); ++row) {
-    for (size_t col = 0; col < X.getCols(); ++col) {
-      result[row][col] =
-          (X[row][col] > value<T>::zero()) ? value<T>::one() : value<T>::zero();
-    }
-  }
-  return result;
+  return applyKernel(X, simdKernels<T>().reluDerivative);
 }
 
 // ____________________________________________________________________________
 // Step
 template <typename T> Matrix<T> step(const Matrix<T> &X) {
-  Matrix<T> result(X.getRows(), X.getCols(), InitState::EMPTY);
-  for (size_t row = 0; row < X.getRows(); ++row) {
-    for (size_t col = 0; col < X.getCols(); ++col) {
-      result[row][col] = (X[row][col] >= value<T>::zero()) ? value<T>::one()
-                                                           : value<T>::zero();
-    }
-  }
-  return result;
+  return applyKernel(X, simdKernels<T>().step);
 }
 
 // ____________________________________________________________________________
 // Step derivative
 template <typename T> Matrix<T> step_derivative(const Matrix<T> &X) {
-  Matrix<T> result(X.getRows(), X.getCols(), InitState::EMPTY);
-  for (size_t row = 0; row < X.getRows(); ++row) {
-    for (size_t col = 0; col < X.getCols(); ++col) {
-      result[row][col] = value<T>::zero();
-    }
-  }
-  return result;
+  return Matrix<T>(X.getRows(), X.getCols(), InitState::ZERO);
 }
 
 // ____________________________________________________________________________
 // Sigmoid
 template <typename T> Matrix<T> sigmoid(const Matrix<T> &X) {
-  Matrix<T> result(X.getRows(), X.getCols(), InitState::EMPTY);
-  for (size_t row = 0; row < X.getRows(); ++row) {
-    for (size_t col = 0; col < X.getCols(); ++col) {
-      result[row][col] = value<T>::one() /
-                         (value<T>::one() + value<T>::e(-X.getValue(row, col)));
-    }
-  }
-  return result;
+  return applyKernel(X, simdKernels<T>().sigmoid);
 }
 
 // ____________________________________________________________________________
 // Sigmoid derivative
 template <typename T> Matrix<T> sigmoid_derivative(const Matrix<T> &X) {
-  Matrix<T> result(X.getRows(), X.getCols(), InitState::EMPTY);
-  for (size_t row = 0; row < X.getRows(); ++row) {
-    for (size_t col = 0; col < X.getCols(); ++col) {
-      result[row][col] =
-          (value<T>::one() /
-           (value<T>::one() + value<T>::e(-X.getValue(row, col)))) *
-          (value<T>::one() -
-           (value<T>::one() /
-            (value<T>::one() + value<T>::e(-X.getValue(row, col)))));
-    }
-  }
-  return result;
+  return applyKernel(X, simdKernels<T>().sigmoidDerivative);
 }
 
 // ____________________________________________________________________________
 // Tanh
 template <typename T> Matrix<T> tanh(const Matrix<T> &X) {
-  Matrix<T> result(X.getRows(), X.getCols(), InitState::EMPTY);
-  for (size_t row = 0; row < X.getRows(); ++row) {
-    for (size_t col = 0; col < X.getCols(); ++col) {
-      result[row][col] = value<T>::tanh(X.getValue(row, col));
-    }
-  }
-  return result;
+  return applyKernel(X, simdKernels<T>().tanh);
 }
 
 // ____________________________________________________________________________
 // Tanh derivative
 template <typename T> Matrix<T> tanh_derivative(const Matrix<T> &X) {
-  Matrix<T> result(X.getRows(), X.getCols(), InitState::EMPTY);
-  for (size_t row = 0; row < X.getRows(); ++row) {
-    for (size_t col = 0; col < X.getCols(); ++col) {
-      result[row][col] =
-          value<T>::one() - std::pow(value<T>::tanh(X.getValue(row, col)), 2.0);
-    }
-  }
-  return result;
+  return applyKernel(X, simdKernels<T>().tanhDerivative);
 }
 
 // ____________________________________________________________________________
 // Softmax
 template <typename T> Matrix<T> softmax(const Matrix<T> &X) {
-  size_t rows = X.getRows();
-  size_t cols = X.getCols();
-  Matrix<T> result(rows, cols, InitState::EMPTY);
-
-  for (size_t col = 0; col < cols; ++col) {
-    T sum_exp = 0;
-    // Compute the sum of exponentials
-    for (size_t row = 0; row < rows; ++row) {
-      sum_exp += std::exp(X.getValue(row, col));
-    }
-    // Normalize by the sum of exponentials
-    for (size_t row = 0; row < rows; ++row) {
-      result[row][col] = std::exp(X.getValue(row, col)) / sum_exp;
-    }
-  }
-
+  Matrix<T> result(X.getRows(), X.getCols(), InitState::EMPTY);
+  softmax(X, result);
   return result;
 }
 
 // ____________________________________________________________________________
 // Softmax derivative
 template <typename T> Matrix<T> softmax_derivative(const Matrix<T> &X) {
-  Matrix<T> softmax_vals = softmax(X);
-  size_t rows = X.getRows();
-  size_t cols = X.getCols();
-  Matrix<T> result(rows, cols, InitState::EMPTY);
-
-  for (size_t row = 0; row < rows; ++row) {
-    for (size_t col = 0; col < cols; ++col) {
-      T s = softmax_vals.getValue(row, col);
-      result[row][col] = s * (1 - s);
-    }
+  Matrix<T> result(X.getRows(), X.getCols(), InitState::EMPTY);
+  softmax_derivative(X, result);
+  return result;
+}
+
+// ____________________________________________________________________________
+// Calls body(begin, end) on ranges of the rows of a rows x cols matrix, in
+// parallel. Unlike forEachRow it never merges rows, for kernels that reduce
+// over a row.
+template <typename F>
+void forEachRowRange(size_t rows, size_t cols, const F &body) {
+  if (cols == 0) {
+    return;
   }
+  parallelFor(rows, std::max<size_t>(1, kParallelGrain / cols), body);
+}
 
-  return result;
+// ____________________________________________________________________________
+template <typename T> void softmax(const Matrix<T> &X, Matrix<T> &out) {
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  const size_t cols = X.getCols();
+  forEachRowRange(X.getRows(), cols, [&](size_t begin, size_t end) {
+    for (size_t row = begin; row < end; ++row) {
+      kernels.softmax(X[row], out[row], cols);
+    }
+  });
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void softmax_derivative(const Matrix<T> &X, Matrix<T> &out) {
+  softmax(X, out);
+  forEachRow(out, out, [](const T *s, T *result, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      result[i] = s[i] * (1 - s[i]);
+    }
+  });
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void softmaxBackward(const Matrix<T> &S, const Matrix<T> &G, Matrix<T> &out) {
+  const size_t cols = S.getCols();
+  forEachRowRange(S.getRows(), cols, [&](size_t begin, size_t end) {
+    for (size_t row = begin; row < end; ++row) {
+      const T *s = S[row];
+      const T *g = G[row];
+      T *o = out[row];
+      T dot = value<T>::zero();
+      for (size_t col = 0; col < cols; ++col) {
+        dot += g[col] * s[col];
+      }
+      for (size_t col = 0; col < cols; ++col) {
+        o[col] = s[col] * (g[col] - dot);
+      }
+    }
+  });
+}
+
+// ____________________________________________________________________________
+template <typename T>
+T softmaxCrossEntropy(const Matrix<T> &Z, const Matrix<T> &Y,
+                      Matrix<T> &gradient) {
+  const size_t rows = Z.getRows();
+  const size_t cols = Z.getCols();
+  if (Y.getRows() != rows || Y.getCols() != cols) {
+    throw std::invalid_argument(
+        "Dimensions of logits and targets do not match.");
+  }
+  if (gradient.getRows() != rows || gradient.getCols() != cols) {
+    gradient.resize(rows, cols);
+  }
+  // Every range of rows adds its loss once.
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  std::mutex mutex;
+  double loss = 0.0;
+  forEachRowRange(rows, cols, [&](size_t begin, size_t end) {
+    double rangeLoss = 0.0;
+    for (size_t row = begin; row < end; ++row) {
+      rangeLoss += kernels.softmaxCrossEntropy(Z[row], Y[row], gradient[row],
+                                               cols);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    loss += rangeLoss;
+  });
+  return static_cast<T>(loss);
 }
 
 // ____________________________________________________________________________
 // Exp
 template <typename T> Matrix<T> exp(const Matrix<T> &X) {
-  Matrix<T> result(X.getRows(), X.getCols(), InitState::EMPTY);
-  for (size_t row = 0; row < X.getRows(); ++row) {
-    for (size_t col = 0; col < X.getCols(); ++col) {
-      result[row][col] = value<T>::e(X.getValue(row, col));
-    }
+  return applyKernel(X, simdKernels<T>().exp);
+}
+
+// ____________________________________________________________________________
+template <typename T> UnaryKernel<T> activationKernel(Activation activation) {
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  switch (activation) {
+  case Activation::relu:
+    return kernels.relu;
+  case Activation::step:
+    return kernels.step;
+  case Activation::sigmoid:
+    return kernels.sigmoid;
+  case Activation::tanh:
+    return kernels.tanh;
+  case Activation::linear:
+  case Activation::softmax:
+    break;
+  }
+  return nullptr;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void activationDerivative(Activation activation, const Matrix<T> &X,
+                          Matrix<T> &out) {
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  switch (activation) {
+  case Activation::linear:
+    fillRows(out, value<T>::one());
+    break;
+  case Activation::step:
+    fillRows(out, value<T>::zero());
+    break;
+  case Activation::relu:
+    forEachRow(X, out, kernels.reluDerivative);
+    break;
+  case Activation::sigmoid:
+    forEachRow(X, out, kernels.sigmoidDerivative);
+    break;
+  case Activation::tanh:
+    forEachRow(X, out, kernels.tanhDerivative);
+    break;
+  case Activation::softmax:
+    softmax_derivative(X, out);
+    break;
   }
-  return result;
 }
 
 // ____________________________________________________________________________
@@ -184,5 +251,19 @@ template Matrix<float> sigmoid_derivative<float>(const Matrix<float> &X);
 
 template Matrix<float> softmax<float>(const Matrix<float> &X);
 template Matrix<float> softmax_derivative<float>(const Matrix<float> &X);
+template void softmax<float>(const Matrix<float> &X, Matrix<float> &out);
+template void softmax_derivative<float>(const Matrix<float> &X,
+                                        Matrix<float> &out);
+template void softmaxBackward<float>(const Matrix<float> &S,
+                                     const Matrix<float> &G,
+                                     Matrix<float> &out);
+template float softmaxCrossEntropy<float>(const Matrix<float> &Z,
+                                          const Matrix<float> &Y,
+                                          Matrix<float> &gradient);
+
+template Matrix<float> exp<float>(const Matrix<float> &X);
 
-template Matrix<float> exp<float>(const Matrix<float> &X);
\ No newline at end of file
+template UnaryKernel<float> activationKernel<float>(Activation activation);
+template void activationDerivative<float>(Activation activation,
+                                          const Matrix<float> &X,
+                                          Matrix<float> &out);
\ No newline at end of file
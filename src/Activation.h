@@ -2,9 +2,20 @@
 #pragma once
 
 #include "./Matrix.h"
+#include "./Simd.h"
 
 enum class Activation { linear, relu, step, softmax, sigmoid, tanh };
 
+// Returns the elementwise kernel computing activation (see Simd.h), or
+// nullptr for linear (the identity) and softmax (not elementwise).
+template <typename T> UnaryKernel<T> activationKernel(Activation activation);
+
+// Writes the derivative of activation at X to out (same shape as X, may be
+// X). Does not allocate.
+template <typename T>
+void activationDerivative(Activation activation, const Matrix<T> &X,
+                          Matrix<T> &out);
+
 // ____________________________________________________________________________
 // LINEAR
 template <typename T> Matrix<T> linear(const Matrix<T> &X);
@@ -37,10 +48,39 @@ template <typename T> Matrix<T> tanh_derivative(const Matrix<T> &X);
 
 // ____________________________________________________________________________
 // SOFTMAX
+// Normalizes every row of X (one sample per row), subtracting the largest
+// element of the row first so no exp overflows.
 template <typename T> Matrix<T> softmax(const Matrix<T> &X);
 
+// Diagonal s * (1 - s) of the Jacobian of every row, with s = softmax(X).
+// Backpropagation needs the whole Jacobian (see softmaxBackward).
 template <typename T> Matrix<T> softmax_derivative(const Matrix<T> &X);
 
+// Same as above, writing to out (same shape as X, may be X).
+template <typename T> void softmax(const Matrix<T> &X, Matrix<T> &out);
+
+template <typename T>
+void softmax_derivative(const Matrix<T> &X, Matrix<T> &out);
+
+// Backpropagates G, the gradient with respect to S = softmax(X), through
+// the softmax: writes S * (G - sum over the row of G * S), the product
+// with the Jacobian of every row, to out (same shape, may be G). Does not
+// allocate.
+template <typename T>
+void softmaxBackward(const Matrix<T> &S, const Matrix<T> &G, Matrix<T> &out);
+
+// Fused log-softmax and cross-entropy of the logits Z with the targets Y
+// (same shape, every row the class probabilities of a sample, e.g.
+// one-hot). Returns the cross-entropy -sum Y * log softmax(Z), summed over
+// the rows, and writes its gradient with respect to Z, softmax(Z) - Y, to
+// gradient (resized to the shape of Z, may be Z). One kernel call per row
+// (see SimdKernels::softmaxCrossEntropy): the probabilities are never
+// logged, and the softmax Jacobian is never formed. Throws
+// std::invalid_argument if the shapes of Z and Y do not match.
+template <typename T>
+T softmaxCrossEntropy(const Matrix<T> &Z, const Matrix<T> &Y,
+                      Matrix<T> &gradient);
+
 // ____________________________________________________________________________
 // EXP
-template <typename T> Matrix<T> exp(Matrix<T> &X);
\ No newline at end of file
+template <typename T> Matrix<T> exp(const Matrix<T> &X);
\ No newline at end of file
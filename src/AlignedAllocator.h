@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+// Alignment (in bytes) of all matrix buffers. One cache line, which is also
+// the width of an AVX-512 register.
+constexpr std::size_t kMatrixAlignment = 64;
+
+// Number of buffers AlignedAllocator has allocated so far (all threads), for
+// tests and benchmarks checking that a code path does not allocate.
+inline std::atomic<std::size_t> numAlignedAllocations{0};
+
+// Allocator handing out kMatrixAlignment aligned memory.
+// Elements are default-initialized, not value-initialized, so resizing a
+// buffer of floats does not zero it (InitState::EMPTY stays cheap).
+template <typename T> class AlignedAllocator {
+public:
+  using value_type = T;
+
+  template <typename U> struct rebind {
+    using other = AlignedAllocator<U>;
+  };
+
+  AlignedAllocator() noexcept = default;
+
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U> &) noexcept {}
+
+  // Allocates memory for n elements.
+  T *allocate(std::size_t n) {
+    if (n == 0) {
+      return nullptr;
+    }
+    // std::aligned_alloc wants the size to be a multiple of the alignment.
+    std::size_t bytes = n * sizeof(T);
+    bytes =
+        (bytes + kMatrixAlignment - 1) / kMatrixAlignment * kMatrixAlignment;
+    void *ptr = std::aligned_alloc(kMatrixAlignment, bytes);
+    if (ptr == nullptr) {
+      throw std::bad_alloc();
+    }
+    numAlignedAllocations.fetch_add(1, std::memory_order_relaxed);
+    return static_cast<T *>(ptr);
+  }
+
+  // Frees memory allocated with allocate.
+  void deallocate(T *ptr, std::size_t) noexcept { std::free(ptr); }
+
+  // Default-initializes an element (no zeroing for trivial types).
+  template <typename U> void construct(U *ptr) noexcept {
+    ::new (static_cast<void *>(ptr)) U;
+  }
+
+  // Constructs an element from arguments.
+  template <typename U, typename... Args>
+  void construct(U *ptr, Args &&...args) {
+    ::new (static_cast<void *>(ptr)) U(std::forward<Args>(args)...);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const AlignedAllocator<T> &, const AlignedAllocator<U> &) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const AlignedAllocator<T> &, const AlignedAllocator<U> &) {
+  return false;
+}
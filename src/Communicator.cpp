@@ -0,0 +1,546 @@
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "./Communicator.h"
+#include "./Simd.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// ____________________________________________________________________________
+Clock::time_point deadlineAfter(double seconds) {
+  return Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                            std::chrono::duration<double>(seconds));
+}
+
+// ____________________________________________________________________________
+// Spins (yielding, the other workers may share the cores) until done()
+// returns true. Throws std::runtime_error with message after deadline.
+template <typename Done>
+void spinUntil(Done done, Clock::time_point deadline, const char *message) {
+  for (std::size_t spins = 0; !done(); ++spins) {
+    if (spins % 1024 == 1023 && Clock::now() > deadline) {
+      throw std::runtime_error(message);
+    }
+    std::this_thread::yield();
+  }
+}
+
+// ____________________________________________________________________________
+// Splits n elements into size parts, returns the start of part i.
+std::size_t partBegin(std::size_t n, std::size_t size, std::size_t i) {
+  return n * i / size;
+}
+
+// ____________________________________________________________________________
+// Shared memory transport.
+// ____________________________________________________________________________
+
+// Start of the segment. The workers synchronize with a barrier on these
+// counters (they are lock-free, so they work between processes).
+struct SegmentHeader {
+  std::atomic<std::uint64_t> arrived;
+  std::atomic<std::uint64_t> generation;
+  std::atomic<std::uint32_t> ready;
+  std::uint64_t size;
+  std::uint64_t chunkBytes;
+};
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+              "The barrier needs lock-free atomics.");
+
+// Bytes before the slots.
+constexpr std::size_t kHeaderBytes = 128;
+static_assert(sizeof(SegmentHeader) <= kHeaderBytes, "Header too large.");
+
+class SharedMemoryCommunicator : public Communicator {
+public:
+  SharedMemoryCommunicator(std::size_t rank, std::size_t size,
+                           const CommunicatorSettings &settings);
+  ~SharedMemoryCommunicator() override;
+
+  void allReduce(float *data, std::size_t n) override {
+    allReduceImpl(data, n);
+  }
+  void allReduce(double *data, std::size_t n) override {
+    allReduceImpl(data, n);
+  }
+
+private:
+  template <typename T> void allReduceImpl(T *data, std::size_t n);
+
+  // Barrier of all workers on the header (generation counting).
+  void segmentBarrier();
+
+  // Slot of worker in the slot set of the current round.
+  char *slot(std::size_t worker) const;
+
+  std::string name_;
+  std::size_t chunkBytes_;
+  double timeout_;
+  std::size_t bytes_ = 0;
+  char *segment_ = nullptr;
+  SegmentHeader *header_ = nullptr;
+  // Chunks reduced so far; consecutive rounds use the two slot sets in
+  // turn, so a worker may fill the next one while the others still read
+  // the last one.
+  std::size_t round_ = 0;
+};
+
+// ____________________________________________________________________________
+SharedMemoryCommunicator::SharedMemoryCommunicator(
+    std::size_t rank, std::size_t size, const CommunicatorSettings &settings)
+    : Communicator(rank, size), name_("/" + settings.name),
+      chunkBytes_((settings.chunkBytes + 63) / 64 * 64),
+      timeout_(settings.timeout) {
+  if (chunkBytes_ < sizeof(double)) {
+    throw std::invalid_argument("Chunks must hold at least one element.");
+  }
+  bytes_ = kHeaderBytes + 2 * size * chunkBytes_;
+  const Clock::time_point deadline = deadlineAfter(timeout_);
+
+  // Worker 0 creates the segment, the others open it once it exists.
+  int fd = -1;
+  if (rank == 0) {
+    ::shm_unlink(name_.c_str());
+    fd = ::shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 || ::ftruncate(fd, static_cast<off_t>(bytes_)) != 0) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      throw std::runtime_error("Cannot create shared memory: " + name_);
+    }
+  } else {
+    spinUntil(
+        [&] {
+          fd = ::shm_open(name_.c_str(), O_RDWR, 0600);
+          struct stat status;
+          if (fd >= 0 && (::fstat(fd, &status) != 0 ||
+                          static_cast<std::size_t>(status.st_size) < bytes_)) {
+            ::close(fd);
+            fd = -1;
+          }
+          return fd >= 0;
+        },
+        deadline, "Timed out waiting for the shared memory of worker 0.");
+  }
+  void *segment =
+      ::mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  // The mapping stays valid after closing the descriptor.
+  ::close(fd);
+  if (segment == MAP_FAILED) {
+    throw std::runtime_error("Cannot map shared memory: " + name_);
+  }
+  segment_ = static_cast<char *>(segment);
+  if (rank == 0) {
+    header_ = new (segment_) SegmentHeader();
+    header_->size = size;
+    header_->chunkBytes = chunkBytes_;
+    header_->ready.store(1, std::memory_order_release);
+  } else {
+    header_ = reinterpret_cast<SegmentHeader *>(segment_);
+    try {
+      spinUntil(
+          [&] { return header_->ready.load(std::memory_order_acquire) == 1; },
+          deadline, "Timed out waiting for the shared memory of worker 0.");
+    } catch (...) {
+      ::munmap(segment_, bytes_);
+      throw;
+    }
+    if (header_->size != size || header_->chunkBytes != chunkBytes_) {
+      ::munmap(segment_, bytes_);
+      throw std::runtime_error("Workers use different settings: " + name_);
+    }
+  }
+
+  // Once all workers mapped the segment, its name is no longer needed
+  // (the memory is freed when the last worker unmaps it).
+  try {
+    segmentBarrier();
+  } catch (...) {
+    if (rank == 0) {
+      ::shm_unlink(name_.c_str());
+    }
+    ::munmap(segment_, bytes_);
+    throw;
+  }
+  if (rank == 0) {
+    ::shm_unlink(name_.c_str());
+  }
+}
+
+// ____________________________________________________________________________
+SharedMemoryCommunicator::~SharedMemoryCommunicator() {
+  stopThread();
+  ::munmap(segment_, bytes_);
+}
+
+// ____________________________________________________________________________
+void SharedMemoryCommunicator::segmentBarrier() {
+  const std::uint64_t generation =
+      header_->generation.load(std::memory_order_acquire);
+  if (header_->arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == size_) {
+    header_->arrived.store(0, std::memory_order_relaxed);
+    header_->generation.fetch_add(1, std::memory_order_acq_rel);
+    return;
+  }
+  spinUntil(
+      [&] {
+        return header_->generation.load(std::memory_order_acquire) !=
+               generation;
+      },
+      deadlineAfter(timeout_), "Timed out waiting for the other workers.");
+}
+
+// ____________________________________________________________________________
+char *SharedMemoryCommunicator::slot(std::size_t worker) const {
+  return segment_ + kHeaderBytes +
+         ((round_ % 2) * size_ + worker) * chunkBytes_;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void SharedMemoryCommunicator::allReduceImpl(T *data, std::size_t n) {
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  const std::size_t chunk = chunkBytes_ / sizeof(T);
+  for (std::size_t offset = 0; offset < n; offset += chunk, ++round_) {
+    const std::size_t m = std::min(chunk, n - offset);
+    T *own = reinterpret_cast<T *>(slot(rank_));
+    std::copy(data + offset, data + offset + m, own);
+    segmentBarrier();
+
+    // Reduce-scatter: sum part rank_ of the chunk over all slots, into the
+    // slot of worker 0.
+    const std::size_t begin = partBegin(m, size_, rank_);
+    const std::size_t end = partBegin(m, size_, rank_ + 1);
+    T *sum = reinterpret_cast<T *>(slot(0));
+    for (std::size_t worker = 1; worker < size_; ++worker) {
+      const T *other = reinterpret_cast<const T *>(slot(worker));
+      kernels.add(sum + begin, other + begin, sum + begin, end - begin);
+    }
+    segmentBarrier();
+
+    // All-gather: every worker copies the whole sum.
+    std::copy(sum, sum + m, data + offset);
+  }
+}
+
+// ____________________________________________________________________________
+// TCP transport.
+// ____________________________________________________________________________
+
+class TcpCommunicator : public Communicator {
+public:
+  TcpCommunicator(std::size_t rank, std::size_t size,
+                  const CommunicatorSettings &settings);
+  ~TcpCommunicator() override;
+
+  void allReduce(float *data, std::size_t n) override {
+    allReduceImpl(data, n);
+  }
+  void allReduce(double *data, std::size_t n) override {
+    allReduceImpl(data, n);
+  }
+
+private:
+  template <typename T> void allReduceImpl(T *data, std::size_t n);
+
+  // Sends sendBytes to the next worker while receiving recvBytes from the
+  // previous one (both at once, so the ring cannot deadlock on full
+  // socket buffers).
+  void exchange(const void *send, std::size_t sendBytes, void *recv,
+                std::size_t recvBytes);
+
+  // Closes the sockets.
+  void closeAll();
+
+  double timeout_;
+  int listen_ = -1;
+  int next_ = -1;
+  int prev_ = -1;
+  std::vector<char> buffer_;
+};
+
+// ____________________________________________________________________________
+// Loopback address of port.
+sockaddr_in loopback(std::uint16_t port) {
+  sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  return address;
+}
+
+// ____________________________________________________________________________
+TcpCommunicator::TcpCommunicator(std::size_t rank, std::size_t size,
+                                 const CommunicatorSettings &settings)
+    : Communicator(rank, size), timeout_(settings.timeout) {
+  if (size == 1) {
+    return;
+  }
+  const Clock::time_point deadline = deadlineAfter(timeout_);
+  const std::uint16_t port =
+      static_cast<std::uint16_t>(settings.basePort + rank);
+  const std::uint16_t nextPort =
+      static_cast<std::uint16_t>(settings.basePort + (rank + 1) % size);
+  try {
+    // Listen for the previous worker.
+    listen_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    const int one = 1;
+    ::setsockopt(listen_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address = loopback(port);
+    if (listen_ < 0 ||
+        ::bind(listen_, reinterpret_cast<sockaddr *>(&address),
+               sizeof(address)) != 0 ||
+        ::listen(listen_, 1) != 0) {
+      throw std::runtime_error("Cannot listen on port " +
+                               std::to_string(port));
+    }
+
+    // Connect to the next worker (retrying until it listens).
+    sockaddr_in nextAddress = loopback(nextPort);
+    spinUntil(
+        [&] {
+          next_ = ::socket(AF_INET, SOCK_STREAM, 0);
+          if (::connect(next_, reinterpret_cast<sockaddr *>(&nextAddress),
+                        sizeof(nextAddress)) == 0) {
+            return true;
+          }
+          ::close(next_);
+          next_ = -1;
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+          return false;
+        },
+        deadline, "Timed out connecting to the next worker.");
+
+    // Accept the previous worker.
+    pollfd request = {listen_, POLLIN, 0};
+    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - Clock::now());
+    const int leftMs = static_cast<int>(std::max<long>(0, left.count()));
+    if (::poll(&request, 1, leftMs) != 1 ||
+        (prev_ = ::accept(listen_, nullptr, nullptr)) < 0) {
+      throw std::runtime_error("Timed out waiting for the previous worker.");
+    }
+    ::close(listen_);
+    listen_ = -1;
+
+    for (int fd : {next_, prev_}) {
+      ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+  } catch (...) {
+    closeAll();
+    throw;
+  }
+}
+
+// ____________________________________________________________________________
+TcpCommunicator::~TcpCommunicator() {
+  stopThread();
+  closeAll();
+}
+
+// ____________________________________________________________________________
+void TcpCommunicator::closeAll() {
+  for (int *fd : {&listen_, &next_, &prev_}) {
+    if (*fd >= 0) {
+      ::close(*fd);
+      *fd = -1;
+    }
+  }
+}
+
+// ____________________________________________________________________________
+void TcpCommunicator::exchange(const void *send, std::size_t sendBytes,
+                               void *recv, std::size_t recvBytes) {
+  const char *out = static_cast<const char *>(send);
+  char *in = static_cast<char *>(recv);
+  std::size_t sent = 0;
+  std::size_t received = 0;
+  const Clock::time_point deadline = deadlineAfter(timeout_);
+  while (sent < sendBytes || received < recvBytes) {
+    pollfd fds[2] = {{next_, static_cast<short>(sent < sendBytes ? POLLOUT : 0),
+                      0},
+                     {prev_,
+                      static_cast<short>(received < recvBytes ? POLLIN : 0),
+                      0}};
+    const int ready = ::poll(fds, 2, 100);
+    if (ready < 0 && errno != EINTR) {
+      throw std::runtime_error("Cannot poll the connections.");
+    }
+    if (ready <= 0) {
+      if (Clock::now() > deadline) {
+        throw std::runtime_error("Timed out waiting for the other workers.");
+      }
+      continue;
+    }
+    if ((fds[0].revents | fds[1].revents) & (POLLERR | POLLNVAL)) {
+      throw std::runtime_error("Connection to another worker failed.");
+    }
+    if (fds[0].revents & POLLOUT) {
+      const ssize_t count =
+          ::send(next_, out + sent, sendBytes - sent, MSG_NOSIGNAL);
+      if (count < 0 && errno != EAGAIN && errno != EINTR) {
+        throw std::runtime_error("Connection to the next worker failed.");
+      }
+      sent += static_cast<std::size_t>(std::max<ssize_t>(count, 0));
+    }
+    if (fds[1].revents & (POLLIN | POLLHUP)) {
+      const ssize_t count =
+          ::recv(prev_, in + received, recvBytes - received, 0);
+      if (count == 0) {
+        throw std::runtime_error("The previous worker closed the connection.");
+      }
+      if (count < 0 && errno != EAGAIN && errno != EINTR) {
+        throw std::runtime_error("Connection to the previous worker failed.");
+      }
+      received += static_cast<std::size_t>(std::max<ssize_t>(count, 0));
+    }
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void TcpCommunicator::allReduceImpl(T *data, std::size_t n) {
+  if (size_ == 1 || n == 0) {
+    return;
+  }
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  auto begin = [&](std::size_t part) { return partBegin(n, size_, part); };
+  auto length = [&](std::size_t part) {
+    return begin(part + 1) - begin(part);
+  };
+  buffer_.resize((n / size_ + 1) * sizeof(T));
+  T *received = reinterpret_cast<T *>(buffer_.data());
+
+  // Reduce-scatter: in step s, send the part summed so far (s + 1 workers)
+  // and add the part received. Afterwards worker r has the full sum of part
+  // r + 1.
+  for (std::size_t step = 0; step + 1 < size_; ++step) {
+    const std::size_t sendPart = (rank_ + size_ - step) % size_;
+    const std::size_t recvPart = (rank_ + 2 * size_ - step - 1) % size_;
+    exchange(data + begin(sendPart), length(sendPart) * sizeof(T), received,
+             length(recvPart) * sizeof(T));
+    kernels.add(data + begin(recvPart), received, data + begin(recvPart),
+                length(recvPart));
+  }
+
+  // All-gather: pass the summed parts on around the ring.
+  for (std::size_t step = 0; step + 1 < size_; ++step) {
+    const std::size_t sendPart = (rank_ + 1 + size_ - step) % size_;
+    const std::size_t recvPart = (rank_ + size_ - step) % size_;
+    exchange(data + begin(sendPart), length(sendPart) * sizeof(T),
+             data + begin(recvPart), length(recvPart) * sizeof(T));
+  }
+}
+
+} // namespace
+
+// ____________________________________________________________________________
+// Communicator:
+// ____________________________________________________________________________
+
+// ____________________________________________________________________________
+std::unique_ptr<Communicator>
+Communicator::connect(std::size_t rank, std::size_t size,
+                      const CommunicatorSettings &settings) {
+  if (size == 0 || rank >= size) {
+    throw std::invalid_argument("Rank must be smaller than the size.");
+  }
+  if (settings.transport == Transport::TCP) {
+    return std::make_unique<TcpCommunicator>(rank, size, settings);
+  }
+  return std::make_unique<SharedMemoryCommunicator>(rank, size, settings);
+}
+
+// ____________________________________________________________________________
+Communicator::Communicator(std::size_t rank, std::size_t size)
+    : rank_(rank), size_(size) {}
+
+// ____________________________________________________________________________
+Communicator::~Communicator() { stopThread(); }
+
+// ____________________________________________________________________________
+std::size_t Communicator::getRank() const { return rank_; }
+
+// ____________________________________________________________________________
+std::size_t Communicator::getSize() const { return size_; }
+
+// ____________________________________________________________________________
+void Communicator::barrier() {
+  float token = 0.0f;
+  allReduce(&token, 1);
+}
+
+// ____________________________________________________________________________
+void Communicator::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [&] { return pending_ == 0; });
+  if (error_) {
+    std::exception_ptr error = error_;
+    error_ = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+// ____________________________________________________________________________
+void Communicator::stopThread() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    changed_.notify_all();
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+// ____________________________________________________________________________
+void Communicator::communicationLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    changed_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      return;
+    }
+    const Job job = queue_.front();
+    queue_.pop_front();
+    // After a failure the workers are out of step, later jobs are dropped.
+    const bool failed = error_ != nullptr;
+    lock.unlock();
+    std::exception_ptr error;
+    if (!failed) {
+      try {
+        if (job.isDouble) {
+          allReduce(static_cast<double *>(job.data), job.n);
+        } else {
+          allReduce(static_cast<float *>(job.data), job.n);
+        }
+      } catch (...) {
+        error = std::current_exception();
+      }
+    }
+    lock.lock();
+    if (error && !error_) {
+      error_ = error;
+    }
+    --pending_;
+    changed_.notify_all();
+  }
+}
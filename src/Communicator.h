@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+// How the workers of a Communicator exchange data.
+enum class Transport {
+  // POSIX shared memory segment mapped by all workers (one host).
+  SHARED_MEMORY,
+  // TCP connections over the loopback interface, in a ring.
+  TCP
+};
+
+// ____________________________________________________________________________
+// Settings of a group of workers (see Communicator::connect).
+struct CommunicatorSettings {
+  Transport transport = Transport::SHARED_MEMORY;
+  // Name of the group, the shared memory segment is "/" + name. Must be
+  // unique per launch (e.g. contain the process id of the launcher).
+  std::string name = "nn-communicator";
+  // TCP: worker r listens on 127.0.0.1, port basePort + r.
+  std::uint16_t basePort = 29500;
+  // Shared memory: bytes every worker exchanges at a time, larger
+  // reductions are split into chunks of this size.
+  std::size_t chunkBytes = std::size_t(1) << 20;
+  // Seconds to wait for the other workers (connecting, or in a reduction)
+  // before throwing std::runtime_error.
+  double timeout = 60.0;
+};
+
+// ____________________________________________________________________________
+// Collective operations between size worker processes on one host, for
+// data-parallel training (see NeuralNetwork::setCommunicator): every worker
+// creates a Communicator with its rank (0 to size - 1) and the same
+// settings, and all of them call the same collective operations in the same
+// order.
+//
+//   auto communicator = Communicator::connect(rank, size, settings);
+//   communicator->allReduce(gradient, n);  // sum over all workers
+//
+// The shared memory transport reduces in place: every worker copies a chunk
+// to its slot of the segment, sums its 1 / size part of the chunk over all
+// slots (reduce-scatter), and copies the summed chunk back (all-gather),
+// with barriers in the segment between the phases. The TCP transport runs
+// the same two phases as a ring: size - 1 steps in which every worker sends
+// a part to the next worker and receives one from the previous worker.
+//
+// allReduceAsync queues a reduction for the communication thread of the
+// communicator, so it runs while the caller goes on (e.g. with the backward
+// pass of the earlier layers); wait returns when the queued reductions are
+// done.
+class Communicator {
+public:
+  // Connects worker rank of size workers. Blocks until all of them are
+  // connected. Throws std::invalid_argument if rank >= size and
+  // std::runtime_error if connecting fails or times out.
+  static std::unique_ptr<Communicator>
+  connect(std::size_t rank, std::size_t size,
+          const CommunicatorSettings &settings = CommunicatorSettings());
+
+  // Waits for the queued reductions and stops the communication thread.
+  virtual ~Communicator();
+
+  Communicator(const Communicator &) = delete;
+  Communicator &operator=(const Communicator &) = delete;
+
+  std::size_t getRank() const;
+  std::size_t getSize() const;
+
+  // Replaces data (n elements) with its sum over all workers. Throws
+  // std::runtime_error if a worker does not take part before the timeout.
+  // Like broadcast and barrier, not to be called while queued reductions
+  // run (call wait first).
+  virtual void allReduce(float *data, std::size_t n) = 0;
+  virtual void allReduce(double *data, std::size_t n) = 0;
+
+  // Replaces data on all workers with data of worker root.
+  template <typename T>
+  void broadcast(T *data, std::size_t n, std::size_t root = 0) {
+    if (rank_ != root) {
+      std::fill(data, data + n, T(0));
+    }
+    allReduce(data, n);
+  }
+
+  // Returns when all workers called it.
+  void barrier();
+
+  // Queues allReduce(data, n) for the communication thread. data must not
+  // be used until wait returns. Reductions run in the order they are queued.
+  template <typename T> void allReduceAsync(T *data, std::size_t n) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(Job{data, n, std::is_same<T, double>::value});
+    ++pending_;
+    if (!thread_.joinable()) {
+      thread_ = std::thread([this] { communicationLoop(); });
+    }
+    changed_.notify_all();
+  }
+
+  // Returns when the queued reductions are done. Rethrows the exception of
+  // a reduction that failed.
+  void wait();
+
+protected:
+  Communicator(std::size_t rank, std::size_t size);
+
+  // Stops the communication thread (called by the destructors of the
+  // transports, before they close their connections).
+  void stopThread();
+
+  const std::size_t rank_;
+  const std::size_t size_;
+
+private:
+  struct Job {
+    void *data;
+    std::size_t n;
+    bool isDouble;
+  };
+
+  // Communication thread: runs the queued reductions.
+  void communicationLoop();
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::deque<Job> queue_;
+  // Number of queued jobs not done yet (the one running included).
+  std::size_t pending_ = 0;
+  std::exception_ptr error_;
+  bool stop_ = false;
+  std::thread thread_;
+};
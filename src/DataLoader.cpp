@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+#include "./DataLoader.h"
+
+namespace {
+
+// Magic bytes and version of data set files.
+constexpr char kDatasetMagic[4] = {'N', 'N', 'D', 'S'};
+constexpr std::uint32_t kDatasetVersion = 1;
+
+// Size of the header in bytes.
+constexpr std::streamoff kDatasetHeaderSize =
+    sizeof(kDatasetMagic) + 2 * sizeof(std::uint32_t) +
+    3 * sizeof(std::uint64_t);
+
+// ____________________________________________________________________________
+// Returns a random seeded generator (like value<T>::random in Utils.h).
+std::mt19937 seededGenerator() {
+  std::random_device rd;
+  return std::mt19937(rd());
+}
+
+// ____________________________________________________________________________
+template <typename U> void writeValue(std::ofstream &out, U value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// ____________________________________________________________________________
+template <typename U> U readValue(std::ifstream &in) {
+  U value;
+  in.read(reinterpret_cast<char *>(&value), sizeof(value));
+  return value;
+}
+
+} // namespace
+
+// ____________________________________________________________________________
+// MatrixLoader:
+// ____________________________________________________________________________
+
+// ____________________________________________________________________________
+template <typename T>
+MatrixLoader<T>::MatrixLoader(const Matrix<T> &X, const Matrix<T> &y,
+                              std::size_t batchSize, bool shuffle)
+    : X_(X), y_(y), batchSize_(batchSize), shuffle_(shuffle),
+      order_(X.getRows()), random_(seededGenerator()) {
+  if (X.getRows() != y.getRows()) {
+    throw std::invalid_argument(
+        "Number of rows of data and labels do not match.");
+  }
+  if (batchSize == 0) {
+    throw std::invalid_argument("Batch size must be > 0.");
+  }
+  std::iota(order_.begin(), order_.end(), 0);
+  position_ = order_.size();
+}
+
+// ____________________________________________________________________________
+template <typename T> void MatrixLoader<T>::reset() {
+  if (shuffle_) {
+    std::shuffle(order_.begin(), order_.end(), random_);
+  }
+  position_ = 0;
+}
+
+// ____________________________________________________________________________
+template <typename T> bool MatrixLoader<T>::next(Matrix<T> &X, Matrix<T> &y) {
+  if (position_ >= order_.size()) {
+    return false;
+  }
+  const std::size_t rows = std::min(batchSize_, order_.size() - position_);
+  const std::size_t featureCols = X_.getCols();
+  const std::size_t labelCols = y_.getCols();
+  X.resize(rows, featureCols);
+  y.resize(rows, labelCols);
+  for (std::size_t row = 0; row < rows; ++row) {
+    const std::size_t source = order_[position_ + row];
+    std::copy(X_[source], X_[source] + featureCols, X[row]);
+    std::copy(y_[source], y_[source] + labelCols, y[row]);
+  }
+  position_ += rows;
+  return true;
+}
+
+// ____________________________________________________________________________
+// Data set files:
+// ____________________________________________________________________________
+
+// ____________________________________________________________________________
+template <typename T>
+void saveDataset(const std::string &fileName, const Matrix<T> &X,
+                 const Matrix<T> &y) {
+  if (X.getRows() != y.getRows()) {
+    throw std::invalid_argument(
+        "Number of rows of data and labels do not match.");
+  }
+  std::ofstream out(fileName, std::ios::binary);
+  if (!out) {
+    throw std::runtime_error("Cannot open file for writing");
+  }
+  out.write(kDatasetMagic, sizeof(kDatasetMagic));
+  writeValue<std::uint32_t>(out, kDatasetVersion);
+  writeValue<std::uint32_t>(out, sizeof(T));
+  writeValue<std::uint64_t>(out, X.getRows());
+  writeValue<std::uint64_t>(out, X.getCols());
+  writeValue<std::uint64_t>(out, y.getCols());
+  for (std::size_t row = 0; row < X.getRows(); ++row) {
+    out.write(reinterpret_cast<const char *>(X[row]), X.getCols() * sizeof(T));
+    out.write(reinterpret_cast<const char *>(y[row]), y.getCols() * sizeof(T));
+  }
+  if (!out) {
+    throw std::runtime_error("Cannot write data set file");
+  }
+}
+
+// ____________________________________________________________________________
+// FileLoader:
+// ____________________________________________________________________________
+
+// ____________________________________________________________________________
+template <typename T>
+FileLoader<T>::FileLoader(const std::string &fileName, std::size_t batchSize,
+                          bool shuffle)
+    : file_(fileName, std::ios::binary), batchSize_(batchSize),
+      shuffle_(shuffle), random_(seededGenerator()) {
+  if (!file_) {
+    throw std::runtime_error("Cannot open file for reading");
+  }
+  if (batchSize == 0) {
+    throw std::invalid_argument("Batch size must be > 0.");
+  }
+  char magic[sizeof(kDatasetMagic)];
+  file_.read(magic, sizeof(magic));
+  const auto version = readValue<std::uint32_t>(file_);
+  const auto valueSize = readValue<std::uint32_t>(file_);
+  rows_ = readValue<std::uint64_t>(file_);
+  featureCols_ = readValue<std::uint64_t>(file_);
+  labelCols_ = readValue<std::uint64_t>(file_);
+  if (!file_ || std::memcmp(magic, kDatasetMagic, sizeof(magic)) != 0 ||
+      version != kDatasetVersion) {
+    throw std::runtime_error("Not a data set file: " + fileName);
+  }
+  if (valueSize != sizeof(T)) {
+    throw std::runtime_error("Data set file has a different value type");
+  }
+  dataOffset_ = kDatasetHeaderSize;
+
+  batchOrder_.resize((rows_ + batchSize_ - 1) / batchSize_);
+  std::iota(batchOrder_.begin(), batchOrder_.end(), 0);
+  position_ = batchOrder_.size();
+  buffer_.resize(batchSize_ * (featureCols_ + labelCols_));
+  rowOrder_.resize(batchSize_);
+}
+
+// ____________________________________________________________________________
+template <typename T> void FileLoader<T>::reset() {
+  if (shuffle_) {
+    std::shuffle(batchOrder_.begin(), batchOrder_.end(), random_);
+  }
+  position_ = 0;
+}
+
+// ____________________________________________________________________________
+template <typename T> bool FileLoader<T>::next(Matrix<T> &X, Matrix<T> &y) {
+  if (position_ >= batchOrder_.size()) {
+    return false;
+  }
+  const std::size_t firstRow = batchOrder_[position_] * batchSize_;
+  const std::size_t rows = std::min<std::size_t>(batchSize_, rows_ - firstRow);
+  const std::size_t rowSize = featureCols_ + labelCols_;
+
+  // Read the rows of the batch in one go.
+  file_.clear();
+  file_.seekg(dataOffset_ + static_cast<std::streamoff>(firstRow * rowSize *
+                                                         sizeof(T)));
+  file_.read(reinterpret_cast<char *>(buffer_.data()),
+             static_cast<std::streamsize>(rows * rowSize * sizeof(T)));
+  if (!file_) {
+    throw std::runtime_error("Data set file is truncated");
+  }
+
+  std::iota(rowOrder_.begin(), rowOrder_.begin() + rows, 0);
+  if (shuffle_) {
+    std::shuffle(rowOrder_.begin(), rowOrder_.begin() + rows, random_);
+  }
+  X.resize(rows, featureCols_);
+  y.resize(rows, labelCols_);
+  for (std::size_t row = 0; row < rows; ++row) {
+    const T *source = buffer_.data() + rowOrder_[row] * rowSize;
+    std::copy(source, source + featureCols_, X[row]);
+    std::copy(source + featureCols_, source + rowSize, y[row]);
+  }
+  ++position_;
+  return true;
+}
+
+// ____________________________________________________________________________
+template <typename T> std::size_t FileLoader<T>::getRows() const {
+  return rows_;
+}
+
+// ____________________________________________________________________________
+template <typename T> std::size_t FileLoader<T>::getFeatureCols() const {
+  return featureCols_;
+}
+
+// ____________________________________________________________________________
+template <typename T> std::size_t FileLoader<T>::getLabelCols() const {
+  return labelCols_;
+}
+
+// ____________________________________________________________________________
+// PrefetchLoader:
+// ____________________________________________________________________________
+
+// ____________________________________________________________________________
+template <typename T>
+PrefetchLoader<T>::PrefetchLoader(DataLoader<T> &source)
+    : source_(source), thread_(&PrefetchLoader<T>::prefetchLoop, this) {}
+
+// ____________________________________________________________________________
+template <typename T> PrefetchLoader<T>::~PrefetchLoader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  changed_.notify_all();
+  thread_.join();
+}
+
+// ____________________________________________________________________________
+template <typename T> void PrefetchLoader<T>::reset() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  waitForBatch(lock);
+  // Start the epoch with loading its first batch.
+  reset_ = true;
+  requested_ = true;
+  ready_ = false;
+  changed_.notify_all();
+}
+
+// ____________________________________________________________________________
+template <typename T>
+bool PrefetchLoader<T>::next(Matrix<T> &X, Matrix<T> &y) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  waitForBatch(lock);
+  if (!hasBatch_) {
+    return false;
+  }
+  // Hand out the prefetched batch, the thread loads the next one into the
+  // buffers of the previous batch.
+  std::swap(X, X_);
+  std::swap(y, y_);
+  requested_ = true;
+  ready_ = false;
+  changed_.notify_all();
+  return true;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void PrefetchLoader<T>::waitForBatch(std::unique_lock<std::mutex> &lock) {
+  changed_.wait(lock, [this] { return ready_; });
+  if (error_ != nullptr) {
+    std::exception_ptr error = error_;
+    error_ = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T> void PrefetchLoader<T>::prefetchLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    changed_.wait(lock, [this] { return stop_ || requested_; });
+    if (stop_) {
+      return;
+    }
+    const bool reset = reset_;
+    requested_ = false;
+    reset_ = false;
+
+    // Load without holding the lock (the consumer waits for ready_).
+    lock.unlock();
+    bool hasBatch = false;
+    std::exception_ptr error;
+    try {
+      if (reset) {
+        source_.reset();
+      }
+      hasBatch = source_.next(X_, y_);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    lock.lock();
+
+    hasBatch_ = hasBatch;
+    error_ = error;
+    ready_ = true;
+    changed_.notify_all();
+  }
+}
+
+// ____________________________________________________________________________
+// Explicit instantiations for float (loaders) and int, float and double
+// (data set files).
+template class MatrixLoader<float>;
+template class FileLoader<float>;
+template class PrefetchLoader<float>;
+
+template void saveDataset<int>(const std::string &fileName,
+                               const Matrix<int> &X, const Matrix<int> &y);
+template void saveDataset<float>(const std::string &fileName,
+                                 const Matrix<float> &X,
+                                 const Matrix<float> &y);
+template void saveDataset<double>(const std::string &fileName,
+                                  const Matrix<double> &X,
+                                  const Matrix<double> &y);
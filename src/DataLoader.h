@@ -0,0 +1,147 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "./Matrix.h"
+
+// ____________________________________________________________________________
+// Source of training batches (inputs X and labels y) for
+// NeuralNetwork<T>::train.
+//
+// An epoch is reset() followed by next() until it returns false. next()
+// writes into the given matrices, which are only reallocated if their buffer
+// is too small (see Matrix::resize), so a training loop reusing them does not
+// allocate.
+template <typename T> class DataLoader {
+public:
+  virtual ~DataLoader() = default;
+
+  // Starts a new epoch (and reshuffles, if the loader shuffles).
+  virtual void reset() = 0;
+
+  // Writes the next batch to X and y. Returns false (and leaves X and y
+  // alone) at the end of the epoch.
+  virtual bool next(Matrix<T> &X, Matrix<T> &y) = 0;
+};
+
+// ____________________________________________________________________________
+// Batches of batchSize rows of a data set in memory (the last batch of an
+// epoch may be smaller). If shuffle, the rows are visited in a new random
+// order every epoch. The matrices are referenced, not copied, and must
+// outlive the loader.
+template <typename T> class MatrixLoader : public DataLoader<T> {
+public:
+  MatrixLoader(const Matrix<T> &X, const Matrix<T> &y, std::size_t batchSize,
+               bool shuffle = true);
+
+  void reset() override;
+  bool next(Matrix<T> &X, Matrix<T> &y) override;
+
+private:
+  const Matrix<T> &X_;
+  const Matrix<T> &y_;
+  std::size_t batchSize_;
+  bool shuffle_;
+  // Order of the rows in the current epoch, and the next one to visit.
+  std::vector<std::size_t> order_;
+  std::size_t position_ = 0;
+  std::mt19937 random_;
+};
+
+// ____________________________________________________________________________
+// Data set files streamed by FileLoader:
+//
+//   char[4]   magic "NNDS"
+//   uint32    version (1)
+//   uint32    sizeof(T)
+//   uint64    rows
+//   uint64    feature cols
+//   uint64    label cols
+//   T[rows][feature cols + label cols]  (features, then labels of each row)
+//
+// all in the byte order of the machine that wrote it.
+
+// Writes X (features) and y (labels) to a data set file.
+template <typename T>
+void saveDataset(const std::string &fileName, const Matrix<T> &X,
+                 const Matrix<T> &y);
+
+// Streams batches of batchSize consecutive rows from a data set file, so data
+// sets larger than memory can be trained on. Only one batch is in memory at
+// a time. If shuffle, every epoch visits the batches in a new random order
+// and shuffles the rows inside each batch.
+template <typename T> class FileLoader : public DataLoader<T> {
+public:
+  FileLoader(const std::string &fileName, std::size_t batchSize,
+             bool shuffle = true);
+
+  void reset() override;
+  bool next(Matrix<T> &X, Matrix<T> &y) override;
+
+  // Returns the number of rows, feature and label cols of the file.
+  std::size_t getRows() const;
+  std::size_t getFeatureCols() const;
+  std::size_t getLabelCols() const;
+
+private:
+  std::ifstream file_;
+  std::uint64_t rows_ = 0;
+  std::uint64_t featureCols_ = 0;
+  std::uint64_t labelCols_ = 0;
+  std::streamoff dataOffset_ = 0;
+  std::size_t batchSize_;
+  bool shuffle_;
+  // Order of the batches in the current epoch, and the next one to read.
+  std::vector<std::size_t> batchOrder_;
+  std::size_t position_ = 0;
+  // Rows of the current batch as read from the file, and their order.
+  std::vector<T> buffer_;
+  std::vector<std::size_t> rowOrder_;
+  std::mt19937 random_;
+};
+
+// ____________________________________________________________________________
+// Wraps a loader and reads its next batch on a background thread while the
+// current batch trains. Batches come out in the same order as from source,
+// which must outlive the PrefetchLoader and is only used by its thread.
+template <typename T> class PrefetchLoader : public DataLoader<T> {
+public:
+  explicit PrefetchLoader(DataLoader<T> &source);
+  ~PrefetchLoader() override;
+
+  void reset() override;
+  bool next(Matrix<T> &X, Matrix<T> &y) override;
+
+private:
+  // Background thread: loads a batch into X_, y_ whenever requested.
+  void prefetchLoop();
+
+  // Waits for the batch being loaded. Rethrows what the source threw.
+  void waitForBatch(std::unique_lock<std::mutex> &lock);
+
+  DataLoader<T> &source_;
+  // The prefetched batch.
+  Matrix<T> X_;
+  Matrix<T> y_;
+  bool hasBatch_ = false;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  // Set by the consumer: reset the source before loading, load a batch, stop.
+  bool reset_ = false;
+  bool requested_ = false;
+  bool stop_ = false;
+  // Set while the thread has no request pending or in progress.
+  bool ready_ = true;
+  // Exception thrown by the source on the thread.
+  std::exception_ptr error_;
+  std::thread thread_;
+};
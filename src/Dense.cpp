@@ -0,0 +1,111 @@
+#include <stdexcept>
+
+#include "./Dense.h"
+#include "./Gemm.h"
+#include "./Half.h"
+
+namespace {
+
+// ____________________________________________________________________________
+// Makes sure M has shape rows x cols, keeping its buffer if it is large
+// enough.
+template <typename T>
+void ensureShape(Matrix<T> &M, std::size_t rows, std::size_t cols) {
+  if (M.getRows() != rows || M.getCols() != cols) {
+    M.resize(rows, cols);
+  }
+}
+
+} // namespace
+
+// ____________________________________________________________________________
+template <typename T, typename TW>
+void dense(const Matrix<T> &X, const Matrix<TW> &W, const Matrix<T> &b,
+           Activation activation, Matrix<T> &A, Matrix<T> *Z) {
+  if (X.getCols() != W.getRows()) {
+    throw std::invalid_argument(
+        "Matrices dimensions do not match for multiplication.");
+  }
+  if (b.getRows() != 1 || b.getCols() != W.getCols()) {
+    throw std::invalid_argument("Bias must be a 1 x cols row vector.");
+  }
+  const std::size_t m = X.getRows();
+  const std::size_t n = W.getCols();
+  ensureShape(A, m, n);
+
+  GemmEpilogue<T> epilogue;
+  epilogue.bias = b.data();
+  if (Z != nullptr) {
+    ensureShape(*Z, m, n);
+    epilogue.Z = Z->data();
+    epilogue.ldz = Z->getStride();
+  }
+  epilogue.activation = activationKernel<T>(activation);
+  gemm(m, n, X.getCols(), X.data(), X.getStride(), W.data(), W.getStride(),
+       A.data(), A.getStride(), false, &epilogue);
+
+  if (activation == Activation::softmax) {
+    softmax(A, A);
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T, typename TW>
+void dense(const SparseMatrix<T> &X, const Matrix<TW> &W, const Matrix<T> &b,
+           Activation activation, Matrix<T> &A, Matrix<T> *Z) {
+  if (X.getCols() != W.getRows()) {
+    throw std::invalid_argument(
+        "Matrices dimensions do not match for multiplication.");
+  }
+  if (b.getRows() != 1 || b.getCols() != W.getCols()) {
+    throw std::invalid_argument("Bias must be a 1 x cols row vector.");
+  }
+  const std::size_t m = X.getRows();
+  const std::size_t n = W.getCols();
+  ensureShape(A, m, n);
+
+  GemmEpilogue<T> epilogue;
+  epilogue.bias = b.data();
+  if (Z != nullptr) {
+    ensureShape(*Z, m, n);
+    epilogue.Z = Z->data();
+    epilogue.ldz = Z->getStride();
+  }
+  epilogue.activation = activationKernel<T>(activation);
+  sparseDot(X, W, A, &epilogue);
+
+  if (activation == Activation::softmax) {
+    softmax(A, A);
+  }
+}
+
+// ____________________________________________________________________________
+// Explicit instantiations for float, with float, bfloat16 and float16
+// weights.
+template void dense<float>(const Matrix<float> &X, const Matrix<float> &W,
+                           const Matrix<float> &b, Activation activation,
+                           Matrix<float> &A, Matrix<float> *Z);
+template void dense<float, bfloat16>(const Matrix<float> &X,
+                                     const Matrix<bfloat16> &W,
+                                     const Matrix<float> &b,
+                                     Activation activation, Matrix<float> &A,
+                                     Matrix<float> *Z);
+template void dense<float, float16>(const Matrix<float> &X,
+                                    const Matrix<float16> &W,
+                                    const Matrix<float> &b,
+                                    Activation activation, Matrix<float> &A,
+                                    Matrix<float> *Z);
+template void dense<float>(const SparseMatrix<float> &X,
+                           const Matrix<float> &W, const Matrix<float> &b,
+                           Activation activation, Matrix<float> &A,
+                           Matrix<float> *Z);
+template void dense<float, bfloat16>(const SparseMatrix<float> &X,
+                                     const Matrix<bfloat16> &W,
+                                     const Matrix<float> &b,
+                                     Activation activation, Matrix<float> &A,
+                                     Matrix<float> *Z);
+template void dense<float, float16>(const SparseMatrix<float> &X,
+                                    const Matrix<float16> &W,
+                                    const Matrix<float> &b,
+                                    Activation activation, Matrix<float> &A,
+                                    Matrix<float> *Z);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "./Activation.h"
+#include "./Matrix.h"
+#include "./SparseMatrix.h"
+
+// ____________________________________________________________________________
+// Fused dense layer:
+//
+// Z = dot(X, W) + b
+// A = activation(Z)
+//
+// computed in one GEMM pass: the bias broadcast, the copy to Z and the
+// activation run in the GEMM epilogue on each output tile while it is still
+// in cache (see Gemm.h). Pass Z = nullptr in inference, when only A is
+// needed. Softmax is not elementwise, so it runs after the GEMM.
+//
+// A and Z are resized to X.getRows() x W.getCols() if needed (see
+// Matrix::resize), so their buffers are reused across calls.
+//
+// W may be stored as bfloat16 or float16 (TW, see Half.h); the GEMM widens
+// it to float while packing.
+template <typename T, typename TW = T>
+void dense(const Matrix<T> &X, const Matrix<TW> &W, const Matrix<T> &b,
+           Activation activation, Matrix<T> &A, Matrix<T> *Z = nullptr);
+
+// Same, for sparse inputs X (see SparseMatrix.h): the product is computed by
+// sparseDot, with the bias, Z and the activation applied to every output row
+// while it is still in cache, so the work is proportional to the non-zeros
+// of X.
+template <typename T, typename TW = T>
+void dense(const SparseMatrix<T> &X, const Matrix<TW> &W, const Matrix<T> &b,
+           Activation activation, Matrix<T> &A, Matrix<T> *Z = nullptr);
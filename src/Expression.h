@@ -0,0 +1,499 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "./Activation.h"
+#include "./Matrix.h"
+#include "./Simd.h"
+
+// ____________________________________________________________________________
+// Lazy elementwise Matrix arithmetic (expression templates).
+//
+// The free functions of Matrix.h compute eagerly, so a chain like
+//
+//   Matrix<T> diff = sub(y, out);
+//   T loss = sum(dotElementWise(diff, diff));
+//
+// writes and reads a full temporary matrix per operator. Wrapping the
+// operands with lazy() instead builds the expression as a small tree of
+// types, and nothing is computed until it is assigned:
+//
+//   auto diff = lazy(y) - lazy(out);
+//   T loss = sum(diff * diff);
+//   assign(Z, activation(lazy(Z) + lazy(b), Activation::sigmoid));
+//
+// The expression is then evaluated in one pass over the rows: blocks of
+// kExpressionBlock elements of every operand go through the SIMD kernels
+// (see Simd.h) in buffers on the stack, which stay in L1, and only the
+// result is written to memory. No temporary matrix is allocated.
+// Expressions over unpadded matrices without broadcasting are evaluated as
+// one array; otherwise every row costs a kernel call per operator, so with
+// a broadcast operand and narrow rows (e.g. 10 outputs) the eager functions
+// are faster.
+//
+// Operators: + - and * (elementwise, like dotElementWise) between
+// expressions, and with a Matrix or a scalar on either side; maximum(),
+// activation() and map() for unary kernels. An operand with one row is
+// broadcast to all rows of the other (e.g. a bias). Shapes are checked
+// when the expression is built (std::invalid_argument).
+//
+// Expressions reference their matrices, so they must not outlive them. The
+// result may be assigned to one of its operands (all operations are
+// elementwise), as long as the shape does not change.
+//
+// This is opt-in: nothing in Matrix.h changes, Matrix has no operators, and
+// the eager functions stay as they are.
+
+// Elements of every operand evaluated at once.
+constexpr std::size_t kExpressionBlock = 1024;
+
+// Base of all expression nodes, E is the node type (CRTP). Every node has
+//   using Scalar = T;
+//   static constexpr std::size_t kBuffers;  // blocks of scratch it needs
+//   std::size_t getRows() const;
+//   std::size_t getCols() const;
+//   // True if all rows are one array (no padding and no broadcast), so
+//   // evaluate(0, col, n, buffers) works for any col < rows * cols.
+//   bool isContiguous() const;
+//   // Elements [col, col + n) of row (n <= kExpressionBlock), in buffers
+//   // (kBuffers blocks) or in the memory of an operand.
+//   const T *evaluate(std::size_t row, std::size_t col, std::size_t n,
+//                     T *buffers) const;
+//   // Same, written to out (which may alias the operands).
+//   void write(std::size_t row, std::size_t col, std::size_t n, T *out,
+//              T *buffers) const;
+template <typename E> struct Expression {
+  const E &self() const { return static_cast<const E &>(*this); }
+};
+
+// ____________________________________________________________________________
+// Leaf referencing a Matrix.
+template <typename T>
+class MatrixExpression : public Expression<MatrixExpression<T>> {
+public:
+  using Scalar = T;
+  static constexpr std::size_t kBuffers = 0;
+
+  explicit MatrixExpression(const Matrix<T> &matrix) : matrix_(&matrix) {}
+
+  std::size_t getRows() const { return matrix_->getRows(); }
+  std::size_t getCols() const { return matrix_->getCols(); }
+  bool isContiguous() const {
+    return matrix_->getStride() == matrix_->getCols();
+  }
+
+  const T *evaluate(std::size_t row, std::size_t col, std::size_t,
+                    T *) const {
+    return (*matrix_)[row] + col;
+  }
+
+  void write(std::size_t row, std::size_t col, std::size_t n, T *out,
+             T *) const {
+    const T *a = (*matrix_)[row] + col;
+    if (a != out) {
+      std::copy(a, a + n, out);
+    }
+  }
+
+private:
+  const Matrix<T> *matrix_;
+};
+
+// ____________________________________________________________________________
+// Elementwise kernel(lhs, rhs, out, n). An operand with one row is
+// broadcast to all rows.
+template <typename L, typename R>
+class BinaryExpression : public Expression<BinaryExpression<L, R>> {
+public:
+  using Scalar = typename L::Scalar;
+  static_assert(std::is_same<Scalar, typename R::Scalar>::value,
+                "Operands of an expression must have the same type.");
+  using Kernel = void (*)(const Scalar *a, const Scalar *b, Scalar *out,
+                          std::size_t n);
+  // The lhs is kept in the first block while the rhs is evaluated in the
+  // others.
+  static constexpr std::size_t kBuffers =
+      std::max(L::kBuffers, R::kBuffers + 1);
+
+  BinaryExpression(const L &lhs, const R &rhs, Kernel kernel,
+                   const char *name)
+      : lhs_(lhs), rhs_(rhs), kernel_(kernel) {
+    const std::size_t lhsRows = lhs.getRows();
+    const std::size_t rhsRows = rhs.getRows();
+    if (lhs.getCols() != rhs.getCols() ||
+        (lhsRows != rhsRows && lhsRows != 1 && rhsRows != 1)) {
+      throw std::invalid_argument(
+          std::string("Matrices dimensions do not match for ") + name + ".");
+    }
+  }
+
+  std::size_t getRows() const {
+    return std::max(lhs_.getRows(), rhs_.getRows());
+  }
+  std::size_t getCols() const { return lhs_.getCols(); }
+  bool isContiguous() const {
+    return lhs_.getRows() == rhs_.getRows() && lhs_.isContiguous() &&
+           rhs_.isContiguous();
+  }
+
+  const Scalar *evaluate(std::size_t row, std::size_t col, std::size_t n,
+                         Scalar *buffers) const {
+    write(row, col, n, buffers, buffers);
+    return buffers;
+  }
+
+  void write(std::size_t row, std::size_t col, std::size_t n, Scalar *out,
+             Scalar *buffers) const {
+    const Scalar *a =
+        lhs_.evaluate(lhs_.getRows() == 1 ? 0 : row, col, n, buffers);
+    const Scalar *b = rhs_.evaluate(rhs_.getRows() == 1 ? 0 : row, col, n,
+                                    buffers + kExpressionBlock);
+    kernel_(a, b, out, n);
+  }
+
+private:
+  L lhs_;
+  R rhs_;
+  Kernel kernel_;
+};
+
+// ____________________________________________________________________________
+// Elementwise kernel(operand, out, n).
+template <typename E>
+class UnaryExpression : public Expression<UnaryExpression<E>> {
+public:
+  using Scalar = typename E::Scalar;
+  static constexpr std::size_t kBuffers = std::max<std::size_t>(E::kBuffers, 1);
+
+  UnaryExpression(const E &operand, UnaryKernel<Scalar> kernel)
+      : operand_(operand), kernel_(kernel) {}
+
+  std::size_t getRows() const { return operand_.getRows(); }
+  std::size_t getCols() const { return operand_.getCols(); }
+  bool isContiguous() const { return operand_.isContiguous(); }
+
+  const Scalar *evaluate(std::size_t row, std::size_t col, std::size_t n,
+                         Scalar *buffers) const {
+    write(row, col, n, buffers, buffers);
+    return buffers;
+  }
+
+  void write(std::size_t row, std::size_t col, std::size_t n, Scalar *out,
+             Scalar *buffers) const {
+    kernel_(operand_.evaluate(row, col, n, buffers), out, n);
+  }
+
+private:
+  E operand_;
+  UnaryKernel<Scalar> kernel_;
+};
+
+// ____________________________________________________________________________
+// Elementwise kernel(operand, scalar, out, n), e.g. scale or maximum.
+template <typename E>
+class ScalarExpression : public Expression<ScalarExpression<E>> {
+public:
+  using Scalar = typename E::Scalar;
+  using Kernel = void (*)(const Scalar *a, Scalar scalar, Scalar *out,
+                          std::size_t n);
+  static constexpr std::size_t kBuffers = std::max<std::size_t>(E::kBuffers, 1);
+
+  ScalarExpression(const E &operand, Scalar scalar, Kernel kernel)
+      : operand_(operand), scalar_(scalar), kernel_(kernel) {}
+
+  std::size_t getRows() const { return operand_.getRows(); }
+  std::size_t getCols() const { return operand_.getCols(); }
+  bool isContiguous() const { return operand_.isContiguous(); }
+
+  const Scalar *evaluate(std::size_t row, std::size_t col, std::size_t n,
+                         Scalar *buffers) const {
+    write(row, col, n, buffers, buffers);
+    return buffers;
+  }
+
+  void write(std::size_t row, std::size_t col, std::size_t n, Scalar *out,
+             Scalar *buffers) const {
+    kernel_(operand_.evaluate(row, col, n, buffers), scalar_, out, n);
+  }
+
+private:
+  E operand_;
+  Scalar scalar_;
+  Kernel kernel_;
+};
+
+// ____________________________________________________________________________
+// Kernels with a scalar that SimdKernels does not have (simple enough for
+// the compiler to vectorize).
+template <typename T>
+void addScalarKernel(const T *a, T scalar, T *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = a[i] + scalar;
+  }
+}
+
+template <typename T>
+void subtractFromScalarKernel(const T *a, T scalar, T *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = scalar - a[i];
+  }
+}
+
+template <typename T> void copyKernel(const T *a, T *out, std::size_t n) {
+  if (a != out) {
+    std::copy(a, a + n, out);
+  }
+}
+
+// ____________________________________________________________________________
+// Building expressions:
+// ____________________________________________________________________________
+
+// Starts an expression on matrix (referenced, not copied).
+template <typename T> MatrixExpression<T> lazy(const Matrix<T> &matrix) {
+  return MatrixExpression<T>(matrix);
+}
+
+// A temporary would be gone before the expression is evaluated.
+template <typename T> void lazy(const Matrix<T> &&matrix) = delete;
+
+// ____________________________________________________________________________
+template <typename L, typename R>
+BinaryExpression<L, R> operator+(const Expression<L> &lhs,
+                                 const Expression<R> &rhs) {
+  return BinaryExpression<L, R>(lhs.self(), rhs.self(),
+                                simdKernels<typename L::Scalar>().add,
+                                "addition");
+}
+
+template <typename L, typename R>
+BinaryExpression<L, R> operator-(const Expression<L> &lhs,
+                                 const Expression<R> &rhs) {
+  return BinaryExpression<L, R>(lhs.self(), rhs.self(),
+                                simdKernels<typename L::Scalar>().sub,
+                                "subtraction");
+}
+
+// Elementwise product (see dotElementWise), not the matrix product.
+template <typename L, typename R>
+BinaryExpression<L, R> operator*(const Expression<L> &lhs,
+                                 const Expression<R> &rhs) {
+  return BinaryExpression<L, R>(lhs.self(), rhs.self(),
+                                simdKernels<typename L::Scalar>().mul,
+                                "element wise multiplication");
+}
+
+// ____________________________________________________________________________
+// With a Matrix on one side.
+template <typename E>
+auto operator+(const Expression<E> &lhs,
+               const Matrix<typename E::Scalar> &rhs) {
+  return lhs + lazy(rhs);
+}
+
+template <typename E>
+auto operator+(const Matrix<typename E::Scalar> &lhs,
+               const Expression<E> &rhs) {
+  return lazy(lhs) + rhs;
+}
+
+template <typename E>
+auto operator-(const Expression<E> &lhs,
+               const Matrix<typename E::Scalar> &rhs) {
+  return lhs - lazy(rhs);
+}
+
+template <typename E>
+auto operator-(const Matrix<typename E::Scalar> &lhs,
+               const Expression<E> &rhs) {
+  return lazy(lhs) - rhs;
+}
+
+template <typename E>
+auto operator*(const Expression<E> &lhs,
+               const Matrix<typename E::Scalar> &rhs) {
+  return lhs * lazy(rhs);
+}
+
+template <typename E>
+auto operator*(const Matrix<typename E::Scalar> &lhs,
+               const Expression<E> &rhs) {
+  return lazy(lhs) * rhs;
+}
+
+// ____________________________________________________________________________
+// With a scalar on one side.
+template <typename E>
+ScalarExpression<E> operator*(const Expression<E> &lhs,
+                              typename E::Scalar scalar) {
+  return ScalarExpression<E>(lhs.self(), scalar,
+                             simdKernels<typename E::Scalar>().scale);
+}
+
+template <typename E>
+ScalarExpression<E> operator*(typename E::Scalar scalar,
+                              const Expression<E> &rhs) {
+  return rhs * scalar;
+}
+
+template <typename E>
+ScalarExpression<E> operator+(const Expression<E> &lhs,
+                              typename E::Scalar scalar) {
+  return ScalarExpression<E>(lhs.self(), scalar,
+                             addScalarKernel<typename E::Scalar>);
+}
+
+template <typename E>
+ScalarExpression<E> operator+(typename E::Scalar scalar,
+                              const Expression<E> &rhs) {
+  return rhs + scalar;
+}
+
+template <typename E>
+ScalarExpression<E> operator-(const Expression<E> &lhs,
+                              typename E::Scalar scalar) {
+  return lhs + static_cast<typename E::Scalar>(-scalar);
+}
+
+template <typename E>
+ScalarExpression<E> operator-(typename E::Scalar scalar,
+                              const Expression<E> &rhs) {
+  return ScalarExpression<E>(rhs.self(), scalar,
+                             subtractFromScalarKernel<typename E::Scalar>);
+}
+
+// ____________________________________________________________________________
+// max(x, inf) for every element x (see Matrix::maximum).
+template <typename E>
+ScalarExpression<E> maximum(const Expression<E> &operand,
+                            typename E::Scalar inf) {
+  return ScalarExpression<E>(operand.self(), inf,
+                             simdKernels<typename E::Scalar>().maximum);
+}
+
+// kernel applied to every element (see Simd.h).
+template <typename E>
+UnaryExpression<E> map(const Expression<E> &operand,
+                       UnaryKernel<typename E::Scalar> kernel) {
+  return UnaryExpression<E>(operand.self(), kernel);
+}
+
+// Elementwise activation (float, see activationKernel). Throws
+// std::invalid_argument for softmax, which needs whole rows.
+template <typename E>
+UnaryExpression<E> activation(const Expression<E> &operand,
+                              Activation activation) {
+  using T = typename E::Scalar;
+  if (activation == Activation::softmax) {
+    throw std::invalid_argument("Softmax is not elementwise.");
+  }
+  UnaryKernel<T> kernel = activationKernel<T>(activation);
+  return UnaryExpression<E>(operand.self(),
+                            kernel != nullptr ? kernel : copyKernel<T>);
+}
+
+// ____________________________________________________________________________
+// Evaluating expressions:
+// ____________________________________________________________________________
+
+// Calls block(row, col, n, buffers) for the blocks of [colBegin, colEnd) in
+// the rows [rowBegin, rowEnd), with buffers for E on the stack.
+template <typename E, typename Block>
+void forEachBlock(std::size_t rowBegin, std::size_t rowEnd,
+                  std::size_t colBegin, std::size_t colEnd, Block block) {
+  alignas(kMatrixAlignment) typename E::Scalar
+      buffers[std::max<std::size_t>(E::kBuffers, 1) * kExpressionBlock];
+  for (std::size_t row = rowBegin; row < rowEnd; ++row) {
+    for (std::size_t col = colBegin; col < colEnd; col += kExpressionBlock) {
+      block(row, col, std::min(kExpressionBlock, colEnd - col), buffers);
+    }
+  }
+}
+
+// Evaluates expression into out, resized to its shape if needed. Large
+// expressions are split between the threads like forEachRow, and
+// contiguous ones are handled as one array.
+template <typename E>
+void assign(Matrix<typename E::Scalar> &out, const Expression<E> &expression) {
+  using T = typename E::Scalar;
+  const E &e = expression.self();
+  const std::size_t rows = e.getRows();
+  const std::size_t cols = e.getCols();
+  if (out.getRows() != rows || out.getCols() != cols) {
+    out.resize(rows, cols);
+  }
+  if (rows == 0 || cols == 0) {
+    return;
+  }
+  const std::size_t stride = out.getStride();
+  auto write = [&](std::size_t row, std::size_t col, std::size_t n,
+                   T *buffers) {
+    e.write(row, col, n, out.data() + row * stride + col, buffers);
+  };
+  if (stride == cols && e.isContiguous()) {
+    parallelFor(rows * cols, kParallelGrain,
+                [&](std::size_t begin, std::size_t end) {
+                  forEachBlock<E>(0, 1, begin, end, write);
+                });
+    return;
+  }
+  const std::size_t grain = std::max<std::size_t>(1, kParallelGrain / cols);
+  parallelFor(rows, grain, [&](std::size_t begin, std::size_t end) {
+    forEachBlock<E>(begin, end, 0, cols, write);
+  });
+}
+
+// Evaluates expression into a new matrix.
+template <typename E>
+Matrix<typename E::Scalar> evaluate(const Expression<E> &expression) {
+  Matrix<typename E::Scalar> out;
+  assign(out, expression);
+  return out;
+}
+
+// Sums all elements of expression, like sum(const Matrix<T> &): partial
+// sums of fixed parts (so the result does not depend on the number of
+// threads), added up in order.
+template <typename E> typename E::Scalar sum(const Expression<E> &expression) {
+  using T = typename E::Scalar;
+  const E &e = expression.self();
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  const std::size_t rows = e.getRows();
+  const std::size_t cols = e.getCols();
+  if (rows == 0 || cols == 0) {
+    return T(0);
+  }
+  // Parts of kParallelGrain elements, or of whole rows.
+  const bool contiguous = e.isContiguous();
+  const std::size_t length = contiguous ? rows * cols : rows;
+  const std::size_t part =
+      contiguous ? kParallelGrain
+                 : std::max<std::size_t>(1, kParallelGrain / cols);
+  std::vector<T> partial((length + part - 1) / part, T(0));
+  parallelFor(partial.size(), 1, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      T &res = partial[i];
+      auto add = [&](std::size_t row, std::size_t col, std::size_t n,
+                     T *buffers) {
+        res += kernels.sum(e.evaluate(row, col, n, buffers), n);
+      };
+      const std::size_t first = i * part;
+      const std::size_t last = std::min(length, first + part);
+      if (contiguous) {
+        forEachBlock<E>(0, 1, first, last, add);
+      } else {
+        forEachBlock<E>(first, last, 0, cols, add);
+      }
+    }
+  });
+  T res = T(0);
+  for (const T &value : partial) {
+    res += value;
+  }
+  return res;
+}
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "./NeuralNetwork.h"
+#include "./SimdSse2.h"
+
+// ____________________________________________________________________________
+// Dense layer of a FixedNetwork: In inputs, Out outputs and the activation,
+// all known at compile time.
+template <std::size_t In, std::size_t Out, Activation A> struct FixedDense {
+  static_assert(In > 0 && Out > 0, "A layer needs inputs and outputs.");
+  static constexpr std::size_t kInputs = In;
+  static constexpr std::size_t kOutputs = Out;
+  static constexpr Activation kActivation = A;
+};
+
+// Returns whether the outputs of every layer are the inputs of the next.
+template <typename... Layers> constexpr bool fixedLayersChain() {
+  constexpr std::size_t inputs[] = {Layers::kInputs...};
+  constexpr std::size_t outputs[] = {Layers::kOutputs...};
+  for (std::size_t i = 1; i < sizeof...(Layers); ++i) {
+    if (inputs[i] != outputs[i - 1]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// ____________________________________________________________________________
+// exp and tanh of the activations of a FixedNetwork layer. With SSE2 (every
+// x86-64 CPU, so there is nothing to dispatch) floats run 4 at a time
+// through the approximations of the SIMD kernels (SimdMath.h on the SSE2
+// wrappers of SimdSse2.h); the layers are padded to a multiple of
+// fixedLanes<T>() for it. Otherwise std::exp and std::tanh.
+template <typename T> constexpr std::size_t fixedLanes() {
+#if defined(__SSE2__)
+  return std::is_same_v<T, float> ? 4 : 1;
+#else
+  return 1;
+#endif
+}
+
+#if defined(__SSE2__)
+// The approximations of SimdMath.h on the SSE2 wrappers.
+namespace fixed_sse2 {
+#define NN_SIMD_TARGET __attribute__((target("sse2")))
+#include "./SimdMath.h"
+#undef NN_SIMD_TARGET
+} // namespace fixed_sse2
+#endif
+
+template <typename T, std::size_t N>
+inline void fixedExp(std::array<T, N> &x) {
+#if defined(__SSE2__)
+  if constexpr (std::is_same_v<T, float>) {
+    static_assert(N % 4 == 0, "Pad the layer to fixedLanes<float>().");
+    using V = simd_sse2::VecF;
+    for (std::size_t i = 0; i < N; i += V::kWidth) {
+      V::store(x.data() + i, fixed_sse2::expApprox<V>(V::load(x.data() + i)));
+    }
+    return;
+  }
+#endif
+  for (T &value : x) {
+    value = std::exp(value);
+  }
+}
+
+template <typename T, std::size_t N>
+inline void fixedTanh(std::array<T, N> &x) {
+#if defined(__SSE2__)
+  if constexpr (std::is_same_v<T, float>) {
+    static_assert(N % 4 == 0, "Pad the layer to fixedLanes<float>().");
+    using V = simd_sse2::VecF;
+    for (std::size_t i = 0; i < N; i += V::kWidth) {
+      V::store(x.data() + i, fixed_sse2::tanhApprox<V>(V::load(x.data() + i)));
+    }
+    return;
+  }
+#endif
+  for (T &value : x) {
+    value = std::tanh(value);
+  }
+}
+
+// ____________________________________________________________________________
+// Inference of a tiny network whose shape is fixed at compile time, e.g. the
+// XOR network of NeuralNetworkMain.cpp:
+//
+//   using Xor = FixedNetwork<float, FixedDense<2, 4, Activation::sigmoid>,
+//                            FixedDense<4, 1, Activation::sigmoid>>;
+//   Xor xorGate(trained);                    // copies the weights
+//   Xor::Output out = xorGate.act(Xor::Input{1.0f, 0.0f});
+//
+// The weights, biases and all intermediate activations live in std::arrays
+// (the network on the stack, or wherever it is), there are no shape checks
+// and no calls through kernel pointers: every layer is a loop with constant
+// trip counts, which the compiler unrolls and vectorizes, and the
+// activation is selected at compile time. For networks with a few hundred
+// weights this takes nanoseconds per sample, where NeuralNetwork::act spends
+// its time allocating matrices and dispatching. Larger networks are better
+// served by NeuralNetwork (blocked GEMM, threads).
+//
+// The weights have the layout of NeuralNetwork (In x Out, row-major), so
+// outputs match NeuralNetwork::act up to the rounding of the activation
+// functions (fixedExp and fixedTanh here, the SIMD kernels there).
+template <typename T, typename... Layers> class FixedNetwork {
+public:
+  static_assert(sizeof...(Layers) > 0, "A network needs a layer.");
+  static_assert(fixedLayersChain<Layers...>(),
+                "The outputs of a layer must be the inputs of the next.");
+
+  static constexpr std::size_t kNumLayers = sizeof...(Layers);
+  static constexpr std::size_t kInputs =
+      std::tuple_element_t<0, std::tuple<Layers...>>::kInputs;
+  static constexpr std::size_t kOutputs =
+      std::tuple_element_t<kNumLayers - 1, std::tuple<Layers...>>::kOutputs;
+
+  using Input = std::array<T, kInputs>;
+  using Output = std::array<T, kOutputs>;
+
+  // Zero weights and biases.
+  FixedNetwork() = default;
+
+  // Copies the weights and biases of nn (the float weights, or the half
+  // width ones widened). Throws std::invalid_argument if its layer sizes or
+  // activations differ and std::runtime_error if it has no float or half
+  // width weights (loaded quantized).
+  explicit FixedNetwork(const NeuralNetwork<T> &nn) {
+    const std::vector<size_t> &sizes = nn.getLayerSizes();
+    const std::vector<Activation> &activations = nn.getActivations();
+    bool matches = sizes.size() == kNumLayers + 1 && sizes[0] == kInputs;
+    forEachLayer([&](auto &layer, std::size_t i) {
+      using L = typename std::decay_t<decltype(layer)>::Shape;
+      matches = matches && sizes[i + 1] == L::kOutputs &&
+                activations[i] == L::kActivation;
+    });
+    if (!matches) {
+      throw std::invalid_argument(
+          "Layer sizes or activations of the network do not match.");
+    }
+    nn.visitWeights([&](const auto &weights) {
+      if (weights.size() != kNumLayers) {
+        throw std::runtime_error(
+            "Network has no float weights to copy (loaded quantized).");
+      }
+      forEachLayer([&](auto &layer, std::size_t i) {
+        using L = typename std::decay_t<decltype(layer)>::Shape;
+        const Matrix<T> &b = nn.getBiases()[i];
+        for (std::size_t in = 0; in < L::kInputs; ++in) {
+          for (std::size_t out = 0; out < L::kOutputs; ++out) {
+            layer.W[in * layer.kPadded + out] =
+                static_cast<T>(weights[i][in][out]);
+          }
+        }
+        std::copy_n(b[0], L::kOutputs, layer.b.begin());
+      });
+    });
+  }
+
+  // Loads a model file written by NeuralNetwork::save (see
+  // NeuralNetwork::load for the exceptions).
+  static FixedNetwork load(const std::string &fileName) {
+    NeuralNetwork<T> nn;
+    nn.load(fileName);
+    return FixedNetwork(nn);
+  }
+
+  // Generates the output of one sample.
+  Output act(const Input &input) const {
+    Output output;
+    act(input.data(), output.data());
+    return output;
+  }
+
+  // Same as above, with input kInputs and output kOutputs elements.
+  void act(const T *input, T *output) const {
+    actFrom<0>(input, output);
+  }
+
+  // Generates the output of every row of X (X.getCols() == kInputs, not
+  // checked), one sample at a time.
+  Matrix<T> act(const Matrix<T> &X) const {
+    Matrix<T> out(X.getRows(), kOutputs, InitState::EMPTY);
+    for (std::size_t row = 0; row < X.getRows(); ++row) {
+      act(X[row], out[row]);
+    }
+    return out;
+  }
+
+private:
+  // Parameters of a layer, W is In x Out (row-major). The outputs are
+  // padded with zero weights to a multiple of fixedLanes<T>(), so a layer
+  // computes whole vectors (partial writes to a vector before it is read
+  // stall the store forwarding).
+  template <typename L> struct Parameters {
+    using Shape = L;
+    static constexpr std::size_t kPadded =
+        (L::kOutputs + fixedLanes<T>() - 1) / fixedLanes<T>() *
+        fixedLanes<T>();
+    std::array<T, L::kInputs * kPadded> W = {};
+    std::array<T, kPadded> b = {};
+  };
+
+  std::tuple<Parameters<Layers>...> layers_;
+
+  // Calls f(layer parameters, index) for every layer in order.
+  template <typename F> void forEachLayer(F &&f) {
+    forEachLayer(f, std::index_sequence_for<Layers...>());
+  }
+  template <typename F, std::size_t... I>
+  void forEachLayer(F &f, std::index_sequence<I...>) {
+    (f(std::get<I>(layers_), I), ...);
+  }
+
+  // Layer I and the layers after it, the activations between them in
+  // arrays on the stack.
+  template <std::size_t I> void actFrom(const T *input, T *output) const {
+    const auto &layer = std::get<I>(layers_);
+    using L = typename std::decay_t<decltype(layer)>::Shape;
+    if constexpr (I + 1 == kNumLayers) {
+      dense<L>(layer, input, output);
+    } else {
+      std::array<T, L::kOutputs> hidden;
+      dense<L>(layer, input, hidden.data());
+      actFrom<I + 1>(hidden.data(), output);
+    }
+  }
+
+  // out = activation(input * W + b), on the padded outputs.
+  template <typename L>
+  static void dense(const Parameters<L> &layer, const T *input, T *out) {
+    constexpr std::size_t kIn = L::kInputs;
+    constexpr std::size_t kOut = L::kOutputs;
+    constexpr std::size_t kPadded = Parameters<L>::kPadded;
+    std::array<T, kPadded> z = layer.b;
+    for (std::size_t in = 0; in < kIn; ++in) {
+      const T x = input[in];
+      for (std::size_t o = 0; o < kPadded; ++o) {
+        z[o] += x * layer.W[in * kPadded + o];
+      }
+    }
+    constexpr Activation kActivation = L::kActivation;
+    if constexpr (kActivation == Activation::softmax) {
+      // Largest element first, so no exp overflows (as softmax).
+      const T largest = *std::max_element(z.begin(), z.begin() + kOut);
+      for (T &value : z) {
+        value -= largest;
+      }
+      fixedExp(z);
+      T sum = T(0);
+      for (std::size_t o = 0; o < kOut; ++o) {
+        sum += z[o];
+      }
+      for (std::size_t o = 0; o < kOut; ++o) {
+        out[o] = z[o] / sum;
+      }
+    } else if constexpr (kActivation == Activation::sigmoid) {
+      // sigmoid(z) = 1 / (1 + exp(-z)).
+      for (T &value : z) {
+        value = -value;
+      }
+      fixedExp(z);
+      for (std::size_t o = 0; o < kOut; ++o) {
+        out[o] = T(1) / (T(1) + z[o]);
+      }
+    } else if constexpr (kActivation == Activation::tanh) {
+      fixedTanh(z);
+      std::copy_n(z.begin(), kOut, out);
+    } else {
+      for (std::size_t o = 0; o < kOut; ++o) {
+        out[o] = activate<kActivation>(z[o]);
+      }
+    }
+  }
+
+  // The other elementwise activations, as the scalar kernels (see
+  // Simd.cpp).
+  template <Activation A> static T activate(T x) {
+    if constexpr (A == Activation::relu) {
+      return x < T(0) ? T(0) : x;
+    } else if constexpr (A == Activation::step) {
+      return x >= T(0) ? T(1) : T(0);
+    } else {
+      return x;
+    }
+  }
+};
@@ -0,0 +1,391 @@
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+#include "./AlignedAllocator.h"
+#include "./Gemm.h"
+#include "./Half.h"
+#include "./Simd.h"
+#include "./ThreadPool.h"
+
+namespace {
+
+// Products with m * n * k below this are computed without packing.
+constexpr std::size_t kSmallGemm = 32 * 32 * 32;
+
+// Columns per parallel block of gemmInt8 (a multiple of the 4 columns of the
+// int8 kernels).
+constexpr std::size_t kInt8BlockN = 64;
+
+// ____________________________________________________________________________
+// Per-thread packing buffers for a kGemmMC x kGemmKC block of A and a
+// kGemmKC x kGemmNC panel of B. Each is allocated at full size the first time
+// a thread uses it, so no later GEMM allocates, whichever tiles the thread
+// gets. (kGemmMC and kGemmNC are multiples of every MR and NR.)
+template <typename T> T *packBufferA() {
+  thread_local std::vector<T, AlignedAllocator<T>> buffer(kGemmMC * kGemmKC);
+  return buffer.data();
+}
+
+template <typename T> T *packBufferB() {
+  thread_local std::vector<T, AlignedAllocator<T>> buffer(kGemmKC * kGemmNC);
+  return buffer.data();
+}
+
+// The pool workers allocate their A buffers when they start, the caller of
+// a GEMM (which packs B) on its first GEMM.
+void allocatePackBuffers() {
+  packBufferA<int>();
+  packBufferA<float>();
+  packBufferA<double>();
+}
+[[maybe_unused]] const bool packBuffersOnWorkers =
+    (addWorkerInit(&allocatePackBuffers), true);
+
+// ____________________________________________________________________________
+// Copies n values to T, converting half width values (see Half.h).
+template <typename S, typename T>
+void copyConverted(const S *source, std::size_t n, T *destination) {
+  if constexpr (std::is_same_v<S, T>) {
+    std::copy(source, source + n, destination);
+  } else {
+    convert(source, destination, n);
+  }
+}
+
+// ____________________________________________________________________________
+// Packs the mc x kc block of op(A) starting at A into MR-row slivers:
+// sliver s holds rows [s * MR, s * MR + MR), stored column by column
+// (packed[p * MR + i] = op(A)[i][p]). Rows beyond mc are zero. Half width
+// values are converted to T here.
+template <typename T, typename S>
+void packA(std::size_t mc, std::size_t kc, const S *A, std::size_t lda,
+           Transpose transA, std::size_t MR, T *packed) {
+  for (std::size_t i0 = 0; i0 < mc; i0 += MR) {
+    const std::size_t mr = std::min(MR, mc - i0);
+    for (std::size_t p = 0; p < kc; ++p) {
+      if (transA == Transpose::YES) {
+        copyConverted(A + p * lda + i0, mr, packed + p * MR);
+      } else {
+        for (std::size_t i = 0; i < mr; ++i) {
+          packed[p * MR + i] = static_cast<T>(A[(i0 + i) * lda + p]);
+        }
+      }
+      std::fill(packed + p * MR + mr, packed + (p + 1) * MR, T());
+    }
+    packed += kc * MR;
+  }
+}
+
+// ____________________________________________________________________________
+// Packs the kc x nc panel of op(B) starting at B into NR-col slivers:
+// sliver s holds cols [s * NR, s * NR + NR), stored row by row
+// (packed[p * NR + j] = op(B)[p][j]). Cols beyond nc are zero. Half width
+// values are converted to T here, a whole row of B as stored (nc or kc
+// contiguous values) at a time.
+template <typename T, typename S>
+void packB(std::size_t kc, std::size_t nc, const S *B, std::size_t ldb,
+           Transpose transB, std::size_t NR, T *packed) {
+  const std::size_t slivers = (nc + NR - 1) / NR;
+  if constexpr (!std::is_same_v<S, T>) {
+    T row[std::max(kGemmKC, kGemmNC)];
+    if (transB == Transpose::NO) {
+      for (std::size_t p = 0; p < kc; ++p) {
+        copyConverted(B + p * ldb, nc, row);
+        for (std::size_t s = 0; s < slivers; ++s) {
+          const std::size_t nr = std::min(NR, nc - s * NR);
+          T *out = packed + s * kc * NR + p * NR;
+          std::copy(row + s * NR, row + s * NR + nr, out);
+          std::fill(out + nr, out + NR, T());
+        }
+      }
+      return;
+    }
+    for (std::size_t j = 0; j < nc; ++j) {
+      copyConverted(B + j * ldb, kc, row);
+      T *out = packed + j / NR * kc * NR + j % NR;
+      for (std::size_t p = 0; p < kc; ++p) {
+        out[p * NR] = row[p];
+      }
+    }
+    for (std::size_t s = 0; s < slivers; ++s) {
+      const std::size_t nr = std::min(NR, nc - s * NR);
+      for (std::size_t p = 0; p < kc; ++p) {
+        T *out = packed + s * kc * NR + p * NR;
+        std::fill(out + nr, out + NR, T());
+      }
+    }
+    return;
+  }
+  for (std::size_t j0 = 0; j0 < nc; j0 += NR) {
+    const std::size_t nr = std::min(NR, nc - j0);
+    for (std::size_t p = 0; p < kc; ++p) {
+      if (transB == Transpose::YES) {
+        for (std::size_t j = 0; j < nr; ++j) {
+          packed[p * NR + j] = B[(j0 + j) * ldb + p];
+        }
+      } else {
+        const S *b = B + p * ldb + j0;
+        std::copy(b, b + nr, packed + p * NR);
+      }
+      std::fill(packed + p * NR + nr, packed + (p + 1) * NR, T());
+    }
+    packed += kc * NR;
+  }
+}
+
+// ____________________________________________________________________________
+// Applies the epilogue to the rows x cols block of C at (row0, col0).
+template <typename T>
+void applyEpilogue(const GemmEpilogue<T> &epilogue, std::size_t row0,
+                   std::size_t col0, std::size_t rows, std::size_t cols, T *C,
+                   std::size_t ldc) {
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  for (std::size_t i = 0; i < rows; ++i) {
+    T *c = C + (row0 + i) * ldc + col0;
+    if (epilogue.bias != nullptr) {
+      kernels.add(c, epilogue.bias + col0, c, cols);
+    }
+    if (epilogue.Z != nullptr) {
+      std::copy(c, c + cols, epilogue.Z + (row0 + i) * epilogue.ldz + col0);
+    }
+    if (epilogue.activation != nullptr) {
+      epilogue.activation(c, c, cols);
+    }
+  }
+}
+
+// ____________________________________________________________________________
+// Unpacked loops for tiny products. The loop order keeps the innermost
+// accesses unit stride: i-k-j unless B is transposed, then i-j-k (a dot
+// product of a row of op(A) with a row of B as stored).
+template <typename T, typename TA, typename TB>
+void smallGemm(Transpose transA, Transpose transB, std::size_t m,
+               std::size_t n, std::size_t k, const TA *A, std::size_t lda,
+               const TB *B, std::size_t ldb, T *C, std::size_t ldc,
+               bool accumulate, const GemmEpilogue<T> *epilogue) {
+  // Strides of op(A) along its rows and cols.
+  const std::size_t aRow = transA == Transpose::YES ? 1 : lda;
+  const std::size_t aCol = transA == Transpose::YES ? lda : 1;
+  for (std::size_t i = 0; i < m; ++i) {
+    T *c = C + i * ldc;
+    if (!accumulate) {
+      std::fill(c, c + n, T());
+    }
+    if (transB == Transpose::YES) {
+      for (std::size_t j = 0; j < n; ++j) {
+        const TB *b = B + j * ldb;
+        T sum = T();
+        for (std::size_t p = 0; p < k; ++p) {
+          sum += static_cast<T>(A[i * aRow + p * aCol]) * static_cast<T>(b[p]);
+        }
+        c[j] += sum;
+      }
+    } else {
+      for (std::size_t p = 0; p < k; ++p) {
+        const T a = static_cast<T>(A[i * aRow + p * aCol]);
+        const TB *b = B + p * ldb;
+        for (std::size_t j = 0; j < n; ++j) {
+          c[j] += a * static_cast<T>(b[j]);
+        }
+      }
+    }
+    if (epilogue != nullptr) {
+      applyEpilogue(*epilogue, i, 0, 1, n, C, ldc);
+    }
+  }
+}
+
+} // namespace
+
+// ____________________________________________________________________________
+template <typename T, typename TA, typename TB>
+void gemm(Transpose transA, Transpose transB, std::size_t m, std::size_t n,
+          std::size_t k, const TA *A, std::size_t lda, const TB *B,
+          std::size_t ldb, T *C, std::size_t ldc, bool accumulate,
+          const GemmEpilogue<T> *epilogue) {
+  if (m == 0 || n == 0) {
+    return;
+  }
+  if (k == 0 || m * n * k < kSmallGemm) {
+    smallGemm(transA, transB, m, n, k, A, lda, B, ldb, C, ldc, accumulate,
+              epilogue);
+    return;
+  }
+
+  // Micro-kernel and register tile of the current instruction set.
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  const std::size_t MR = kernels.gemmMR;
+  const std::size_t NR = kernels.gemmNR;
+  const auto microKernel = kernels.gemmMicroKernel;
+
+  // Work split for the threads (see ThreadPool.h): C is cut into
+  // rowBlocks x colChunks tiles per packed B panel, each tile is one task
+  // that packs its own A block. With few row blocks (small batches) the
+  // blocks get lower and the panel is cut into column chunks as well, so
+  // every thread gets work.
+  const std::size_t threads = getNumThreads();
+  std::size_t mcTile = std::min(kGemmMC, (m + MR - 1) / MR * MR);
+  if (threads > 1 && (m + mcTile - 1) / mcTile < threads) {
+    mcTile = std::max(MR, ((m + threads - 1) / threads + MR - 1) / MR * MR);
+  }
+  const std::size_t rowBlocks = (m + mcTile - 1) / mcTile;
+
+  T *packedB = packBufferB<T>();
+  // (The caller works on tiles as well, whether or not it gets any now.)
+  packBufferA<T>();
+
+  // Loop 5: NC wide column panels of B and C.
+  for (std::size_t jc = 0; jc < n; jc += kGemmNC) {
+    const std::size_t nc = std::min(kGemmNC, n - jc);
+    const std::size_t slivers = (nc + NR - 1) / NR;
+    std::size_t colChunks = 1;
+    if (rowBlocks < threads) {
+      colChunks = std::min(slivers, (threads + rowBlocks - 1) / rowBlocks);
+    }
+    const std::size_t ncTile = (slivers + colChunks - 1) / colChunks * NR;
+    colChunks = (nc + ncTile - 1) / ncTile;
+
+    // Loop 4: KC deep slices of the shared dimension. Only the first slice
+    // may overwrite C.
+    for (std::size_t pc = 0; pc < k; pc += kGemmKC) {
+      const std::size_t kc = std::min(kGemmKC, k - pc);
+      const bool acc = accumulate || pc > 0;
+      const bool last = pc + kc == k;
+
+      // Pack the B panel, in parallel over its NR wide slivers.
+      parallelFor(slivers, 4, [&](std::size_t s0, std::size_t s1) {
+        const std::size_t j0 = jc + s0 * NR;
+        const TB *panelB = transB == Transpose::YES ? B + j0 * ldb + pc
+                                                    : B + pc * ldb + j0;
+        packB(kc, std::min(nc, s1 * NR) - s0 * NR, panelB, ldb, transB, NR,
+              packedB + s0 * NR * kc);
+      });
+
+      // Loop 3 (and a split of loop 2): tiles of C, in parallel.
+      parallelFor(rowBlocks * colChunks, 1, [&](std::size_t t0,
+                                                std::size_t t1) {
+        T *packedA = packBufferA<T>();
+        for (std::size_t t = t0; t < t1; ++t) {
+          const std::size_t ic = t / colChunks * mcTile;
+          const std::size_t mc = std::min(mcTile, m - ic);
+          const std::size_t jr0 = t % colChunks * ncTile;
+          const std::size_t jr1 = std::min(nc, jr0 + ncTile);
+          const TA *blockA = transA == Transpose::YES ? A + pc * lda + ic
+                                                      : A + ic * lda + pc;
+          packA(mc, kc, blockA, lda, transA, MR, packedA);
+          // Loops 2 and 1: NR x MR register tiles.
+          for (std::size_t jr = jr0; jr < jr1; jr += NR) {
+            const std::size_t nr = std::min(NR, nc - jr);
+            const T *b = packedB + jr * kc;
+            for (std::size_t ir = 0; ir < mc; ir += MR) {
+              const std::size_t mr = std::min(MR, mc - ir);
+              microKernel(kc, packedA + ir * kc, b,
+                          C + (ic + ir) * ldc + jc + jr, ldc, mr, nr, acc);
+              if (last && epilogue != nullptr) {
+                applyEpilogue(*epilogue, ic + ir, jc + jr, mr, nr, C, ldc);
+              }
+            }
+          }
+        }
+      });
+    }
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void gemmInt8(std::size_t m, std::size_t n, std::size_t k,
+              const std::int8_t *A, std::size_t lda, const std::int8_t *B,
+              std::size_t ldb, T *C, std::size_t ldc,
+              const QuantizedEpilogue<T> &epilogue) {
+  const Int8Kernels &kernels = int8Kernels();
+  const std::size_t numBlocks = (n + kInt8BlockN - 1) / kInt8BlockN;
+  // Tasks of at least about 64K multiply-adds.
+  const std::size_t grain =
+      std::max<std::size_t>(1, 65536 / (m * kInt8BlockN * k + 1));
+  parallelFor(numBlocks, grain, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t block = begin; block < end; ++block) {
+      const std::size_t j0 = block * kInt8BlockN;
+      const std::size_t j1 = std::min(n, j0 + kInt8BlockN);
+      for (std::size_t i = 0; i < m; ++i) {
+        T *row = C + i * ldc;
+        for (std::size_t j = j0; j < j1; j += 4) {
+          const std::size_t nb = std::min<std::size_t>(4, j1 - j);
+          std::int32_t acc[4];
+          kernels.dot(k, A + i * lda, B + j * ldb, ldb, nb, acc);
+          for (std::size_t jj = 0; jj < nb; ++jj) {
+            row[j + jj] = static_cast<T>(acc[jj]) * epilogue.scales[j + jj];
+            if (epilogue.bias != nullptr) {
+              row[j + jj] += epilogue.bias[j + jj];
+            }
+          }
+        }
+        // The row of the block is still in L1.
+        if (epilogue.activation != nullptr) {
+          epilogue.activation(row + j0, row + j0, j1 - j0);
+        }
+        if (epilogue.Q != nullptr) {
+          quantizeInt8(row + j0, j1 - j0, epilogue.outputScale,
+                       epilogue.Q + i * epilogue.ldq + j0);
+        }
+      }
+    }
+  });
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void quantizeInt8(const T *C, std::size_t n, T scale, std::int8_t *Q) {
+  const T inverse = 1 / scale;
+  for (std::size_t i = 0; i < n; ++i) {
+    const T q = std::nearbyint(C[i] * inverse);
+    Q[i] = static_cast<std::int8_t>(std::clamp<T>(q, -127, 127));
+  }
+}
+
+// ____________________________________________________________________________
+// Explicit instantiations for int, float and double, float with half width
+// operands, and float for the quantized GEMM.
+template void gemm<int>(Transpose transA, Transpose transB, std::size_t m,
+                        std::size_t n, std::size_t k, const int *A,
+                        std::size_t lda, const int *B, std::size_t ldb,
+                        int *C, std::size_t ldc, bool accumulate,
+                        const GemmEpilogue<int> *epilogue);
+template void gemm<float>(Transpose transA, Transpose transB, std::size_t m,
+                          std::size_t n, std::size_t k, const float *A,
+                          std::size_t lda, const float *B, std::size_t ldb,
+                          float *C, std::size_t ldc, bool accumulate,
+                          const GemmEpilogue<float> *epilogue);
+template void gemm<double>(Transpose transA, Transpose transB, std::size_t m,
+                           std::size_t n, std::size_t k, const double *A,
+                           std::size_t lda, const double *B,
+                           std::size_t ldb, double *C, std::size_t ldc,
+                           bool accumulate,
+                           const GemmEpilogue<double> *epilogue);
+
+// Half width operands, accumulated in float.
+#define NN_INSTANTIATE_MIXED(TA, TB)                                          \
+  template void gemm<float, TA, TB>(                                          \
+      Transpose transA, Transpose transB, std::size_t m, std::size_t n,       \
+      std::size_t k, const TA *A, std::size_t lda, const TB *B,               \
+      std::size_t ldb, float *C, std::size_t ldc, bool accumulate,            \
+      const GemmEpilogue<float> *epilogue);
+
+NN_INSTANTIATE_MIXED(float, bfloat16)
+NN_INSTANTIATE_MIXED(bfloat16, float)
+NN_INSTANTIATE_MIXED(bfloat16, bfloat16)
+NN_INSTANTIATE_MIXED(float, float16)
+NN_INSTANTIATE_MIXED(float16, float)
+NN_INSTANTIATE_MIXED(float16, float16)
+
+#undef NN_INSTANTIATE_MIXED
+
+template void gemmInt8<float>(std::size_t m, std::size_t n, std::size_t k,
+                              const std::int8_t *A, std::size_t lda,
+                              const std::int8_t *B, std::size_t ldb, float *C,
+                              std::size_t ldc,
+                              const QuantizedEpilogue<float> &epilogue);
+template void quantizeInt8<float>(const float *C, std::size_t n, float scale,
+                                  std::int8_t *Q);
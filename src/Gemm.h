@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Cache blocking parameters (in elements).
+// KC: depth of a packed panel, MC: rows of a packed A block (a multiple of
+// every micro-kernel height), NC: cols of a packed B panel (a multiple of
+// every micro-kernel width).
+constexpr std::size_t kGemmKC = 256;
+constexpr std::size_t kGemmMC = 96;
+constexpr std::size_t kGemmNC = 2048;
+
+// Whether gemm() uses an operand as stored or transposed.
+enum class Transpose { NO, YES };
+
+// ____________________________________________________________________________
+// Work fused into the end of a GEMM. It runs on each finished MR x NR tile of
+// C right after the micro-kernel wrote it, while the tile is still in L1:
+//   C += bias (broadcast over rows), Z = C, C = activation(C).
+// Every member is optional (nullptr = skip).
+template <typename T> struct GemmEpilogue {
+  // Row vector of n elements added to every row of C.
+  const T *bias = nullptr;
+  // Receives C after the bias (pre-activation values), row stride ldz.
+  T *Z = nullptr;
+  std::size_t ldz = 0;
+  // Elementwise kernel applied in place (see Simd.h).
+  void (*activation)(const T *, T *, std::size_t) = nullptr;
+};
+
+// ____________________________________________________________________________
+// General matrix multiplication on raw row-major buffers.
+//
+// C = op(A) * op(B)        (accumulate == false)
+// C = C + op(A) * op(B)    (accumulate == true)
+// followed by the epilogue, if given. op(X) is X or X^T (see transA and
+// transB).
+//
+// op(A) is m x k, op(B) is k x n and C is m x n. lda, ldb and ldc are the
+// row strides of the matrices as stored: A is m x k, or k x m if transposed,
+// B is k x n, or n x k if transposed.
+//
+// The product is computed blocked (Goto/BLIS style): B is packed in
+// kGemmKC x kGemmNC panels that stay in L3/L2, A in kGemmMC x kGemmKC blocks
+// that stay in L2, and a register-tiled micro-kernel computes MR x NR tiles
+// of C from the packed data with unit-stride loads only. Transposed operands
+// are transposed while packing, so no transposed copy is ever made. The
+// micro-kernel and its tile size come from simdKernels<T>() (Simd.h). The
+// packing and the tiles of C run in parallel on the library thread pool
+// (ThreadPool.h). Tiny products skip packing and use a plain loop.
+//
+// For T = float, A and B may also be stored as bfloat16 or float16 (TA, TB,
+// see Half.h). They are converted to float while packing, so the
+// micro-kernel, the accumulation and C are float, and only half the bytes
+// of a half width operand are read from memory.
+template <typename T, typename TA = T, typename TB = T>
+void gemm(Transpose transA, Transpose transB, std::size_t m, std::size_t n,
+          std::size_t k, const TA *A, std::size_t lda, const TB *B,
+          std::size_t ldb, T *C, std::size_t ldc, bool accumulate = false,
+          const GemmEpilogue<T> *epilogue = nullptr);
+
+// Same as above without transposed operands.
+template <typename T, typename TA = T, typename TB = T>
+inline void gemm(std::size_t m, std::size_t n, std::size_t k, const TA *A,
+                 std::size_t lda, const TB *B, std::size_t ldb, T *C,
+                 std::size_t ldc, bool accumulate = false,
+                 const GemmEpilogue<T> *epilogue = nullptr) {
+  gemm(Transpose::NO, Transpose::NO, m, n, k, A, lda, B, ldb, C, ldc,
+       accumulate, epilogue);
+}
+
+// ____________________________________________________________________________
+// Quantized GEMM (int8 inference, see Quantization.h).
+
+// Work fused into the end of gemmInt8, per output element:
+//   C = activation(acc * scales[j] + bias[j])
+//   Q = quantizeInt8(C, outputScale)            (if Q is given)
+// where acc is the exact int32 dot product and scales[j] the product of the
+// scales of the two int8 operands.
+template <typename T> struct QuantizedEpilogue {
+  // Dequantization scale of every output column (required).
+  const T *scales = nullptr;
+  // Row vector of n elements added to every row of C.
+  const T *bias = nullptr;
+  // Elementwise kernel applied in place (see Simd.h).
+  void (*activation)(const T *, T *, std::size_t) = nullptr;
+  // Receives C requantized with outputScale, row stride ldq (the int8 input
+  // of the next layer).
+  std::int8_t *Q = nullptr;
+  std::size_t ldq = 0;
+  T outputScale = 1;
+};
+
+// C = A * B^T with the epilogue, for int8 A (m x k, row stride lda) and B
+// (n x k, row stride ldb: the weights of every output column are
+// contiguous). Products are accumulated exactly in int32 by the int8
+// kernels of Simd.h. Columns are split in blocks that run in parallel on
+// the library thread pool; every block reads its rows of B once for all
+// rows of A.
+template <typename T>
+void gemmInt8(std::size_t m, std::size_t n, std::size_t k,
+              const std::int8_t *A, std::size_t lda, const std::int8_t *B,
+              std::size_t ldb, T *C, std::size_t ldc,
+              const QuantizedEpilogue<T> &epilogue);
+
+// Q[i] = round(C[i] / scale), clamped to [-127, 127] (symmetric, so -128 is
+// never used).
+template <typename T>
+void quantizeInt8(const T *C, std::size_t n, T scale, std::int8_t *Q);
@@ -0,0 +1,61 @@
+#include <algorithm>
+#include <type_traits>
+
+#include "./Half.h"
+#include "./Simd.h"
+
+namespace {
+
+// ____________________________________________________________________________
+template <typename H> const std::uint16_t *bitsOf(const H *h) {
+  static_assert(sizeof(H) == sizeof(std::uint16_t));
+  return reinterpret_cast<const std::uint16_t *>(h);
+}
+
+// ____________________________________________________________________________
+template <typename H> std::uint16_t *bitsOf(H *h) {
+  return reinterpret_cast<std::uint16_t *>(h);
+}
+
+} // namespace
+
+// ____________________________________________________________________________
+const char *precisionName(Precision precision) {
+  switch (precision) {
+  case Precision::BFLOAT16:
+    return "bfloat16";
+  case Precision::FLOAT16:
+    return "float16";
+  default:
+    return "float32";
+  }
+}
+
+// ____________________________________________________________________________
+template <typename S, typename D>
+void convert(const S *source, D *destination, std::size_t n) {
+  if constexpr (std::is_same_v<S, D>) {
+    std::copy(source, source + n, destination);
+  } else if constexpr (std::is_same_v<S, bfloat16>) {
+    halfKernels().bf16ToFloat(bitsOf(source), destination, n);
+  } else if constexpr (std::is_same_v<S, float16>) {
+    halfKernels().fp16ToFloat(bitsOf(source), destination, n);
+  } else if constexpr (std::is_same_v<D, bfloat16>) {
+    halfKernels().floatToBf16(source, bitsOf(destination), n);
+  } else {
+    halfKernels().floatToFp16(source, bitsOf(destination), n);
+  }
+}
+
+// ____________________________________________________________________________
+// Explicit instantiations between float and the half types.
+template void convert<float, float>(const float *source, float *destination,
+                                    std::size_t n);
+template void convert<bfloat16, float>(const bfloat16 *source,
+                                       float *destination, std::size_t n);
+template void convert<float16, float>(const float16 *source,
+                                      float *destination, std::size_t n);
+template void convert<float, bfloat16>(const float *source,
+                                       bfloat16 *destination, std::size_t n);
+template void convert<float, float16>(const float *source,
+                                      float16 *destination, std::size_t n);
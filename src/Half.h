@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// ____________________________________________________________________________
+// Half width floating point storage types. They only store values: all
+// arithmetic converts to float (implicitly), and the GEMM (see Gemm.h)
+// converts half operands to float while packing them, so products are
+// accumulated in float.
+//
+//   bfloat16: the upper 16 bits of a float (8 exponent bits, 7 mantissa
+//             bits). Same range as float, about 3 significant digits.
+//   float16:  IEEE 754 half (5 exponent bits, 10 mantissa bits). About 3.3
+//             significant digits, but the largest value is 65504 and values
+//             below 2^-24 round to zero.
+//
+// Conversions from float round to nearest even, NaN stays NaN.
+
+// Storage precision of the weights of a NeuralNetwork (see setPrecision).
+enum class Precision { FLOAT32, BFLOAT16, FLOAT16 };
+
+// Returns "float32", "bfloat16" or "float16".
+const char *precisionName(Precision precision);
+
+// ____________________________________________________________________________
+// Conversions of a single value (the kernels in Simd.h convert arrays).
+
+// ____________________________________________________________________________
+inline std::uint32_t floatBits(float x) {
+  std::uint32_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  return bits;
+}
+
+// ____________________________________________________________________________
+inline float floatFromBits(std::uint32_t bits) {
+  float x;
+  std::memcpy(&x, &bits, sizeof(x));
+  return x;
+}
+
+// ____________________________________________________________________________
+inline float bf16ToFloat(std::uint16_t h) {
+  return floatFromBits(static_cast<std::uint32_t>(h) << 16);
+}
+
+// ____________________________________________________________________________
+inline std::uint16_t floatToBf16(float x) {
+  const std::uint32_t bits = floatBits(x);
+  if ((bits & 0x7fffffffu) > 0x7f800000u) {
+    // NaN: keep the sign and make sure the mantissa stays non-zero.
+    return static_cast<std::uint16_t>((bits >> 16) | 0x40);
+  }
+  const std::uint32_t roundingBias = 0x7fff + ((bits >> 16) & 1);
+  return static_cast<std::uint16_t>((bits + roundingBias) >> 16);
+}
+
+// ____________________________________________________________________________
+inline float fp16ToFloat(std::uint16_t h) {
+  const std::uint32_t sign = static_cast<std::uint32_t>(h & 0x8000) << 16;
+  const std::uint32_t exponent = (h >> 10) & 0x1f;
+  const std::uint32_t mantissa = h & 0x3ff;
+  if (exponent == 0x1f) {
+    // Infinity or NaN.
+    return floatFromBits(sign | 0x7f800000u | (mantissa << 13));
+  }
+  if (exponent == 0) {
+    // Zero or subnormal: mantissa * 2^-24.
+    const float magnitude = static_cast<float>(mantissa) * 0x1p-24f;
+    return sign != 0 ? -magnitude : magnitude;
+  }
+  return floatFromBits(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+// ____________________________________________________________________________
+inline std::uint16_t floatToFp16(float x) {
+  const std::uint32_t bits = floatBits(x);
+  const std::uint16_t sign = static_cast<std::uint16_t>((bits >> 16) & 0x8000);
+  const std::uint32_t magnitude = bits & 0x7fffffffu;
+  if (magnitude > 0x7f800000u) {
+    return sign | 0x7e00;
+  }
+  if (magnitude >= 0x477ff000u) {
+    // Rounds to a value above 65504: infinity.
+    return sign | 0x7c00;
+  }
+  if (magnitude < 0x38800000u) {
+    // Below the smallest normal half (2^-14): subnormal or zero. Adding
+    // 0.5 shifts the mantissa into the low bits, rounded to nearest even by
+    // the float addition.
+    const float shifted = floatFromBits(magnitude) + 0.5f;
+    return sign | static_cast<std::uint16_t>(floatBits(shifted) - 0x3f000000u);
+  }
+  // Normal: rebias the exponent and round the 13 dropped mantissa bits.
+  const std::uint32_t roundingBias = 0xfff + ((magnitude >> 13) & 1);
+  return sign | static_cast<std::uint16_t>(
+                    (magnitude - (112u << 23) + roundingBias) >> 13);
+}
+
+// ____________________________________________________________________________
+struct bfloat16 {
+  std::uint16_t bits = 0;
+
+  bfloat16() = default;
+  explicit bfloat16(float x) : bits(floatToBf16(x)) {}
+  operator float() const { return bf16ToFloat(bits); }
+
+  // Returns the value with the given bit pattern.
+  static bfloat16 fromBits(std::uint16_t bits) {
+    bfloat16 h;
+    h.bits = bits;
+    return h;
+  }
+};
+
+// ____________________________________________________________________________
+struct float16 {
+  std::uint16_t bits = 0;
+
+  float16() = default;
+  explicit float16(float x) : bits(floatToFp16(x)) {}
+  operator float() const { return fp16ToFloat(bits); }
+
+  // Returns the value with the given bit pattern.
+  static float16 fromBits(std::uint16_t bits) {
+    float16 h;
+    h.bits = bits;
+    return h;
+  }
+};
+
+// ____________________________________________________________________________
+// Array conversions, with the kernels of the current instruction set (see
+// Simd.h). S and D are float, bfloat16 or float16 (float to float copies).
+template <typename S, typename D>
+void convert(const S *source, D *destination, std::size_t n);
@@ -0,0 +1,100 @@
+#include <array>
+#include <stdexcept>
+#include <type_traits>
+
+#include "./Dense.h"
+#include "./InferenceSession.h"
+
+// ____________________________________________________________________________
+template <typename T>
+InferenceSession<T>::InferenceSession(const NeuralNetwork<T> &network)
+    : network_(network) {
+  if (network.getLayerSizes().size() < 2) {
+    throw std::invalid_argument("Network has no layers.");
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void InferenceSession<T>::run(const Matrix<T> &X, Matrix<T> &out) const {
+  forward(X, out);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+Matrix<T> InferenceSession<T>::run(const Matrix<T> &X) const {
+  Matrix<T> out;
+  run(X, out);
+  return out;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void InferenceSession<T>::run(const SparseMatrix<T> &X, Matrix<T> &out) const {
+  forward(X, out);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+Matrix<T> InferenceSession<T>::run(const SparseMatrix<T> &X) const {
+  Matrix<T> out;
+  run(X, out);
+  return out;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+template <typename Input>
+void InferenceSession<T>::forward(const Input &X, Matrix<T> &out) const {
+  if (X.getCols() != getInputSize()) {
+    throw std::invalid_argument(
+        "Number of columns of input and input layer do not match.");
+  }
+  if (const QuantizedModel<T> *quantized = network_.getQuantized()) {
+    if constexpr (std::is_same_v<Input, Matrix<T>>) {
+      quantized->run(X, out);
+    } else {
+      quantized->run(X.toDense(), out);
+    }
+    return;
+  }
+  const std::vector<Matrix<T>> &biases = network_.getBiases();
+  const std::vector<Activation> &activations = network_.getActivations();
+  const size_t numWeights = biases.size();
+
+  // Hidden activations of this thread, shared by all sessions of type T (a
+  // run uses them only until it returns).
+  thread_local std::array<Matrix<T>, 2> hidden;
+
+  // The weights in the precision of the network (see setPrecision).
+  // (The first layer reads X, dense or sparse.)
+  network_.visitWeights([&](const auto &weights) {
+    if (numWeights == 1) {
+      dense(X, weights[0], biases[0], activations[0], out);
+      return;
+    }
+    dense(X, weights[0], biases[0], activations[0], hidden[0]);
+    const Matrix<T> *input = &hidden[0];
+    for (size_t i = 1; i + 1 < numWeights; ++i) {
+      Matrix<T> &output = hidden[i % 2];
+      dense(*input, weights[i], biases[i], activations[i], output);
+      input = &output;
+    }
+    dense(*input, weights.back(), biases.back(), activations[numWeights - 1],
+          out);
+  });
+}
+
+// ____________________________________________________________________________
+template <typename T> std::size_t InferenceSession<T>::getInputSize() const {
+  return network_.getLayerSizes().front();
+}
+
+// ____________________________________________________________________________
+template <typename T> std::size_t InferenceSession<T>::getOutputSize() const {
+  return network_.getLayerSizes().back();
+}
+
+// ____________________________________________________________________________
+// Explicit instantiations for float.
+template class InferenceSession<float>;
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+
+#include "./Matrix.h"
+#include "./NeuralNetwork.h"
+#include "./SparseMatrix.h"
+
+// ____________________________________________________________________________
+// Read-only forward pass of a NeuralNetwork, for serving.
+//
+// A session references the weights and biases of the network (nothing is
+// copied) and keeps no training state, so one network can be served by any
+// number of threads through one session (or one session each):
+//
+//   const InferenceSession<float> session(nn);
+//   // On every worker thread:
+//   Matrix<float> out;
+//   session.run(X, out);
+//
+// run is const and thread safe. The activations of the hidden layers
+// ping-pong between two buffers of the calling thread, which grow to the
+// largest batch that thread has run and are reused after that. The output is
+// written to the caller's matrix, so repeated runs with the same batch size do
+// not allocate.
+//
+// Quantized networks run their int8 model (see Quantization.h), networks
+// with half width precision their bfloat16 or float16 weights.
+//
+// The network must outlive the session and must not be trained or loaded
+// while the session is running.
+template <typename T> class InferenceSession {
+public:
+  explicit InferenceSession(const NeuralNetwork<T> &network);
+
+  // Computes the output of the network for input X (one sample per row) into
+  // out (resized to X.getRows() x getOutputSize() if needed). Throws
+  // std::invalid_argument if X does not have getInputSize() columns.
+  void run(const Matrix<T> &X, Matrix<T> &out) const;
+
+  // Same, returning a new matrix.
+  Matrix<T> run(const Matrix<T> &X) const;
+
+  // Same for a sparse input (see SparseMatrix.h): the first layer is a
+  // sparse x dense product (a quantized model runs on X.toDense()).
+  void run(const SparseMatrix<T> &X, Matrix<T> &out) const;
+  Matrix<T> run(const SparseMatrix<T> &X) const;
+
+  // Returns the number of inputs and outputs of the network.
+  std::size_t getInputSize() const;
+  std::size_t getOutputSize() const;
+
+private:
+  const NeuralNetwork<T> &network_;
+
+  // The forward pass of run for a dense or sparse input.
+  template <typename Input> void forward(const Input &X, Matrix<T> &out) const;
+};
@@ -0,0 +1,360 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "./Dense.h"
+#include "./Gemm.h"
+#include "./Layer.h"
+#include "./ThreadPool.h"
+#include "./Utils.h"
+
+namespace {
+
+// ____________________________________________________________________________
+void checkInputSize(size_t expected, size_t inputSize, const char *layer) {
+  if (inputSize != expected) {
+    throw std::invalid_argument(std::string(layer) + " takes " +
+                                std::to_string(expected) + " inputs, not " +
+                                std::to_string(inputSize) + ".");
+  }
+}
+
+// ____________________________________________________________________________
+// Writes the sums of the columns of delta (the gradient of a row vector
+// added to every row) to out (1 x cols).
+template <typename T> void sumColumns(const Matrix<T> &delta, Matrix<T> &out) {
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  const size_t rows = delta.getRows();
+  T *sums = out.data();
+  parallelFor(delta.getCols(), 256, [&](size_t begin, size_t end) {
+    std::fill(sums + begin, sums + end, value<T>::zero());
+    for (size_t row = 0; row < rows; ++row) {
+      kernels.add(sums + begin, delta[row] + begin, sums + begin, end - begin);
+    }
+  });
+}
+
+// ____________________________________________________________________________
+// Copies A to out (same shape) without reallocating out.
+template <typename T> void copyRows(const Matrix<T> &A, Matrix<T> &out) {
+  forEachRow(A, out, [](const T *a, T *o, size_t n) { std::copy_n(a, n, o); });
+}
+
+// ____________________________________________________________________________
+// Whether backpropagating through activation needs its inputs (the weighted
+// sums): the derivatives of the elementwise activations are computed from
+// them, the softmax Jacobian from the outputs.
+bool needsInputs(Activation activation) {
+  return activation != Activation::linear && activation != Activation::softmax;
+}
+
+} // namespace
+
+// ____________________________________________________________________________
+// DenseLayer:
+template <typename T>
+DenseLayer<T>::DenseLayer(size_t inputs, size_t outputs, Activation activation,
+                          InitState state)
+    : DenseLayer(Matrix<T>(inputs, outputs, state),
+                 Matrix<T>(1, outputs, state), activation) {}
+
+// ____________________________________________________________________________
+template <typename T>
+DenseLayer<T>::DenseLayer(Matrix<T> weights, Matrix<T> biases,
+                          Activation activation)
+    : weights_(std::move(weights)), biases_(std::move(biases)),
+      activation_(activation),
+      dW_(weights_.getRows(), weights_.getCols(), InitState::ZERO),
+      dB_(1, weights_.getCols(), InitState::ZERO) {
+  if (biases_.getRows() != 1 || biases_.getCols() != weights_.getCols()) {
+    throw std::invalid_argument(
+        "Dimensions of weights and biases do not match.");
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+size_t DenseLayer<T>::getOutputSize(size_t inputSize) const {
+  checkInputSize(weights_.getRows(), inputSize, "Dense layer");
+  return weights_.getCols();
+}
+
+// ____________________________________________________________________________
+template <typename T>
+std::vector<size_t> DenseLayer<T>::getBufferWidths(size_t) const {
+  // The weighted sums Z, if the activation derivative needs them.
+  if (needsInputs(activation_)) {
+    return {weights_.getCols()};
+  }
+  return {};
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void DenseLayer<T>::forward(const Matrix<T> &X, Matrix<T> &Y,
+                            std::vector<Matrix<T>> &buffers, bool training) {
+  dense(X, weights_, biases_, activation_, Y,
+        training && needsInputs(activation_) ? &buffers[0] : nullptr);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void DenseLayer<T>::backward(const Matrix<T> &X, const Matrix<T> &Y,
+                             Matrix<T> &dY, Matrix<T> *dX,
+                             std::vector<Matrix<T>> &buffers) {
+  // delta = dY * f'(Z) (the derivative overwrites Z), dW = X^T * delta,
+  // db = sum of the rows of delta, dX = delta * W^T (the GEMMs read X and W
+  // transposed, no copies).
+  if (activation_ == Activation::softmax) {
+    softmaxBackward(Y, dY, dY);
+  } else if (needsInputs(activation_)) {
+    activationDerivative(activation_, buffers[0], buffers[0]);
+    forEachRow(dY, buffers[0], dY, simdKernels<T>().mul);
+  }
+  const size_t rows = X.getRows();
+  gemm(Transpose::YES, Transpose::NO, weights_.getRows(), weights_.getCols(),
+       rows, X.data(), X.getStride(), dY.data(), dY.getStride(), dW_.data(),
+       dW_.getStride());
+  sumColumns(dY, dB_);
+  if (dX) {
+    dX->resize(rows, weights_.getRows());
+    gemm(Transpose::NO, Transpose::YES, rows, weights_.getRows(),
+         weights_.getCols(), dY.data(), dY.getStride(), weights_.data(),
+         weights_.getStride(), dX->data(), dX->getStride());
+  }
+}
+
+// ____________________________________________________________________________
+// ActivationLayer:
+template <typename T>
+ActivationLayer<T>::ActivationLayer(Activation activation)
+    : activation_(activation) {}
+
+// ____________________________________________________________________________
+template <typename T>
+size_t ActivationLayer<T>::getOutputSize(size_t inputSize) const {
+  return inputSize;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+std::vector<size_t> ActivationLayer<T>::getBufferWidths(size_t) const {
+  // The derivative is computed from the inputs, into dX.
+  return {};
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void ActivationLayer<T>::forward(const Matrix<T> &X, Matrix<T> &Y,
+                                 std::vector<Matrix<T>> &, bool) {
+  Y.resize(X.getRows(), X.getCols());
+  if (activation_ == Activation::softmax) {
+    softmax(X, Y);
+  } else if (UnaryKernel<T> kernel = activationKernel<T>(activation_)) {
+    forEachRow(X, Y, kernel);
+  } else {
+    copyRows(X, Y);
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void ActivationLayer<T>::backward(const Matrix<T> &X, const Matrix<T> &Y,
+                                  Matrix<T> &dY, Matrix<T> *dX,
+                                  std::vector<Matrix<T>> &) {
+  if (!dX) {
+    return;
+  }
+  dX->resize(X.getRows(), X.getCols());
+  if (activation_ == Activation::softmax) {
+    softmaxBackward(Y, dY, *dX);
+  } else if (needsInputs(activation_)) {
+    activationDerivative(activation_, X, *dX);
+    forEachRow(dY, *dX, *dX, simdKernels<T>().mul);
+  } else {
+    copyRows(dY, *dX);
+  }
+}
+
+// ____________________________________________________________________________
+// DropoutLayer:
+template <typename T>
+DropoutLayer<T>::DropoutLayer(float rate, std::uint32_t seed)
+    : rate_(rate), random_(seed) {
+  if (!(rate >= 0.0f && rate < 1.0f)) {
+    throw std::invalid_argument("Dropout rate must be in [0, 1).");
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+size_t DropoutLayer<T>::getOutputSize(size_t inputSize) const {
+  return inputSize;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+std::vector<size_t> DropoutLayer<T>::getBufferWidths(size_t inputSize) const {
+  // The mask, 0 or 1 / (1 - rate).
+  return {inputSize};
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void DropoutLayer<T>::forward(const Matrix<T> &X, Matrix<T> &Y,
+                              std::vector<Matrix<T>> &buffers, bool training) {
+  Y.resize(X.getRows(), X.getCols());
+  if (!training) {
+    copyRows(X, Y);
+    return;
+  }
+  // The mask is drawn serially, so it only depends on the seed.
+  Matrix<T> &mask = buffers[0];
+  mask.resize(X.getRows(), X.getCols());
+  const T keep = static_cast<T>(1.0f / (1.0f - rate_));
+  std::bernoulli_distribution dropped(rate_);
+  for (size_t row = 0; row < mask.getRows(); ++row) {
+    T *m = mask[row];
+    for (size_t col = 0; col < mask.getCols(); ++col) {
+      m[col] = dropped(random_) ? value<T>::zero() : keep;
+    }
+  }
+  forEachRow(X, mask, Y, simdKernels<T>().mul);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void DropoutLayer<T>::backward(const Matrix<T> &, const Matrix<T> &Y,
+                               Matrix<T> &dY, Matrix<T> *dX,
+                               std::vector<Matrix<T>> &buffers) {
+  if (dX) {
+    dX->resize(Y.getRows(), Y.getCols());
+    forEachRow(dY, buffers[0], *dX, simdKernels<T>().mul);
+  }
+}
+
+// ____________________________________________________________________________
+// LayerNormLayer:
+template <typename T>
+LayerNormLayer<T>::LayerNormLayer(size_t features, float epsilon)
+    : features_(features), epsilon_(epsilon),
+      gamma_(1, features, InitState::ONES),
+      beta_(1, features, InitState::ZERO),
+      dGamma_(1, features, InitState::ZERO),
+      dBeta_(1, features, InitState::ZERO) {
+  if (!(epsilon > 0.0f)) {
+    throw std::invalid_argument("Layer norm epsilon must be positive.");
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+size_t LayerNormLayer<T>::getOutputSize(size_t inputSize) const {
+  checkInputSize(features_, inputSize, "Layer norm");
+  return features_;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+std::vector<size_t> LayerNormLayer<T>::getBufferWidths(size_t) const {
+  // The normalized inputs and the inverse standard deviation of every row.
+  return {features_, 1};
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void LayerNormLayer<T>::forward(const Matrix<T> &X, Matrix<T> &Y,
+                                std::vector<Matrix<T>> &buffers, bool) {
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  const size_t rows = X.getRows();
+  const size_t cols = features_;
+  Matrix<T> &normalized = buffers[0];
+  Matrix<T> &inverseStd = buffers[1];
+  normalized.resize(rows, cols);
+  inverseStd.resize(rows, 1);
+  Y.resize(rows, cols);
+  const T n = static_cast<T>(cols);
+  const size_t grain = std::max<size_t>(1, kParallelGrain / cols);
+  parallelFor(rows, grain, [&](size_t begin, size_t end) {
+    for (size_t row = begin; row < end; ++row) {
+      const T *x = X[row];
+      T *xhat = normalized[row];
+      const T mean = kernels.sum(x, cols) / n;
+      T variance = value<T>::zero();
+      for (size_t col = 0; col < cols; ++col) {
+        xhat[col] = x[col] - mean;
+        variance += xhat[col] * xhat[col];
+      }
+      const T invStd =
+          1 / std::sqrt(variance / n + static_cast<T>(epsilon_));
+      inverseStd[row][0] = invStd;
+      kernels.scale(xhat, invStd, xhat, cols);
+      kernels.mul(xhat, gamma_.data(), Y[row], cols);
+      kernels.add(Y[row], beta_.data(), Y[row], cols);
+    }
+  });
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void LayerNormLayer<T>::backward(const Matrix<T> &, const Matrix<T> &,
+                                 Matrix<T> &dY, Matrix<T> *dX,
+                                 std::vector<Matrix<T>> &buffers) {
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  const size_t rows = dY.getRows();
+  const size_t cols = features_;
+  Matrix<T> &normalized = buffers[0];
+  const Matrix<T> &inverseStd = buffers[1];
+
+  // dgamma = sum over the rows of dY * xhat, dbeta = sum of dY.
+  T *dGamma = dGamma_.data();
+  T *dBeta = dBeta_.data();
+  parallelFor(cols, 256, [&](size_t begin, size_t end) {
+    std::fill(dGamma + begin, dGamma + end, value<T>::zero());
+    std::fill(dBeta + begin, dBeta + end, value<T>::zero());
+    for (size_t row = 0; row < rows; ++row) {
+      const T *dy = dY[row];
+      const T *xhat = normalized[row];
+      for (size_t col = begin; col < end; ++col) {
+        dGamma[col] += dy[col] * xhat[col];
+        dBeta[col] += dy[col];
+      }
+    }
+  });
+  if (!dX) {
+    return;
+  }
+
+  // With g = dY * gamma, per row:
+  // dX = invStd * (g - mean(g) - xhat * mean(g * xhat))
+  dX->resize(rows, cols);
+  const T n = static_cast<T>(cols);
+  const size_t grain = std::max<size_t>(1, kParallelGrain / cols);
+  parallelFor(rows, grain, [&](size_t begin, size_t end) {
+    for (size_t row = begin; row < end; ++row) {
+      T *g = dY[row];
+      const T *xhat = normalized[row];
+      T *dx = (*dX)[row];
+      kernels.mul(g, gamma_.data(), g, cols);
+      const T meanG = kernels.sum(g, cols) / n;
+      T meanGX = value<T>::zero();
+      for (size_t col = 0; col < cols; ++col) {
+        meanGX += g[col] * xhat[col];
+      }
+      meanGX /= n;
+      const T invStd = inverseStd[row][0];
+      for (size_t col = 0; col < cols; ++col) {
+        dx[col] = invStd * (g[col] - meanG - xhat[col] * meanGX);
+      }
+    }
+  });
+}
+
+// ____________________________________________________________________________
+// Explicit instantiations for float.
+template class DenseLayer<float>;
+template class ActivationLayer<float>;
+template class DropoutLayer<float>;
+template class LayerNormLayer<float>;
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <variant>
+#include <vector>
+
+#include "./Activation.h"
+#include "./Matrix.h"
+
+// ____________________________________________________________________________
+// Layers of a Sequential network (see Sequential.h).
+//
+// Every layer type has the same members, which Sequential calls through
+// std::visit on the Layer variant below. The layer types are known at
+// compile time, so there are no virtual calls and the calls into the
+// kernels can be inlined; adding a layer type is adding it to the variant.
+//
+//   // Returns the number of outputs for inputSize inputs. Throws
+//   // std::invalid_argument if the layer cannot take inputSize inputs.
+//   size_t getOutputSize(size_t inputSize) const;
+//
+//   // Returns the widths of the scratch matrices the layer keeps from the
+//   // forward to the backward pass, one row per sample (e.g. a dropout
+//   // mask). The network allocates them, batch size x width, before the
+//   // first step (see Sequential::reserve).
+//   std::vector<size_t> getBufferWidths(size_t inputSize) const;
+//
+//   // Computes the outputs Y (resized to batch size x getOutputSize) of
+//   // the inputs X. In training the buffers are filled for backward.
+//   void forward(const Matrix<T> &X, Matrix<T> &Y,
+//                std::vector<Matrix<T>> &buffers, bool training);
+//
+//   // Given the inputs X and outputs Y of forward (in training) and the
+//   // gradient dY of the loss with respect to Y (overwritten), computes the
+//   // gradients of the parameters and, if dX is not nullptr, the gradient
+//   // with respect to X (resized to the shape of X). Gradients are sums
+//   // over the batch.
+//   void backward(const Matrix<T> &X, const Matrix<T> &Y, Matrix<T> &dY,
+//                 Matrix<T> *dX, std::vector<Matrix<T>> &buffers);
+//
+//   // Calls f(parameter, gradient, decay) for every parameter matrix and its
+//   // gradient (of the last backward), decay false if weight decay does not
+//   // apply to it (biases).
+//   template <typename F> void forEachParameter(F &&f);
+//
+// None of them allocates once the matrices are large enough.
+
+// ____________________________________________________________________________
+// Fully connected layer, Y = activation(dot(X, W) + b), computed by the fused
+// dense() of Dense.h. The activation is optional (linear); fusing it is
+// faster than a separate ActivationLayer.
+template <typename T> class DenseLayer {
+public:
+  // Weights and biases are initialized with state.
+  DenseLayer(size_t inputs, size_t outputs,
+             Activation activation = Activation::linear,
+             InitState state = InitState::RANDOM);
+
+  // Takes weights (inputs x outputs) and biases (1 x outputs). Throws
+  // std::invalid_argument if their shapes do not match.
+  DenseLayer(Matrix<T> weights, Matrix<T> biases,
+             Activation activation = Activation::linear);
+
+  size_t getOutputSize(size_t inputSize) const;
+  std::vector<size_t> getBufferWidths(size_t inputSize) const;
+  void forward(const Matrix<T> &X, Matrix<T> &Y,
+               std::vector<Matrix<T>> &buffers, bool training);
+  void backward(const Matrix<T> &X, const Matrix<T> &Y, Matrix<T> &dY,
+                Matrix<T> *dX, std::vector<Matrix<T>> &buffers);
+  template <typename F> void forEachParameter(F &&f) {
+    f(weights_, dW_, true);
+    f(biases_, dB_, false);
+  }
+
+  const Matrix<T> &getWeights() const { return weights_; }
+  const Matrix<T> &getBiases() const { return biases_; }
+  Activation getActivation() const { return activation_; }
+
+private:
+  Matrix<T> weights_;
+  Matrix<T> biases_;
+  Activation activation_;
+  Matrix<T> dW_;
+  Matrix<T> dB_;
+};
+
+// ____________________________________________________________________________
+// Elementwise activation (or softmax over every row), without parameters.
+template <typename T> class ActivationLayer {
+public:
+  explicit ActivationLayer(Activation activation);
+
+  size_t getOutputSize(size_t inputSize) const;
+  std::vector<size_t> getBufferWidths(size_t inputSize) const;
+  void forward(const Matrix<T> &X, Matrix<T> &Y,
+               std::vector<Matrix<T>> &buffers, bool training);
+  void backward(const Matrix<T> &X, const Matrix<T> &Y, Matrix<T> &dY,
+                Matrix<T> *dX, std::vector<Matrix<T>> &buffers);
+  template <typename F> void forEachParameter(F &&) {}
+
+  Activation getActivation() const { return activation_; }
+
+private:
+  Activation activation_;
+};
+
+// ____________________________________________________________________________
+// Inverted dropout: in training every input is zeroed with probability rate
+// and the others are scaled by 1 / (1 - rate), so in inference the layer is
+// the identity. The mask is drawn from the layer's own generator.
+template <typename T> class DropoutLayer {
+public:
+  // Throws std::invalid_argument unless 0 <= rate < 1.
+  explicit DropoutLayer(float rate, std::uint32_t seed = 0);
+
+  size_t getOutputSize(size_t inputSize) const;
+  std::vector<size_t> getBufferWidths(size_t inputSize) const;
+  void forward(const Matrix<T> &X, Matrix<T> &Y,
+               std::vector<Matrix<T>> &buffers, bool training);
+  void backward(const Matrix<T> &X, const Matrix<T> &Y, Matrix<T> &dY,
+                Matrix<T> *dX, std::vector<Matrix<T>> &buffers);
+  template <typename F> void forEachParameter(F &&) {}
+
+  float getRate() const { return rate_; }
+
+private:
+  float rate_;
+  std::mt19937 random_;
+};
+
+// ____________________________________________________________________________
+// Layer normalization: every row (sample) is normalized to mean 0 and
+// variance 1 over its features, then scaled and shifted per feature:
+//
+//   Y = gamma * (X - mean) / sqrt(variance + epsilon) + beta
+//
+// gamma starts as ones, beta as zeros.
+template <typename T> class LayerNormLayer {
+public:
+  explicit LayerNormLayer(size_t features, float epsilon = 1e-5f);
+
+  size_t getOutputSize(size_t inputSize) const;
+  std::vector<size_t> getBufferWidths(size_t inputSize) const;
+  void forward(const Matrix<T> &X, Matrix<T> &Y,
+               std::vector<Matrix<T>> &buffers, bool training);
+  void backward(const Matrix<T> &X, const Matrix<T> &Y, Matrix<T> &dY,
+                Matrix<T> *dX, std::vector<Matrix<T>> &buffers);
+  template <typename F> void forEachParameter(F &&f) {
+    f(gamma_, dGamma_, false);
+    f(beta_, dBeta_, false);
+  }
+
+  const Matrix<T> &getGamma() const { return gamma_; }
+  const Matrix<T> &getBeta() const { return beta_; }
+
+private:
+  size_t features_;
+  float epsilon_;
+  Matrix<T> gamma_;
+  Matrix<T> beta_;
+  Matrix<T> dGamma_;
+  Matrix<T> dBeta_;
+};
+
+// ____________________________________________________________________________
+// Any layer of a Sequential network.
+template <typename T>
+using Layer = std::variant<DenseLayer<T>, ActivationLayer<T>, DropoutLayer<T>,
+                           LayerNormLayer<T>>;
@@ -0,0 +1,48 @@
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./MappedFile.h"
+
+// ____________________________________________________________________________
+MappedFile::MappedFile(const std::string &fileName) {
+  int fd = ::open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot open file for reading");
+  }
+  struct stat status;
+  if (::fstat(fd, &status) != 0) {
+    ::close(fd);
+    throw std::runtime_error("Cannot read size of file: " + fileName);
+  }
+  size_ = static_cast<std::size_t>(status.st_size);
+  if (size_ > 0) {
+    void *data = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                        fd, 0);
+    if (data == MAP_FAILED) {
+      ::close(fd);
+      throw std::runtime_error("Cannot map file: " + fileName);
+    }
+    data_ = static_cast<char *>(data);
+  }
+  // The mapping stays valid after closing the descriptor.
+  ::close(fd);
+}
+
+// ____________________________________________________________________________
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    ::munmap(data_, size_);
+  }
+}
+
+// ____________________________________________________________________________
+char *MappedFile::data() { return data_; }
+
+// ____________________________________________________________________________
+const char *MappedFile::data() const { return data_; }
+
+// ____________________________________________________________________________
+std::size_t MappedFile::size() const { return size_; }
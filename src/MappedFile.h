@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// ____________________________________________________________________________
+// A file mapped into memory (POSIX mmap). Pages are read from the file on
+// first access, so mapping a large file costs almost nothing up front.
+//
+// The mapping is private: the contents can be written (e.g. training the
+// weights of a loaded model), but writes are copy-on-write and never reach
+// the file.
+class MappedFile {
+public:
+  // Maps the whole file. Throws std::runtime_error if it cannot be opened or
+  // mapped.
+  explicit MappedFile(const std::string &fileName);
+
+  // Unmaps the file.
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // Returns the first byte of the file (page aligned).
+  char *data();
+  const char *data() const;
+
+  // Returns the size of the file in bytes.
+  std::size_t size() const;
+
+private:
+  char *data_ = nullptr;
+  std::size_t size_ = 0;
+};
@@ -1,10 +1,15 @@
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdlib>
+#include <memory>
 #include <stdexcept>
 #include <utility>
 
+#include "./Gemm.h"
+#include "./Half.h"
 #include "./Matrix.h"
+#include "./Simd.h"
 #include "./Utils.h"
 
 // ____________________________________________________________________________
@@ -18,7 +23,7 @@ Matrix<T>::Matrix(std::size_t rows, std::size_t cols, InitState state)
   if (rows_ <= 0 || cols_ <= 0) {
     throw std::invalid_argument("Rows or cols must be > 0");
   }
-  matrix_ = std::vector(rows_, std::vector<T>(cols_));
+  allocate(rows_, cols_);
   // Handle InitState for matrix entrys.
   switch (state) {
   case InitState::ZERO:
@@ -41,72 +46,124 @@ Matrix<T>::Matrix(const std::vector<std::vector<T>> &other) {
   if (other.empty() || other[0].empty()) {
     throw std::invalid_argument("Input vector must not be empty");
   }
-  rows_ = other.size();
-  cols_ = other[0].size();
-  matrix_ = std::vector<std::vector<T>>(rows_, std::vector<T>(cols_));
+  allocate(other.size(), other[0].size());
 
   // Copy elements from 2D vector to matrix_.
   for (size_t row = 0; row < rows_; ++row) {
-    for (size_t col = 0; col < cols_; ++col) {
-      matrix_[row][col] = other[row][col];
-    }
+    std::copy(other[row].begin(), other[row].begin() + cols_,
+              data_ + row * stride_);
   }
 }
 
+// ____________________________________________________________________________
+template <typename T>
+Matrix<T>::Matrix(const Matrix<T> &other) : rows_(0), cols_(0), stride_(0) {
+  *this = other;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+Matrix<T>::Matrix(Matrix<T> &&other) noexcept
+    : rows_(0), cols_(0), stride_(0) {
+  *this = std::move(other);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+Matrix<T> Matrix<T>::view(T *data, std::size_t rows, std::size_t cols,
+                          std::size_t stride, std::shared_ptr<void> owner) {
+  if (stride < cols) {
+    throw std::invalid_argument("Stride must be >= cols");
+  }
+  Matrix<T> matrix;
+  matrix.rows_ = rows;
+  matrix.cols_ = cols;
+  matrix.stride_ = stride;
+  matrix.data_ = data;
+  matrix.owner_ = std::move(owner);
+  return matrix;
+}
+
 // ____________________________________________________________________________
 // Operators:
 // ____________________________________________________________________________
 
+// ____________________________________________________________________________
+template <typename T>
+Matrix<T> &Matrix<T>::operator=(const Matrix<T> &other) {
+  if (this == &other) {
+    return *this;
+  }
+  // Always copies into an own buffer (reusing it if it is large enough), also
+  // if other is a view.
+  allocate(other.rows_, other.cols_);
+  for (size_t row = 0; row < rows_; ++row) {
+    const T *a = other.data_ + row * other.stride_;
+    std::copy(a, a + cols_, data_ + row * stride_);
+  }
+  return *this;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+Matrix<T> &Matrix<T>::operator=(Matrix<T> &&other) noexcept {
+  // Swapping keeps data_ valid on both sides (moving a std::vector does not
+  // move its elements).
+  std::swap(rows_, other.rows_);
+  std::swap(cols_, other.cols_);
+  std::swap(stride_, other.stride_);
+  matrix_.swap(other.matrix_);
+  std::swap(data_, other.data_);
+  owner_.swap(other.owner_);
+  return *this;
+}
+
 // ____________________________________________________________________________
 template <typename T>
 Matrix<T> &Matrix<T>::operator=(const std::vector<std::vector<T>> other) {
   if (rows_ != other.size() || cols_ != other[0].size()) {
-    rows_ = static_cast<size_t>(other.size());
-    cols_ = static_cast<size_t>(other[0].size());
-    matrix_.clear();
-    matrix_.resize(rows_, std::vector<T>(cols_));
+    allocate(other.size(), other[0].size());
   }
 
   // Perform copy.
   for (size_t row = 0; row < rows_; ++row) {
-    for (size_t col = 0; col < cols_; ++col) {
-      matrix_[row][col] = other[row][col];
-    }
+    std::copy(other[row].begin(), other[row].begin() + cols_,
+              data_ + row * stride_);
   }
   return *this;
 }
 
 // ____________________________________________________________________________
-template <typename T>
-std::vector<T> &Matrix<T>::operator[](const std::size_t row) {
+template <typename T> T *Matrix<T>::operator[](const std::size_t row) {
   // Handle if row >= rows_.
   if (row >= rows_) {
     throw std::out_of_range("Row index (1) out of range");
   }
-  return matrix_[row];
+  return data_ + row * stride_;
 };
 
 // ____________________________________________________________________________
 template <typename T>
-const std::vector<T> &Matrix<T>::operator[](const std::size_t row) const {
-  // Handle if col >= cols_.
+const T *Matrix<T>::operator[](const std::size_t row) const {
+  // Handle if row >= rows_.
   if (row >= rows_) {
     throw std::out_of_range("Row index (2) out of range");
   }
-  return matrix_[row];
+  return data_ + row * stride_;
 };
 
 // ____________________________________________________________________________
-template <typename T> bool Matrix<T>::operator==(const Matrix<T> other) const {
+template <typename T>
+bool Matrix<T>::operator==(const Matrix<T> &other) const {
   if (rows_ != other.rows_ || cols_ != other.cols_) {
     return false;
   }
 
   for (size_t row = 0; row < rows_; ++row) {
-    for (size_t col = 0; col < cols_; ++col) {
-      if (matrix_[row][col] != other.matrix_[row][col]) {
-        return false;
-      }
+    const T *a = data_ + row * stride_;
+    const T *b = other.data_ + row * other.stride_;
+    if (!std::equal(a, a + cols_, b)) {
+      return false;
     }
   }
   return true;
@@ -118,13 +175,13 @@ template <typename T> bool Matrix<T>::operator==(const Matrix<T> other) const {
 
 // ____________________________________________________________________________
 template <typename T> Matrix<T> &Matrix<T>::add(const Matrix<T> &other) {
+  const SimdKernels<T> &kernels = simdKernels<T>();
   // Scalar addition.
   if (cols_ == other.cols_ && other.rows_ == 1) {
     // Perform matrix addition with scalar value.
     for (size_t row = 0; row < rows_; ++row) {
-      for (size_t col = 0; col < cols_; ++col) {
-        matrix_[row][col] = matrix_[row][col] + other.matrix_[0][col];
-      }
+      T *a = data_ + row * stride_;
+      kernels.add(a, other.data_, a, cols_);
     }
     return *this;
   }
@@ -135,11 +192,7 @@ template <typename T> Matrix<T> &Matrix<T>::add(const Matrix<T> &other) {
         "Matrices dimensions do not match for addition.");
   }
   // Perform matrix addition.
-  for (size_t row = 0; row < rows_; ++row) {
-    for (size_t col = 0; col < cols_; ++col) {
-      matrix_[row][col] = matrix_[row][col] + other.matrix_[row][col];
-    }
-  }
+  forEachRow(*this, other, *this, kernels.add);
   return *this;
 }
 
@@ -150,12 +203,8 @@ template <typename T> Matrix<T> Matrix<T>::sub(const Matrix<T> &other) {
     throw std::invalid_argument(
         "Matrices dimensions do not match for subtraction.");
   }
-  // Perform matrix addition.
-  for (size_t row = 0; row < rows_; ++row) {
-    for (size_t col = 0; col < cols_; ++col) {
-      matrix_[row][col] = matrix_[row][col] - other.matrix_[row][col];
-    }
-  }
+  // Perform matrix subtraction.
+  forEachRow(*this, other, *this, simdKernels<T>().sub);
   return *this;
 }
 
@@ -167,30 +216,17 @@ template <typename T> Matrix<T> Matrix<T>::dot(const Matrix<T> &other) {
         "Matrices dimensions do not match for multiplication.");
   }
 
-  // Perform matrix multiplication.
-  // Really expensive, maybie work on this later.
-  Matrix<T> C(rows_, other.cols_, InitState::ZERO);
-  for (size_t i = 0; i < rows_; ++i) {
-    for (size_t k = 0; k < other.cols_; ++k) {
-      for (size_t j = 0; j < cols_; ++j) {
-        C[i][k] += matrix_[i][j] * other.matrix_[j][k];
-      }
-    }
-  }
-  cols_ = other.cols_;
+  // Perform matrix multiplication (blocked GEMM, see Gemm.h).
+  Matrix<T> C(rows_, other.cols_, InitState::EMPTY);
+  gemm(rows_, other.cols_, cols_, data_, stride_,
+       other.data_, other.stride_, C.data_, C.stride_);
   *this = std::move(C);
   return *this;
 }
 
 // ____________________________________________________________________________
 template <typename T> Matrix<T> &Matrix<T>::transpose() {
-  Matrix<T> transposed(cols_, rows_, InitState::EMPTY);
-  for (size_t row = 0; row < rows_; ++row) {
-    for (size_t col = 0; col < cols_; ++col) {
-      transposed[col][row] = matrix_[row][col];
-    }
-  }
-  *this = std::move(transposed);
+  *this = transpose_copy();
   return *this;
 }
 
@@ -198,8 +234,9 @@ template <typename T> Matrix<T> &Matrix<T>::transpose() {
 template <typename T> Matrix<T> Matrix<T>::transpose_copy() {
   Matrix<T> transposed(cols_, rows_, InitState::EMPTY);
   for (size_t row = 0; row < rows_; ++row) {
+    const T *a = data_ + row * stride_;
     for (size_t col = 0; col < cols_; ++col) {
-      transposed[col][row] = matrix_[row][col];
+      transposed.data_[col * transposed.stride_ + row] = a[col];
     }
   }
   return transposed;
@@ -207,42 +244,46 @@ template <typename T> Matrix<T> Matrix<T>::transpose_copy() {
 
 // ____________________________________________________________________________
 template <typename T> Matrix<T> Matrix<T>::scalMul(T scalar) {
-  for (size_t row = 0; row < rows_; ++row) {
-    for (size_t col = 0; col < cols_; ++col) {
-      matrix_[row][col] *= scalar;
-    }
-  }
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  forEachRow(*this, *this, [&](const T *a, T *out, size_t n) {
+    kernels.scale(a, scalar, out, n);
+  });
   return *this;
 }
 
 // ____________________________________________________________________________
 template <typename T> void Matrix<T>::maximum(T inf) {
-  for (size_t row = 0; row < rows_; ++row) {
-    for (size_t col = 0; col < cols_; ++col) {
-      if (matrix_[row][col] < inf) {
-        matrix_[row][col] = inf;
-      }
-    }
-  }
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  forEachRow(*this, *this, [&](const T *a, T *out, size_t n) {
+    kernels.maximum(a, inf, out, n);
+  });
 }
 
 // ____________________________________________________________________________
 template <typename T> Matrix<T> Matrix<T>::sum(bool axis) const {
+  const SimdKernels<T> &kernels = simdKernels<T>();
   if (!axis) {
-    Matrix<T> sum(rows_, 1, InitState::ZERO);
-    for (size_t row = 0; row < rows_; ++row) {
-      for (size_t col = 0; col < cols_; ++col) {
-        sum.matrix_[row][0] += matrix_[row][col];
+    // Row sums, in parallel over the rows.
+    Matrix<T> sum(rows_, 1, InitState::EMPTY);
+    const size_t grain = std::max<size_t>(1, kParallelGrain / cols_);
+    parallelFor(rows_, grain, [&](size_t begin, size_t end) {
+      for (size_t row = begin; row < end; ++row) {
+        sum.data_[row * sum.stride_] =
+            kernels.sum(data_ + row * stride_, cols_);
       }
-    }
+    });
     return sum;
   }
+  // Column sums, in parallel over blocks of columns.
   Matrix<T> sum(1, cols_, InitState::ZERO);
-  for (size_t row = 0; row < rows_; ++row) {
-    for (size_t col = 0; col < cols_; ++col) {
-      sum.matrix_[0][col] += matrix_[row][col];
+  T *s = sum.data_;
+  const size_t grain = std::max<size_t>(64, kParallelGrain / rows_);
+  parallelFor(cols_, grain, [&](size_t begin, size_t end) {
+    for (size_t row = 0; row < rows_; ++row) {
+      kernels.add(s + begin, data_ + row * stride_ + begin,
+                  s + begin, end - begin);
     }
-  }
+  });
   return sum;
 }
 
@@ -257,24 +298,69 @@ template <typename T> std::size_t Matrix<T>::getRows() const { return rows_; }
 template <typename T> std::size_t Matrix<T>::getCols() const { return cols_; }
 
 // ____________________________________________________________________________
-template <typename T> std::vector<std::vector<T>> Matrix<T>::getData() const {
-  return matrix_;
+template <typename T> std::size_t Matrix<T>::getStride() const {
+  return stride_;
 }
 
 // ____________________________________________________________________________
-template <typename T> void Matrix<T>::fillZeros() {
+template <typename T>
+void Matrix<T>::resize(std::size_t rows, std::size_t cols) {
+  allocate(rows, cols);
+}
+
+// ____________________________________________________________________________
+template <typename T> std::vector<std::vector<T>> Matrix<T>::getData() const {
+  std::vector<std::vector<T>> data(rows_);
   for (size_t row = 0; row < rows_; ++row) {
-    for (size_t col = 0; col < cols_; ++col) {
-      matrix_[row][col] = value<T>::zero();
-    }
+    const T *a = data_ + row * stride_;
+    data[row].assign(a, a + cols_);
+  }
+  return data;
+}
+
+// ____________________________________________________________________________
+template <typename T> T *Matrix<T>::data() { return data_; }
+
+// ____________________________________________________________________________
+template <typename T> const T *Matrix<T>::data() const {
+  return data_;
+}
+
+// ____________________________________________________________________________
+template <typename T> std::size_t Matrix<T>::computeStride(std::size_t cols) {
+  // Rows narrower than a cache line are stored densely, so column vectors
+  // (labels, outputs) do not blow up. Wider rows are padded to a multiple of
+  // the alignment, so every row starts on a cache line boundary.
+  constexpr std::size_t lanes = kMatrixAlignment / sizeof(T);
+  if (cols < lanes) {
+    return cols;
   }
+  return (cols + lanes - 1) / lanes * lanes;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void Matrix<T>::allocate(std::size_t rows, std::size_t cols) {
+  rows_ = rows;
+  cols_ = cols;
+  stride_ = computeStride(cols);
+  owner_.reset();
+  matrix_.clear();
+  matrix_.resize(rows_ * stride_);
+  data_ = matrix_.data();
+}
+
+// ____________________________________________________________________________
+template <typename T> void Matrix<T>::fillZeros() {
+  std::fill(data_, data_ + rows_ * stride_, value<T>::zero());
 }
 
 // ____________________________________________________________________________
 template <typename T> void Matrix<T>::fillRandom() {
   for (size_t row = 0; row < rows_; ++row) {
+    T *a = data_ + row * stride_;
     for (size_t col = 0; col < cols_; ++col) {
-      matrix_[row][col] = value<T>::random();
+      a[col] = value<T>::random();
     }
   }
 }
@@ -282,9 +368,8 @@ template <typename T> void Matrix<T>::fillRandom() {
 // ____________________________________________________________________________
 template <typename T> void Matrix<T>::fillOnes() {
   for (size_t row = 0; row < rows_; ++row) {
-    for (size_t col = 0; col < cols_; ++col) {
-      matrix_[row][col] = value<T>::one();
-    }
+    T *a = data_ + row * stride_;
+    std::fill(a, a + cols_, value<T>::one());
   }
 }
 
@@ -294,7 +379,7 @@ template <typename T> void Matrix<T>::print() const {
   for (size_t row = 0; row < rows_; ++row) {
     std::cout << "[";
     for (size_t col = 0; col < cols_; ++col) {
-      std::cout << matrix_[row][col];
+      std::cout << data_[row * stride_ + col];
       if (col < cols_ - 1)
         std::cout << ", ";
     }
@@ -314,7 +399,7 @@ T Matrix<T>::getValue(const size_t row, const size_t col) const {
   if (col >= cols_) {
     throw std::out_of_range("Col index out of range.");
   }
-  return matrix_[row][col];
+  return data_[row * stride_ + col];
 }
 
 // ____________________________________________________________________________
@@ -323,6 +408,39 @@ template class Matrix<int>;
 template class Matrix<float>;
 template class Matrix<double>;
 
+// Storage only for the half width types (see Half.h): the members that do
+// not compute.
+#define NN_INSTANTIATE_STORAGE(T)                                             \
+  template Matrix<T>::Matrix(std::size_t rows, std::size_t cols,              \
+                             InitState state);                                \
+  template Matrix<T>::Matrix(const Matrix<T> &matrix);                        \
+  template Matrix<T>::Matrix(const std::vector<std::vector<T>> &matrix);      \
+  template Matrix<T>::Matrix(Matrix<T> &&matrix) noexcept;                    \
+  template Matrix<T> Matrix<T>::view(T *data, std::size_t rows,               \
+                                     std::size_t cols, std::size_t stride,    \
+                                     std::shared_ptr<void> owner);            \
+  template Matrix<T> &Matrix<T>::operator=(const Matrix<T> &other);           \
+  template Matrix<T> &Matrix<T>::operator=(                                   \
+      const std::vector<std::vector<T>> other);                               \
+  template Matrix<T> &Matrix<T>::operator=(Matrix<T> &&other) noexcept;       \
+  template T *Matrix<T>::operator[](const std::size_t row);                   \
+  template const T *Matrix<T>::operator[](const std::size_t row) const;       \
+  template bool Matrix<T>::operator==(const Matrix<T> &other) const;          \
+  template std::size_t Matrix<T>::getRows() const;                            \
+  template std::size_t Matrix<T>::getCols() const;                            \
+  template std::size_t Matrix<T>::getStride() const;                          \
+  template void Matrix<T>::resize(std::size_t rows, std::size_t cols);        \
+  template std::vector<std::vector<T>> Matrix<T>::getData() const;            \
+  template T *Matrix<T>::data();                                              \
+  template const T *Matrix<T>::data() const;                                  \
+  template T Matrix<T>::getValue(const size_t row, const size_t col) const;   \
+  template void Matrix<T>::print() const;
+
+NN_INSTANTIATE_STORAGE(bfloat16)
+NN_INSTANTIATE_STORAGE(float16)
+
+#undef NN_INSTANTIATE_STORAGE
+
 // ____________________________________________________________________________
 // Linear Algebra functions:
 // ____________________________________________________________________________
@@ -335,42 +453,64 @@ template <typename T> Matrix<T> dot(const Matrix<T> &A, const Matrix<T> &B) {
         "Matrices dimensions do not match for multiplication.");
   }
 
-  // Perform matrix multiplication (really expensive).
-  Matrix<T> C(A.getRows(), B.getCols(), InitState::ZERO);
-  for (size_t i = 0; i < A.getRows(); ++i) {
-    for (size_t j = 0; j < B.getCols(); ++j) {
-      T sum = value<T>::zero();
-      for (size_t k = 0; k < A.getCols(); ++k) {
-        // C[i][k] += A[i][j] * B[j][k];
-        sum += A[i][k] * B[k][j];
-      }
-      C[i][j] = sum;
-    }
+  // Perform matrix multiplication (blocked GEMM, see Gemm.h).
+  Matrix<T> C(A.getRows(), B.getCols(), InitState::EMPTY);
+  gemm(A.getRows(), B.getCols(), A.getCols(), A.data(), A.getStride(),
+       B.data(), B.getStride(), C.data(), C.getStride());
+  return C;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+Matrix<T> transposeDot(const Matrix<T> &A, const Matrix<T> &B) {
+  if (A.getRows() != B.getRows()) {
+    throw std::invalid_argument(
+        "Matrices dimensions do not match for multiplication.");
+  }
+  Matrix<T> C(A.getCols(), B.getCols(), InitState::EMPTY);
+  gemm(Transpose::YES, Transpose::NO, A.getCols(), B.getCols(), A.getRows(),
+       A.data(), A.getStride(), B.data(), B.getStride(), C.data(),
+       C.getStride());
+  return C;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+Matrix<T> dotTranspose(const Matrix<T> &A, const Matrix<T> &B) {
+  if (A.getCols() != B.getCols()) {
+    throw std::invalid_argument(
+        "Matrices dimensions do not match for multiplication.");
   }
+  Matrix<T> C(A.getRows(), B.getRows(), InitState::EMPTY);
+  gemm(Transpose::NO, Transpose::YES, A.getRows(), B.getRows(), A.getCols(),
+       A.data(), A.getStride(), B.data(), B.getStride(), C.data(),
+       C.getStride());
   return C;
 }
 
 // ____________________________________________________________________________
 template <typename T> Matrix<T> add(const Matrix<T> &A, const Matrix<T> &B) {
+  const SimdKernels<T> &kernels = simdKernels<T>();
   // Case 1: Scalar addition.
   // Case 1.1:
   // [[1, 2], [3, 4]] + [[10, 10]] = [[11, 12], [13, 14]]
   if (A.getCols() == B.getCols() && B.getRows() == 1) {
-    Matrix<T> C(A.getRows(), A.getCols(), InitState::ZERO);
+    Matrix<T> C(A.getRows(), A.getCols(), InitState::EMPTY);
     for (size_t row = 0; row < A.getRows(); ++row) {
-      for (size_t col = 0; col < A.getCols(); ++col) {
-        C[row][col] = A[row][col] + B[0][col];
-      }
+      kernels.add(A[row], B.data(), C[row], A.getCols());
     }
     return C;
   }
   // Case 1.2:
   // [[1, 2], [3, 4]] + [[10], [10]] = [[11, 12], [13, 14]]
   if (A.getRows() == B.getRows() && B.getCols() == 1) {
-    Matrix<T> C(A.getRows(), A.getCols(), InitState::ZERO);
+    Matrix<T> C(A.getRows(), A.getCols(), InitState::EMPTY);
     for (size_t row = 0; row < A.getRows(); ++row) {
+      const T *a = A[row];
+      const T b = B[row][0];
+      T *c = C[row];
       for (size_t col = 0; col < A.getCols(); ++col) {
-        C[row][col] = A[row][col] + B[row][0];
+        c[col] = a[col] + b;
       }
     }
     return C;
@@ -382,34 +522,32 @@ template <typename T> Matrix<T> add(const Matrix<T> &A, const Matrix<T> &B) {
         "Matrices dimensions do not match for addition.");
   }
   // Perform matrix addition.
-  Matrix<T> C(A.getRows(), A.getCols(), InitState::ZERO);
-  for (size_t row = 0; row < A.getRows(); ++row) {
-    for (size_t col = 0; col < A.getCols(); ++col) {
-      C[row][col] = A[row][col] + B[row][col];
-    }
-  }
+  Matrix<T> C(A.getRows(), A.getCols(), InitState::EMPTY);
+  forEachRow(A, B, C, kernels.add);
   return C;
 }
 
 // ____________________________________________________________________________
 template <typename T> Matrix<T> sub(const Matrix<T> &A, const Matrix<T> &B) {
+  const SimdKernels<T> &kernels = simdKernels<T>();
   // Scalar addition.
   if (A.getCols() == B.getCols() && B.getRows() == 1) {
-    // Perform matrix addition with scalar value.
-    Matrix<T> C(A.getRows(), A.getCols(), InitState::ZERO);
+    // Perform matrix subtraction with scalar value.
+    Matrix<T> C(A.getRows(), A.getCols(), InitState::EMPTY);
     for (size_t row = 0; row < A.getRows(); ++row) {
-      for (size_t col = 0; col < A.getCols(); ++col) {
-        C[row][col] = A[row][col] - B[0][col];
-      }
+      kernels.sub(A[row], B.data(), C[row], A.getCols());
     }
     return C;
   }
   if (A.getRows() == B.getRows() && B.getCols() == 1) {
-    // Perform matrix addition with scalar value.
-    Matrix<T> C(A.getRows(), A.getCols(), InitState::ZERO);
+    // Perform matrix subtraction with scalar value.
+    Matrix<T> C(A.getRows(), A.getCols(), InitState::EMPTY);
     for (size_t row = 0; row < A.getRows(); ++row) {
+      const T *a = A[row];
+      const T b = B[row][0];
+      T *c = C[row];
       for (size_t col = 0; col < A.getCols(); ++col) {
-        C[row][col] = A[row][col] - B[row][0];
+        c[col] = a[col] - b;
       }
     }
     return C;
@@ -419,13 +557,9 @@ template <typename T> Matrix<T> sub(const Matrix<T> &A, const Matrix<T> &B) {
   if (A.getRows() != B.getRows() || A.getCols() != B.getCols()) {
     throw std::invalid_argument("Matrices dimensions do not match for sub.");
   }
-  // Perform matrix addition.
-  Matrix<T> C(A.getRows(), A.getCols(), InitState::ZERO);
-  for (size_t row = 0; row < A.getRows(); ++row) {
-    for (size_t col = 0; col < A.getCols(); ++col) {
-      C[row][col] = A[row][col] - B[row][col];
-    }
-  }
+  // Perform matrix subtraction.
+  Matrix<T> C(A.getRows(), A.getCols(), InitState::EMPTY);
+  forEachRow(A, B, C, kernels.sub);
   return C;
 }
 
@@ -433,39 +567,97 @@ template <typename T> Matrix<T> sub(const Matrix<T> &A, const Matrix<T> &B) {
 template <typename T>
 Matrix<T> dotElementWise(const Matrix<T> &A, const Matrix<T> &B) {
   // Check if matrices are in the same vectorspace.
-  if (A.getRows() != B.getRows()) {
+  if (A.getRows() != B.getRows() || A.getCols() != B.getCols()) {
     throw std::invalid_argument(
         "Matrices dimensions do not match for element wise multiplication.");
   }
 
   // Perform element wise multiplication.
-  Matrix<T> C(A.getRows(), B.getCols(), InitState::ZERO);
-  for (size_t row = 0; row < A.getRows(); ++row) {
-    for (size_t col = 0; col < B.getCols(); ++col) {
-      C[row][col] += A[row][col] * B[row][col];
-    }
-  }
+  Matrix<T> C(A.getRows(), B.getCols(), InitState::EMPTY);
+  forEachRow(A, B, C, simdKernels<T>().mul);
   return C;
 }
 
 // ____________________________________________________________________________
-template <typename T> T sum(Matrix<T> A) {
-  // Perform element wise multiplication.
-  T res = value<T>::zero();
-  for (size_t row = 0; row < A.getRows(); ++row) {
-    for (size_t col = 0; col < A.getCols(); ++col) {
-      res += A[row][col];
+template <typename T> T sum(const Matrix<T> &A) {
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  const size_t rows = A.getRows();
+  const size_t cols = A.getCols();
+  if (rows * cols < 2 * kParallelGrain) {
+    if (A.getStride() == cols) {
+      return kernels.sum(A.data(), rows * cols);
+    }
+    T res = value<T>::zero();
+    for (size_t row = 0; row < rows; ++row) {
+      res += kernels.sum(A[row], cols);
     }
+    return res;
+  }
+
+  // Partial sums of fixed blocks of rows (so the result does not depend on
+  // the number of threads), added up in order.
+  const size_t blockRows = std::max<size_t>(1, kParallelGrain / cols);
+  std::vector<T> partial((rows + blockRows - 1) / blockRows);
+  parallelFor(partial.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t block = begin; block < end; ++block) {
+      const size_t row0 = block * blockRows;
+      const size_t row1 = std::min(rows, row0 + blockRows);
+      T res = value<T>::zero();
+      if (A.getStride() == cols) {
+        res = kernels.sum(A[row0], (row1 - row0) * cols);
+      } else {
+        for (size_t row = row0; row < row1; ++row) {
+          res += kernels.sum(A[row], cols);
+        }
+      }
+      partial[block] = res;
+    }
+  });
+  T res = value<T>::zero();
+  for (const T &p : partial) {
+    res += p;
   }
   return res;
 }
 
 // ____________________________________________________________________________
-// Explicit instantiations (for linear algebra helper functions) for int, float.
+template <typename S, typename D>
+void convert(const Matrix<S> &A, Matrix<D> &out) {
+  if (out.getRows() != A.getRows() || out.getCols() != A.getCols()) {
+    out.resize(A.getRows(), A.getCols());
+  }
+  const std::size_t grain =
+      std::max<std::size_t>(1, kParallelGrain / A.getCols());
+  parallelFor(A.getRows(), grain, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t row = begin; row < end; ++row) {
+      convert(A[row], out[row], A.getCols());
+    }
+  });
+}
+
+// ____________________________________________________________________________
+// Explicit instantiations (for linear algebra helper functions) for int,
+// float and double.
 
 template Matrix<int> dot<int>(const Matrix<int> &A, const Matrix<int> &B);
 template Matrix<float> dot<float>(const Matrix<float> &A,
                                   const Matrix<float> &B);
+template Matrix<double> dot<double>(const Matrix<double> &A,
+                                    const Matrix<double> &B);
+
+template Matrix<int> transposeDot<int>(const Matrix<int> &A,
+                                       const Matrix<int> &B);
+template Matrix<float> transposeDot<float>(const Matrix<float> &A,
+                                           const Matrix<float> &B);
+template Matrix<double> transposeDot<double>(const Matrix<double> &A,
+                                             const Matrix<double> &B);
+
+template Matrix<int> dotTranspose<int>(const Matrix<int> &A,
+                                       const Matrix<int> &B);
+template Matrix<float> dotTranspose<float>(const Matrix<float> &A,
+                                           const Matrix<float> &B);
+template Matrix<double> dotTranspose<double>(const Matrix<double> &A,
+                                             const Matrix<double> &B);
 
 template Matrix<int> add<int>(const Matrix<int> &A, const Matrix<int> &B);
 template Matrix<float> add<float>(const Matrix<float> &A,
@@ -480,4 +672,19 @@ template Matrix<int> dotElementWise<int>(const Matrix<int> &A,
 template Matrix<float> dotElementWise<float>(const Matrix<float> &A,
                                              const Matrix<float> &B);
 
-template float sum(Matrix<float> A);
\ No newline at end of file
+template Matrix<double> add<double>(const Matrix<double> &A,
+                                    const Matrix<double> &B);
+template Matrix<double> sub<double>(const Matrix<double> &A,
+                                    const Matrix<double> &B);
+template Matrix<double> dotElementWise<double>(const Matrix<double> &A,
+                                               const Matrix<double> &B);
+
+template int sum(const Matrix<int> &A);
+template float sum(const Matrix<float> &A);
+template double sum(const Matrix<double> &A);
+
+// Conversions between float and the half width types.
+template void convert(const Matrix<float> &A, Matrix<bfloat16> &out);
+template void convert(const Matrix<float> &A, Matrix<float16> &out);
+template void convert(const Matrix<bfloat16> &A, Matrix<float> &out);
+template void convert(const Matrix<float16> &A, Matrix<float> &out);
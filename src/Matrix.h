@@ -1,11 +1,16 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <cstddef>
 #include <iostream>
+#include <memory>
 #include <vector>
 
+#include "./AlignedAllocator.h"
+#include "./ThreadPool.h"
+
 // Different matrix states.
 enum class InitState { ZERO, RANDOM, ONES, EMPTY };
 
@@ -17,10 +22,24 @@ private:
   // ____________________________________________________________________________
 
   // Rows, cols and matrix elements.
+  // The elements live in one contiguous, kMatrixAlignment aligned buffer in
+  // row-major order. Row i starts at data_[i * stride_]; stride_ >= cols_
+  // pads rows to a multiple of the alignment (see computeStride).
   std::size_t rows_;
   std::size_t cols_;
-  // T** matrix_;
-  std::vector<std::vector<T>> matrix_;
+  std::size_t stride_;
+  std::vector<T, AlignedAllocator<T>> matrix_;
+
+  // The elements: matrix_.data(), or memory the matrix does not own (see
+  // view), kept alive by owner_.
+  T *data_ = nullptr;
+  std::shared_ptr<void> owner_;
+
+  // Returns the row stride used for a matrix with cols columns.
+  static std::size_t computeStride(std::size_t cols);
+
+  // Allocates the buffer for rows x cols (contents uninitialized).
+  void allocate(std::size_t rows, std::size_t cols);
 
   // Fills the matrix with zeros.
   void fillZeros();
@@ -36,18 +55,29 @@ public:
   // Constructors:
   // ____________________________________________________________________________
 
+  // Empty 0 x 0 matrix, e.g. a buffer that is assigned later.
+  Matrix() : rows_(0), cols_(0), stride_(0) {}
+
   // Constructor.
   Matrix(std::size_t rows, std::size_t cols,
          InitState state = InitState::RANDOM);
 
   // Copy-Constructor for Matrix<T>.
-  Matrix(const Matrix<T> &matrix) = default;
+  Matrix(const Matrix<T> &matrix);
 
   // Copy-Constructor for std::vector<std::vector<T>> (2D-Vector).
   Matrix(const std::vector<std::vector<T>> &matrix);
 
   // Move-Constructor for Matrix<T>.
-  Matrix(Matrix<T> &&matrix) = default;
+  Matrix(Matrix<T> &&matrix) noexcept;
+
+  // Matrix over memory it does not own, e.g. a tensor in a memory mapped
+  // model file: row i starts at data + i * stride. owner keeps the memory
+  // alive as long as the matrix uses it. The elements can be read and
+  // written in place; resize and assigning a Matrix switch to an own buffer,
+  // and copies of a view own their elements.
+  static Matrix<T> view(T *data, std::size_t rows, std::size_t cols,
+                        std::size_t stride, std::shared_ptr<void> owner);
 
   // Destructor.
   ~Matrix() = default;
@@ -57,20 +87,21 @@ public:
   // ____________________________________________________________________________
 
   // Copy-Assignment operator.
-  Matrix<T> &operator=(const Matrix<T> &other) = default;
+  Matrix<T> &operator=(const Matrix<T> &other);
 
   // Copy-Assignment operator for std::vector<std::vector<T>> (2D-Vector).
   Matrix<T> &operator=(const std::vector<std::vector<T>> other);
 
   // Move-Assignment operator for Matrix<T>.
-  Matrix<T> &operator=(Matrix<T> &&other) = default;
+  Matrix<T> &operator=(Matrix<T> &&other) noexcept;
 
-  // Matrix access (for testing purpose only).
-  std::vector<T> &operator[](const std::size_t row);
-  const std::vector<T> &operator[](const std::size_t col) const;
+  // Matrix access, returns a pointer to the first element of row, so
+  // matrix[row][col] works as before.
+  T *operator[](const std::size_t row);
+  const T *operator[](const std::size_t row) const;
 
   // Check if two matrices are the same.
-  bool operator==(const Matrix<T> other) const;
+  bool operator==(const Matrix<T> &other) const;
 
   // ____________________________________________________________________________
   // Linear Algebra methods:
@@ -113,9 +144,20 @@ public:
   // Returns number of cols.
   std::size_t getCols() const;
 
+  // Returns the distance (in elements) between the starts of two rows.
+  std::size_t getStride() const;
+
+  // Changes the shape to rows x cols. The buffer is only reallocated if it
+  // is too small, the contents are unspecified afterwards.
+  void resize(std::size_t rows, std::size_t cols);
+
   // Returns matrix data.
   std::vector<std::vector<T>> getData() const;
 
+  // Returns a pointer to the first element (row-major, getStride() apart).
+  T *data();
+  const T *data() const;
+
   // Returns of Value at row, col in matrix.
   T getValue(const size_t row, const size_t col) const;
 
@@ -130,6 +172,18 @@ public:
 // Matrix multiplication.
 template <typename T> Matrix<T> dot(const Matrix<T> &A, const Matrix<T> &B);
 
+// Matrix multiplication with the first operand transposed, dot(A^T, B),
+// without copying A.
+// n x m * n x k = m x k
+template <typename T>
+Matrix<T> transposeDot(const Matrix<T> &A, const Matrix<T> &B);
+
+// Matrix multiplication with the second operand transposed, dot(A, B^T),
+// without copying B.
+// m x n * k x n = m x k
+template <typename T>
+Matrix<T> dotTranspose(const Matrix<T> &A, const Matrix<T> &B);
+
 // Add to matrices.
 template <typename T> Matrix<T> add(const Matrix<T> &A, const Matrix<T> &B);
 
@@ -145,4 +199,67 @@ template <typename T>
 Matrix<T> dotElementWise(const Matrix<T> &A, const Matrix<T> &B);
 
 // Sums all entys in Matrix to one scalar.
-template <typename T> T sum(Matrix<T> A);
\ No newline at end of file
+template <typename T> T sum(const Matrix<T> &A);
+
+// Converts A to another element type (float to and from the half width
+// types of Half.h) into out, resized to the shape of A if needed.
+template <typename S, typename D>
+void convert(const Matrix<S> &A, Matrix<D> &out);
+
+// ____________________________________________________________________________
+// Row helpers for kernels on raw arrays (see Simd.h):
+// ____________________________________________________________________________
+
+// Number of elements below which the helpers do not split the work between
+// threads.
+constexpr std::size_t kParallelGrain = 1 << 14;
+
+// Calls kernel(a, out, n) for every row of A and the matching row of out
+// (same shape). Unpadded matrices are handled as one array. Large matrices
+// are split between the threads of the pool (see ThreadPool.h).
+template <typename T, typename Kernel>
+void forEachRow(const Matrix<T> &A, Matrix<T> &out, Kernel kernel) {
+  const std::size_t rows = A.getRows();
+  const std::size_t cols = A.getCols();
+  const T *a = A.data();
+  T *o = out.data();
+  if (A.getStride() == cols && out.getStride() == cols) {
+    parallelFor(rows * cols, kParallelGrain,
+                [&](std::size_t begin, std::size_t end) {
+                  kernel(a + begin, o + begin, end - begin);
+                });
+    return;
+  }
+  const std::size_t grain = std::max<std::size_t>(1, kParallelGrain / cols);
+  parallelFor(rows, grain, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t row = begin; row < end; ++row) {
+      kernel(a + row * A.getStride(), o + row * out.getStride(), cols);
+    }
+  });
+}
+
+// Calls kernel(a, b, out, n) for every row of A, B and out (same shape).
+template <typename T, typename Kernel>
+void forEachRow(const Matrix<T> &A, const Matrix<T> &B, Matrix<T> &out,
+                Kernel kernel) {
+  const std::size_t rows = A.getRows();
+  const std::size_t cols = A.getCols();
+  const T *a = A.data();
+  const T *b = B.data();
+  T *o = out.data();
+  if (A.getStride() == cols && B.getStride() == cols &&
+      out.getStride() == cols) {
+    parallelFor(rows * cols, kParallelGrain,
+                [&](std::size_t begin, std::size_t end) {
+                  kernel(a + begin, b + begin, o + begin, end - begin);
+                });
+    return;
+  }
+  const std::size_t grain = std::max<std::size_t>(1, kParallelGrain / cols);
+  parallelFor(rows, grain, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t row = begin; row < end; ++row) {
+      kernel(a + row * A.getStride(), b + row * B.getStride(),
+             o + row * out.getStride(), cols);
+    }
+  });
+}
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <exception>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+#include "./MicroBatcher.h"
+
+// ____________________________________________________________________________
+template <typename T>
+MicroBatcher<T>::MicroBatcher(const NeuralNetwork<T> &network,
+                              std::size_t maxBatch,
+                              std::chrono::microseconds maxWait)
+    : session_(network), maxBatch_(maxBatch), maxWait_(maxWait) {
+  if (maxBatch == 0) {
+    throw std::invalid_argument("Batch size must be > 0.");
+  }
+  batch_.reserve(maxBatch);
+  thread_ = std::thread(&MicroBatcher<T>::batchLoop, this);
+}
+
+// ____________________________________________________________________________
+template <typename T> MicroBatcher<T>::~MicroBatcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  changed_.notify_all();
+  thread_.join();
+}
+
+// ____________________________________________________________________________
+template <typename T>
+std::future<Matrix<T>> MicroBatcher<T>::submit(const Matrix<T> &row) {
+  if (row.getRows() != 1 || row.getCols() != session_.getInputSize()) {
+    throw std::invalid_argument("Request must be one row of inputs.");
+  }
+  Request request{row, std::promise<Matrix<T>>(), Clock::now()};
+  std::future<Matrix<T>> output = request.output.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(std::move(request));
+  }
+  changed_.notify_one();
+  return output;
+}
+
+// ____________________________________________________________________________
+template <typename T> std::size_t MicroBatcher<T>::getNumRequests() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return numRequests_;
+}
+
+// ____________________________________________________________________________
+template <typename T> std::size_t MicroBatcher<T>::getNumBatches() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return numBatches_;
+}
+
+// ____________________________________________________________________________
+template <typename T> void MicroBatcher<T>::batchLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    changed_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      return;
+    }
+    // Wait for the batch to fill up until the oldest row is due. When
+    // stopping, run what is there right away.
+    const Clock::time_point deadline = queue_.front().submitted + maxWait_;
+    changed_.wait_until(lock, deadline, [this] {
+      return stop_ || queue_.size() >= maxBatch_;
+    });
+    const std::size_t rows = std::min(maxBatch_, queue_.size());
+    std::move(queue_.begin(), queue_.begin() + rows,
+              std::back_inserter(batch_));
+    queue_.erase(queue_.begin(), queue_.begin() + rows);
+    numRequests_ += rows;
+    ++numBatches_;
+
+    // Run without holding the lock, so callers can queue the next batch.
+    lock.unlock();
+    runBatch();
+    lock.lock();
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T> void MicroBatcher<T>::runBatch() {
+  const std::size_t rows = batch_.size();
+  const std::size_t inputs = session_.getInputSize();
+  const std::size_t outputs = session_.getOutputSize();
+  try {
+    if (X_.getRows() != rows || X_.getCols() != inputs) {
+      X_.resize(rows, inputs);
+    }
+    for (std::size_t i = 0; i < rows; ++i) {
+      std::copy(batch_[i].row[0], batch_[i].row[0] + inputs, X_[i]);
+    }
+    session_.run(X_, y_);
+    for (std::size_t i = 0; i < rows; ++i) {
+      Matrix<T> output(1, outputs, InitState::EMPTY);
+      std::copy(y_[i], y_[i] + outputs, output[0]);
+      batch_[i].output.set_value(std::move(output));
+    }
+  } catch (...) {
+    // Rows already answered keep their outputs.
+    const std::exception_ptr error = std::current_exception();
+    for (Request &request : batch_) {
+      try {
+        request.output.set_exception(error);
+      } catch (const std::future_error &) {
+      }
+    }
+  }
+  batch_.clear();
+}
+
+// ____________________________________________________________________________
+// Explicit instantiations for float.
+template class MicroBatcher<float>;
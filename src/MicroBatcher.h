@@ -0,0 +1,89 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "./InferenceSession.h"
+#include "./Matrix.h"
+
+// ____________________________________________________________________________
+// Combines concurrent single-row inference requests into batches.
+//
+// Run one row at a time, every layer of a network is a matrix-vector
+// product, which is bound by reading the weights. A MicroBatcher collects
+// the rows submitted by any number of threads and runs them through the
+// network as one batch on its own thread, so the weights are read once per
+// batch instead of once per row:
+//
+//   MicroBatcher<float> batcher(nn, 32, std::chrono::microseconds(500));
+//   // On every caller thread:
+//   std::future<Matrix<float>> output = batcher.submit(row);
+//   Matrix<float> y = output.get();
+//
+// A batch runs as soon as maxBatch rows are waiting, or maxWait after the
+// oldest waiting row was submitted. A larger maxBatch and maxWait give
+// larger batches (throughput), smaller ones lower latency for a single
+// request.
+//
+// The network must outlive the batcher and must not be trained or loaded
+// while it runs (see InferenceSession). Destroying the batcher runs the rows
+// still waiting.
+template <typename T> class MicroBatcher {
+public:
+  MicroBatcher(const NeuralNetwork<T> &network, std::size_t maxBatch,
+               std::chrono::microseconds maxWait);
+  ~MicroBatcher();
+
+  MicroBatcher(const MicroBatcher &) = delete;
+  MicroBatcher &operator=(const MicroBatcher &) = delete;
+
+  // Queues row (1 x inputs) and returns the future of its output
+  // (1 x outputs). If running the batch throws, the future rethrows that.
+  // Throws std::invalid_argument if row does not have that shape.
+  std::future<Matrix<T>> submit(const Matrix<T> &row);
+
+  // Returns the number of rows and of batches started so far.
+  std::size_t getNumRequests() const;
+  std::size_t getNumBatches() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Request {
+    Matrix<T> row;
+    std::promise<Matrix<T>> output;
+    Clock::time_point submitted;
+  };
+
+  // Background thread: waits for a batch to fill up (or its deadline), then
+  // runs it.
+  void batchLoop();
+
+  // Runs the rows of batch_ and fulfills their promises.
+  void runBatch();
+
+  const InferenceSession<T> session_;
+  const std::size_t maxBatch_;
+  const std::chrono::microseconds maxWait_;
+
+  // Rows of the current batch, and its input and output matrices (only used
+  // by the thread).
+  std::vector<Request> batch_;
+  Matrix<T> X_;
+  Matrix<T> y_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable changed_;
+  // Submitted rows not run yet, oldest first.
+  std::deque<Request> queue_;
+  std::size_t numRequests_ = 0;
+  std::size_t numBatches_ = 0;
+  bool stop_ = false;
+  std::thread thread_;
+};
@@ -1,8 +1,165 @@
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
 
+#include "./Dense.h"
+#include "./Expression.h"
+#include "./Gemm.h"
+#include "./InferenceSession.h"
+#include "./MappedFile.h"
 #include "./NeuralNetwork.h"
+#include "./Profiler.h"
+#include "./Utils.h"
+
+namespace {
+
+// Magic bytes and version of model files (see NeuralNetwork.h).
+constexpr char kModelMagic[4] = {'N', 'N', 'M', 'F'};
+constexpr std::uint32_t kModelVersion = 3;
+// Last version without the optimizer field.
+constexpr std::uint32_t kModelVersionWithoutOptimizer = 2;
+constexpr std::uint32_t kByteOrderMark = 0x01020304;
+
+// Start value of checksum.
+constexpr std::uint64_t kChecksumSeed = 0xcbf29ce484222325ULL;
+
+// ____________________________________________________________________________
+// Value type code of model files.
+template <typename T> constexpr std::uint32_t modelDtype() {
+  static_assert(std::is_same_v<T, float> || std::is_same_v<T, double>,
+                "Model files store float or double values");
+  return std::is_same_v<T, float> ? 1 : 2;
+}
+
+// Value type code of quantized model files (int8 weights, float scales and
+// biases).
+constexpr std::uint32_t kInt8Dtype = 3;
+
+// Value type codes of model files with half width weights (float biases).
+constexpr std::uint32_t kBf16Dtype = 4;
+constexpr std::uint32_t kFp16Dtype = 5;
+
+// ____________________________________________________________________________
+// Number of non-zero inputs per row of a sparse batch, for the profiler.
+template <typename T> double inputsPerRow(const SparseMatrix<T> &X) {
+  return static_cast<double>(X.getNonZeros()) /
+         static_cast<double>(std::max<size_t>(1, X.getRows()));
+}
+
+// ____________________________________________________________________________
+// Name of loss in the training output.
+const char *lossName(Loss loss) {
+  return loss == Loss::CROSS_ENTROPY ? "cross-entropy" : "MSE";
+}
+
+// ____________________________________________________________________________
+// 64-bit FNV-1a hash of size bytes, continuing from hash.
+std::uint64_t checksum(const char *data, size_t size,
+                       std::uint64_t hash = kChecksumSeed) {
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// ____________________________________________________________________________
+// Rounds offset up to a multiple of kMatrixAlignment.
+std::uint64_t alignOffset(std::uint64_t offset) {
+  return (offset + kMatrixAlignment - 1) / kMatrixAlignment * kMatrixAlignment;
+}
+
+// ____________________________________________________________________________
+template <typename U> void appendValue(std::string &out, U value) {
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// ____________________________________________________________________________
+// Calls write(chunk, size) for size zero bytes.
+template <typename Write> void forEachZeroChunk(size_t size, Write &&write) {
+  static const char zeros[kMatrixAlignment] = {};
+  while (size > 0) {
+    const size_t chunk = std::min(size, sizeof(zeros));
+    write(zeros, chunk);
+    size -= chunk;
+  }
+}
+
+// A tensor of a model file: rows of cols values of elementSize bytes, the
+// rows stride values apart.
+struct Tensor {
+  const char *data;
+  size_t rows;
+  size_t cols;
+  size_t stride;
+  size_t elementSize;
+};
+
+// ____________________________________________________________________________
+template <typename T> Tensor tensorOf(const Matrix<T> &M) {
+  return {reinterpret_cast<const char *>(M.data()), M.getRows(), M.getCols(),
+          M.getStride(), sizeof(T)};
+}
+
+// ____________________________________________________________________________
+// Calls write(chunk, size) for the bytes of tensor as stored in a model
+// file: all rows, each padded to the stride with zeros.
+template <typename Write>
+void forEachTensorChunk(const Tensor &tensor, Write &&write) {
+  const size_t rowBytes = tensor.stride * tensor.elementSize;
+  for (size_t row = 0; row < tensor.rows; ++row) {
+    write(tensor.data + row * rowBytes, tensor.cols * tensor.elementSize);
+    forEachZeroChunk((tensor.stride - tensor.cols) * tensor.elementSize,
+                     write);
+  }
+}
+
+// ____________________________________________________________________________
+// Returns the rows and cols of parameter index of a network with the given
+// layer sizes: the weights of every layer, then the biases (the order of the
+// optimizer state).
+std::pair<size_t, size_t> parameterShape(const std::vector<size_t> &layerSizes,
+                                         size_t index) {
+  const size_t numWeights = layerSizes.size() - 1;
+  if (index < numWeights) {
+    return {layerSizes[index], layerSizes[index + 1]};
+  }
+  return {1, layerSizes[index - numWeights + 1]};
+}
+
+// Reads values from the header of a mapped model file.
+struct ModelReader {
+  const char *data;
+  size_t size;
+  size_t position;
+
+  template <typename U> U read() {
+    if (size - position < sizeof(U)) {
+      throw std::runtime_error("Model file is truncated");
+    }
+    U value;
+    std::memcpy(&value, data + position, sizeof(U));
+    position += sizeof(U);
+    return value;
+  }
+};
+
+} // namespace
 
 // ____________________________________________________________________________
 template <typename T>
@@ -19,56 +176,14 @@ NeuralNetwork<T>::NeuralNetwork(std::vector<size_t> layers,
     biases_.push_back(Matrix<T>(1, layers[i + 1], state));
   }
 
-  for (const auto &act : activation_functions) {
-    // Not pretty i guess, maybie better to store pointers.
-    // https://en.cppreference.com/w/cpp/utility/functional/function
-    switch (act) {
-    case Activation::linear:
-      activationFunctions_.push_back([](Matrix<T> &X) { return linear(X); });
-      activationFunctionDerivatives_.push_back(
-          [](Matrix<T> &X) { return linear_derivative(X); });
-      break;
-    case Activation::relu:
-      activationFunctions_.push_back([](Matrix<T> &X) { return relu(X); });
-      activationFunctionDerivatives_.push_back(
-          [](Matrix<T> &X) { return relu_derivative(X); });
-      break;
-    case Activation::step:
-      activationFunctions_.push_back([](Matrix<T> &X) { return step(X); });
-      activationFunctionDerivatives_.push_back(
-          [](Matrix<T> &X) { return step_derivative(X); });
-      break;
-    case Activation::sigmoid:
-      activationFunctions_.push_back([](Matrix<T> &X) { return sigmoid(X); });
-      activationFunctionDerivatives_.push_back(
-          [](Matrix<T> &X) { return sigmoid_derivative(X); });
-      break;
-    case Activation::softmax:
-      activationFunctions_.push_back([](Matrix<T> &X) { return softmax(X); });
-      activationFunctionDerivatives_.push_back(
-          [](Matrix<T> &X) { return softmax_derivative(X); });
-      break;
-    case Activation::tanh:
-      activationFunctions_.push_back([](Matrix<T> &X) { return tanh(X); });
-      activationFunctionDerivatives_.push_back(
-          [](Matrix<T> &X) { return tanh_derivative(X); });
-      break;
-    }
-  }
+  activations_ = activation_functions;
 }
 
 // ____________________________________________________________________________
 // Forward propagation:
-template <typename T> Matrix<T> NeuralNetwork<T>::forward(const Matrix<T> &X) {
-
-  // Pre-active values (weighted sums).
-  Z_.clear();
-
-  // Activations (of weighted sums).
-  A_.clear();
-
-  // Initialize activations with input data X.
-  A_.push_back(X);
+template <typename T>
+template <typename Input>
+const Matrix<T> &NeuralNetwork<T>::forward(const Input &X, Workspace<T> &ws) {
 
   // Forward propagation.
   // In a nutshell:
@@ -88,98 +203,382 @@ template <typename T> Matrix<T> NeuralNetwork<T>::forward(const Matrix<T> &X) {
   // A_[n] = ACT_n(dot(... (ACT_1(dot(ACT_0(dot(X, W[0]) + BIAS[0]), W[1]) +
   // BIAS[1]) ...W[n]) + BIAS[n])
 
-  // Loop through each layer to perform forward propagation.
-  for (size_t i = 0; i < numLayers_ - 1; ++i) {
-    // Weighted sums:
-    // Z_[i] = dot(A[i], W[i]) + BIAS[i]
-    Matrix<T> z = std::move(dot(A_.back(), weights_[i]));
-    z = std::move(add(z, biases_[i]));
-    Z_.push_back(z);
+  // Each layer is one fused dense() call: the bias and the activation are
+  // applied while the GEMM output tiles are still in cache.
 
-    // Activation of weighted sums:
-    // A_[i + 1] = activate(dot(A[i], W[i]) + BIAS) = activate(Z_[i])
-    Matrix<T> a = activationFunctions_[i](z);
-    A_.push_back(a);
+  // Initialize activations with input data X. The workspace is only
+  // allocated if the batch size changes. A sparse input is not copied, the
+  // first layer reads it (and its gradient is computed from it) in place.
+  constexpr bool sparse = std::is_same_v<Input, SparseMatrix<T>>;
+  ws.reserve(layerSizes_, X.getRows(), sparse, checkpointing_);
+  if constexpr (sparse) {
+    ws.sparseInput = &X;
+  } else {
+    ws.sparseInput = nullptr;
+    ws.A[0] = X;
   }
 
+  // Loop through each layer to perform forward propagation, one segment
+  // after the other with checkpointing (the last one stays active for the
+  // backward pass).
+  // (With half width precision the GEMMs read the half width weights.)
+  visitWeights([&](const auto &weights) {
+    const std::vector<size_t> &segments = ws.getSegments();
+    for (size_t s = 0; s + 1 < segments.size(); ++s) {
+      ws.activateSegment(s);
+      for (size_t i = segments[s]; i < segments[s + 1]; ++i) {
+        forwardLayer(weights, i, ws, "forward");
+      }
+    }
+  });
+
   // Return final output of the network.
-  return A_.back();
+  return ws.A.back();
+}
+
+// ____________________________________________________________________________
+template <typename T>
+template <typename W>
+void NeuralNetwork<T>::forwardLayer(const std::vector<Matrix<W>> &weights,
+                                    size_t i, Workspace<T> &ws,
+                                    const char *category) {
+  static_cast<void>(category); // (Only named by the profiler.)
+  const double rows = static_cast<double>(ws.getBatchSize());
+  const bool sparse = i == 0 && ws.sparseInput != nullptr;
+  const double in = sparse ? inputsPerRow(*ws.sparseInput)
+                           : static_cast<double>(layerSizes_[i]);
+  const double out = static_cast<double>(layerSizes_[i + 1]);
+  NN_PROFILE_SCOPE("dense", category, i, 2 * rows * in * out,
+                   sizeof(T) * (rows * in + out + 2 * rows * out) +
+                       sizeof(W) * in * out);
+  // Z[i] = dot(A[i], W[i]) + BIAS[i]
+  // A[i + 1] = activate(Z[i])
+  // (Z[i] is only kept if the workspace has it, see Workspace.h.)
+  Matrix<T> *Z = ws.Z[i].getRows() > 0 ? &ws.Z[i] : nullptr;
+  if (sparse) {
+    dense(*ws.sparseInput, weights[0], biases_[0], activations_[0], ws.A[1],
+          Z);
+  } else {
+    dense(ws.A[i], weights[i], biases_[i], activations_[i], ws.A[i + 1], Z);
+  }
 }
 
 // ____________________________________________________________________________
 // Backpropagation:
-template <typename T> void NeuralNetwork<T>::backward(Matrix<T> y) {
+template <typename T> void NeuralNetwork<T>::backward(const Matrix<T> &y) {
+  computeGradients(y, workspace_);
+  update();
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void NeuralNetwork<T>::computeGradients(const Matrix<T> &y,
+                                        Workspace<T> &ws) {
 
   // __________________________________________________________________________
   // Backpropagation in a nutshell.
   //
   // 1. Calculate output error:
-  // output error = output - y
+  // output error = output - y (the gradient of the squared error), or
+  // softmax(Z) - y for the cross-entropy (fused with the softmax)
   //
   // 2. Calculate delta for each layer by propagating the error backwards
   // through the network.
   //
   // 3. Calculate gradient of weights and biases.
   //
-  // 4. Update weights and biases.
+  // 4. Update weights and biases (see update).
+  //
+  // Every intermediate lives in ws (and the half width errors in half_),
+  // nothing is allocated here after the first step.
   // __________________________________________________________________________
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  const size_t numWeights = numLayers_ - 1;
+  const size_t batchSize = ws.getBatchSize();
+  if (y.getRows() != batchSize || y.getCols() != layerSizes_.back()) {
+    throw std::invalid_argument(
+        "Dimensions of output and labels do not match.");
+  }
+
+  Matrix<T> &output_delta = ws.deltas[numWeights - 1];
+  const double outputs = static_cast<double>(batchSize * y.getCols());
+  if (loss_ == Loss::CROSS_ENTROPY) {
+    NN_PROFILE_SCOPE("softmax cross-entropy", "backward", numWeights - 1,
+                     4 * outputs, 3 * sizeof(T) * outputs);
+    // The gradient of the cross-entropy with respect to the weighted sums
+    // of the softmax layer is softmax(Z) - labels, one fused pass over Z.
+    softmaxCrossEntropy(ws.Z.back(), y, output_delta);
+  } else {
+    // Calculate output error.
+    // Calculates: output - labels = output_error
+    {
+      NN_PROFILE_SCOPE("output error", "backward", numWeights - 1, outputs,
+                       3 * sizeof(T) * outputs);
+      forEachRow(ws.A.back(), y, output_delta, kernels.sub);
+    }
+
+    // Compute delta for the output layer using element-wise multiplication
+    // of error and the derivative of the activation function at the output
+    // layer (the product with the Jacobian for softmax).
+    NN_PROFILE_SCOPE("activation derivative", "backward", numWeights - 1,
+                     3 * outputs, 5 * sizeof(T) * outputs);
+    if (activations_.back() == Activation::softmax) {
+      softmaxBackward(ws.A.back(), output_delta, output_delta);
+    } else {
+      activationDerivative(activations_.back(), ws.A.back(),
+                           ws.derivatives.back());
+      forEachRow(output_delta, ws.derivatives.back(), output_delta,
+                 kernels.mul);
+    }
+  }
 
-  // Calculate output error.
-  // Calculates: output - labels = output_error
-  Matrix<T> output_error = std::move(sub(y, A_.back()));
+  // Scale the error (mixed precision training, see LossScaling).
+  if (lossScaling_.scale != 1.0f) {
+    const T lossScale = static_cast<T>(lossScaling_.scale);
+    forEachRow(output_delta, output_delta, [&](const T *a, T *out, size_t n) {
+      kernels.scale(a, lossScale, out, n);
+    });
+  }
 
-  // Calculate the derivative of the activation function at the output layer.
-  Matrix<T> activation_derivative =
-      activationFunctionDerivatives_.back()(A_.back());
+  // Propagate the error backwards through the network, reading the weights
+  // and errors in their precision.
+  if (precision_ == Precision::FLOAT32) {
+    backpropagate(weights_, ws.deltas, ws);
+  } else {
+    std::visit(
+        [&](auto &half) {
+          half.deltas.resize(numWeights);
+          backpropagate(half.weights, half.deltas, ws);
+        },
+        half_);
+  }
+}
 
-  // Compute delta for the output layer using element-wise multiplication of
-  // error and activation derivative.
-  Matrix<T> delta =
-      std::move(dotElementWise(output_error, activation_derivative));
+// ____________________________________________________________________________
+template <typename T>
+template <typename W>
+void NeuralNetwork<T>::backpropagate(const std::vector<Matrix<W>> &weights,
+                                     std::vector<Matrix<W>> &deltas,
+                                     Workspace<T> &ws) {
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  const size_t numWeights = numLayers_ - 1;
+  const size_t batchSize = ws.getBatchSize();
 
-  // Store delta values in a vector for each layer.
-  std::vector<Matrix<T>> deltas;
-  deltas.push_back(delta);
+  // The errors are computed in T (ws.deltas) and read by the GEMMs as W.
+  auto roundError = [&](size_t i) {
+    if constexpr (!std::is_same_v<W, T>) {
+      convert(ws.deltas[i], deltas[i]);
+    }
+  };
+  // Gradients of layer i: dW = A_i^T * delta, and the bias gradient, the
+  // sum of the deltas over the batch. In data-parallel training they are
+  // summed over the workers on the communication thread while the errors
+  // of the earlier layers are computed (update waits for them).
+  const double rows = static_cast<double>(batchSize);
+  auto layerGradients = [&](size_t i) {
+    const double in = static_cast<double>(layerSizes_[i]);
+    const double out = static_cast<double>(layerSizes_[i + 1]);
+    if (i == 0 && ws.sparseInput != nullptr) {
+      // Only the rows of the inputs the batch uses (from the float errors).
+      const double nonZeros =
+          static_cast<double>(ws.sparseInput->getNonZeros());
+      NN_PROFILE_SCOPE("sparse dW", "backward", i, 2 * nonZeros * out,
+                       sizeof(T) * (2 * nonZeros * out + rows * out));
+      sparseTransposeDot(*ws.sparseInput, ws.deltas[0], ws.sparseDW);
+    } else {
+      NN_PROFILE_SCOPE("gemm dW", "backward", i, 2 * rows * in * out,
+                       sizeof(T) * (rows * in + in * out) +
+                           sizeof(W) * rows * out);
+      gemm(Transpose::YES, Transpose::NO, layerSizes_[i], layerSizes_[i + 1],
+           batchSize, ws.A[i].data(), ws.A[i].getStride(), deltas[i].data(),
+           deltas[i].getStride(), ws.dW[i].data(), ws.dW[i].getStride());
+    }
 
-  // Propagate the error backwards through the network.
-  // This was kind of hard xd.
-  for (size_t i = numLayers_ - 2; i > 0; --i) {
-    // Transpose the weight matrix of the next layer
-    Matrix<T> W = std::move(weights_[i].transpose_copy());
+    NN_PROFILE_SCOPE("bias gradient", "backward", i, rows * out,
+                     sizeof(T) * (rows + 1) * out);
+    const Matrix<T> &delta = ws.deltas[i];
+    T *dB = ws.dB[i].data();
+    parallelFor(layerSizes_[i + 1], 256, [&](size_t begin, size_t end) {
+      std::fill(dB + begin, dB + end, value<T>::zero());
+      for (size_t row = 0; row < batchSize; ++row) {
+        kernels.add(dB + begin, delta[row] + begin, dB + begin, end - begin);
+      }
+    });
 
-    // Calculate delta for the current layer
-    // delta = (delta_next * W_next) * activation_derivative
-    delta = dot(deltas.back(), W);
-    activation_derivative = activationFunctionDerivatives_[i](A_[i]);
-    delta = dotElementWise(delta, activation_derivative);
-    deltas.push_back(delta);
+    if (communicator_) {
+      communicator_->allReduceAsync(
+          ws.dW[i].data(), ws.dW[i].getRows() * ws.dW[i].getStride());
+      communicator_->allReduceAsync(ws.dB[i].data(), ws.dB[i].getCols());
+    }
+  };
+  roundError(numWeights - 1);
+
+  // This was kind of hard xd. From the last layer down, the gradients of a
+  // layer are computed as soon as its error is known. With checkpointing,
+  // entering a segment recomputes the activations inside it from the one
+  // kept at its start (its last layer's output is kept as well).
+  const std::vector<size_t> &segments = ws.getSegments();
+  size_t segment = segments.size() - 2;
+  for (size_t i = numWeights; i-- > 0;) {
+    if (i < segments[segment]) {
+      --segment;
+      ws.activateSegment(segment);
+      for (size_t l = segments[segment]; l + 1 < segments[segment + 1]; ++l) {
+        forwardLayer(weights, l, ws, "recompute");
+      }
+    }
+    layerGradients(i);
+    if (i == 0) {
+      break;
+    }
+    // Calculate delta for the previous layer
+    // delta = (delta_next * W_next^T) * activation_derivative
+    // (the GEMM reads W_next transposed, no copy is made)
+    const double in = static_cast<double>(layerSizes_[i]);
+    const double out = static_cast<double>(layerSizes_[i + 1]);
+    Matrix<T> &delta = ws.deltas[i - 1];
+    {
+      NN_PROFILE_SCOPE("gemm delta", "backward", i, 2 * rows * in * out,
+                       sizeof(W) * (rows * out + in * out) +
+                           sizeof(T) * rows * in);
+      gemm(Transpose::NO, Transpose::YES, batchSize, layerSizes_[i],
+           layerSizes_[i + 1], deltas[i].data(), deltas[i].getStride(),
+           weights[i].data(), weights[i].getStride(), delta.data(),
+           delta.getStride());
+    }
+    // (A[i] is the output of layer i - 1.)
+    NN_PROFILE_SCOPE("activation derivative", "backward", i - 1, 3 * rows * in,
+                     5 * sizeof(T) * rows * in);
+    if (activations_[i - 1] == Activation::softmax) {
+      softmaxBackward(ws.A[i], delta, delta);
+    } else {
+      activationDerivative(activations_[i - 1], ws.A[i],
+                           ws.derivatives[i - 1]);
+      forEachRow(delta, ws.derivatives[i - 1], delta, kernels.mul);
+    }
+    roundError(i - 1);
   }
-  std::reverse(deltas.begin(), deltas.end());
+}
 
-  // Update weights and biases.
-  for (size_t i = 0; i < numLayers_ - 1; ++i) {
+// ____________________________________________________________________________
+template <typename T> void NeuralNetwork<T>::update() {
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  Workspace<T> &ws = workspace_;
+  const size_t numWeights = numLayers_ - 1;
+
+  // In data-parallel training, the gradients summed over all workers.
+  if (communicator_) {
+    communicator_->wait();
+  }
 
-    // Compute weight gradients
-    Matrix<T> A_i_transposed = std::move(A_[i].transpose_copy());
-    Matrix<T> dW = std::move(dot(A_i_transposed, deltas[i]));
-    // Update weights.
-    dW = dW.scalMul(learningRate_);
-    weights_[i] = std::move(add(weights_[i], dW));
+  // With dynamic loss scaling, a step whose gradients overflowed is skipped.
+  if (lossScaling_.dynamic) {
+    bool finite = true;
+    auto check = [&](const Matrix<T> &gradient) {
+      for (size_t row = 0; finite && row < gradient.getRows(); ++row) {
+        finite = std::isfinite(kernels.sum(gradient[row], gradient.getCols()));
+      }
+    };
+    const bool sparse = ws.sparseInput != nullptr;
+    for (size_t i = 0; finite && i < numWeights; ++i) {
+      if (i == 0 && sparse) {
+        if (!ws.sparseDW.rows.empty()) {
+          check(ws.sparseDW.values);
+        }
+      } else {
+        check(ws.dW[i]);
+      }
+      check(ws.dB[i]);
+    }
+    if (!finite) {
+      lossScaling_.scale /= 2;
+      stepsWithoutOverflow_ = 0;
+      ++skippedSteps_;
+      return;
+    }
+  }
+
+  // Update weights and biases (unscaling the gradients), in place. Weight
+  // decay only applies to the weights.
+  // With a sparse input only the rows of the first weights of the inputs
+  // the batch used have a gradient.
+  const bool sparse = ws.sparseInput != nullptr;
+  optimizer_.beginStep(learningRate_, 1.0f / lossScaling_.scale);
+  for (size_t i = 0; i < numWeights; ++i) {
+    // (Plain SGD: two operations per element, reads p and g, writes p.)
+    const size_t rows = i == 0 && sparse ? ws.sparseDW.rows.size()
+                                         : layerSizes_[i];
+    const double parameters =
+        static_cast<double>((rows + 1) * layerSizes_[i + 1]);
+    NN_PROFILE_SCOPE("update", "update", i, 2 * parameters,
+                     3 * sizeof(T) * parameters);
+    if (i == 0 && sparse) {
+      optimizer_.updateRows(0, weights_[0], ws.sparseDW.rows,
+                            ws.sparseDW.values);
+    } else {
+      optimizer_.update(i, weights_[i], ws.dW[i]);
+    }
+    optimizer_.update(numWeights + i, biases_[i], ws.dB[i], false);
+  }
+  updateHalfWeights(sparse ? &ws.sparseDW.rows : nullptr);
+
+  if (lossScaling_.dynamic &&
+      ++stepsWithoutOverflow_ >= lossScaling_.growthInterval) {
+    lossScaling_.scale *= 2;
+    stepsWithoutOverflow_ = 0;
+  }
+}
 
-    // Compute bias gradients
-    Matrix<T> dB = deltas[i].sum(1).scalMul(learningRate_);
-    // Update Biases
-    biases_[i] = std::move(add(biases_[i], dB));
+// ____________________________________________________________________________
+template <typename T>
+void NeuralNetwork<T>::updateHalfWeights(
+    const std::vector<std::uint32_t> *rows) {
+  if (precision_ == Precision::FLOAT32) {
+    return;
   }
+  std::visit(
+      [&](auto &half) {
+        half.weights.resize(weights_.size());
+        for (size_t i = 0; i < weights_.size(); ++i) {
+          if (i == 0 && rows != nullptr &&
+              half.weights[0].getRows() == weights_[0].getRows()) {
+            const size_t cols = weights_[0].getCols();
+            for (std::uint32_t row : *rows) {
+              convert(weights_[0][row], half.weights[0][row], cols);
+            }
+          } else {
+            convert(weights_[i], half.weights[i]);
+          }
+        }
+      },
+      half_);
 }
 
 // ____________________________________________________________________________
 // Loss:
 template <typename T>
-float NeuralNetwork<T>::loss(Matrix<T> &out, Matrix<T> &y) {
-  Matrix<T> diff = sub(y, out); // Element-wise subtraction
-  Matrix<T> squared_diff = dotElementWise(diff, diff); // Element-wise squaring
-  float loss = static_cast<float>(sum(squared_diff)) /
+float NeuralNetwork<T>::loss(const Matrix<T> &out, const Matrix<T> &y) {
+  if (loss_ == Loss::CROSS_ENTROPY) {
+    if (out.getRows() != y.getRows() || out.getCols() != y.getCols()) {
+      throw std::invalid_argument(
+          "Dimensions of output and labels do not match.");
+    }
+    const T smallest = std::numeric_limits<T>::min();
+    double crossEntropy = 0.0;
+    for (size_t row = 0; row < y.getRows(); ++row) {
+      for (size_t col = 0; col < y.getCols(); ++col) {
+        if (y[row][col] != 0) {
+          crossEntropy -=
+              y[row][col] * std::log(std::max(out[row][col], smallest));
+        }
+      }
+    }
+    return static_cast<float>(crossEntropy /
+                              static_cast<double>(y.getRows()));
+  }
+  // Sum of the squared differences in one pass (see Expression.h).
+  auto diff = lazy(y) - lazy(out);
+  float loss = static_cast<float>(sum(diff * diff)) /
                static_cast<float>(y.getCols() * y.getRows());
   return loss;
 }
@@ -187,8 +586,8 @@ float NeuralNetwork<T>::loss(Matrix<T> &out, Matrix<T> &y) {
 // ____________________________________________________________________________
 // Accuracy:
 template <typename T>
-float NeuralNetwork<T>::getAccuracy(Matrix<T> &out, Matrix<T> &y,
-                                    float threshold) {
+float NeuralNetwork<T>::getAccuracy(const Matrix<T> &out,
+                                    const Matrix<T> &y, float threshold) {
   size_t correctCount = 0;
   size_t numRows = out.getRows();
 
@@ -218,8 +617,15 @@ float NeuralNetwork<T>::getAccuracy(Matrix<T> &out, Matrix<T> &y,
 
 // ____________________________________________________________________________
 template <typename T>
-void NeuralNetwork<T>::train(Matrix<T> X, Matrix<T> y, float learning_rate,
-                             int epochs, bool verbose) {
+void NeuralNetwork<T>::train(const Matrix<T> &X, const Matrix<T> &y,
+                             float learning_rate, int epochs, bool verbose,
+                             size_t batchSize) {
+  prepareTraining();
+  if (batchSize > 0 && batchSize < X.getRows()) {
+    MatrixLoader<T> loader(X, y, batchSize);
+    train(loader, learning_rate, epochs, verbose);
+    return;
+  }
   if (learning_rate != 0.1f) {
     learningRate_ = learning_rate;
   }
@@ -230,11 +636,12 @@ void NeuralNetwork<T>::train(Matrix<T> X, Matrix<T> y, float learning_rate,
   }
   // Start training the NeuralNetwork.
   for (int epoch = 0; epoch < epochs; ++epoch) {
-    Matrix<T> output = forward(X);
+    const Matrix<T> &output = forward(X, workspace_);
     backward(y);
     if (verbose) {
       if (epoch % 1 == 0) {
-        std::cout << "Epoch: " << epoch << ", Loss (MSE): " << loss(output, y)
+        std::cout << "Epoch: " << epoch << ", Loss (" << lossName(loss_)
+                  << "): " << loss(output, y)
                   << ", Accuracy: " << getAccuracy(output, y) << std::endl;
       }
     }
@@ -242,8 +649,433 @@ void NeuralNetwork<T>::train(Matrix<T> X, Matrix<T> y, float learning_rate,
 }
 
 // ____________________________________________________________________________
-template <typename T> Matrix<T> NeuralNetwork<T>::act(const Matrix<T> &X) {
-  return forward(X);
+template <typename T>
+void NeuralNetwork<T>::train(const SparseMatrix<T> &X, const Matrix<T> &y,
+                             float learning_rate, int epochs, bool verbose,
+                             size_t batchSize) {
+  prepareTraining();
+  if (communicator_) {
+    throw std::invalid_argument(
+        "Training on sparse inputs does not support a communicator.");
+  }
+  if (X.getRows() != y.getRows()) {
+    throw std::invalid_argument(
+        "Number of rows of data and labels do not match.");
+  }
+  if (learning_rate != 0.1f) {
+    learningRate_ = learning_rate;
+  }
+  if (verbose) {
+    std::cout << "Start training NeuralNetwork with parameters: " << std::endl;
+    std::cout << "LearningRate: " << learningRate_ << std::endl;
+    std::cout << "Epochs: " << epochs << std::endl;
+  }
+  const size_t numRows = X.getRows();
+  if (batchSize == 0 || batchSize > numRows) {
+    batchSize = numRows;
+  }
+  // Like MatrixLoader: every epoch visits the rows in a new random order
+  // (the whole data set in order if it is a single batch).
+  std::vector<size_t> order(numRows);
+  std::iota(order.begin(), order.end(), size_t(0));
+  std::mt19937 generator(std::random_device{}());
+  for (int epoch = 0; epoch < epochs; ++epoch) {
+    if (batchSize < numRows) {
+      std::shuffle(order.begin(), order.end(), generator);
+    }
+    float lossSum = 0.0f;
+    float accuracySum = 0.0f;
+    for (size_t begin = 0; begin < numRows; begin += batchSize) {
+      const size_t rows = std::min(batchSize, numRows - begin);
+      X.selectRows(order.data() + begin, rows, sparseBatchX_);
+      batchY_.resize(rows, y.getCols());
+      for (size_t row = 0; row < rows; ++row) {
+        std::copy_n(y[order[begin + row]], y.getCols(), batchY_[row]);
+      }
+      const Matrix<T> &output = forward(sparseBatchX_, workspace_);
+      if (verbose) {
+        const float batchRows = static_cast<float>(rows);
+        lossSum += loss(output, batchY_) * batchRows;
+        accuracySum += getAccuracy(output, batchY_) * batchRows;
+      }
+      backward(batchY_);
+    }
+    if (verbose && numRows > 0) {
+      std::cout << "Epoch: " << epoch << ", Loss (" << lossName(loss_)
+                << "): " << lossSum / static_cast<float>(numRows)
+                << ", Accuracy: " << accuracySum / static_cast<float>(numRows)
+                << std::endl;
+    }
+  }
+  // (The batch stays, but is not an input of the workspace anymore.)
+  workspace_.sparseInput = nullptr;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void NeuralNetwork<T>::train(DataLoader<T> &loader, float learning_rate,
+                             int epochs, bool verbose) {
+  prepareTraining();
+  if (learning_rate != 0.1f) {
+    learningRate_ = learning_rate;
+  }
+  if (verbose) {
+    std::cout << "Start training NeuralNetwork with parameters: " << std::endl;
+    std::cout << "LearningRate: " << learningRate_ << std::endl;
+    std::cout << "Epochs: " << epochs << std::endl;
+  }
+  // Start training the NeuralNetwork, one step per batch.
+  for (int epoch = 0; epoch < epochs; ++epoch) {
+    float lossSum = 0.0f;
+    float accuracySum = 0.0f;
+    size_t rows = 0;
+    loader.reset();
+    while (loader.next(batchX_, batchY_)) {
+      const Matrix<T> &output = forward(batchX_, workspace_);
+      if (verbose) {
+        // Before the step, like the full batch loss.
+        const float batchRows = static_cast<float>(batchX_.getRows());
+        lossSum += loss(output, batchY_) * batchRows;
+        accuracySum += getAccuracy(output, batchY_) * batchRows;
+        rows += batchX_.getRows();
+      }
+      backward(batchY_);
+    }
+    if (verbose && rows > 0) {
+      std::cout << "Epoch: " << epoch << ", Loss (" << lossName(loss_)
+                << "): " << lossSum / static_cast<float>(rows)
+                << ", Accuracy: " << accuracySum / static_cast<float>(rows)
+                << std::endl;
+    }
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+HogwildStats NeuralNetwork<T>::trainHogwild(const Matrix<T> &X,
+                                            const Matrix<T> &y,
+                                            float learningRate, int epochs,
+                                            size_t batchSize) {
+  prepareTraining();
+  if (optimizer_.getSettings().type != OptimizerType::SGD ||
+      precision_ != Precision::FLOAT32 || communicator_) {
+    throw std::invalid_argument(
+        "Hogwild training needs the SGD optimizer, float32 precision and no "
+        "communicator.");
+  }
+  if (X.getRows() != y.getRows() || X.getCols() != layerSizes_.front() ||
+      y.getCols() != layerSizes_.back()) {
+    throw std::invalid_argument(
+        "Dimensions of training data and labels do not match.");
+  }
+  if (learningRate != 0.1f) {
+    learningRate_ = learningRate;
+  }
+  const size_t numRows = X.getRows();
+  if (batchSize == 0 || batchSize > numRows) {
+    batchSize = numRows;
+  }
+  const size_t numBatches = (numRows + batchSize - 1) / batchSize;
+  const size_t numWeights = numLayers_ - 1;
+  const size_t inputs = layerSizes_.front();
+  const SimdKernels<T> &kernels = simdKernels<T>();
+
+  // The SGD step without the optimizer (it has no state to share),
+  // unscaling the gradients. Rows of the first weights with a zero gradient
+  // only change with weight decay.
+  OptimizerStep<T> step = {};
+  step.learningRate = static_cast<T>(learningRate_);
+  step.gradientScale = static_cast<T>(1.0f / lossScaling_.scale);
+  step.weightDecay = static_cast<T>(optimizer_.getSettings().weightDecay);
+  OptimizerStep<T> biasStep = step;
+  biasStep.weightDecay = value<T>::zero();
+  const bool sparseUpdate = step.weightDecay == value<T>::zero();
+
+  // State of a thread: its workspace, batch and staleness.
+  struct Worker {
+    Workspace<T> ws;
+    Matrix<T> batchX;
+    Matrix<T> batchY;
+    std::vector<char> inputUsed;
+    std::vector<size_t> activeInputs;
+    size_t steps = 0;
+    size_t rows = 0;
+    size_t staleness = 0;
+    size_t maxStaleness = 0;
+  };
+  const size_t numWorkers = getNumThreads();
+  std::vector<Worker> workers(numWorkers);
+  for (Worker &worker : workers) {
+    worker.inputUsed.assign(inputs, 0);
+  }
+
+  // Number of updates applied so far, to measure the staleness.
+  std::atomic<size_t> updates{0};
+  std::atomic<size_t> nextBatch{0};
+  std::vector<size_t> order(numRows);
+  std::iota(order.begin(), order.end(), size_t(0));
+  std::mt19937 generator(std::random_device{}());
+
+  // One thread training until no batch is left in the epoch.
+  auto train = [&](Worker &worker) {
+    for (size_t batch = nextBatch.fetch_add(1); batch < numBatches;
+         batch = nextBatch.fetch_add(1)) {
+      const size_t begin = batch * batchSize;
+      const size_t rows = std::min(batchSize, numRows - begin);
+      if (worker.batchX.getRows() != rows) {
+        worker.batchX = Matrix<T>(rows, inputs, InitState::ZERO);
+        worker.batchY = Matrix<T>(rows, y.getCols(), InitState::ZERO);
+      }
+      for (size_t row = 0; row < rows; ++row) {
+        std::copy_n(X[order[begin + row]], inputs, worker.batchX[row]);
+        std::copy_n(y[order[begin + row]], y.getCols(), worker.batchY[row]);
+      }
+
+      const size_t version = updates.load(std::memory_order_relaxed);
+      forward(worker.batchX, worker.ws);
+      computeGradients(worker.batchY, worker.ws);
+
+      // Apply the gradients to the shared weights right away, racing with
+      // the other threads.
+      Workspace<T> &ws = worker.ws;
+      for (size_t i = 0; i < numWeights; ++i) {
+        const size_t cols = weights_[i].getCols();
+        NN_PROFILE_SCOPE("update", "update", i,
+                         2 * (weights_[i].getRows() + 1) * cols,
+                         3 * sizeof(T) * (weights_[i].getRows() + 1) * cols);
+        if (i == 0 && sparseUpdate) {
+          // Flag the inputs the batch uses in one pass over its rows, then
+          // collect them (clearing the flags for the next batch).
+          for (size_t row = 0; row < rows; ++row) {
+            const T *x = worker.batchX[row];
+            for (size_t col = 0; col < inputs; ++col) {
+              worker.inputUsed[col] |= x[col] != value<T>::zero();
+            }
+          }
+          worker.activeInputs.clear();
+          for (size_t col = 0; col < inputs; ++col) {
+            if (worker.inputUsed[col]) {
+              worker.activeInputs.push_back(col);
+              worker.inputUsed[col] = 0;
+            }
+          }
+          for (size_t row : worker.activeInputs) {
+            kernels.sgdUpdate(weights_[0][row], ws.dW[0][row], cols, step);
+          }
+        } else {
+          for (size_t row = 0; row < weights_[i].getRows(); ++row) {
+            kernels.sgdUpdate(weights_[i][row], ws.dW[i][row], cols, step);
+          }
+        }
+        kernels.sgdUpdate(biases_[i].data(), ws.dB[i].data(), cols, biasStep);
+      }
+
+      const size_t staleness = updates.fetch_add(1) - version;
+      ++worker.steps;
+      worker.rows += rows;
+      worker.staleness += staleness;
+      worker.maxStaleness = std::max(worker.maxStaleness, staleness);
+    }
+  };
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int epoch = 0; epoch < epochs; ++epoch) {
+    std::shuffle(order.begin(), order.end(), generator);
+    nextBatch = 0;
+    // One range per thread (a thread that gets more than one worker, e.g.
+    // stolen from a thread that was late, runs them one after the other).
+    // The GEMMs inside run serially on their thread.
+    parallelFor(numWorkers, 1, [&](size_t begin, size_t end) {
+      for (size_t w = begin; w < end; ++w) {
+        train(workers[w]);
+      }
+    });
+  }
+
+  HogwildStats stats;
+  stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  stats.threads = numWorkers;
+  size_t staleness = 0;
+  for (const Worker &worker : workers) {
+    stats.steps += worker.steps;
+    stats.rows += worker.rows;
+    staleness += worker.staleness;
+    stats.maxStaleness = std::max(stats.maxStaleness, worker.maxStaleness);
+  }
+  if (stats.steps > 0) {
+    stats.meanStaleness =
+        static_cast<double>(staleness) / static_cast<double>(stats.steps);
+  }
+  return stats;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void NeuralNetwork<T>::ensureFloatWeights(const char *message) {
+  if (!weights_.empty()) {
+    return;
+  }
+  if (precision_ != Precision::FLOAT32) {
+    std::visit(
+        [&](const auto &half) {
+          for (const auto &W : half.weights) {
+            weights_.emplace_back();
+            convert(W, weights_.back());
+          }
+        },
+        half_);
+  }
+  if (weights_.empty()) {
+    throw std::runtime_error(message);
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T> void NeuralNetwork<T>::prepareTraining() {
+  ensureFloatWeights(
+      "Network was loaded quantized, it has no float weights to train.");
+  if (loss_ == Loss::CROSS_ENTROPY &&
+      activations_.back() != Activation::softmax) {
+    throw std::invalid_argument(
+        "Cross-entropy loss needs a softmax output layer.");
+  }
+  // The quantized model would be out of date.
+  quantized_.reset();
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void NeuralNetwork<T>::quantize(const Matrix<T> &calibration) {
+  ensureFloatWeights("Network has no float weights to quantize.");
+  quantized_ = std::make_shared<const QuantizedModel<T>>(
+      weights_, biases_, activations_, calibration);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+const QuantizedModel<T> *NeuralNetwork<T>::getQuantized() const {
+  return quantized_.get();
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void NeuralNetwork<T>::setPrecision(Precision precision,
+                                    LossScaling lossScaling) {
+  if (lossScaling.scale <= 0.0f || lossScaling.growthInterval == 0) {
+    throw std::invalid_argument(
+        "Loss scale and growth interval must be positive.");
+  }
+  if (precision != precision_) {
+    ensureFloatWeights("Network was loaded quantized, it has no weights.");
+    precision_ = precision;
+    // (Empty for float32.)
+    if (precision == Precision::FLOAT16) {
+      half_.template emplace<HalfState<float16>>();
+    } else {
+      half_.template emplace<HalfState<bfloat16>>();
+    }
+    updateHalfWeights();
+  }
+  lossScaling_ = lossScaling;
+  stepsWithoutOverflow_ = 0;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void NeuralNetwork<T>::setOptimizer(OptimizerSettings settings) {
+  optimizer_ = Optimizer<T>(settings);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+const Optimizer<T> &NeuralNetwork<T>::getOptimizer() const {
+  return optimizer_;
+}
+
+// ____________________________________________________________________________
+template <typename T> void NeuralNetwork<T>::setLoss(Loss loss) {
+  loss_ = loss;
+}
+
+// ____________________________________________________________________________
+template <typename T> Loss NeuralNetwork<T>::getLoss() const { return loss_; }
+
+// ____________________________________________________________________________
+template <typename T>
+void NeuralNetwork<T>::setCheckpointing(Checkpointing checkpointing) {
+  size_t previous = 0;
+  for (size_t checkpoint : checkpointing.checkpoints) {
+    if (checkpoint <= previous || checkpoint + 1 >= numLayers_) {
+      throw std::invalid_argument(
+          "Checkpoints must be increasing layers between the first and the "
+          "last.");
+    }
+    previous = checkpoint;
+  }
+  checkpointing_ = std::move(checkpointing);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+const Checkpointing &NeuralNetwork<T>::getCheckpointing() const {
+  return checkpointing_;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void NeuralNetwork<T>::setCommunicator(
+    std::shared_ptr<Communicator> communicator) {
+  communicator_ = std::move(communicator);
+  if (!communicator_) {
+    return;
+  }
+  // All workers start from the weights of worker 0.
+  ensureFloatWeights("Cannot train a network loaded quantized.");
+  for (std::vector<Matrix<T>> *parameters : {&weights_, &biases_}) {
+    for (Matrix<T> &parameter : *parameters) {
+      communicator_->broadcast(parameter.data(),
+                               parameter.getRows() * parameter.getStride());
+    }
+  }
+  if (precision_ != Precision::FLOAT32) {
+    updateHalfWeights();
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+const std::shared_ptr<Communicator> &NeuralNetwork<T>::getCommunicator() const {
+  return communicator_;
+}
+
+// ____________________________________________________________________________
+template <typename T> Precision NeuralNetwork<T>::getPrecision() const {
+  return precision_;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+const LossScaling &NeuralNetwork<T>::getLossScaling() const {
+  return lossScaling_;
+}
+
+// ____________________________________________________________________________
+template <typename T> size_t NeuralNetwork<T>::getSkippedSteps() const {
+  return skippedSteps_;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+Matrix<T> NeuralNetwork<T>::act(const Matrix<T> &X) const {
+  return InferenceSession<T>(*this).run(X);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+Matrix<T> NeuralNetwork<T>::act(const SparseMatrix<T> &X) const {
+  return InferenceSession<T>(*this).run(X);
 }
 
 // ____________________________________________________________________________
@@ -255,52 +1087,332 @@ void NeuralNetwork<T>::evaluate(Matrix<T> &X, Matrix<T> &y) {
 }
 
 // ____________________________________________________________________________
-template <typename T> void NeuralNetwork<T>::save(std::string fileName) {
-  std::ofstream outFile(fileName, std::ios::binary);
+template <typename T>
+void NeuralNetwork<T>::save(std::string fileName, bool checkpoint) {
+  // Header up to the tensor table, tensor table, then the checksums.
+  std::string header;
+  header.append(kModelMagic, sizeof(kModelMagic));
+  appendValue<std::uint32_t>(header, kModelVersion);
+  appendValue<std::uint32_t>(header, kByteOrderMark);
+  std::uint32_t dtype = modelDtype<T>();
+  if (quantized_) {
+    dtype = kInt8Dtype;
+  } else if (precision_ != Precision::FLOAT32) {
+    dtype = precision_ == Precision::BFLOAT16 ? kBf16Dtype : kFp16Dtype;
+  }
+  appendValue<std::uint32_t>(header, dtype);
+  appendValue<std::uint64_t>(header, numLayers_);
+  for (size_t size : layerSizes_) {
+    appendValue<std::uint64_t>(header, size);
+  }
+  for (Activation activation : activations_) {
+    appendValue<std::uint32_t>(header, static_cast<std::uint32_t>(activation));
+  }
+  checkpoint = checkpoint && !quantized_;
+  const OptimizerSettings &settings = optimizer_.getSettings();
+  appendValue<std::uint32_t>(
+      header, checkpoint ? 1 + static_cast<std::uint32_t>(settings.type) : 0);
+  if (checkpoint) {
+    for (float setting : {settings.momentum, settings.beta1, settings.beta2,
+                          settings.epsilon, settings.weightDecay}) {
+      appendValue<float>(header, setting);
+    }
+    appendValue<std::uint64_t>(header, optimizer_.getSteps());
+  }
+
+  // Tensors: the weights, then the biases of every layer. Quantized: the
+  // int8 weights, the biases, the weight scales and the input scales.
+  std::vector<Tensor> tensors;
+  Matrix<T> inputScales;
+  if (quantized_) {
+    const auto &layers = quantized_->getLayers();
+    for (const auto &layer : layers) {
+      tensors.push_back({reinterpret_cast<const char *>(layer.weights),
+                         layer.outputs, layer.inputs, layer.stride, 1});
+    }
+    for (const auto &layer : layers) {
+      tensors.push_back(tensorOf(layer.bias));
+    }
+    for (const auto &layer : layers) {
+      tensors.push_back(tensorOf(layer.weightScales));
+    }
+    inputScales = Matrix<T>(1, layers.size(), InitState::EMPTY);
+    for (size_t i = 0; i < layers.size(); ++i) {
+      inputScales[0][i] = layers[i].inputScale;
+    }
+    tensors.push_back(tensorOf(inputScales));
+  } else {
+    // The weights in their precision.
+    visitWeights([&](const auto &weights) {
+      for (const auto &weightMatrix : weights) {
+        tensors.push_back(tensorOf(weightMatrix));
+      }
+    });
+    for (const auto &biasMatrix : biases_) {
+      tensors.push_back(tensorOf(biasMatrix));
+    }
+  }
+
+  // Optimizer state, zero for parameters that have not been updated yet.
+  std::vector<Matrix<T>> zeroState;
+  if (checkpoint) {
+    const size_t numWeights = numLayers_ - 1;
+    const size_t states = optimizer_.statesPerParameter();
+    const std::vector<Matrix<T>> &state = optimizer_.getState();
+    zeroState.reserve(2 * numWeights * states);
+    for (size_t i = 0; i < 2 * numWeights * states; ++i) {
+      if (i < state.size() && state[i].getRows() != 0) {
+        tensors.push_back(tensorOf(state[i]));
+        continue;
+      }
+      const auto [rows, cols] = parameterShape(layerSizes_, i / states);
+      zeroState.emplace_back(rows, cols, InitState::ZERO);
+      tensors.push_back(tensorOf(zeroState.back()));
+    }
+  }
+  const size_t headerSize =
+      header.size() + tensors.size() * 4 * sizeof(std::uint64_t) +
+      2 * sizeof(std::uint64_t);
+  std::uint64_t offset = alignOffset(headerSize);
+  std::uint64_t dataChecksum = kChecksumSeed;
+  for (const Tensor &tensor : tensors) {
+    appendValue<std::uint64_t>(header, tensor.rows);
+    appendValue<std::uint64_t>(header, tensor.cols);
+    appendValue<std::uint64_t>(header, tensor.stride);
+    appendValue<std::uint64_t>(header, offset);
+    const size_t bytes = tensor.rows * tensor.stride * tensor.elementSize;
+    offset = alignOffset(offset + bytes);
+    forEachTensorChunk(tensor, [&](const char *chunk, size_t size) {
+      dataChecksum = checksum(chunk, size, dataChecksum);
+    });
+  }
+  appendValue<std::uint64_t>(header, dataChecksum);
+  appendValue<std::uint64_t>(header, checksum(header.data(), header.size()));
 
-  // Write number of layers.
-  outFile.write(reinterpret_cast<const char *>(&numLayers_),
-                sizeof(numLayers_));
+  // Write to a new file and rename it, the old file may still be mapped by
+  // a loaded network (truncating it would invalidate those pages).
+  const std::string tmpFileName = fileName + ".tmp";
+  std::ofstream outFile(tmpFileName, std::ios::binary);
+  if (!outFile) {
+    throw std::runtime_error("Cannot open file for writing");
+  }
+  std::uint64_t position = 0;
+  auto write = [&](const char *chunk, size_t size) {
+    outFile.write(chunk, static_cast<std::streamsize>(size));
+    position += size;
+  };
+  auto pad = [&]() {
+    forEachZeroChunk(alignOffset(position) - position, write);
+  };
+  write(header.data(), header.size());
+  for (const Tensor &tensor : tensors) {
+    pad();
+    forEachTensorChunk(tensor, write);
+  }
+  pad();
+  outFile.close();
+  if (!outFile || std::rename(tmpFileName.c_str(), fileName.c_str()) != 0) {
+    std::remove(tmpFileName.c_str());
+    throw std::runtime_error("Cannot write model file");
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void NeuralNetwork<T>::load(std::string fileName, bool verifyData) {
+  auto file = std::make_shared<MappedFile>(fileName);
+  if (file->size() < sizeof(kModelMagic) ||
+      std::memcmp(file->data(), kModelMagic, sizeof(kModelMagic)) != 0) {
+    // Files written before the versioned format have no magic.
+    loadLegacy(fileName);
+    return;
+  }
 
-  // Write the sizes of each layer.
-  for (const auto &size : layerSizes_) {
-    outFile.write(reinterpret_cast<const char *>(&size), sizeof(size));
+  ModelReader reader{file->data(), file->size(), sizeof(kModelMagic)};
+  const auto version = reader.read<std::uint32_t>();
+  if (version != kModelVersion && version != kModelVersionWithoutOptimizer) {
+    throw std::runtime_error("Unsupported model file version: " + fileName);
+  }
+  if (reader.read<std::uint32_t>() != kByteOrderMark) {
+    throw std::runtime_error("Model file has a different byte order");
+  }
+  const auto dtype = reader.read<std::uint32_t>();
+  const bool quantized = dtype == kInt8Dtype && std::is_same_v<T, float>;
+  Precision precision = Precision::FLOAT32;
+  if (std::is_same_v<T, float> && dtype == kBf16Dtype) {
+    precision = Precision::BFLOAT16;
+  } else if (std::is_same_v<T, float> && dtype == kFp16Dtype) {
+    precision = Precision::FLOAT16;
+  } else if (dtype != modelDtype<T>() && !quantized) {
+    throw std::runtime_error("Model file has a different value type");
   }
-  // Write weights
-  for (const auto &weightMatrix : weights_) {
-    auto data = weightMatrix.getData();
-    std::size_t rows = weightMatrix.getRows();
-    std::size_t cols = weightMatrix.getCols();
-    outFile.write(reinterpret_cast<const char *>(&rows), sizeof(rows));
-    outFile.write(reinterpret_cast<const char *>(&cols), sizeof(cols));
-    for (const auto &row : data) {
-      outFile.write(reinterpret_cast<const char *>(row.data()),
-                    row.size() * sizeof(T));
+  const auto numLayers = reader.read<std::uint64_t>();
+  if (numLayers < 2 || numLayers > file->size()) {
+    throw std::runtime_error("Model file is corrupt: " + fileName);
+  }
+  std::vector<size_t> layerSizes(numLayers);
+  for (auto &size : layerSizes) {
+    size = reader.read<std::uint64_t>();
+  }
+  std::vector<Activation> activations(numLayers - 1);
+  for (auto &activation : activations) {
+    const auto value = reader.read<std::uint32_t>();
+    if (value > static_cast<std::uint32_t>(Activation::tanh)) {
+      throw std::runtime_error("Model file is corrupt: " + fileName);
     }
+    activation = static_cast<Activation>(value);
+  }
+  const auto optimizer =
+      version == kModelVersion ? reader.read<std::uint32_t>() : 0;
+  if (optimizer > 1 + static_cast<std::uint32_t>(OptimizerType::ADAMW)) {
+    throw std::runtime_error("Model file is corrupt: " + fileName);
+  }
+  OptimizerSettings optimizerSettings = optimizer_.getSettings();
+  std::uint64_t optimizerSteps = 0;
+  if (optimizer != 0) {
+    optimizerSettings.type = static_cast<OptimizerType>(optimizer - 1);
+    for (float *setting :
+         {&optimizerSettings.momentum, &optimizerSettings.beta1,
+          &optimizerSettings.beta2, &optimizerSettings.epsilon,
+          &optimizerSettings.weightDecay}) {
+      *setting = reader.read<float>();
+    }
+    optimizerSteps = reader.read<std::uint64_t>();
+  }
+  Optimizer<T> loadedOptimizer;
+  try {
+    loadedOptimizer = Optimizer<T>(optimizerSettings);
+  } catch (const std::invalid_argument &) {
+    throw std::runtime_error("Model file is corrupt: " + fileName);
   }
 
-  // Write biases
-  for (const auto &biasMatrix : biases_) {
-    auto data = biasMatrix.getData();
-    std::size_t rows = biasMatrix.getRows();
-    std::size_t cols = biasMatrix.getCols();
-    outFile.write(reinterpret_cast<const char *>(&rows), sizeof(rows));
-    outFile.write(reinterpret_cast<const char *>(&cols), sizeof(cols));
-    for (const auto &row : data) {
-      outFile.write(reinterpret_cast<const char *>(row.data()),
-                    row.size() * sizeof(T));
+  // Reads the next entry of the tensor table and returns the data of the
+  // tensor and its stride.
+  std::uint64_t dataChecksum = kChecksumSeed;
+  auto readTensor = [&](size_t expectedRows, size_t expectedCols,
+                        size_t elementSize, size_t &stride) {
+    const auto rows = reader.read<std::uint64_t>();
+    const auto cols = reader.read<std::uint64_t>();
+    stride = reader.read<std::uint64_t>();
+    const auto offset = reader.read<std::uint64_t>();
+    if (rows != expectedRows || cols != expectedCols || cols == 0 ||
+        stride < cols || offset % kMatrixAlignment != 0 ||
+        offset > file->size() ||
+        rows > (file->size() - offset) / elementSize / stride) {
+      throw std::runtime_error("Model file is corrupt: " + fileName);
     }
+    char *data = file->data() + offset;
+    if (verifyData) {
+      dataChecksum = checksum(data, rows * stride * elementSize, dataChecksum);
+    }
+    return data;
+  };
+  // The tensors are views into the mapped file, which they keep alive.
+  auto readView = [&](auto &matrix, size_t rows, size_t cols) {
+    using U = std::remove_pointer_t<decltype(matrix.data())>;
+    size_t stride;
+    U *data = reinterpret_cast<U *>(readTensor(rows, cols, sizeof(U), stride));
+    matrix = Matrix<U>::view(data, rows, cols, stride, file);
+  };
+  auto readMatrix = [&](size_t rows, size_t cols) {
+    Matrix<T> matrix;
+    readView(matrix, rows, cols);
+    return matrix;
+  };
+
+  const size_t numWeights = numLayers - 1;
+  std::vector<Matrix<T>> weights;
+  std::vector<Matrix<T>> biases;
+  std::variant<HalfState<bfloat16>, HalfState<float16>> half;
+  if (precision == Precision::FLOAT16) {
+    half.template emplace<HalfState<float16>>();
+  }
+  std::vector<typename QuantizedModel<T>::Layer> quantizedLayers;
+  if (quantized) {
+    quantizedLayers.resize(numWeights);
+    for (size_t i = 0; i < numWeights; ++i) {
+      auto &layer = quantizedLayers[i];
+      layer.inputs = layerSizes[i];
+      layer.outputs = layerSizes[i + 1];
+      layer.weights = reinterpret_cast<const std::int8_t *>(
+          readTensor(layer.outputs, layer.inputs, 1, layer.stride));
+      layer.activation = activations[i];
+    }
+    for (auto &layer : quantizedLayers) {
+      layer.bias = readMatrix(1, layer.outputs);
+    }
+    for (auto &layer : quantizedLayers) {
+      layer.weightScales = readMatrix(1, layer.outputs);
+    }
+    const Matrix<T> inputScales = readMatrix(1, numWeights);
+    for (size_t i = 0; i < numWeights; ++i) {
+      quantizedLayers[i].inputScale = inputScales[0][i];
+    }
+  } else if (precision != Precision::FLOAT32) {
+    std::visit(
+        [&](auto &state) {
+          state.weights.resize(numWeights);
+          for (size_t i = 0; i < numWeights; ++i) {
+            readView(state.weights[i], layerSizes[i], layerSizes[i + 1]);
+          }
+        },
+        half);
+    for (size_t i = 0; i < numWeights; ++i) {
+      biases.push_back(readMatrix(1, layerSizes[i + 1]));
+    }
+  } else {
+    for (size_t i = 0; i < numWeights; ++i) {
+      weights.push_back(readMatrix(layerSizes[i], layerSizes[i + 1]));
+    }
+    for (size_t i = 0; i < numWeights; ++i) {
+      biases.push_back(readMatrix(1, layerSizes[i + 1]));
+    }
+  }
+  // Optimizer state of checkpoints, in the order of the parameters. Like the
+  // weights, it is updated in place in the mapped file.
+  std::vector<Matrix<T>> optimizerState;
+  if (optimizer != 0) {
+    const size_t states = loadedOptimizer.statesPerParameter();
+    for (size_t i = 0; i < 2 * numWeights * states; ++i) {
+      const auto [rows, cols] = parameterShape(layerSizes, i / states);
+      optimizerState.push_back(readMatrix(rows, cols));
+    }
+  }
+  const auto expectedDataChecksum = reader.read<std::uint64_t>();
+  const std::uint64_t headerChecksum = checksum(file->data(), reader.position);
+  if (reader.read<std::uint64_t>() != headerChecksum ||
+      (verifyData && dataChecksum != expectedDataChecksum)) {
+    throw std::runtime_error("Checksum mismatch in model file: " + fileName);
+  }
+
+  numLayers_ = numLayers;
+  layerSizes_ = std::move(layerSizes);
+  activations_ = std::move(activations);
+  weights_ = std::move(weights);
+  biases_ = std::move(biases);
+  precision_ = precision;
+  half_ = std::move(half);
+  loadedOptimizer.setState(optimizerSteps, std::move(optimizerState));
+  optimizer_ = std::move(loadedOptimizer);
+  quantized_.reset();
+  if (quantized) {
+    quantized_ = std::make_shared<const QuantizedModel<T>>(
+        std::move(quantizedLayers), file);
   }
-  outFile.close();
 }
 
 // ____________________________________________________________________________
-template <typename T> void NeuralNetwork<T>::load(std::string fileName) {
+template <typename T>
+void NeuralNetwork<T>::loadLegacy(const std::string &fileName) {
   std::ifstream inFile(fileName, std::ios::binary);
 
   if (!inFile) {
     throw std::runtime_error("Cannot open file for reading");
   }
+  quantized_.reset();
+  precision_ = Precision::FLOAT32;
+  half_ = {};
+  optimizer_ = Optimizer<T>(optimizer_.getSettings());
 
   // Read the number of layers
   inFile.read(reinterpret_cast<char *>(&numLayers_), sizeof(numLayers_));
@@ -311,43 +1423,58 @@ template <typename T> void NeuralNetwork<T>::load(std::string fileName) {
     inFile.read(reinterpret_cast<char *>(&size), sizeof(size));
   }
 
-  // Read weights
-  weights_.clear();
-  for (size_t i = 0; i < numLayers_ - 1;
-       ++i) { // Assuming weights are between layers
+  // Reads the next matrix (rows, cols, then the rows) directly into place.
+  auto readMatrix = [&]() {
     std::size_t rows, cols;
     inFile.read(reinterpret_cast<char *>(&rows), sizeof(rows));
     inFile.read(reinterpret_cast<char *>(&cols), sizeof(cols));
-    Matrix<T> weightMatrix(rows, cols, InitState::EMPTY);
-    auto data = weightMatrix.getData();
-    for (auto &row : data) {
-      row.resize(cols);
-      inFile.read(reinterpret_cast<char *>(row.data()), row.size() * sizeof(T));
+    if (!inFile) {
+      throw std::runtime_error("Model file is truncated: " + fileName);
     }
-    weightMatrix = data;
-    // weightMatrix.setData(data);
-    weights_.push_back(weightMatrix);
-  }
+    Matrix<T> matrix(rows, cols, InitState::EMPTY);
+    for (size_t row = 0; row < rows; ++row) {
+      inFile.read(reinterpret_cast<char *>(matrix[row]), cols * sizeof(T));
+    }
+    return matrix;
+  };
 
-  // Read biases
+  // Read weights (between layers) and biases (of each layer except the
+  // input).
+  weights_.clear();
+  for (size_t i = 0; i < numLayers_ - 1; ++i) {
+    weights_.push_back(readMatrix());
+  }
   biases_.clear();
-  for (size_t i = 0; i < numLayers_ - 1;
-       ++i) { // Assuming biases are for each layer except the input
-    std::size_t rows, cols;
-    inFile.read(reinterpret_cast<char *>(&rows), sizeof(rows));
-    inFile.read(reinterpret_cast<char *>(&cols), sizeof(cols));
-    Matrix<T> biasMatrix(rows, cols, InitState::EMPTY);
-    auto data = biasMatrix.getData();
-    for (auto &row : data) {
-      row.resize(cols);
-      inFile.read(reinterpret_cast<char *>(row.data()), row.size() * sizeof(T));
-    }
-    biasMatrix = data;
-    // biasMatrix.setData(data);
-    biases_.push_back(biasMatrix);
+  for (size_t i = 0; i < numLayers_ - 1; ++i) {
+    biases_.push_back(readMatrix());
+  }
+  if (!inFile) {
+    throw std::runtime_error("Model file is truncated: " + fileName);
   }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+const std::vector<size_t> &NeuralNetwork<T>::getLayerSizes() const {
+  return layerSizes_;
+}
 
-  inFile.close();
+// ____________________________________________________________________________
+template <typename T>
+const std::vector<Matrix<T>> &NeuralNetwork<T>::getWeights() const {
+  return weights_;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+const std::vector<Matrix<T>> &NeuralNetwork<T>::getBiases() const {
+  return biases_;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+const std::vector<Activation> &NeuralNetwork<T>::getActivations() const {
+  return activations_;
 }
 
 // ____________________________________________________________________________
@@ -1,10 +1,66 @@
 
 #pragma once
 
-#include <functional>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <variant>
 
 #include "./Activation.h"
+#include "./Communicator.h"
+#include "./DataLoader.h"
+#include "./Half.h"
 #include "./Matrix.h"
+#include "./Optimizer.h"
+#include "./Quantization.h"
+#include "./SparseMatrix.h"
+#include "./Workspace.h"
+
+// ____________________________________________________________________________
+// Loss scaling of mixed precision training (see NeuralNetwork::setPrecision).
+// The output error is multiplied by scale before it is propagated back, so
+// small errors do not round to zero in float16, and the gradients are
+// divided by it again before the update.
+struct LossScaling {
+  float scale = 1.0f;
+  // Dynamic scaling: a step with gradients that are not finite (an error
+  // overflowed) is skipped and halves the scale, growthInterval steps in a
+  // row without overflow double it.
+  bool dynamic = false;
+  size_t growthInterval = 1000;
+};
+
+// Statistics of asynchronous training (see NeuralNetwork::trainHogwild).
+struct HogwildStats {
+  // Number of threads that trained.
+  size_t threads = 0;
+  // Updates applied (one per batch) and rows trained on, by all threads.
+  size_t steps = 0;
+  size_t rows = 0;
+  double seconds = 0.0;
+  // Staleness of an update: the number of updates the other threads
+  // applied between its forward pass and the update itself.
+  double meanStaleness = 0.0;
+  size_t maxStaleness = 0;
+
+  double stepsPerSecond() const {
+    return seconds > 0.0 ? static_cast<double>(steps) / seconds : 0.0;
+  }
+  double rowsPerSecond() const {
+    return seconds > 0.0 ? static_cast<double>(rows) / seconds : 0.0;
+  }
+};
+
+// Loss minimized by training (see NeuralNetwork::setLoss).
+enum class Loss {
+  // Mean squared error of the outputs.
+  MSE,
+  // Cross-entropy of the softmax outputs with one-hot (or probability)
+  // labels, fused with the softmax: the output error is softmax(Z) - y,
+  // computed from the weighted sums Z of the output layer (see
+  // softmaxCrossEntropy in Activation.h).
+  CROSS_ENTROPY
+};
 
 // Simple feed forward neural network.
 template <typename T> class NeuralNetwork {
@@ -16,6 +72,12 @@ private:
   // Learning rate.
   float learningRate_;
 
+  // Update rule and its state (see setOptimizer).
+  Optimizer<T> optimizer_;
+
+  // Loss minimized by training (see setLoss).
+  Loss loss_ = Loss::MSE;
+
   // Layer sizes.
   std::vector<size_t> layerSizes_;
 
@@ -29,26 +91,100 @@ private:
   std::vector<Matrix<T>> biases_;
 
   // Activation functions.
-  std::vector<std::function<Matrix<T>(Matrix<T> &)>> activationFunctions_;
+  std::vector<Activation> activations_;
+
+  // Precision of the weights and errors in the forward and backward pass
+  // (see setPrecision).
+  Precision precision_ = Precision::FLOAT32;
 
-  // Activation function derivatives.
-  std::vector<std::function<Matrix<T>(Matrix<T> &)>>
-      activationFunctionDerivatives_;
+  // Half width copies of the weights, rounded from the float (master)
+  // weights after every update, and of the errors of the layers in a
+  // training step.
+  template <typename H> struct HalfState {
+    std::vector<Matrix<H>> weights;
+    std::vector<Matrix<H>> deltas;
+  };
+  std::variant<HalfState<bfloat16>, HalfState<float16>> half_;
+
+  // Loss scaling, the current scale and the steps since it last changed.
+  LossScaling lossScaling_;
+  size_t stepsWithoutOverflow_ = 0;
+  size_t skippedSteps_ = 0;
+
+  // Gradient checkpointing of training (see setCheckpointing).
+  Checkpointing checkpointing_;
+
+  // Group of workers of data-parallel training (see setCommunicator),
+  // nullptr when training alone.
+  std::shared_ptr<Communicator> communicator_;
+
+  // int8 model used for inference instead of the float weights (see
+  // quantize), nullptr if the network is not quantized. Shared by copies of
+  // the network, it is never changed.
+  std::shared_ptr<const QuantizedModel<T>> quantized_;
 
   // ____________________________________________________________________________
   // Forward, backward propagation:
 
-  // Storing activations.
-  std::vector<Matrix<T>> A_;
+  // Activations, weighted sums, deltas and gradients of a training step.
+  Workspace<T> workspace_;
+
+  // Current batch of training data and labels.
+  Matrix<T> batchX_;
+  Matrix<T> batchY_;
+  SparseMatrix<T> sparseBatchX_;
+
+  // Forward propagation in training: stores the weighted sums and
+  // activations in ws for backpropagation (see InferenceSession for the
+  // read-only forward pass). Returns the output of the network. X is a
+  // Matrix or a SparseMatrix; a sparse X is referenced by ws (as
+  // ws.sparseInput) until the next forward pass.
+  template <typename Input>
+  const Matrix<T> &forward(const Input &X, Workspace<T> &ws);
+
+  // Computes layer i of the forward pass in ws, from the weights the GEMMs
+  // read (T, or their half width copies). category names the pass for the
+  // profiler.
+  template <typename W>
+  void forwardLayer(const std::vector<Matrix<W>> &weights, size_t i,
+                    Workspace<T> &ws, const char *category);
 
-  // Stroing Zs
-  std::vector<Matrix<T>> Z_;
+  // Backpropagation (after a forward pass in training on workspace_):
+  // computeGradients, then update.
+  void backward(const Matrix<T> &y);
 
-  // Forward propagation.
-  Matrix<T> forward(const Matrix<T> &X);
+  // Computes the gradients of the weights and biases in ws (after a forward
+  // pass on ws). Does not change the network.
+  void computeGradients(const Matrix<T> &y, Workspace<T> &ws);
 
-  // Backpropagation.
-  void backward(Matrix<T> y);
+  // Propagates the output error in ws back through the layers and computes
+  // the gradients, with the GEMMs reading the weights and the errors as W
+  // (T, or their half width copies).
+  template <typename W>
+  void backpropagate(const std::vector<Matrix<W>> &weights,
+                     std::vector<Matrix<W>> &deltas, Workspace<T> &ws);
+
+  // Updates the weights and biases with the gradients in workspace_ (one
+  // step of optimizer_), and adjusts the loss scale.
+  void update();
+
+  // Rounds the float weights to the half width copies of the precision
+  // (of the first weights only the rows rows, if given).
+  void updateHalfWeights(const std::vector<std::uint32_t> *rows = nullptr);
+
+  // Makes sure the float weights exist: a network loaded with half width
+  // weights gets float copies of them. Throws std::runtime_error with
+  // message if there are none (loaded quantized).
+  void ensureFloatWeights(const char *message);
+
+  // Called before training: drops the quantized model, which training
+  // would make out of date. Throws std::runtime_error if the network was
+  // loaded quantized (it has no float weights).
+  void prepareTraining();
+
+  // Loads a model file written before the versioned format (no magic, raw
+  // size_t headers, tensors copied into memory).
+  void loadLegacy(const std::string &fileName);
 
 public:
   // ____________________________________________________________________________
@@ -65,26 +201,240 @@ public:
   // Training and evaluation:
 
   // Trains the neural net.
-  void train(Matrix<T> X, Matrix<T> y, float learningRate = 0.1f,
-             int epochs = 1, bool verbose = false);
+  // With batchSize > 0 (and smaller than the data set) this is mini-batch
+  // gradient descent: every epoch visits the rows in a new random order, in
+  // batches of batchSize rows. Otherwise every epoch is one step on the whole
+  // data set.
+  void train(const Matrix<T> &X, const Matrix<T> &y,
+             float learningRate = 0.1f, int epochs = 1, bool verbose = false,
+             size_t batchSize = 0);
+
+  // Trains the neural net on sparse inputs (see SparseMatrix.h), like the
+  // dense train. The first layer multiplies the sparse batch with the
+  // weights (sparseDot) and its weight gradient only has the rows of the
+  // inputs the batch uses (sparseTransposeDot), so only those rows of the
+  // first weights are updated (see Optimizer::updateRows) and a step costs
+  // time proportional to the non-zeros, not to the number of inputs. Throws
+  // std::invalid_argument with a communicator.
+  void train(const SparseMatrix<T> &X, const Matrix<T> &y,
+             float learningRate = 0.1f, int epochs = 1, bool verbose = false,
+             size_t batchSize = 0);
+
+  // Trains the neural net on the batches of loader (see DataLoader.h), one
+  // step per batch.
+  void train(DataLoader<T> &loader, float learningRate = 0.1f, int epochs = 1,
+             bool verbose = false);
 
-  // Generates an output with input data X.
-  Matrix<T> act(const Matrix<T> &X);
+  // Asynchronous SGD without locks (Hogwild!): every thread of the pool
+  // (see getNumThreads in ThreadPool.h) takes batches of batchSize rows of
+  // X and y (all rows if 0, in a new random order every epoch), runs the
+  // forward and backward pass on its own workspace and applies the SGD
+  // update to the shared weights and biases right away, without locks.
+  // Updates of the threads interleave: an update may be computed from
+  // weights others changed meanwhile (its staleness, see HogwildStats) and
+  // some element writes may be lost. With sparse inputs the batches touch
+  // few of the same weights, so this costs little and the throughput grows
+  // with the number of threads: rows of the first weight matrix whose input
+  // is zero in the whole batch are not written at all (without weight
+  // decay). The gradients are divided by the loss scale (see LossScaling),
+  // which stays as it is even if dynamic. Throws std::invalid_argument
+  // unless the optimizer is SGD, the precision FLOAT32 and there is no
+  // communicator.
+  HogwildStats trainHogwild(const Matrix<T> &X, const Matrix<T> &y,
+                            float learningRate = 0.1f, int epochs = 1,
+                            size_t batchSize = 0);
 
-  // Calculate loss (Mean Squared Error).
-  float loss(Matrix<T> &out, Matrix<T> &y);
+  // Generates an output with input data X. Does not change the network, so
+  // it can be called from several threads at once (see InferenceSession).
+  Matrix<T> act(const Matrix<T> &X) const;
+
+  // Same for sparse inputs (see SparseMatrix.h).
+  Matrix<T> act(const SparseMatrix<T> &X) const;
+
+  // Calculates the loss (see setLoss) of the outputs out: the mean squared
+  // error, or the cross-entropy averaged over the rows (out are
+  // probabilities, clamped to the smallest normal value before the log).
+  float loss(const Matrix<T> &out, const Matrix<T> &y);
 
   // Calculates accuracy.
-  float getAccuracy(Matrix<T> &out, Matrix<T> &y, float threshold = 0.3f);
+  float getAccuracy(const Matrix<T> &out, const Matrix<T> &y,
+                    float threshold = 0.3f);
 
   // Evaluates neural net.
   // Calculates performance metrics precision, recall and accuracy.
   // Prints performance metrics.
   void evaluate(Matrix<T> &X, Matrix<T> &y);
 
-  // Saves weights and biases to binary file.
-  void save(std::string fileName = "neural_network_data.bin");
+  // Saves the layer sizes, activations, weights and biases to a model file:
+  //
+  //   char[4]   magic "NNMF"
+  //   uint32    version (3; version 2 files, without the optimizer field,
+  //             still load)
+  //   uint32    byte order mark 0x01020304 (as written by the machine)
+  //   uint32    value type (1 = float, 2 = double, 3 = quantized,
+  //             4 = bfloat16, 5 = float16, see below)
+  //   uint64    number of layers L
+  //   uint64    layer sizes [L]
+  //   uint32    activations [L - 1]
+  //   uint32    optimizer (0 = none, 1 + OptimizerType in checkpoints)
+  //   if optimizer != 0:
+  //     float32 momentum, beta1, beta2, epsilon, weight decay
+  //     uint64  number of optimizer steps
+  //   tensor table, the weights and then the biases (2 (L - 1) entries),
+  //   in checkpoints followed by the optimizer state (S 2 (L - 1) entries,
+  //   S = Optimizer::statesPerParameter, in the order of Optimizer::getState):
+  //     uint64  rows, cols, stride (elements), offset (bytes, from the start)
+  //   uint64    checksum (FNV-1a) of the tensor data
+  //   uint64    checksum of the header before it
+  //   tensors at their offsets (multiples of 64 bytes): rows * stride values,
+  //   laid out like a Matrix (padding is zero)
+  //
+  // Quantized networks (see quantize) are saved with value type 3 and the
+  // tensors of their QuantizedModel (3 (L - 1) + 1 entries): the int8
+  // weights (outputs x inputs, transposed), the float biases and weight
+  // scales (1 x outputs) of every layer, then the float input scales of the
+  // layers (1 x (L - 1)). They load quantized, without float weights.
+  //
+  // Networks with bfloat16 or float16 precision (see setPrecision) are saved
+  // with value type 4 or 5 and their half width weights (the biases stay
+  // float). They load with that precision, the float weights are recreated
+  // from the half width ones when training starts.
+  //
+  // A checkpoint also holds the optimizer settings and state, so training
+  // continues after load exactly as it would have (quantized networks are
+  // saved without optimizer state).
+  void save(std::string fileName = "neural_network_data.bin",
+            bool checkpoint = false);
+
+  // Loads a model file written by save. The file is memory mapped and the
+  // weights and biases are used in place (see Matrix::view), so loading
+  // does not read or copy the tensors: their pages are read on first use.
+  // The header is always checked; verifyData also checks the checksum of
+  // the tensor data (which reads all of it). Files without the magic are
+  // read as the unversioned format of earlier versions. Files that are not
+  // checkpoints reset the optimizer state (the settings are kept).
+  void load(std::string fileName, bool verifyData = false);
+
+  // ____________________________________________________________________________
+  // Optimizer:
+
+  // Sets the update rule of training (see Optimizer.h), with empty state.
+  // The default is plain SGD.
+  void setOptimizer(OptimizerSettings settings);
+
+  // Returns the optimizer, with the state of the last training step.
+  const Optimizer<T> &getOptimizer() const;
+
+  // ____________________________________________________________________________
+  // Loss:
+
+  // Sets the loss training minimizes and loss reports (not saved in model
+  // files). The default is MSE. CROSS_ENTROPY needs a softmax output layer,
+  // training throws std::invalid_argument otherwise.
+  void setLoss(Loss loss);
+
+  // Returns the loss.
+  Loss getLoss() const;
+
+  // ____________________________________________________________________________
+  // Gradient checkpointing:
+
+  // Trades recomputation for the memory of training: the forward pass keeps
+  // the activations only at the checkpoints (see Checkpointing in
+  // Workspace.h), the backward pass recomputes those in between, one
+  // segment at a time. Instead of about 4 batch buffers per layer (the
+  // activations, weighted sums, errors and derivatives) a step needs 3 per
+  // segment and 3 per layer of the longest segment, so with about sqrt(L)
+  // segments of L layers deep networks train on batches several times as
+  // large. That costs one more forward pass of all segments but the last;
+  // the steps stay the same. With memoryBudget the checkpoints are chosen
+  // for the batch size (see planCheckpoints). The errors of half width
+  // precision are not pooled. Throws std::invalid_argument if the
+  // checkpoints are not increasing layers in (0, number of layers).
+  void setCheckpointing(Checkpointing checkpointing);
+
+  // Returns the checkpointing settings.
+  const Checkpointing &getCheckpointing() const;
+
+  // ____________________________________________________________________________
+  // Data-parallel training:
+
+  // Trains together with the other workers of communicator (see
+  // Communicator.h), one process each, nullptr to train alone again. Every
+  // worker calls train with its own shard of the data, so all of them take
+  // the same number of steps. The gradients of every step are summed over
+  // the workers before the update, so a step of N workers on b rows each
+  // is the step of one network on all N * b rows (the gradients are sums
+  // over the rows of a batch). They are reduced layer by layer while the
+  // errors of the earlier layers are still computed.
+  //
+  // All workers must call this (it is collective): the weights and biases
+  // of worker 0 are copied to the others. The other settings (optimizer,
+  // loss, precision) must be the same on all workers. Copies of the network
+  // share the communicator.
+  void setCommunicator(std::shared_ptr<Communicator> communicator);
+
+  // Returns the communicator, nullptr if the network trains alone.
+  const std::shared_ptr<Communicator> &getCommunicator() const;
+
+  // ____________________________________________________________________________
+  // Quantization:
+
+  // Quantizes the network to int8 (post-training, see Quantization.h),
+  // calibrating the activation ranges on the rows of calibration (sample
+  // inputs). act, InferenceSession and save use the quantized model from
+  // then on. Training keeps working on the float weights and drops the
+  // quantized model.
+  void quantize(const Matrix<T> &calibration);
+
+  // Returns the quantized model, nullptr if the network is not quantized.
+  const QuantizedModel<T> *getQuantized() const;
+
+  // ____________________________________________________________________________
+  // Mixed precision:
+
+  // Stores the weights used by the forward and backward pass (and the
+  // errors propagated back in training) as precision, see Half.h. The float
+  // weights stay the master copy that training updates; the half width
+  // weights are rounded from them after every step. All products are
+  // accumulated in float. bfloat16 has the range of float; float16 usually
+  // needs lossScaling to keep small errors from rounding to zero. The
+  // quantized model, if any, is still used for inference.
+  void setPrecision(Precision precision,
+                    LossScaling lossScaling = LossScaling());
+
+  // Returns the precision of the weights.
+  Precision getPrecision() const;
+
+  // Returns the loss scaling, with the current scale.
+  const LossScaling &getLossScaling() const;
+
+  // Returns the number of training steps skipped because their gradients
+  // overflowed (dynamic loss scaling).
+  size_t getSkippedSteps() const;
+
+  // Calls f with the weights the forward pass uses: getWeights(), or the
+  // half width copies (a const std::vector<Matrix<bfloat16>> or
+  // Matrix<float16> &) for those precisions.
+  template <typename F> void visitWeights(F &&f) const {
+    if (precision_ == Precision::FLOAT32) {
+      f(weights_);
+      return;
+    }
+    std::visit([&](const auto &half) { f(half.weights); }, half_);
+  }
+
+  // ____________________________________________________________________________
+  // Getters:
+
+  // Returns the layer sizes (inputs, hidden layers, outputs).
+  const std::vector<size_t> &getLayerSizes() const;
+
+  // Returns the weights and biases of every layer (no weights if the network
+  // was loaded quantized or with half width weights).
+  const std::vector<Matrix<T>> &getWeights() const;
+  const std::vector<Matrix<T>> &getBiases() const;
 
-  // Loads weights and biases from a binary file.
-  void load(std::string fileName);
+  // Returns the activation function of every layer.
+  const std::vector<Activation> &getActivations() const;
 };
\ No newline at end of file
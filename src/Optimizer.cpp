@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+#include "./Optimizer.h"
+
+// ____________________________________________________________________________
+template <typename T>
+Optimizer<T>::Optimizer(OptimizerSettings settings) : settings_(settings) {
+  auto isFraction = [](float x) { return x >= 0.0f && x < 1.0f; };
+  if (!isFraction(settings.momentum) || !isFraction(settings.beta1) ||
+      !isFraction(settings.beta2) || !(settings.epsilon > 0.0f) ||
+      !(settings.weightDecay >= 0.0f)) {
+    throw std::invalid_argument("Optimizer settings out of range.");
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void Optimizer<T>::beginStep(float learningRate, float gradientScale) {
+  ++steps_;
+  const bool decoupled = settings_.type == OptimizerType::ADAMW;
+  step_.learningRate = static_cast<T>(learningRate);
+  step_.gradientScale = static_cast<T>(gradientScale);
+  step_.weightDecay = static_cast<T>(decoupled ? 0.0f : settings_.weightDecay);
+  step_.momentum = static_cast<T>(settings_.momentum);
+  step_.beta1 = static_cast<T>(settings_.beta1);
+  step_.beta2 = static_cast<T>(settings_.beta2);
+  step_.epsilon = static_cast<T>(settings_.epsilon);
+  // Bias corrections of the moment estimates, which start at zero.
+  const double t = static_cast<double>(steps_);
+  auto correction = [&](double beta) {
+    return static_cast<T>(1.0 / (1.0 - std::pow(beta, t)));
+  };
+  step_.correction1 = correction(settings_.beta1);
+  step_.correction2 = correction(settings_.beta2);
+  step_.decoupledDecay =
+      static_cast<T>(decoupled ? settings_.weightDecay : 0.0f);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void Optimizer<T>::update(std::size_t index, Matrix<T> &parameter,
+                          const Matrix<T> &gradient, bool decay) {
+  const std::size_t rows = parameter.getRows();
+  const std::size_t cols = parameter.getCols();
+  if (gradient.getRows() != rows || gradient.getCols() != cols) {
+    throw std::invalid_argument(
+        "Dimensions of parameter and gradient do not match.");
+  }
+
+  Matrix<T> *state = stateOf(index, rows, cols);
+  OptimizerStep<T> step = step_;
+  if (!decay) {
+    step.weightDecay = 0;
+    step.decoupledDecay = 0;
+  }
+  const std::size_t grain = std::max<std::size_t>(1, kParallelGrain / cols);
+  parallelFor(rows, grain, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t row = begin; row < end; ++row) {
+      updateRow(parameter[row], gradient[row], state, row, cols, step);
+    }
+  });
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void Optimizer<T>::updateRows(std::size_t index, Matrix<T> &parameter,
+                              const std::vector<std::uint32_t> &rows,
+                              const Matrix<T> &gradient, bool decay) {
+  const std::size_t cols = parameter.getCols();
+  if (rows.empty()) {
+    return;
+  }
+  if (gradient.getRows() != rows.size() || gradient.getCols() != cols ||
+      rows.back() >= parameter.getRows()) {
+    throw std::invalid_argument(
+        "Dimensions of parameter and gradient do not match.");
+  }
+  Matrix<T> *state = stateOf(index, parameter.getRows(), cols);
+  OptimizerStep<T> step = step_;
+  if (!decay) {
+    step.weightDecay = 0;
+    step.decoupledDecay = 0;
+  }
+  const std::size_t grain = std::max<std::size_t>(1, kParallelGrain / cols);
+  parallelFor(rows.size(), grain, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      updateRow(parameter[rows[i]], gradient[i], state, rows[i], cols, step);
+    }
+  });
+}
+
+// ____________________________________________________________________________
+template <typename T>
+Matrix<T> *Optimizer<T>::stateOf(std::size_t index, std::size_t rows,
+                                 std::size_t cols) {
+  const std::size_t states = statesPerParameter();
+  if (state_.size() < (index + 1) * states) {
+    state_.resize((index + 1) * states);
+  }
+  Matrix<T> *state = state_.data() + index * states;
+  for (std::size_t s = 0; s < states; ++s) {
+    if (state[s].getRows() == 0) {
+      state[s] = Matrix<T>(rows, cols, InitState::ZERO);
+    } else if (state[s].getRows() != rows || state[s].getCols() != cols) {
+      throw std::invalid_argument(
+          "Dimensions of parameter and optimizer state do not match.");
+    }
+  }
+  return state;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void Optimizer<T>::updateRow(T *parameter, const T *g, Matrix<T> *state,
+                             std::size_t row, std::size_t cols,
+                             const OptimizerStep<T> &step) const {
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  if (settings_.type == OptimizerType::SGD) {
+    kernels.sgdUpdate(parameter, g, cols, step);
+  } else if (settings_.type == OptimizerType::MOMENTUM) {
+    kernels.momentumUpdate(parameter, g, state[0][row], cols, step);
+  } else {
+    kernels.adamUpdate(parameter, g, state[0][row], state[1][row], cols,
+                       step);
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+const OptimizerSettings &Optimizer<T>::getSettings() const {
+  return settings_;
+}
+
+// ____________________________________________________________________________
+template <typename T> std::size_t Optimizer<T>::getSteps() const {
+  return steps_;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+const std::vector<Matrix<T>> &Optimizer<T>::getState() const {
+  return state_;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void Optimizer<T>::setState(std::size_t steps, std::vector<Matrix<T>> state) {
+  const std::size_t states = statesPerParameter();
+  if (states == 0 ? !state.empty() : state.size() % states != 0) {
+    throw std::invalid_argument("Optimizer state does not match its type.");
+  }
+  steps_ = steps;
+  state_ = std::move(state);
+}
+
+// ____________________________________________________________________________
+template <typename T> std::size_t Optimizer<T>::statesPerParameter() const {
+  switch (settings_.type) {
+  case OptimizerType::SGD:
+    return 0;
+  case OptimizerType::MOMENTUM:
+    return 1;
+  default:
+    return 2;
+  }
+}
+
+// ____________________________________________________________________________
+// Explicit instantiations for float and double.
+template class Optimizer<float>;
+template class Optimizer<double>;
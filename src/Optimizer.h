@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "./Matrix.h"
+#include "./Simd.h"
+
+// Update rules of Optimizer.
+enum class OptimizerType { SGD, MOMENTUM, ADAM, ADAMW };
+
+// ____________________________________________________________________________
+// Settings of an Optimizer. Only the fields of the type are used.
+struct OptimizerSettings {
+  OptimizerType type = OptimizerType::SGD;
+  // Momentum (MOMENTUM): v = momentum * v + g.
+  float momentum = 0.9f;
+  // Decay rates of the first and second moment estimates (ADAM, ADAMW).
+  float beta1 = 0.9f;
+  float beta2 = 0.999f;
+  // Added to the square root of the second moment (ADAM, ADAMW).
+  float epsilon = 1e-8f;
+  // Weight decay: L2 regularization added to the gradient (SGD, MOMENTUM,
+  // ADAM), decoupled from the gradient (ADAMW, p -= lr * weightDecay * p).
+  float weightDecay = 0.0f;
+};
+
+// ____________________________________________________________________________
+// Gradient descent on a set of parameter matrices, identified by their index
+// (NeuralNetwork: weights 0 .. L - 1, then biases L .. 2 L - 1):
+//
+//   SGD:      p -= lr * g
+//   MOMENTUM: v = momentum * v + g, p -= lr * v
+//   ADAM:     m and v are running averages of g and g^2 (bias corrected),
+//             p -= lr * m / (sqrt(v) + epsilon)
+//   ADAMW:    ADAM with decoupled weight decay
+//
+// Every update is one pass of a fused kernel (see SimdKernels::adamUpdate
+// etc.): it reads the gradient, updates the state and writes the parameter
+// in place, so a step does not allocate. The state of a parameter (v, or m
+// and v) is allocated, zero, on its first update.
+//
+// A step is
+//
+//   optimizer.beginStep(learningRate);
+//   for (every parameter i) optimizer.update(i, parameter, gradient);
+template <typename T> class Optimizer {
+public:
+  // Throws std::invalid_argument if the settings are out of range (momentum
+  // and betas in [0, 1), epsilon > 0, weightDecay >= 0).
+  explicit Optimizer(OptimizerSettings settings = OptimizerSettings());
+
+  // Starts the next step: the updates use learningRate and multiply the
+  // gradients by gradientScale (e.g. to undo loss scaling).
+  void beginStep(float learningRate, float gradientScale = 1.0f);
+
+  // Updates parameter index with its gradient (same shape). Without decay
+  // the weight decay is not applied (biases). Throws std::invalid_argument
+  // if the shapes do not match.
+  void update(std::size_t index, Matrix<T> &parameter,
+              const Matrix<T> &gradient, bool decay = true);
+
+  // Updates only the rows of parameter index listed in rows (increasing),
+  // row i of gradient being the gradient of row rows[i], for gradients that
+  // are zero in all other rows (e.g. the first weights of a network with
+  // sparse inputs, see SparseRows). For SGD without weight decay this is
+  // the update of the whole gradient. The state of momentum and Adam and
+  // the weight decay are updated lazily: rows without a gradient keep
+  // theirs. Throws std::invalid_argument if the shapes do not match.
+  void updateRows(std::size_t index, Matrix<T> &parameter,
+                  const std::vector<std::uint32_t> &rows,
+                  const Matrix<T> &gradient, bool decay = true);
+
+  // Returns the settings.
+  const OptimizerSettings &getSettings() const;
+
+  // Returns the number of steps begun.
+  std::size_t getSteps() const;
+
+  // Returns the state matrices of the parameters, statesPerParameter() per
+  // index (empty for parameters not updated yet).
+  const std::vector<Matrix<T>> &getState() const;
+
+  // Restores the step count and the state (e.g. from a checkpoint). Throws
+  // std::invalid_argument if state does not hold statesPerParameter()
+  // matrices per parameter.
+  void setState(std::size_t steps, std::vector<Matrix<T>> state);
+
+  // Returns the number of state matrices per parameter: 0 (SGD), 1
+  // (MOMENTUM) or 2 (ADAM, ADAMW).
+  std::size_t statesPerParameter() const;
+
+private:
+  OptimizerSettings settings_;
+  std::size_t steps_ = 0;
+  std::vector<Matrix<T>> state_;
+  // Hyperparameters of the current step, as the kernels take them.
+  OptimizerStep<T> step_ = {};
+
+  // Returns the state of parameter index (rows x cols), allocated on its
+  // first update. Throws std::invalid_argument if its shape differs.
+  Matrix<T> *stateOf(std::size_t index, std::size_t rows, std::size_t cols);
+
+  // Updates row of parameter with the gradient g and the state row of
+  // parameter index (see statesPerParameter).
+  void updateRow(T *parameter, const T *g, Matrix<T> *state, std::size_t row,
+                 std::size_t cols, const OptimizerStep<T> &step) const;
+};
@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+
+#include "./Profiler.h"
+
+namespace {
+
+// ____________________________________________________________________________
+std::uint64_t steadyNanoseconds() {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+// ____________________________________________________________________________
+// Small number of the calling thread, in the order threads first ask.
+std::uint32_t threadNumber() {
+  static std::atomic<std::uint32_t> next{0};
+  thread_local const std::uint32_t number = next.fetch_add(1);
+  return number;
+}
+
+} // namespace
+
+// ____________________________________________________________________________
+Profiler::Profiler() : epoch_(steadyNanoseconds()) {}
+
+// ____________________________________________________________________________
+void Profiler::start() {
+  clear();
+  recording_.store(true, std::memory_order_relaxed);
+}
+
+// ____________________________________________________________________________
+void Profiler::stop() { recording_.store(false, std::memory_order_relaxed); }
+
+// ____________________________________________________________________________
+void Profiler::record(const Event &event) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  events_.push_back(event);
+}
+
+// ____________________________________________________________________________
+std::vector<Profiler::Event> Profiler::getEvents() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return events_;
+}
+
+// ____________________________________________________________________________
+void Profiler::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  events_.clear();
+}
+
+// ____________________________________________________________________________
+std::uint64_t Profiler::now() const { return steadyNanoseconds() - epoch_; }
+
+// ____________________________________________________________________________
+void Profiler::writeChromeTrace(const std::string &fileName) const {
+  std::ofstream file(fileName);
+  if (!file) {
+    throw std::runtime_error("Could not open trace file " + fileName + ".");
+  }
+  const std::vector<Event> events = getEvents();
+  // Complete events ("ph": "X") with times in microseconds.
+  file << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+  file << std::fixed << std::setprecision(3);
+  for (size_t i = 0; i < events.size(); ++i) {
+    const Event &event = events[i];
+    file << (i == 0 ? "\n" : ",\n") << "{\"name\": \"" << event.name
+         << "\", \"cat\": \"" << event.category
+         << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << event.thread
+         << ", \"ts\": " << static_cast<double>(event.begin) / 1e3
+         << ", \"dur\": "
+         << static_cast<double>(event.end - event.begin) / 1e3
+         << ", \"args\": {\"layer\": " << event.layer
+         << ", \"flops\": " << std::setprecision(0) << event.flops
+         << ", \"bytes\": " << event.bytes << std::setprecision(3) << "}}";
+  }
+  file << "\n]}\n";
+  if (!file) {
+    throw std::runtime_error("Could not write trace file " + fileName + ".");
+  }
+}
+
+// ____________________________________________________________________________
+void Profiler::printSummary(std::ostream &out) const {
+  // Events summed per layer and step, ordered by layer and then by the
+  // first time the step was recorded.
+  struct Row {
+    int layer;
+    const char *category;
+    const char *name;
+    size_t first;
+    size_t calls;
+    double seconds;
+    double flops;
+    double bytes;
+  };
+  std::vector<Row> rows;
+  double total = 0.0;
+  const std::vector<Event> events = getEvents();
+  for (size_t i = 0; i < events.size(); ++i) {
+    const Event &event = events[i];
+    auto row = std::find_if(rows.begin(), rows.end(), [&](const Row &r) {
+      return r.layer == event.layer && std::strcmp(r.name, event.name) == 0 &&
+             std::strcmp(r.category, event.category) == 0;
+    });
+    if (row == rows.end()) {
+      rows.push_back(
+          Row{event.layer, event.category, event.name, i, 0, 0.0, 0.0, 0.0});
+      row = rows.end() - 1;
+    }
+    const double seconds = static_cast<double>(event.end - event.begin) / 1e9;
+    ++row->calls;
+    row->seconds += seconds;
+    row->flops += event.flops;
+    row->bytes += event.bytes;
+    total += seconds;
+  }
+  std::stable_sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+    return a.layer != b.layer ? a.layer < b.layer : a.first < b.first;
+  });
+
+  out << std::left << std::setw(6) << "layer" << std::setw(10) << "category"
+      << std::setw(24) << "step" << std::right << std::setw(8) << "calls"
+      << std::setw(12) << "total ms" << std::setw(12) << "mean us"
+      << std::setw(8) << "%" << std::setw(10) << "GFLOP/s" << std::setw(10)
+      << "GB/s" << "\n";
+  const std::ios_base::fmtflags flags = out.flags();
+  out << std::fixed;
+  for (const Row &row : rows) {
+    out << std::left << std::setw(6)
+        << (row.layer < 0 ? std::string("-") : std::to_string(row.layer))
+        << std::setw(10) << row.category << std::setw(24) << row.name
+        << std::right << std::setw(8) << row.calls << std::setprecision(3)
+        << std::setw(12) << row.seconds * 1e3 << std::setw(12)
+        << row.seconds * 1e6 / static_cast<double>(row.calls)
+        << std::setprecision(1) << std::setw(8)
+        << (total > 0.0 ? 100.0 * row.seconds / total : 0.0)
+        << std::setprecision(2) << std::setw(10)
+        << (row.seconds > 0.0 ? row.flops / row.seconds / 1e9 : 0.0)
+        << std::setw(10)
+        << (row.seconds > 0.0 ? row.bytes / row.seconds / 1e9 : 0.0) << "\n";
+  }
+  out.flags(flags);
+}
+
+// ____________________________________________________________________________
+Profiler &profiler() {
+  static Profiler instance;
+  return instance;
+}
+
+// ____________________________________________________________________________
+ProfileScope::ProfileScope(const char *name, const char *category, int layer,
+                           double flops, double bytes)
+    : active_(profiler().isRecording()) {
+  if (active_) {
+    event_ = Profiler::Event{name,  category, layer, profiler().now(), 0,
+                             flops, bytes,    threadNumber()};
+  }
+}
+
+// ____________________________________________________________________________
+ProfileScope::~ProfileScope() {
+  if (active_) {
+    event_.end = profiler().now();
+    profiler().record(event_);
+  }
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// ____________________________________________________________________________
+// Per-layer profiling of training.
+//
+// The forward and backward pass time every step of every layer (the fused
+// dense layer, output error, activation derivative, the GEMMs of the
+// gradients, the bias gradient and the update) with NN_PROFILE_SCOPE, which
+// only exists if the library is compiled with NN_PROFILE defined (make
+// PROFILE=1). Otherwise the macro only names its arguments in an unevaluated
+// sizeof, so profiling costs nothing.
+//
+// With NN_PROFILE, events are recorded while the profiler is started:
+//
+//   profiler().start();
+//   nn.train(X, y, 0.01f, 10);
+//   profiler().stop();
+//   profiler().writeChromeTrace("trace.json");  // chrome://tracing, Perfetto
+//   profiler().printSummary(std::cout);        // per layer and step
+class Profiler {
+public:
+  // A timed step of layer (-1 if it belongs to no layer). name and category
+  // are string literals.
+  struct Event {
+    const char *name;
+    const char *category;
+    int layer;
+    // Nanoseconds since the profiler was created.
+    std::uint64_t begin;
+    std::uint64_t end;
+    // Floating point operations and bytes read and written by the step.
+    double flops;
+    double bytes;
+    // Small number of the thread that recorded the event (0, 1, ...).
+    std::uint32_t thread;
+  };
+
+  Profiler();
+
+  // Clears the events and starts recording.
+  void start();
+
+  // Stops recording (the events are kept).
+  void stop();
+
+  // Returns whether events are recorded.
+  bool isRecording() const {
+    return recording_.load(std::memory_order_relaxed);
+  }
+
+  // Adds an event (thread safe).
+  void record(const Event &event);
+
+  // Returns the recorded events, in the order they ended.
+  std::vector<Event> getEvents() const;
+
+  // Removes the recorded events.
+  void clear();
+
+  // Returns the nanoseconds since the profiler was created.
+  std::uint64_t now() const;
+
+  // Writes the events as a Chrome trace_event JSON file (complete events,
+  // one track per thread, with layer, FLOPs and bytes as arguments). Throws
+  // std::runtime_error if the file cannot be written.
+  void writeChromeTrace(const std::string &fileName) const;
+
+  // Prints a table of the events summed per layer and step: calls, total
+  // and mean time, share of the total time, GFLOP/s and GB/s.
+  void printSummary(std::ostream &out) const;
+
+private:
+  std::atomic<bool> recording_{false};
+  mutable std::mutex mutex_;
+  std::vector<Event> events_;
+  std::uint64_t epoch_;
+};
+
+// Returns the library wide profiler.
+Profiler &profiler();
+
+// ____________________________________________________________________________
+// Records the lifetime of the scope as an event of profiler(), if it is
+// recording when the scope starts.
+class ProfileScope {
+public:
+  ProfileScope(const char *name, const char *category, int layer,
+               double flops, double bytes);
+  ~ProfileScope();
+
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+  Profiler::Event event_ = {};
+  bool active_;
+};
+
+#define NN_PROFILE_CONCAT_(a, b) a##b
+#define NN_PROFILE_CONCAT(a, b) NN_PROFILE_CONCAT_(a, b)
+
+// NN_PROFILE_SCOPE(name, category, layer, flops, bytes) times the rest of
+// the enclosing scope (see ProfileScope). Disabled, the arguments are only
+// named in sizeof (not evaluated), so variables computed for them do not
+// warn as unused.
+#ifdef NN_PROFILE
+#define NN_PROFILE_SCOPE(name, category, layer, flops, bytes)                 \
+  ProfileScope NN_PROFILE_CONCAT(profileScope, __LINE__)(                     \
+      name, category, static_cast<int>(layer), static_cast<double>(flops),    \
+      static_cast<double>(bytes))
+#else
+#define NN_PROFILE_SCOPE(name, category, layer, flops, bytes)                 \
+  static_cast<void>(sizeof(layer) + sizeof(flops) + sizeof(bytes))
+#endif
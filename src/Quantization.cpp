@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+#include "./AlignedAllocator.h"
+#include "./Dense.h"
+#include "./Gemm.h"
+#include "./Quantization.h"
+
+namespace {
+
+// Largest magnitude of an int8 value (-128 is not used).
+constexpr float kInt8Max = 127;
+
+// Buffer of int8 values.
+using Int8Buffer = std::vector<std::int8_t, AlignedAllocator<std::int8_t>>;
+
+// Rows of the int8 weights are padded to a multiple of this (one step of the
+// AVX2 kernel), which wastes less than padding them to a cache line.
+constexpr std::size_t kWeightRowAlignment = 16;
+
+// ____________________________________________________________________________
+std::size_t weightStride(std::size_t inputs) {
+  return (inputs + kWeightRowAlignment - 1) / kWeightRowAlignment *
+         kWeightRowAlignment;
+}
+
+// ____________________________________________________________________________
+// Returns the scale mapping [-maxAbs, maxAbs] to [-127, 127].
+template <typename T> T scaleFor(T maxAbs) {
+  return maxAbs > 0 ? maxAbs / static_cast<T>(kInt8Max) : static_cast<T>(1);
+}
+
+// ____________________________________________________________________________
+// Returns the largest absolute value of M.
+template <typename T> T maxAbs(const Matrix<T> &M) {
+  T result = 0;
+  for (std::size_t i = 0; i < M.getRows(); ++i) {
+    for (std::size_t j = 0; j < M.getCols(); ++j) {
+      result = std::max(result, std::abs(M[i][j]));
+    }
+  }
+  return result;
+}
+
+} // namespace
+
+// ____________________________________________________________________________
+template <typename T>
+QuantizedModel<T>::QuantizedModel(const std::vector<Matrix<T>> &weights,
+                                  const std::vector<Matrix<T>> &biases,
+                                  const std::vector<Activation> &activations,
+                                  const Matrix<T> &calibration) {
+  if (weights.empty() || biases.size() != weights.size() ||
+      activations.size() != weights.size()) {
+    throw std::invalid_argument("Network has no layers.");
+  }
+  if (calibration.getRows() == 0 ||
+      calibration.getCols() != weights.front().getRows()) {
+    throw std::invalid_argument(
+        "Calibration data does not match the input layer.");
+  }
+
+  // Weights: one buffer, every layer starting at a cache line.
+  auto buffer = std::make_shared<Int8Buffer>();
+  std::vector<std::size_t> offsets;
+  for (const Matrix<T> &W : weights) {
+    offsets.push_back(buffer->size());
+    const std::size_t bytes = W.getCols() * weightStride(W.getRows());
+    buffer->resize(buffer->size() + (bytes + kMatrixAlignment - 1) /
+                                        kMatrixAlignment * kMatrixAlignment,
+                   0);
+  }
+
+  // Calibration: run the float network, recording the range of the input
+  // of every layer.
+  Matrix<T> A = calibration;
+  Matrix<T> next;
+  for (std::size_t l = 0; l < weights.size(); ++l) {
+    const Matrix<T> &W = weights[l];
+    Layer layer;
+    layer.inputs = W.getRows();
+    layer.outputs = W.getCols();
+    layer.stride = weightStride(layer.inputs);
+    layer.weights = buffer->data() + offsets[l];
+    layer.inputScale = scaleFor(maxAbs(A));
+    layer.activation = activations[l];
+    layer.bias = biases[l];
+    layer.weightScales = Matrix<T>(1, layer.outputs, InitState::EMPTY);
+
+    // Weights: symmetric, one scale per output column.
+    std::int8_t *q = buffer->data() + offsets[l];
+    for (std::size_t j = 0; j < layer.outputs; ++j) {
+      T columnMax = 0;
+      for (std::size_t i = 0; i < layer.inputs; ++i) {
+        columnMax = std::max(columnMax, std::abs(W[i][j]));
+      }
+      const T scale = scaleFor(columnMax);
+      layer.weightScales[0][j] = scale;
+      for (std::size_t i = 0; i < layer.inputs; ++i) {
+        quantizeInt8(&W[i][j], 1, scale, q + j * layer.stride + i);
+      }
+    }
+    layers_.push_back(std::move(layer));
+
+    if (l + 1 < weights.size()) {
+      dense(A, W, biases[l], activations[l], next);
+      std::swap(A, next);
+    }
+  }
+  owner_ = std::move(buffer);
+  computeScales();
+}
+
+// ____________________________________________________________________________
+template <typename T>
+QuantizedModel<T>::QuantizedModel(std::vector<Layer> layers,
+                                  std::shared_ptr<void> owner)
+    : layers_(std::move(layers)), owner_(std::move(owner)) {
+  if (layers_.empty()) {
+    throw std::invalid_argument("Network has no layers.");
+  }
+  computeScales();
+}
+
+// ____________________________________________________________________________
+template <typename T> void QuantizedModel<T>::computeScales() {
+  scales_.clear();
+  for (const Layer &layer : layers_) {
+    std::vector<T> scales(layer.outputs);
+    for (std::size_t j = 0; j < layer.outputs; ++j) {
+      scales[j] = layer.inputScale * layer.weightScales[0][j];
+    }
+    scales_.push_back(std::move(scales));
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void QuantizedModel<T>::run(const Matrix<T> &X, Matrix<T> &out) const {
+  if (X.getCols() != layers_.front().inputs) {
+    throw std::invalid_argument(
+        "Number of columns of input and input layer do not match.");
+  }
+  const std::size_t m = X.getRows();
+
+  // int8 inputs of the layers (ping-pong) and the float outputs of the
+  // hidden layers, per thread. They only ever grow.
+  thread_local std::array<Int8Buffer, 2> inputs;
+  thread_local Matrix<T> hidden;
+
+  const Layer &first = layers_.front();
+  inputs[0].resize(std::max(inputs[0].size(), m * first.inputs));
+  for (std::size_t i = 0; i < m; ++i) {
+    quantizeInt8(X[i], first.inputs, first.inputScale,
+                 inputs[0].data() + i * first.inputs);
+  }
+
+  for (std::size_t l = 0; l < layers_.size(); ++l) {
+    const Layer &layer = layers_[l];
+    const bool last = l + 1 == layers_.size();
+    Matrix<T> &C = last ? out : hidden;
+    if (C.getRows() != m || C.getCols() != layer.outputs) {
+      C.resize(m, layer.outputs);
+    }
+    Int8Buffer &input = inputs[l % 2];
+    Int8Buffer &output = inputs[(l + 1) % 2];
+
+    QuantizedEpilogue<T> epilogue;
+    epilogue.scales = scales_[l].data();
+    epilogue.bias = layer.bias.data();
+    epilogue.activation = activationKernel<T>(layer.activation);
+    const bool softmaxLayer = layer.activation == Activation::softmax;
+    if (!last) {
+      output.resize(std::max(output.size(), m * layer.outputs));
+      if (!softmaxLayer) {
+        epilogue.Q = output.data();
+        epilogue.ldq = layer.outputs;
+        epilogue.outputScale = layers_[l + 1].inputScale;
+      }
+    }
+    gemmInt8(m, layer.outputs, layer.inputs, input.data(), layer.inputs,
+             layer.weights, layer.stride, C.data(), C.getStride(), epilogue);
+
+    // Softmax is not elementwise, it runs (and requantizes) after the GEMM.
+    if (softmaxLayer) {
+      softmax(C, C);
+      if (!last) {
+        for (std::size_t i = 0; i < m; ++i) {
+          quantizeInt8(C[i], layer.outputs, layers_[l + 1].inputScale,
+                       output.data() + i * layer.outputs);
+        }
+      }
+    }
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+const std::vector<typename QuantizedModel<T>::Layer> &
+QuantizedModel<T>::getLayers() const {
+  return layers_;
+}
+
+// ____________________________________________________________________________
+template <typename T> std::size_t QuantizedModel<T>::getWeightBytes() const {
+  std::size_t bytes = 0;
+  for (const Layer &layer : layers_) {
+    bytes += layer.outputs * layer.inputs;
+  }
+  return bytes;
+}
+
+// ____________________________________________________________________________
+// Explicit instantiations for float.
+template class QuantizedModel<float>;
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "./Activation.h"
+#include "./Matrix.h"
+
+// ____________________________________________________________________________
+// Post-training int8 quantization of a feed forward network, for inference.
+//
+// Every value v is stored as q = round(v / scale) in [-127, 127]
+// (symmetric, no zero point):
+//   weights:     one scale per output column, max |W[:, j]| / 127,
+//   activations: one scale per layer input, max |A| / 127 over a calibration
+//                set of sample inputs run through the float network.
+// Biases and the scales stay float. A layer computes the exact int32 dot
+// products of its int8 input and weights (gemmInt8, see Gemm.h), and its
+// epilogue dequantizes them, adds the bias, applies the activation and
+// quantizes the result to the int8 input of the next layer while it is in
+// cache. Only the output of the last layer is float.
+//
+// The weights take a quarter of the memory of float weights, which is what
+// bandwidth bound inference (small batches) is limited by. NeuralNetwork
+// uses a QuantizedModel after NeuralNetwork::quantize or when loading a
+// quantized model file.
+template <typename T> class QuantizedModel {
+public:
+  // A layer of inputs -> outputs values.
+  struct Layer {
+    std::size_t inputs = 0;
+    std::size_t outputs = 0;
+    // Weights, transposed: outputs rows of inputs values, stride apart.
+    const std::int8_t *weights = nullptr;
+    std::size_t stride = 0;
+    // Scale of every output column of the weights and the bias
+    // (1 x outputs each).
+    Matrix<T> weightScales;
+    Matrix<T> bias;
+    // Scale of the input of the layer.
+    T inputScale = 1;
+    Activation activation = Activation::linear;
+  };
+
+  // Quantizes the float layers given by weights (inputs x outputs), biases
+  // and activations. Calibrates the activation scales on the rows of
+  // calibration (sample inputs, e.g. part of the training data).
+  QuantizedModel(const std::vector<Matrix<T>> &weights,
+                 const std::vector<Matrix<T>> &biases,
+                 const std::vector<Activation> &activations,
+                 const Matrix<T> &calibration);
+
+  // Model of layers whose data owner keeps alive (e.g. a mapped model
+  // file).
+  QuantizedModel(std::vector<Layer> layers, std::shared_ptr<void> owner);
+
+  // Computes the output of the model for input X into out (resized to
+  // X.getRows() x outputs if needed). Const and thread safe like
+  // InferenceSession::run. Throws std::invalid_argument if X does not have
+  // as many columns as the first layer has inputs.
+  void run(const Matrix<T> &X, Matrix<T> &out) const;
+
+  // Returns the layers.
+  const std::vector<Layer> &getLayers() const;
+
+  // Returns the size of the int8 weights in bytes.
+  std::size_t getWeightBytes() const;
+
+private:
+  // Computes scales_ from the layers.
+  void computeScales();
+
+  std::vector<Layer> layers_;
+  // Input scale times weight scale of every output column, per layer.
+  std::vector<std::vector<T>> scales_;
+  std::shared_ptr<void> owner_;
+};
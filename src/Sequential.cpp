@@ -0,0 +1,202 @@
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "./Expression.h"
+#include "./Sequential.h"
+
+// ____________________________________________________________________________
+template <typename T>
+Sequential<T>::Sequential(size_t inputSize) : widths_({inputSize}) {}
+
+// ____________________________________________________________________________
+template <typename T>
+Sequential<T>::Sequential(const NeuralNetwork<T> &nn)
+    : Sequential(nn.getLayerSizes().front()) {
+  const std::vector<size_t> &sizes = nn.getLayerSizes();
+  nn.visitWeights([&](const auto &weights) {
+    if (weights.size() + 1 != sizes.size()) {
+      throw std::runtime_error(
+          "Network was loaded quantized, it has no weights.");
+    }
+    for (size_t i = 0; i < weights.size(); ++i) {
+      Matrix<T> W;
+      if constexpr (std::is_same_v<std::decay_t<decltype(weights[i])>,
+                                   Matrix<T>>) {
+        W = weights[i];
+      } else {
+        convert(weights[i], W);
+      }
+      add(DenseLayer<T>(std::move(W), nn.getBiases()[i],
+                        nn.getActivations()[i]));
+    }
+  });
+}
+
+// ____________________________________________________________________________
+template <typename T> Sequential<T> &Sequential<T>::add(Layer<T> layer) {
+  const size_t outputs = std::visit(
+      [&](const auto &l) { return l.getOutputSize(widths_.back()); }, layer);
+  layers_.push_back(std::move(layer));
+  widths_.push_back(outputs);
+  return *this;
+}
+
+// ____________________________________________________________________________
+template <typename T> void Sequential<T>::reserve(size_t batchSize) {
+  if (batchSize == batchSize_ && outputs_.size() == layers_.size()) {
+    return;
+  }
+  const size_t numLayers = layers_.size();
+  outputs_.resize(numLayers);
+  deltas_.resize(numLayers);
+  buffers_.resize(numLayers);
+  for (size_t i = 0; i < numLayers; ++i) {
+    outputs_[i].resize(batchSize, widths_[i + 1]);
+    deltas_[i].resize(batchSize, widths_[i + 1]);
+    const std::vector<size_t> widths = std::visit(
+        [&](const auto &layer) { return layer.getBufferWidths(widths_[i]); },
+        layers_[i]);
+    buffers_[i].resize(widths.size());
+    for (size_t j = 0; j < widths.size(); ++j) {
+      buffers_[i][j].resize(batchSize, widths[j]);
+    }
+  }
+  batchSize_ = batchSize;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+const Matrix<T> &Sequential<T>::forward(const Matrix<T> &X, bool training) {
+  if (X.getCols() != widths_.front()) {
+    throw std::invalid_argument(
+        "Dimensions of input and network do not match.");
+  }
+  reserve(X.getRows());
+  const Matrix<T> *input = &X;
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    std::visit(
+        [&](auto &layer) {
+          layer.forward(*input, outputs_[i], buffers_[i], training);
+        },
+        layers_[i]);
+    input = &outputs_[i];
+  }
+  return *input;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void Sequential<T>::step(const Matrix<T> &X, const Matrix<T> &y,
+                         float learningRate) {
+  if (y.getRows() != X.getRows() || y.getCols() != widths_.back()) {
+    throw std::invalid_argument(
+        "Dimensions of output and labels do not match.");
+  }
+  if (layers_.empty()) {
+    return;
+  }
+
+  // Output error of the squared error (summed over the batch), propagated
+  // back from the last layer. Every layer overwrites its own error and
+  // writes the one of its inputs.
+  const size_t numLayers = layers_.size();
+  forEachRow(outputs_.back(), y, deltas_.back(), simdKernels<T>().sub);
+  for (size_t i = numLayers; i-- > 0;) {
+    const Matrix<T> &input = i == 0 ? X : outputs_[i - 1];
+    Matrix<T> *inputDelta = i == 0 ? nullptr : &deltas_[i - 1];
+    std::visit(
+        [&](auto &layer) {
+          layer.backward(input, outputs_[i], deltas_[i], inputDelta,
+                         buffers_[i]);
+        },
+        layers_[i]);
+  }
+
+  // One index per parameter matrix, in the order of the layers.
+  optimizer_.beginStep(learningRate);
+  size_t index = 0;
+  for (Layer<T> &layer : layers_) {
+    std::visit(
+        [&](auto &l) {
+          l.forEachParameter(
+              [&](Matrix<T> &parameter, const Matrix<T> &gradient,
+                  bool decay) {
+                optimizer_.update(index++, parameter, gradient, decay);
+              });
+        },
+        layer);
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void Sequential<T>::train(const Matrix<T> &X, const Matrix<T> &y,
+                          float learningRate, int epochs, size_t batchSize) {
+  if (batchSize > 0 && batchSize < X.getRows()) {
+    MatrixLoader<T> loader(X, y, batchSize);
+    train(loader, learningRate, epochs);
+    return;
+  }
+  for (int epoch = 0; epoch < epochs; ++epoch) {
+    forward(X, true);
+    step(X, y, learningRate);
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void Sequential<T>::train(DataLoader<T> &loader, float learningRate,
+                          int epochs) {
+  for (int epoch = 0; epoch < epochs; ++epoch) {
+    loader.reset();
+    while (loader.next(batchX_, batchY_)) {
+      forward(batchX_, true);
+      step(batchX_, batchY_, learningRate);
+    }
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T> Matrix<T> Sequential<T>::act(const Matrix<T> &X) {
+  return forward(X, false);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+float Sequential<T>::loss(const Matrix<T> &out, const Matrix<T> &y) const {
+  if (out.getRows() != y.getRows() || out.getCols() != y.getCols()) {
+    throw std::invalid_argument(
+        "Dimensions of output and labels do not match.");
+  }
+  auto diff = lazy(y) - lazy(out);
+  return static_cast<float>(sum(diff * diff)) /
+         static_cast<float>(y.getCols() * y.getRows());
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void Sequential<T>::setOptimizer(OptimizerSettings settings) {
+  optimizer_ = Optimizer<T>(settings);
+}
+
+// ____________________________________________________________________________
+template <typename T> size_t Sequential<T>::getInputSize() const {
+  return widths_.front();
+}
+
+// ____________________________________________________________________________
+template <typename T> size_t Sequential<T>::getOutputSize() const {
+  return widths_.back();
+}
+
+// ____________________________________________________________________________
+template <typename T>
+const std::vector<Layer<T>> &Sequential<T>::getLayers() const {
+  return layers_;
+}
+
+// ____________________________________________________________________________
+// Explicit instantiations for float.
+template class Sequential<float>;
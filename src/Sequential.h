@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "./DataLoader.h"
+#include "./Layer.h"
+#include "./Matrix.h"
+#include "./NeuralNetwork.h"
+#include "./Optimizer.h"
+
+// ____________________________________________________________________________
+// Feed forward network of any layers (see Layer.h), trained on the mean
+// squared error of its outputs:
+//
+//   Sequential<float> net(784);
+//   net.add(DenseLayer<float>(784, 128, Activation::relu))
+//       .add(LayerNormLayer<float>(128))
+//       .add(DropoutLayer<float>(0.2f))
+//       .add(DenseLayer<float>(128, 10, Activation::sigmoid));
+//   net.train(X, y, 0.01f, 10, 64);
+//
+// The layers are a std::variant, dispatched with std::visit, so every call
+// goes straight to the kernels of the layer type. Before the first step the
+// network plans its memory: from the widths of the layers and the buffers
+// they declare (Layer::getBufferWidths) it sizes the activations, errors
+// and scratch of every layer for the batch size (see reserve), so a
+// training step does not allocate.
+//
+// A stack of DenseLayers with fused activations computes the same outputs
+// as the NeuralNetwork of the same layers, with the same kernels.
+template <typename T> class Sequential {
+public:
+  // A network without layers (the identity) on inputSize inputs.
+  explicit Sequential(size_t inputSize);
+
+  // The dense layers of nn, with copies of its weights (widened to T if
+  // they are half width), biases and activations. Throws
+  // std::runtime_error if nn was loaded quantized (it has no weights).
+  explicit Sequential(const NeuralNetwork<T> &nn);
+
+  // Appends layer. Throws std::invalid_argument if it cannot take the
+  // outputs of the last layer (see Layer::getOutputSize).
+  Sequential &add(Layer<T> layer);
+
+  // Sizes the activations, errors and layer buffers for batchSize rows.
+  // Training calls this; memory is only allocated if a buffer grows.
+  void reserve(size_t batchSize);
+
+  // Trains on X and y: with batchSize > 0 (and smaller than the data set)
+  // in batches of batchSize rows, in a new random order every epoch,
+  // otherwise one step per epoch on all rows. Throws std::invalid_argument
+  // if the shapes do not match the network.
+  void train(const Matrix<T> &X, const Matrix<T> &y,
+             float learningRate = 0.1f, int epochs = 1, size_t batchSize = 0);
+
+  // Trains on the batches of loader, one step per batch.
+  void train(DataLoader<T> &loader, float learningRate = 0.1f,
+             int epochs = 1);
+
+  // Returns the outputs for X (inference: dropout is the identity).
+  Matrix<T> act(const Matrix<T> &X);
+
+  // Mean squared error of the outputs out.
+  float loss(const Matrix<T> &out, const Matrix<T> &y) const;
+
+  // Sets the update rule of training (see Optimizer.h), with empty state.
+  void setOptimizer(OptimizerSettings settings);
+
+  // Returns the number of inputs and outputs.
+  size_t getInputSize() const;
+  size_t getOutputSize() const;
+
+  // Returns the layers.
+  const std::vector<Layer<T>> &getLayers() const;
+
+private:
+  // Widths of the inputs and of the outputs of every layer.
+  std::vector<size_t> widths_;
+  std::vector<Layer<T>> layers_;
+  Optimizer<T> optimizer_;
+
+  // Planned memory (see reserve): the outputs of every layer, the errors
+  // with respect to them and the buffers every layer declared.
+  size_t batchSize_ = 0;
+  std::vector<Matrix<T>> outputs_;
+  std::vector<Matrix<T>> deltas_;
+  std::vector<std::vector<Matrix<T>>> buffers_;
+
+  // Current batch of training data and labels.
+  Matrix<T> batchX_;
+  Matrix<T> batchY_;
+
+  // Runs the layers on X (training: fills their buffers). Returns the
+  // output of the network.
+  const Matrix<T> &forward(const Matrix<T> &X, bool training);
+
+  // Backpropagates the error of the outputs of the last forward pass on X
+  // in training and takes one step of the optimizer.
+  void step(const Matrix<T> &X, const Matrix<T> &y, float learningRate);
+};
@@ -0,0 +1,490 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include "./Half.h"
+#include "./Simd.h"
+#include "./Utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+// ____________________________________________________________________________
+// Instruction set detection:
+// ____________________________________________________________________________
+
+namespace {
+
+#if defined(__x86_64__) || defined(__i386__)
+// Returns the XCR0 register (which register states the OS saves).
+std::uint64_t readXcr0() {
+  std::uint32_t eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (static_cast<std::uint64_t>(edx) << 32) | eax;
+}
+#endif
+
+// Parses NN_SIMD, returns the highest level if unset or unknown.
+SimdLevel levelFromEnvironment() {
+  const char *env = std::getenv("NN_SIMD");
+  if (env == nullptr) {
+    return SimdLevel::AVX512;
+  }
+  std::string name(env);
+  for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::SSE2, SimdLevel::AVX2,
+                          SimdLevel::AVX512}) {
+    if (name == simdLevelName(level)) {
+      return level;
+    }
+  }
+  return SimdLevel::AVX512;
+}
+
+// Current cap of the level, -1 until first use.
+std::atomic<int> levelCap{-1};
+
+// Currently selected kernel tables, nullptr until first use.
+template <typename T> std::atomic<const SimdKernels<T> *> &activeKernels() {
+  static std::atomic<const SimdKernels<T> *> kernels{nullptr};
+  return kernels;
+}
+
+} // namespace
+
+// ____________________________________________________________________________
+SimdLevel detectSimdLevel() {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return SimdLevel::SCALAR;
+  }
+  const bool sse2 = edx & bit_SSE2;
+  const bool fma = ecx & bit_FMA;
+  const bool osxsave = ecx & bit_OSXSAVE;
+  if (!sse2) {
+    return SimdLevel::SCALAR;
+  }
+  if (!osxsave || !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    return SimdLevel::SSE2;
+  }
+  const bool avx2 = ebx & bit_AVX2;
+  const bool avx512f = ebx & bit_AVX512F;
+  const std::uint64_t xcr0 = readXcr0();
+  // XMM and YMM state (AVX), plus opmask and ZMM state (AVX-512).
+  const bool osAvx = (xcr0 & 0x6) == 0x6;
+  const bool osAvx512 = (xcr0 & 0xe6) == 0xe6;
+  if (avx512f && osAvx512) {
+    return SimdLevel::AVX512;
+  }
+  if (avx2 && fma && osAvx) {
+    return SimdLevel::AVX2;
+  }
+  return SimdLevel::SSE2;
+#else
+  return SimdLevel::SCALAR;
+#endif
+}
+
+// ____________________________________________________________________________
+SimdLevel simdLevel() {
+  static const SimdLevel detected = detectSimdLevel();
+  int cap = levelCap.load(std::memory_order_acquire);
+  if (cap < 0) {
+    cap = static_cast<int>(levelFromEnvironment());
+    levelCap.store(cap, std::memory_order_release);
+  }
+  return std::min(detected, static_cast<SimdLevel>(cap));
+}
+
+// ____________________________________________________________________________
+void setSimdLevel(SimdLevel level) {
+  levelCap.store(static_cast<int>(level), std::memory_order_release);
+  activeKernels<int>().store(nullptr, std::memory_order_release);
+  activeKernels<float>().store(nullptr, std::memory_order_release);
+  activeKernels<double>().store(nullptr, std::memory_order_release);
+}
+
+// ____________________________________________________________________________
+const char *simdLevelName(SimdLevel level) {
+  switch (level) {
+  case SimdLevel::SCALAR:
+    return "scalar";
+  case SimdLevel::SSE2:
+    return "sse2";
+  case SimdLevel::AVX2:
+    return "avx2";
+  case SimdLevel::AVX512:
+    return "avx512";
+  }
+  return "unknown";
+}
+
+// ____________________________________________________________________________
+// Scalar kernels:
+// ____________________________________________________________________________
+
+namespace {
+
+// Register tile of the portable GEMM micro-kernel.
+constexpr std::size_t kScalarMR = 4;
+constexpr std::size_t kScalarNR = 8;
+
+template <typename T>
+void scalarAdd(const T *a, const T *b, T *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = a[i] + b[i];
+  }
+}
+
+template <typename T>
+void scalarSub(const T *a, const T *b, T *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = a[i] - b[i];
+  }
+}
+
+template <typename T>
+void scalarMul(const T *a, const T *b, T *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = a[i] * b[i];
+  }
+}
+
+template <typename T>
+void scalarScale(const T *a, T scalar, T *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = a[i] * scalar;
+  }
+}
+
+template <typename T>
+void scalarAxpy(const T *a, T scalar, T *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] += a[i] * scalar;
+  }
+}
+
+template <typename T>
+void scalarMaximum(const T *a, T inf, T *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = a[i] < inf ? inf : a[i];
+  }
+}
+
+template <typename T> T scalarSum(const T *a, std::size_t n) {
+  T result = value<T>::zero();
+  for (std::size_t i = 0; i < n; ++i) {
+    result += a[i];
+  }
+  return result;
+}
+
+template <typename T> void scalarExp(const T *a, T *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = value<T>::e(a[i]);
+  }
+}
+
+template <typename T> void scalarRelu(const T *a, T *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = a[i] < value<T>::zero() ? value<T>::zero() : a[i];
+  }
+}
+
+template <typename T>
+void scalarReluDerivative(const T *a, T *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = (a[i] > value<T>::zero()) ? value<T>::one() : value<T>::zero();
+  }
+}
+
+template <typename T> void scalarStep(const T *a, T *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = (a[i] >= value<T>::zero()) ? value<T>::one() : value<T>::zero();
+  }
+}
+
+template <typename T> void scalarSigmoid(const T *a, T *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = value<T>::one() / (value<T>::one() + value<T>::e(-a[i]));
+  }
+}
+
+template <typename T>
+void scalarSigmoidDerivative(const T *a, T *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    T s = value<T>::one() / (value<T>::one() + value<T>::e(-a[i]));
+    out[i] = s * (value<T>::one() - s);
+  }
+}
+
+template <typename T> void scalarTanh(const T *a, T *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = value<T>::tanh(a[i]);
+  }
+}
+
+template <typename T>
+void scalarTanhDerivative(const T *a, T *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    T t = value<T>::tanh(a[i]);
+    out[i] = value<T>::one() - t * t;
+  }
+}
+
+// Largest of a[0], ..., a[n - 1] (n > 0).
+template <typename T> T rowMax(const T *a, std::size_t n) {
+  T result = a[0];
+  for (std::size_t i = 1; i < n; ++i) {
+    result = a[i] > result ? a[i] : result;
+  }
+  return result;
+}
+
+template <typename T> void scalarSoftmax(const T *a, T *out, std::size_t n) {
+  if (n == 0) {
+    return;
+  }
+  const T max = rowMax(a, n);
+  T total = value<T>::zero();
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = value<T>::e(a[i] - max);
+    total += out[i];
+  }
+  const T inverse = static_cast<T>(1) / total;
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] *= inverse;
+  }
+}
+
+template <typename T>
+T scalarSoftmaxCrossEntropy(const T *z, const T *y, T *gradient,
+                            std::size_t n) {
+  if (n == 0) {
+    return value<T>::zero();
+  }
+  const T max = rowMax(z, n);
+  T total = value<T>::zero();
+  T targets = value<T>::zero();
+  T weighted = value<T>::zero();
+  for (std::size_t i = 0; i < n; ++i) {
+    const T shifted = z[i] - max;
+    gradient[i] = value<T>::e(shifted);
+    total += gradient[i];
+    targets += y[i];
+    weighted += y[i] * shifted;
+  }
+  const T inverse = static_cast<T>(1) / total;
+  for (std::size_t i = 0; i < n; ++i) {
+    gradient[i] = gradient[i] * inverse - y[i];
+  }
+  return targets * static_cast<T>(std::log(total)) - weighted;
+}
+
+// Gradient of an optimizer step: scaled, plus the L2 weight decay.
+template <typename T>
+T stepGradient(T p, T g, const OptimizerStep<T> &step) {
+  return g * step.gradientScale + step.weightDecay * p;
+}
+
+template <typename T>
+void scalarSgdUpdate(T *p, const T *g, std::size_t n,
+                     const OptimizerStep<T> &step) {
+  for (std::size_t i = 0; i < n; ++i) {
+    p[i] -= step.learningRate * stepGradient(p[i], g[i], step);
+  }
+}
+
+template <typename T>
+void scalarMomentumUpdate(T *p, const T *g, T *v, std::size_t n,
+                          const OptimizerStep<T> &step) {
+  for (std::size_t i = 0; i < n; ++i) {
+    v[i] = step.momentum * v[i] + stepGradient(p[i], g[i], step);
+    p[i] -= step.learningRate * v[i];
+  }
+}
+
+template <typename T>
+void scalarAdamUpdate(T *p, const T *g, T *m, T *v, std::size_t n,
+                      const OptimizerStep<T> &step) {
+  const T one = 1;
+  for (std::size_t i = 0; i < n; ++i) {
+    const T gi = stepGradient(p[i], g[i], step);
+    m[i] = step.beta1 * m[i] + (one - step.beta1) * gi;
+    v[i] = step.beta2 * v[i] + (one - step.beta2) * (gi * gi);
+    const T denominator =
+        static_cast<T>(std::sqrt(v[i] * step.correction2)) + step.epsilon;
+    const T update =
+        m[i] * step.correction1 / denominator + step.decoupledDecay * p[i];
+    p[i] -= step.learningRate * update;
+  }
+}
+
+// Portable GEMM micro-kernel. The accumulators are a fixed size local array
+// the compiler keeps in registers; only the mr x nr valid part is written.
+template <typename T>
+void scalarGemmMicroKernel(std::size_t kc, const T *a, const T *b, T *C,
+                           std::size_t ldc, std::size_t mr, std::size_t nr,
+                           bool accumulate) {
+  T c[kScalarMR][kScalarNR] = {};
+  for (std::size_t p = 0; p < kc; ++p) {
+    for (std::size_t i = 0; i < kScalarMR; ++i) {
+      const T ai = a[p * kScalarMR + i];
+      for (std::size_t j = 0; j < kScalarNR; ++j) {
+        c[i][j] += ai * b[p * kScalarNR + j];
+      }
+    }
+  }
+  for (std::size_t i = 0; i < mr; ++i) {
+    T *row = C + i * ldc;
+    for (std::size_t j = 0; j < nr; ++j) {
+      row[j] = accumulate ? row[j] + c[i][j] : c[i][j];
+    }
+  }
+}
+
+void scalarInt8Dot(std::size_t k, const std::int8_t *a, const std::int8_t *b,
+                   std::size_t ldb, std::size_t nb, std::int32_t *out) {
+  for (std::size_t j = 0; j < nb; ++j) {
+    std::int32_t result = 0;
+    for (std::size_t p = 0; p < k; ++p) {
+      result += static_cast<std::int32_t>(a[p]) * b[j * ldb + p];
+    }
+    out[j] = result;
+  }
+}
+
+void scalarBf16ToFloat(const std::uint16_t *a, float *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = bf16ToFloat(a[i]);
+  }
+}
+
+void scalarFloatToBf16(const float *a, std::uint16_t *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = floatToBf16(a[i]);
+  }
+}
+
+void scalarFp16ToFloat(const std::uint16_t *a, float *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = fp16ToFloat(a[i]);
+  }
+}
+
+void scalarFloatToFp16(const float *a, std::uint16_t *out, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = floatToFp16(a[i]);
+  }
+}
+
+// Returns the table for level, falling back to lower levels.
+template <typename T> const SimdKernels<T> *selectKernels(SimdLevel level) {
+  static const SimdKernels<T> scalar = scalarKernels<T>();
+  const SimdKernels<T> *kernels = nullptr;
+  if constexpr (std::is_floating_point_v<T>) {
+    if (level >= SimdLevel::AVX512) {
+      kernels = avx512Kernels<T>();
+    }
+    if (kernels == nullptr && level >= SimdLevel::AVX2) {
+      kernels = avx2Kernels<T>();
+    }
+    if (kernels == nullptr && level >= SimdLevel::SSE2) {
+      kernels = sse2Kernels<T>();
+    }
+  }
+  return kernels != nullptr ? kernels : &scalar;
+}
+
+} // namespace
+
+// ____________________________________________________________________________
+template <typename T> SimdKernels<T> scalarKernels() {
+  SimdKernels<T> kernels;
+  kernels.add = &scalarAdd<T>;
+  kernels.sub = &scalarSub<T>;
+  kernels.mul = &scalarMul<T>;
+  kernels.scale = &scalarScale<T>;
+  kernels.axpy = &scalarAxpy<T>;
+  kernels.maximum = &scalarMaximum<T>;
+  kernels.sum = &scalarSum<T>;
+  kernels.exp = &scalarExp<T>;
+  kernels.relu = &scalarRelu<T>;
+  kernels.reluDerivative = &scalarReluDerivative<T>;
+  kernels.step = &scalarStep<T>;
+  kernels.sigmoid = &scalarSigmoid<T>;
+  kernels.sigmoidDerivative = &scalarSigmoidDerivative<T>;
+  kernels.tanh = &scalarTanh<T>;
+  kernels.tanhDerivative = &scalarTanhDerivative<T>;
+  kernels.softmax = &scalarSoftmax<T>;
+  kernels.softmaxCrossEntropy = &scalarSoftmaxCrossEntropy<T>;
+  kernels.sgdUpdate = &scalarSgdUpdate<T>;
+  kernels.momentumUpdate = &scalarMomentumUpdate<T>;
+  kernels.adamUpdate = &scalarAdamUpdate<T>;
+  kernels.gemmMR = kScalarMR;
+  kernels.gemmNR = kScalarNR;
+  kernels.gemmMicroKernel = &scalarGemmMicroKernel<T>;
+  return kernels;
+}
+
+// ____________________________________________________________________________
+template <typename T> const SimdKernels<T> &simdKernels() {
+  const SimdKernels<T> *kernels =
+      activeKernels<T>().load(std::memory_order_acquire);
+  if (kernels == nullptr) {
+    kernels = selectKernels<T>(simdLevel());
+    activeKernels<T>().store(kernels, std::memory_order_release);
+  }
+  return *kernels;
+}
+
+// ____________________________________________________________________________
+Int8Kernels scalarInt8Kernels() {
+  Int8Kernels kernels;
+  kernels.dot = &scalarInt8Dot;
+  return kernels;
+}
+
+// ____________________________________________________________________________
+const Int8Kernels &int8Kernels() {
+  static const Int8Kernels scalar = scalarInt8Kernels();
+  if (simdLevel() >= SimdLevel::AVX2 && avx2Int8Kernels() != nullptr) {
+    return *avx2Int8Kernels();
+  }
+  return scalar;
+}
+
+// ____________________________________________________________________________
+HalfKernels scalarHalfKernels() {
+  HalfKernels kernels;
+  kernels.bf16ToFloat = &scalarBf16ToFloat;
+  kernels.floatToBf16 = &scalarFloatToBf16;
+  kernels.fp16ToFloat = &scalarFp16ToFloat;
+  kernels.floatToFp16 = &scalarFloatToFp16;
+  return kernels;
+}
+
+// ____________________________________________________________________________
+const HalfKernels &halfKernels() {
+  static const HalfKernels scalar = scalarHalfKernels();
+  if (simdLevel() >= SimdLevel::AVX2 && avx2HalfKernels() != nullptr) {
+    return *avx2HalfKernels();
+  }
+  return scalar;
+}
+
+// ____________________________________________________________________________
+// Explicit instantiations for int, float and double.
+template SimdKernels<int> scalarKernels<int>();
+template SimdKernels<float> scalarKernels<float>();
+template SimdKernels<double> scalarKernels<double>();
+
+template const SimdKernels<int> &simdKernels<int>();
+template const SimdKernels<float> &simdKernels<float>();
+template const SimdKernels<double> &simdKernels<double>();
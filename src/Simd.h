@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Instruction set levels the kernels are compiled for.
+enum class SimdLevel { SCALAR, SSE2, AVX2, AVX512 };
+
+// Elementwise kernel out[i] = f(a[i]) on n elements.
+template <typename T>
+using UnaryKernel = void (*)(const T *a, T *out, std::size_t n);
+
+// ____________________________________________________________________________
+// Hyperparameters of one optimizer step, as the fused update kernels take
+// them (see Optimizer.h). With g = gradient * gradientScale + weightDecay * p
+// (L2 regularization) the kernels compute
+//   SGD:      p -= learningRate * g
+//   momentum: v = momentum * v + g,  p -= learningRate * v
+//   Adam:     m = beta1 * m + (1 - beta1) * g,
+//             v = beta2 * v + (1 - beta2) * g * g,
+//             p -= learningRate * (m * correction1 /
+//                  (sqrt(v * correction2) + epsilon) + decoupledDecay * p)
+// where correction1 and correction2 are the bias corrections
+// 1 / (1 - beta^t) and decoupledDecay is the weight decay of AdamW.
+template <typename T> struct OptimizerStep {
+  T learningRate;
+  T gradientScale;
+  T weightDecay;
+  T momentum;
+  T beta1;
+  T beta2;
+  T epsilon;
+  T correction1;
+  T correction2;
+  T decoupledDecay;
+};
+
+// ____________________________________________________________________________
+// Kernels on contiguous arrays of n elements, selected at startup for the
+// instruction set of the machine (see simdKernels()).
+//
+// All binary and unary kernels allow out to alias an input.
+//
+// Accuracy of the float exp based kernels (measured against double precision
+// std::exp / std::tanh, see SimdTest.cpp):
+//   exp:     <= 2 ULP (1 measured) for x in [-87, 88]; results below FLT_MIN
+//            flush to 0, inputs are clamped to [-88.38, 88.38].
+//   sigmoid: <= 3 ULP (3 measured) where sigmoid(x) >= FLT_MIN.
+//   tanh:    <= 3 ULP (1 measured); odd polynomial for |x| < 0.625, exp
+//            based otherwise.
+// The scalar kernels use std::exp / std::tanh and the double kernels are not
+// approximated.
+template <typename T> struct SimdKernels {
+  // out[i] = a[i] + b[i].
+  void (*add)(const T *a, const T *b, T *out, std::size_t n);
+  // out[i] = a[i] - b[i].
+  void (*sub)(const T *a, const T *b, T *out, std::size_t n);
+  // out[i] = a[i] * b[i].
+  void (*mul)(const T *a, const T *b, T *out, std::size_t n);
+  // out[i] = a[i] * scalar.
+  void (*scale)(const T *a, T scalar, T *out, std::size_t n);
+  // out[i] += a[i] * scalar.
+  void (*axpy)(const T *a, T scalar, T *out, std::size_t n);
+  // out[i] = max(a[i], inf).
+  void (*maximum)(const T *a, T inf, T *out, std::size_t n);
+  // Returns a[0] + ... + a[n - 1].
+  T (*sum)(const T *a, std::size_t n);
+
+  // Activations and their derivatives, out[i] = f(a[i]).
+  void (*exp)(const T *a, T *out, std::size_t n);
+  void (*relu)(const T *a, T *out, std::size_t n);
+  void (*reluDerivative)(const T *a, T *out, std::size_t n);
+  void (*step)(const T *a, T *out, std::size_t n);
+  void (*sigmoid)(const T *a, T *out, std::size_t n);
+  void (*sigmoidDerivative)(const T *a, T *out, std::size_t n);
+  void (*tanh)(const T *a, T *out, std::size_t n);
+  void (*tanhDerivative)(const T *a, T *out, std::size_t n);
+
+  // Softmax of one row: out[i] = exp(a[i] - max) / sum_j exp(a[j] - max),
+  // with max the largest a[j], so no exp overflows.
+  void (*softmax)(const T *a, T *out, std::size_t n);
+  // Fused log-softmax and cross-entropy of one row of logits z with targets
+  // y (class probabilities, e.g. one-hot): writes the gradient
+  // softmax(z)[i] - y[i] and returns -sum_i y[i] * log softmax(z)[i],
+  // computed as sum(y) * log(sum exp(z - max)) - sum(y * (z - max)).
+  // gradient may alias z, not y.
+  T (*softmaxCrossEntropy)(const T *z, const T *y, T *gradient,
+                           std::size_t n);
+
+  // Optimizer updates of n parameters p with gradients g in one pass,
+  // updating the optimizer state (v, or m and v) in place (see
+  // OptimizerStep).
+  void (*sgdUpdate)(T *p, const T *g, std::size_t n,
+                    const OptimizerStep<T> &step);
+  void (*momentumUpdate)(T *p, const T *g, T *v, std::size_t n,
+                         const OptimizerStep<T> &step);
+  void (*adamUpdate)(T *p, const T *g, T *m, T *v, std::size_t n,
+                     const OptimizerStep<T> &step);
+
+  // GEMM micro-kernel (see Gemm.cpp): computes the gemmMR x gemmNR tile
+  // a * b from packed slivers of depth kc and stores its mr x nr valid part
+  // to C (added to C if accumulate).
+  std::size_t gemmMR;
+  std::size_t gemmNR;
+  void (*gemmMicroKernel)(std::size_t kc, const T *a, const T *b, T *C,
+                          std::size_t ldc, std::size_t mr, std::size_t nr,
+                          bool accumulate);
+};
+
+// Returns the highest level supported by the CPU and the OS (CPUID, XGETBV).
+SimdLevel detectSimdLevel();
+
+// Returns the level the kernels currently run at. Defaults to
+// detectSimdLevel(), capped by the environment variable NN_SIMD
+// (scalar, sse2, avx2 or avx512) if set.
+SimdLevel simdLevel();
+
+// Caps the level the kernels run at (levels above detectSimdLevel() are
+// ignored). Not meant to be called while kernels are running.
+void setSimdLevel(SimdLevel level);
+
+// Returns "scalar", "sse2", "avx2" or "avx512".
+const char *simdLevelName(SimdLevel level);
+
+// Returns the kernels for the current simdLevel().
+template <typename T> const SimdKernels<T> &simdKernels();
+
+// ____________________________________________________________________________
+// Kernel tables per instruction set (used by simdKernels(), and by tests to
+// compare the paths). The SIMD tables are nullptr on non-x86 builds and only
+// exist for float and double.
+template <typename T> SimdKernels<T> scalarKernels();
+template <typename T> const SimdKernels<T> *sse2Kernels();
+template <typename T> const SimdKernels<T> *avx2Kernels();
+template <typename T> const SimdKernels<T> *avx512Kernels();
+
+// ____________________________________________________________________________
+// Integer kernels of quantized inference (see Quantization.h). They do not
+// depend on the element type, so they have their own table.
+struct Int8Kernels {
+  // out[j] = a[0] * b[j * ldb] + ... + a[k - 1] * b[j * ldb + k - 1] for
+  // j < nb (nb <= 4): dot products of a with nb rows of b, exact in int32.
+  void (*dot)(std::size_t k, const std::int8_t *a, const std::int8_t *b,
+              std::size_t ldb, std::size_t nb, std::int32_t *out);
+};
+
+// Returns the int8 kernels for the current simdLevel(). AVX-512F has no
+// byte and word instructions, so AVX2 and AVX-512 use the AVX2 kernels
+// (with AVX-VNNI if the CPU has it).
+const Int8Kernels &int8Kernels();
+
+// Int8 kernel tables per instruction set, like the tables above.
+Int8Kernels scalarInt8Kernels();
+const Int8Kernels *avx2Int8Kernels();
+
+// ____________________________________________________________________________
+// Conversions between float and the half width types (see Half.h), on the
+// raw 16-bit patterns. Like the int8 kernels they have their own table.
+struct HalfKernels {
+  void (*bf16ToFloat)(const std::uint16_t *a, float *out, std::size_t n);
+  void (*floatToBf16)(const float *a, std::uint16_t *out, std::size_t n);
+  void (*fp16ToFloat)(const std::uint16_t *a, float *out, std::size_t n);
+  void (*floatToFp16)(const float *a, std::uint16_t *out, std::size_t n);
+};
+
+// Returns the conversion kernels for the current simdLevel(). The float16
+// kernels need F16C (on every AVX2 CPU so far), AVX-512 uses the AVX2
+// kernels.
+const HalfKernels &halfKernels();
+
+// Conversion kernel tables per instruction set, like the tables above.
+HalfKernels scalarHalfKernels();
+const HalfKernels *avx2HalfKernels();
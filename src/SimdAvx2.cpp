@@ -0,0 +1,354 @@
+// AVX2 + FMA kernels, see SimdKernels.h.
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "./Half.h"
+#include "./Simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+namespace simd_avx2 {
+
+#define NN_SIMD_TARGET __attribute__((target("avx2,fma")))
+
+// ____________________________________________________________________________
+struct VecF {
+  using Scalar = float;
+  using Reg = __m256;
+  static constexpr std::size_t kWidth = 8;
+
+  NN_SIMD_TARGET static Reg load(const float *p) { return _mm256_loadu_ps(p); }
+  NN_SIMD_TARGET static void store(float *p, Reg x) {
+    _mm256_storeu_ps(p, x);
+  }
+  NN_SIMD_TARGET static Reg set1(float s) { return _mm256_set1_ps(s); }
+  NN_SIMD_TARGET static Reg add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+  NN_SIMD_TARGET static Reg sub(Reg a, Reg b) { return _mm256_sub_ps(a, b); }
+  NN_SIMD_TARGET static Reg mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+  NN_SIMD_TARGET static Reg div(Reg a, Reg b) { return _mm256_div_ps(a, b); }
+  NN_SIMD_TARGET static Reg sqrt(Reg x) { return _mm256_sqrt_ps(x); }
+  NN_SIMD_TARGET static Reg min(Reg a, Reg b) { return _mm256_min_ps(a, b); }
+  NN_SIMD_TARGET static Reg max(Reg a, Reg b) { return _mm256_max_ps(a, b); }
+  NN_SIMD_TARGET static Reg fmadd(Reg a, Reg b, Reg c) {
+    return _mm256_fmadd_ps(a, b, c);
+  }
+  NN_SIMD_TARGET static Reg floor(Reg x) { return _mm256_floor_ps(x); }
+  NN_SIMD_TARGET static Reg pow2n(Reg n) {
+    __m256i e =
+        _mm256_add_epi32(_mm256_cvttps_epi32(n), _mm256_set1_epi32(127));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+  }
+  NN_SIMD_TARGET static Reg greater(Reg x, Reg y, Reg a, Reg b) {
+    return _mm256_blendv_ps(b, a, _mm256_cmp_ps(x, y, _CMP_GT_OQ));
+  }
+  NN_SIMD_TARGET static Reg greaterEqual(Reg x, Reg y, Reg a, Reg b) {
+    return _mm256_blendv_ps(b, a, _mm256_cmp_ps(x, y, _CMP_GE_OQ));
+  }
+  NN_SIMD_TARGET static Reg abs(Reg x) {
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+  }
+  NN_SIMD_TARGET static Reg copySign(Reg magnitude, Reg sign) {
+    const Reg mask = _mm256_set1_ps(-0.0f);
+    return _mm256_or_ps(_mm256_andnot_ps(mask, magnitude),
+                        _mm256_and_ps(mask, sign));
+  }
+  NN_SIMD_TARGET static float reduceAdd(Reg x) {
+    __m128 s =
+        _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+  }
+};
+
+// ____________________________________________________________________________
+struct VecD {
+  using Scalar = double;
+  using Reg = __m256d;
+  static constexpr std::size_t kWidth = 4;
+
+  NN_SIMD_TARGET static Reg load(const double *p) {
+    return _mm256_loadu_pd(p);
+  }
+  NN_SIMD_TARGET static void store(double *p, Reg x) {
+    _mm256_storeu_pd(p, x);
+  }
+  NN_SIMD_TARGET static Reg set1(double s) { return _mm256_set1_pd(s); }
+  NN_SIMD_TARGET static Reg add(Reg a, Reg b) { return _mm256_add_pd(a, b); }
+  NN_SIMD_TARGET static Reg sub(Reg a, Reg b) { return _mm256_sub_pd(a, b); }
+  NN_SIMD_TARGET static Reg mul(Reg a, Reg b) { return _mm256_mul_pd(a, b); }
+  NN_SIMD_TARGET static Reg div(Reg a, Reg b) { return _mm256_div_pd(a, b); }
+  NN_SIMD_TARGET static Reg sqrt(Reg x) { return _mm256_sqrt_pd(x); }
+  NN_SIMD_TARGET static Reg fmadd(Reg a, Reg b, Reg c) {
+    return _mm256_fmadd_pd(a, b, c);
+  }
+  NN_SIMD_TARGET static Reg greater(Reg x, Reg y, Reg a, Reg b) {
+    return _mm256_blendv_pd(b, a, _mm256_cmp_pd(x, y, _CMP_GT_OQ));
+  }
+  NN_SIMD_TARGET static Reg greaterEqual(Reg x, Reg y, Reg a, Reg b) {
+    return _mm256_blendv_pd(b, a, _mm256_cmp_pd(x, y, _CMP_GE_OQ));
+  }
+  NN_SIMD_TARGET static double reduceAdd(Reg x) {
+    __m128d s =
+        _mm_add_pd(_mm256_castpd256_pd128(x), _mm256_extractf128_pd(x, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+  }
+};
+
+// 6 x 16 float and 6 x 8 double tiles: 12 accumulators of 16 registers.
+constexpr std::size_t kGemmRowsF = 6;
+constexpr std::size_t kGemmRowsD = 6;
+
+#include "./SimdKernels.h"
+
+// ____________________________________________________________________________
+// int8 dot products: 16 values per step, sign extended to int16 and
+// multiplied pairwise into int32 lanes (vpmaddwd, exact). With AVX-VNNI the
+// multiply and the add are one instruction (vpdpwssd). The VNNI kernel has
+// its own target, so the compiler cannot fuse the plain kernel into it.
+
+#define NN_VNNI_TARGET __attribute__((target("avx2,fma,avxvnni")))
+
+// Loads 16 int8 values sign extended to int16.
+NN_SIMD_TARGET inline __m256i loadInt8(const std::int8_t *p) {
+  return _mm256_cvtepi8_epi16(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+}
+
+// Sum of the int32 lanes of x.
+NN_SIMD_TARGET inline std::int32_t reduceAddInt32(__m256i x) {
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(x),
+                              _mm256_extracti128_si256(x, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+  return _mm_cvtsi128_si32(sum);
+}
+
+// Adds the products of the last k - begin values (fewer than 16) to out.
+inline void int8DotTail(std::size_t begin, std::size_t k,
+                        const std::int8_t *a, const std::int8_t *b,
+                        std::size_t ldb, std::size_t nb, std::int32_t *out) {
+  for (std::size_t j = 0; j < nb; ++j) {
+    for (std::size_t p = begin; p < k; ++p) {
+      out[j] += static_cast<std::int32_t>(a[p]) * b[j * ldb + p];
+    }
+  }
+}
+
+template <std::size_t NB>
+NN_SIMD_TARGET void int8DotRows(std::size_t k, const std::int8_t *a,
+                                const std::int8_t *b, std::size_t ldb,
+                                std::int32_t *out) {
+  __m256i acc[NB];
+  for (std::size_t j = 0; j < NB; ++j) {
+    acc[j] = _mm256_setzero_si256();
+  }
+  std::size_t p = 0;
+  for (; p + 16 <= k; p += 16) {
+    const __m256i x = loadInt8(a + p);
+#pragma GCC unroll 4
+    for (std::size_t j = 0; j < NB; ++j) {
+      const __m256i y = loadInt8(b + j * ldb + p);
+      acc[j] = _mm256_add_epi32(acc[j], _mm256_madd_epi16(x, y));
+    }
+  }
+  for (std::size_t j = 0; j < NB; ++j) {
+    out[j] = reduceAddInt32(acc[j]);
+  }
+  int8DotTail(p, k, a, b, ldb, NB, out);
+}
+
+template <std::size_t NB>
+NN_VNNI_TARGET void int8DotRowsVnni(std::size_t k, const std::int8_t *a,
+                                    const std::int8_t *b, std::size_t ldb,
+                                    std::int32_t *out) {
+  __m256i acc[NB];
+  for (std::size_t j = 0; j < NB; ++j) {
+    acc[j] = _mm256_setzero_si256();
+  }
+  std::size_t p = 0;
+  for (; p + 16 <= k; p += 16) {
+    const __m256i x = loadInt8(a + p);
+#pragma GCC unroll 4
+    for (std::size_t j = 0; j < NB; ++j) {
+      acc[j] = _mm256_dpwssd_avx_epi32(acc[j], x, loadInt8(b + j * ldb + p));
+    }
+  }
+  for (std::size_t j = 0; j < NB; ++j) {
+    out[j] = reduceAddInt32(acc[j]);
+  }
+  int8DotTail(p, k, a, b, ldb, NB, out);
+}
+
+void int8Dot(std::size_t k, const std::int8_t *a, const std::int8_t *b,
+             std::size_t ldb, std::size_t nb, std::int32_t *out) {
+  switch (nb) {
+  case 1:
+    return int8DotRows<1>(k, a, b, ldb, out);
+  case 2:
+    return int8DotRows<2>(k, a, b, ldb, out);
+  case 3:
+    return int8DotRows<3>(k, a, b, ldb, out);
+  default:
+    return int8DotRows<4>(k, a, b, ldb, out);
+  }
+}
+
+void int8DotVnni(std::size_t k, const std::int8_t *a, const std::int8_t *b,
+                 std::size_t ldb, std::size_t nb, std::int32_t *out) {
+  switch (nb) {
+  case 1:
+    return int8DotRowsVnni<1>(k, a, b, ldb, out);
+  case 2:
+    return int8DotRowsVnni<2>(k, a, b, ldb, out);
+  case 3:
+    return int8DotRowsVnni<3>(k, a, b, ldb, out);
+  default:
+    return int8DotRowsVnni<4>(k, a, b, ldb, out);
+  }
+}
+
+// Whether the CPU has AVX-VNNI (CPUID leaf 7, subleaf 1, EAX bit 4).
+bool hasAvxVnni() {
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx) && (eax & (1u << 4));
+}
+
+// ____________________________________________________________________________
+// Half width conversions, 8 values per step. bfloat16 is the upper half of a
+// float, so these are shifts (rounding to nearest even like floatToBf16);
+// float16 uses the F16C instructions.
+
+#define NN_F16C_TARGET __attribute__((target("avx2,fma,f16c")))
+
+NN_SIMD_TARGET void bf16ToFloat(const std::uint16_t *a, float *out,
+                                std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256i h = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                        _mm256_slli_epi32(h, 16));
+  }
+  for (; i < n; ++i) {
+    out[i] = ::bf16ToFloat(a[i]);
+  }
+}
+
+NN_SIMD_TARGET void floatToBf16(const float *a, std::uint16_t *out,
+                                std::size_t n) {
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i bias = _mm256_set1_epi32(0x7fff);
+  const __m256i quiet = _mm256_set1_epi32(0x40);
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 x = _mm256_loadu_ps(a + i);
+    const __m256i bits = _mm256_castps_si256(x);
+    const __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(bits, 16), one);
+    __m256i h = _mm256_srli_epi32(
+        _mm256_add_epi32(bits, _mm256_add_epi32(bias, lsb)), 16);
+    // NaN: the truncated bits with a quiet bit set.
+    const __m256i nan = _mm256_or_si256(_mm256_srli_epi32(bits, 16), quiet);
+    const __m256 unordered = _mm256_cmp_ps(x, x, _CMP_UNORD_Q);
+    h = _mm256_blendv_epi8(h, nan, _mm256_castps_si256(unordered));
+    // Pack the low 16 bits of the 8 lanes (packus works per 128-bit lane).
+    const __m256i packed = _mm256_permute4x64_epi64(
+        _mm256_packus_epi32(h, _mm256_setzero_si256()), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm256_castsi256_si128(packed));
+  }
+  for (; i < n; ++i) {
+    out[i] = ::floatToBf16(a[i]);
+  }
+}
+
+NN_F16C_TARGET void fp16ToFloat(const std::uint16_t *a, float *out,
+                                std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(out + i,
+                     _mm256_cvtph_ps(_mm_loadu_si128(
+                         reinterpret_cast<const __m128i *>(a + i))));
+  }
+  for (; i < n; ++i) {
+    out[i] = ::fp16ToFloat(a[i]);
+  }
+}
+
+NN_F16C_TARGET void floatToFp16(const float *a, std::uint16_t *out,
+                                std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm256_cvtps_ph(_mm256_loadu_ps(a + i),
+                                     _MM_FROUND_TO_NEAREST_INT));
+  }
+  for (; i < n; ++i) {
+    out[i] = ::floatToFp16(a[i]);
+  }
+}
+
+// Whether the CPU has F16C (CPUID leaf 1, ECX bit 29).
+bool hasF16c() {
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1u << 29));
+}
+
+#undef NN_F16C_TARGET
+#undef NN_VNNI_TARGET
+#undef NN_SIMD_TARGET
+
+} // namespace simd_avx2
+
+// ____________________________________________________________________________
+template <> const SimdKernels<float> *avx2Kernels<float>() {
+  return simd_avx2::floatKernels();
+}
+
+// ____________________________________________________________________________
+template <> const SimdKernels<double> *avx2Kernels<double>() {
+  return simd_avx2::doubleKernels();
+}
+
+// ____________________________________________________________________________
+const Int8Kernels *avx2Int8Kernels() {
+  static const Int8Kernels kernels = [] {
+    Int8Kernels k;
+    k.dot = simd_avx2::hasAvxVnni() ? &simd_avx2::int8DotVnni
+                                    : &simd_avx2::int8Dot;
+    return k;
+  }();
+  return &kernels;
+}
+
+// ____________________________________________________________________________
+const HalfKernels *avx2HalfKernels() {
+  static const HalfKernels kernels = [] {
+    HalfKernels k = scalarHalfKernels();
+    k.bf16ToFloat = &simd_avx2::bf16ToFloat;
+    k.floatToBf16 = &simd_avx2::floatToBf16;
+    if (simd_avx2::hasF16c()) {
+      k.fp16ToFloat = &simd_avx2::fp16ToFloat;
+      k.floatToFp16 = &simd_avx2::floatToFp16;
+    }
+    return k;
+  }();
+  return &kernels;
+}
+
+#else
+
+const Int8Kernels *avx2Int8Kernels() { return nullptr; }
+const HalfKernels *avx2HalfKernels() { return nullptr; }
+
+template <> const SimdKernels<float> *avx2Kernels<float>() { return nullptr; }
+template <> const SimdKernels<double> *avx2Kernels<double>() {
+  return nullptr;
+}
+
+#endif
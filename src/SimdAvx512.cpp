@@ -0,0 +1,153 @@
+// AVX-512F kernels, see SimdKernels.h.
+
+#include <cmath>
+#include <cstring>
+
+#include "./Simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// GCC 12 warns about the deliberately undefined registers inside its own
+// AVX-512 headers (at -O2 and up as "may be used uninitialized").
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include <immintrin.h>
+
+namespace simd_avx512 {
+
+#define NN_SIMD_TARGET __attribute__((target("avx512f")))
+
+// ____________________________________________________________________________
+// Bitwise float operations are AVX512DQ, so they go through the integer
+// domain here.
+struct VecF {
+  using Scalar = float;
+  using Reg = __m512;
+  static constexpr std::size_t kWidth = 16;
+
+  NN_SIMD_TARGET static Reg load(const float *p) { return _mm512_loadu_ps(p); }
+  NN_SIMD_TARGET static void store(float *p, Reg x) {
+    _mm512_storeu_ps(p, x);
+  }
+  NN_SIMD_TARGET static Reg set1(float s) { return _mm512_set1_ps(s); }
+  NN_SIMD_TARGET static Reg add(Reg a, Reg b) { return _mm512_add_ps(a, b); }
+  NN_SIMD_TARGET static Reg sub(Reg a, Reg b) { return _mm512_sub_ps(a, b); }
+  NN_SIMD_TARGET static Reg mul(Reg a, Reg b) { return _mm512_mul_ps(a, b); }
+  NN_SIMD_TARGET static Reg div(Reg a, Reg b) { return _mm512_div_ps(a, b); }
+  // Zero masked (sqrt, max, the extracts in reduceAdd): GCC 12 warns about
+  // the undefined source of the unmasked forms where they inline.
+  NN_SIMD_TARGET static Reg sqrt(Reg x) {
+    return _mm512_maskz_sqrt_ps(0xffff, x);
+  }
+  NN_SIMD_TARGET static Reg min(Reg a, Reg b) { return _mm512_min_ps(a, b); }
+  NN_SIMD_TARGET static Reg max(Reg a, Reg b) {
+    return _mm512_maskz_max_ps(0xffff, a, b);
+  }
+  NN_SIMD_TARGET static Reg fmadd(Reg a, Reg b, Reg c) {
+    return _mm512_fmadd_ps(a, b, c);
+  }
+  NN_SIMD_TARGET static Reg floor(Reg x) {
+    return _mm512_roundscale_ps(x, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+  }
+  NN_SIMD_TARGET static Reg pow2n(Reg n) {
+    __m512i e =
+        _mm512_add_epi32(_mm512_cvttps_epi32(n), _mm512_set1_epi32(127));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(e, 23));
+  }
+  NN_SIMD_TARGET static Reg greater(Reg x, Reg y, Reg a, Reg b) {
+    return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, y, _CMP_GT_OQ), b, a);
+  }
+  NN_SIMD_TARGET static Reg greaterEqual(Reg x, Reg y, Reg a, Reg b) {
+    return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, y, _CMP_GE_OQ), b, a);
+  }
+  NN_SIMD_TARGET static Reg abs(Reg x) {
+    return _mm512_castsi512_ps(_mm512_and_si512(
+        _mm512_castps_si512(x), _mm512_set1_epi32(0x7fffffff)));
+  }
+  NN_SIMD_TARGET static Reg copySign(Reg magnitude, Reg sign) {
+    const __m512i mask = _mm512_set1_epi32(0x7fffffff);
+    // Bitwise mask ? magnitude : sign.
+    return _mm512_castsi512_ps(
+        _mm512_ternarylogic_epi32(mask, _mm512_castps_si512(magnitude),
+                                  _mm512_castps_si512(sign), 0xca));
+  }
+  NN_SIMD_TARGET static float reduceAdd(Reg x) {
+    const __m512d bits = _mm512_castps_pd(x);
+    const __m256 half = _mm256_add_ps(
+        _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xf, bits, 0)),
+        _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xf, bits, 1)));
+    __m128 quarter = _mm_add_ps(_mm256_castps256_ps128(half),
+                                _mm256_extractf128_ps(half, 1));
+    quarter = _mm_add_ps(quarter, _mm_movehl_ps(quarter, quarter));
+    quarter = _mm_add_ss(quarter, _mm_movehdup_ps(quarter));
+    return _mm_cvtss_f32(quarter);
+  }
+};
+
+// ____________________________________________________________________________
+struct VecD {
+  using Scalar = double;
+  using Reg = __m512d;
+  static constexpr std::size_t kWidth = 8;
+
+  NN_SIMD_TARGET static Reg load(const double *p) {
+    return _mm512_loadu_pd(p);
+  }
+  NN_SIMD_TARGET static void store(double *p, Reg x) {
+    _mm512_storeu_pd(p, x);
+  }
+  NN_SIMD_TARGET static Reg set1(double s) { return _mm512_set1_pd(s); }
+  NN_SIMD_TARGET static Reg add(Reg a, Reg b) { return _mm512_add_pd(a, b); }
+  NN_SIMD_TARGET static Reg sub(Reg a, Reg b) { return _mm512_sub_pd(a, b); }
+  NN_SIMD_TARGET static Reg mul(Reg a, Reg b) { return _mm512_mul_pd(a, b); }
+  NN_SIMD_TARGET static Reg div(Reg a, Reg b) { return _mm512_div_pd(a, b); }
+  NN_SIMD_TARGET static Reg sqrt(Reg x) {
+    return _mm512_maskz_sqrt_pd(0xff, x);
+  }
+  NN_SIMD_TARGET static Reg fmadd(Reg a, Reg b, Reg c) {
+    return _mm512_fmadd_pd(a, b, c);
+  }
+  NN_SIMD_TARGET static Reg greater(Reg x, Reg y, Reg a, Reg b) {
+    return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, y, _CMP_GT_OQ), b, a);
+  }
+  NN_SIMD_TARGET static Reg greaterEqual(Reg x, Reg y, Reg a, Reg b) {
+    return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, y, _CMP_GE_OQ), b, a);
+  }
+  NN_SIMD_TARGET static double reduceAdd(Reg x) {
+    return _mm512_reduce_add_pd(x);
+  }
+};
+
+// 12 x 32 float and 12 x 16 double tiles: 24 accumulators of 32 registers.
+constexpr std::size_t kGemmRowsF = 12;
+constexpr std::size_t kGemmRowsD = 12;
+
+#include "./SimdKernels.h"
+
+#undef NN_SIMD_TARGET
+
+} // namespace simd_avx512
+
+// ____________________________________________________________________________
+template <> const SimdKernels<float> *avx512Kernels<float>() {
+  return simd_avx512::floatKernels();
+}
+
+// ____________________________________________________________________________
+template <> const SimdKernels<double> *avx512Kernels<double>() {
+  return simd_avx512::doubleKernels();
+}
+
+#else
+
+template <> const SimdKernels<float> *avx512Kernels<float>() {
+  return nullptr;
+}
+template <> const SimdKernels<double> *avx512Kernels<double>() {
+  return nullptr;
+}
+
+#endif
@@ -0,0 +1,546 @@
+// Generic SIMD kernel bodies.
+//
+// Intentionally no include guard: SimdSse2.cpp, SimdAvx2.cpp and
+// SimdAvx512.cpp each include this file once, inside their own namespace,
+// after defining
+//   NN_SIMD_TARGET  the target attribute of the instruction set,
+//   VecF, VecD      vector wrappers for float and double (load, store, set1,
+//                   add, sub, mul, reduceAdd, fmadd(a, b, c) = a * b + c,
+//                   greater(x, y, a, b) = x > y ? a : b, greaterEqual, div,
+//                   sqrt; VecF also min, max, floor, abs, copySign and
+//                   pow2n(n) = 2^n for integral n),
+//   kGemmRowsF/D    the micro-kernel heights for float and double.
+// Every function here carries NN_SIMD_TARGET, so the wrappers inline and
+// nothing compiled for a wider instruction set leaks into generic code.
+
+// ____________________________________________________________________________
+// Loop drivers, used directly as the binary and unary kernels. Full vectors
+// first, then the tail through a local buffer, so every element goes through
+// the same arithmetic.
+
+template <typename V, typename Op>
+NN_SIMD_TARGET void unaryLoop(const typename V::Scalar *a,
+                              typename V::Scalar *out, std::size_t n) {
+  using Scalar = typename V::Scalar;
+  std::size_t i = 0;
+  for (; i + V::kWidth <= n; i += V::kWidth) {
+    V::store(out + i, Op::template apply<V>(V::load(a + i)));
+  }
+  if (i < n) {
+    alignas(64) Scalar buffer[V::kWidth] = {};
+    std::memcpy(buffer, a + i, (n - i) * sizeof(Scalar));
+    V::store(buffer, Op::template apply<V>(V::load(buffer)));
+    std::memcpy(out + i, buffer, (n - i) * sizeof(Scalar));
+  }
+}
+
+template <typename V, typename Op>
+NN_SIMD_TARGET void binaryLoop(const typename V::Scalar *a,
+                               const typename V::Scalar *b,
+                               typename V::Scalar *out, std::size_t n) {
+  using Scalar = typename V::Scalar;
+  std::size_t i = 0;
+  for (; i + V::kWidth <= n; i += V::kWidth) {
+    V::store(out + i, Op::template apply<V>(V::load(a + i), V::load(b + i)));
+  }
+  if (i < n) {
+    alignas(64) Scalar bufferA[V::kWidth] = {};
+    alignas(64) Scalar bufferB[V::kWidth] = {};
+    std::memcpy(bufferA, a + i, (n - i) * sizeof(Scalar));
+    std::memcpy(bufferB, b + i, (n - i) * sizeof(Scalar));
+    V::store(bufferA,
+             Op::template apply<V>(V::load(bufferA), V::load(bufferB)));
+    std::memcpy(out + i, bufferA, (n - i) * sizeof(Scalar));
+  }
+}
+
+// ____________________________________________________________________________
+// Elementwise operations.
+
+struct AddOp {
+  template <typename V>
+  NN_SIMD_TARGET static typename V::Reg apply(typename V::Reg a,
+                                              typename V::Reg b) {
+    return V::add(a, b);
+  }
+};
+
+struct SubOp {
+  template <typename V>
+  NN_SIMD_TARGET static typename V::Reg apply(typename V::Reg a,
+                                              typename V::Reg b) {
+    return V::sub(a, b);
+  }
+};
+
+struct MulOp {
+  template <typename V>
+  NN_SIMD_TARGET static typename V::Reg apply(typename V::Reg a,
+                                              typename V::Reg b) {
+    return V::mul(a, b);
+  }
+};
+
+struct ReluOp {
+  template <typename V>
+  NN_SIMD_TARGET static typename V::Reg apply(typename V::Reg x) {
+    const typename V::Reg zero = V::set1(0);
+    return V::greater(zero, x, zero, x);
+  }
+};
+
+struct ReluDerivativeOp {
+  template <typename V>
+  NN_SIMD_TARGET static typename V::Reg apply(typename V::Reg x) {
+    return V::greater(x, V::set1(0), V::set1(1), V::set1(0));
+  }
+};
+
+struct StepOp {
+  template <typename V>
+  NN_SIMD_TARGET static typename V::Reg apply(typename V::Reg x) {
+    return V::greaterEqual(x, V::set1(0), V::set1(1), V::set1(0));
+  }
+};
+
+// ____________________________________________________________________________
+// Activations (the approximations are in SimdMath.h).
+
+#include "./SimdMath.h"
+
+struct ExpOp {
+  template <typename V>
+  NN_SIMD_TARGET static typename V::Reg apply(typename V::Reg x) {
+    return expApprox<V>(x);
+  }
+};
+
+struct SigmoidOp {
+  template <typename V>
+  NN_SIMD_TARGET static typename V::Reg apply(typename V::Reg x) {
+    return sigmoidApprox<V>(x);
+  }
+};
+
+struct SigmoidDerivativeOp {
+  template <typename V>
+  NN_SIMD_TARGET static typename V::Reg apply(typename V::Reg x) {
+    typename V::Reg s = sigmoidApprox<V>(x);
+    return V::mul(s, V::sub(V::set1(1.0f), s));
+  }
+};
+
+struct TanhOp {
+  template <typename V>
+  NN_SIMD_TARGET static typename V::Reg apply(typename V::Reg x) {
+    return tanhApprox<V>(x);
+  }
+};
+
+struct TanhDerivativeOp {
+  template <typename V>
+  NN_SIMD_TARGET static typename V::Reg apply(typename V::Reg x) {
+    typename V::Reg t = tanhApprox<V>(x);
+    return V::sub(V::set1(1.0f), V::mul(t, t));
+  }
+};
+
+// ____________________________________________________________________________
+// Kernels that do not fit the loop drivers.
+
+template <typename V>
+NN_SIMD_TARGET void scaleKernel(const typename V::Scalar *a,
+                                typename V::Scalar scalar,
+                                typename V::Scalar *out, std::size_t n) {
+  const typename V::Reg s = V::set1(scalar);
+  std::size_t i = 0;
+  for (; i + V::kWidth <= n; i += V::kWidth) {
+    V::store(out + i, V::mul(V::load(a + i), s));
+  }
+  for (; i < n; ++i) {
+    out[i] = a[i] * scalar;
+  }
+}
+
+template <typename V>
+NN_SIMD_TARGET void axpyKernel(const typename V::Scalar *a,
+                               typename V::Scalar scalar,
+                               typename V::Scalar *out, std::size_t n) {
+  const typename V::Reg s = V::set1(scalar);
+  std::size_t i = 0;
+  for (; i + V::kWidth <= n; i += V::kWidth) {
+    V::store(out + i, V::add(V::load(out + i), V::mul(V::load(a + i), s)));
+  }
+  for (; i < n; ++i) {
+    out[i] += a[i] * scalar;
+  }
+}
+
+template <typename V>
+NN_SIMD_TARGET void maximumKernel(const typename V::Scalar *a,
+                                  typename V::Scalar inf,
+                                  typename V::Scalar *out, std::size_t n) {
+  const typename V::Reg s = V::set1(inf);
+  std::size_t i = 0;
+  for (; i + V::kWidth <= n; i += V::kWidth) {
+    // Same comparison as the scalar loop, so NaNs pass through.
+    typename V::Reg x = V::load(a + i);
+    V::store(out + i, V::greater(s, x, s, x));
+  }
+  for (; i < n; ++i) {
+    out[i] = a[i] < inf ? inf : a[i];
+  }
+}
+
+template <typename V>
+NN_SIMD_TARGET typename V::Scalar sumKernel(const typename V::Scalar *a,
+                                            std::size_t n) {
+  // Four independent accumulators hide the add latency.
+  using Reg = typename V::Reg;
+  Reg acc0 = V::set1(0), acc1 = V::set1(0), acc2 = V::set1(0),
+      acc3 = V::set1(0);
+  std::size_t i = 0;
+  for (; i + 4 * V::kWidth <= n; i += 4 * V::kWidth) {
+    acc0 = V::add(acc0, V::load(a + i));
+    acc1 = V::add(acc1, V::load(a + i + V::kWidth));
+    acc2 = V::add(acc2, V::load(a + i + 2 * V::kWidth));
+    acc3 = V::add(acc3, V::load(a + i + 3 * V::kWidth));
+  }
+  for (; i + V::kWidth <= n; i += V::kWidth) {
+    acc0 = V::add(acc0, V::load(a + i));
+  }
+  typename V::Scalar result =
+      V::reduceAdd(V::add(V::add(acc0, acc1), V::add(acc2, acc3)));
+  for (; i < n; ++i) {
+    result += a[i];
+  }
+  return result;
+}
+
+// ____________________________________________________________________________
+// Softmax of a row and the fused softmax cross-entropy (float, exp based).
+// The exps of the shifted row are stored in the first pass, summed while
+// they are in registers, and normalized in a second pass. The tails go
+// through a buffer, like in unaryLoop.
+
+// Largest of a[0], ..., a[n - 1] (n > 0).
+template <typename V>
+NN_SIMD_TARGET typename V::Scalar maxKernel(const typename V::Scalar *a,
+                                            std::size_t n) {
+  using Scalar = typename V::Scalar;
+  typename V::Reg acc = V::set1(a[0]);
+  std::size_t i = 0;
+  for (; i + V::kWidth <= n; i += V::kWidth) {
+    acc = V::max(acc, V::load(a + i));
+  }
+  alignas(64) Scalar lanes[V::kWidth];
+  V::store(lanes, acc);
+  Scalar result = a[0];
+  for (Scalar x : lanes) {
+    result = x > result ? x : result;
+  }
+  for (; i < n; ++i) {
+    result = a[i] > result ? a[i] : result;
+  }
+  return result;
+}
+
+template <typename V>
+NN_SIMD_TARGET void softmaxKernel(const typename V::Scalar *a,
+                                  typename V::Scalar *out, std::size_t n) {
+  using Scalar = typename V::Scalar;
+  using Reg = typename V::Reg;
+  if (n == 0) {
+    return;
+  }
+  const Reg max = V::set1(maxKernel<V>(a, n));
+  Reg acc = V::set1(0);
+  std::size_t i = 0;
+  for (; i + V::kWidth <= n; i += V::kWidth) {
+    const Reg e = expApprox<V>(V::sub(V::load(a + i), max));
+    V::store(out + i, e);
+    acc = V::add(acc, e);
+  }
+  Scalar total = V::reduceAdd(acc);
+  if (i < n) {
+    alignas(64) Scalar buffer[V::kWidth] = {};
+    std::memcpy(buffer, a + i, (n - i) * sizeof(Scalar));
+    V::store(buffer, expApprox<V>(V::sub(V::load(buffer), max)));
+    for (std::size_t j = 0; j < n - i; ++j) {
+      out[i + j] = buffer[j];
+      total += buffer[j];
+    }
+  }
+  scaleKernel<V>(out, 1 / total, out, n);
+}
+
+template <typename V>
+NN_SIMD_TARGET typename V::Scalar
+softmaxCrossEntropyKernel(const typename V::Scalar *z,
+                          const typename V::Scalar *y,
+                          typename V::Scalar *gradient, std::size_t n) {
+  using Scalar = typename V::Scalar;
+  using Reg = typename V::Reg;
+  if (n == 0) {
+    return 0;
+  }
+  const Reg max = V::set1(maxKernel<V>(z, n));
+  Reg total = V::set1(0), targets = V::set1(0), weighted = V::set1(0);
+  std::size_t i = 0;
+  for (; i + V::kWidth <= n; i += V::kWidth) {
+    const Reg shifted = V::sub(V::load(z + i), max);
+    const Reg e = expApprox<V>(shifted);
+    const Reg yi = V::load(y + i);
+    V::store(gradient + i, e);
+    total = V::add(total, e);
+    targets = V::add(targets, yi);
+    weighted = V::fmadd(yi, shifted, weighted);
+  }
+  Scalar totalSum = V::reduceAdd(total);
+  Scalar targetSum = V::reduceAdd(targets);
+  Scalar weightedSum = V::reduceAdd(weighted);
+  if (i < n) {
+    // The padding targets are 0, only the padding exps need masking.
+    alignas(64) Scalar bufferZ[V::kWidth] = {};
+    alignas(64) Scalar bufferY[V::kWidth] = {};
+    std::memcpy(bufferZ, z + i, (n - i) * sizeof(Scalar));
+    std::memcpy(bufferY, y + i, (n - i) * sizeof(Scalar));
+    const Reg shifted = V::sub(V::load(bufferZ), max);
+    const Reg yi = V::load(bufferY);
+    targetSum += V::reduceAdd(yi);
+    weightedSum += V::reduceAdd(V::mul(yi, shifted));
+    V::store(bufferZ, expApprox<V>(shifted));
+    for (std::size_t j = 0; j < n - i; ++j) {
+      gradient[i + j] = bufferZ[j];
+      totalSum += bufferZ[j];
+    }
+  }
+  const Scalar inverse = 1 / totalSum;
+  const Reg inverseReg = V::set1(inverse);
+  i = 0;
+  for (; i + V::kWidth <= n; i += V::kWidth) {
+    V::store(gradient + i, V::sub(V::mul(V::load(gradient + i), inverseReg),
+                                  V::load(y + i)));
+  }
+  for (; i < n; ++i) {
+    gradient[i] = gradient[i] * inverse - y[i];
+  }
+  return targetSum * std::log(totalSum) - weightedSum;
+}
+
+// ____________________________________________________________________________
+// Fused optimizer updates (see OptimizerStep in Simd.h): every parameter,
+// gradient and state element is loaded and stored once per step. The tails
+// use the scalar formulas.
+
+// The hyperparameters of a step, broadcast to registers.
+template <typename V> struct OptimizerRegs {
+  using Reg = typename V::Reg;
+  Reg learningRate, gradientScale, weightDecay, momentum, beta1, beta2,
+      oneMinusBeta1, oneMinusBeta2, epsilon, correction1, correction2,
+      decoupledDecay;
+
+  NN_SIMD_TARGET explicit OptimizerRegs(
+      const OptimizerStep<typename V::Scalar> &step)
+      : learningRate(V::set1(step.learningRate)),
+        gradientScale(V::set1(step.gradientScale)),
+        weightDecay(V::set1(step.weightDecay)),
+        momentum(V::set1(step.momentum)), beta1(V::set1(step.beta1)),
+        beta2(V::set1(step.beta2)), oneMinusBeta1(V::set1(1 - step.beta1)),
+        oneMinusBeta2(V::set1(1 - step.beta2)),
+        epsilon(V::set1(step.epsilon)),
+        correction1(V::set1(step.correction1)),
+        correction2(V::set1(step.correction2)),
+        decoupledDecay(V::set1(step.decoupledDecay)) {}
+
+  // g * gradientScale + weightDecay * p.
+  NN_SIMD_TARGET Reg gradient(Reg p, Reg g) const {
+    return V::fmadd(weightDecay, p, V::mul(g, gradientScale));
+  }
+};
+
+template <typename V>
+NN_SIMD_TARGET void
+sgdUpdateKernel(typename V::Scalar *p, const typename V::Scalar *g,
+                std::size_t n, const OptimizerStep<typename V::Scalar> &step) {
+  const OptimizerRegs<V> r(step);
+  const typename V::Reg minusRate = V::sub(V::set1(0), r.learningRate);
+  std::size_t i = 0;
+  for (; i + V::kWidth <= n; i += V::kWidth) {
+    const typename V::Reg pi = V::load(p + i);
+    V::store(p + i, V::fmadd(minusRate, r.gradient(pi, V::load(g + i)), pi));
+  }
+  for (; i < n; ++i) {
+    p[i] -= step.learningRate *
+            (g[i] * step.gradientScale + step.weightDecay * p[i]);
+  }
+}
+
+template <typename V>
+NN_SIMD_TARGET void
+momentumUpdateKernel(typename V::Scalar *p, const typename V::Scalar *g,
+                     typename V::Scalar *v, std::size_t n,
+                     const OptimizerStep<typename V::Scalar> &step) {
+  const OptimizerRegs<V> r(step);
+  const typename V::Reg minusRate = V::sub(V::set1(0), r.learningRate);
+  std::size_t i = 0;
+  for (; i + V::kWidth <= n; i += V::kWidth) {
+    const typename V::Reg pi = V::load(p + i);
+    const typename V::Reg vi = V::fmadd(r.momentum, V::load(v + i),
+                                        r.gradient(pi, V::load(g + i)));
+    V::store(v + i, vi);
+    V::store(p + i, V::fmadd(minusRate, vi, pi));
+  }
+  for (; i < n; ++i) {
+    v[i] = step.momentum * v[i] +
+           (g[i] * step.gradientScale + step.weightDecay * p[i]);
+    p[i] -= step.learningRate * v[i];
+  }
+}
+
+template <typename V>
+NN_SIMD_TARGET void
+adamUpdateKernel(typename V::Scalar *p, const typename V::Scalar *g,
+                 typename V::Scalar *m, typename V::Scalar *v, std::size_t n,
+                 const OptimizerStep<typename V::Scalar> &step) {
+  using Reg = typename V::Reg;
+  using Scalar = typename V::Scalar;
+  const OptimizerRegs<V> r(step);
+  const Reg minusRate = V::sub(V::set1(0), r.learningRate);
+  std::size_t i = 0;
+  for (; i + V::kWidth <= n; i += V::kWidth) {
+    const Reg pi = V::load(p + i);
+    const Reg gi = r.gradient(pi, V::load(g + i));
+    const Reg mi =
+        V::fmadd(r.beta1, V::load(m + i), V::mul(r.oneMinusBeta1, gi));
+    const Reg vi = V::fmadd(r.beta2, V::load(v + i),
+                            V::mul(r.oneMinusBeta2, V::mul(gi, gi)));
+    const Reg denominator =
+        V::add(V::sqrt(V::mul(vi, r.correction2)), r.epsilon);
+    const Reg update =
+        V::fmadd(r.decoupledDecay, pi,
+                 V::div(V::mul(mi, r.correction1), denominator));
+    V::store(m + i, mi);
+    V::store(v + i, vi);
+    V::store(p + i, V::fmadd(minusRate, update, pi));
+  }
+  for (; i < n; ++i) {
+    const Scalar gi = g[i] * step.gradientScale + step.weightDecay * p[i];
+    m[i] = step.beta1 * m[i] + (1 - step.beta1) * gi;
+    v[i] = step.beta2 * v[i] + (1 - step.beta2) * (gi * gi);
+    const Scalar denominator =
+        std::sqrt(v[i] * step.correction2) + step.epsilon;
+    p[i] -= step.learningRate * (m[i] * step.correction1 / denominator +
+                                 step.decoupledDecay * p[i]);
+  }
+}
+
+// ____________________________________________________________________________
+// GEMM micro-kernel: an MR x (2 * kWidth) tile of C held in 2 * MR vector
+// registers. Per step of the shared dimension it loads two vectors of the
+// packed B sliver and broadcasts MR values of the packed A sliver.
+template <typename V, std::size_t MR>
+NN_SIMD_TARGET void gemmMicroKernel(std::size_t kc,
+                                    const typename V::Scalar *a,
+                                    const typename V::Scalar *b,
+                                    typename V::Scalar *C, std::size_t ldc,
+                                    std::size_t mr, std::size_t nr,
+                                    bool accumulate) {
+  using Scalar = typename V::Scalar;
+  using Reg = typename V::Reg;
+  constexpr std::size_t NR = 2 * V::kWidth;
+  Reg c0[MR];
+  Reg c1[MR];
+#pragma GCC unroll 16
+  for (std::size_t i = 0; i < MR; ++i) {
+    c0[i] = V::set1(0);
+    c1[i] = V::set1(0);
+  }
+  for (std::size_t p = 0; p < kc; ++p) {
+    const Reg b0 = V::load(b + p * NR);
+    const Reg b1 = V::load(b + p * NR + V::kWidth);
+#pragma GCC unroll 16
+    for (std::size_t i = 0; i < MR; ++i) {
+      const Reg ai = V::set1(a[p * MR + i]);
+      c0[i] = V::fmadd(ai, b0, c0[i]);
+      c1[i] = V::fmadd(ai, b1, c1[i]);
+    }
+  }
+  if (mr == MR && nr == NR) {
+#pragma GCC unroll 16
+    for (std::size_t i = 0; i < MR; ++i) {
+      Scalar *row = C + i * ldc;
+      if (accumulate) {
+        c0[i] = V::add(c0[i], V::load(row));
+        c1[i] = V::add(c1[i], V::load(row + V::kWidth));
+      }
+      V::store(row, c0[i]);
+      V::store(row + V::kWidth, c1[i]);
+    }
+    return;
+  }
+  // Edge tile: spill to a buffer and copy the valid part.
+  alignas(64) Scalar tile[NR];
+  for (std::size_t i = 0; i < mr; ++i) {
+    V::store(tile, c0[i]);
+    V::store(tile + V::kWidth, c1[i]);
+    Scalar *row = C + i * ldc;
+    for (std::size_t j = 0; j < nr; ++j) {
+      row[j] = accumulate ? row[j] + tile[j] : tile[j];
+    }
+  }
+}
+
+// ____________________________________________________________________________
+// Kernel tables.
+
+template <typename V>
+void fillCommon(SimdKernels<typename V::Scalar> &kernels) {
+  kernels.add = &binaryLoop<V, AddOp>;
+  kernels.sub = &binaryLoop<V, SubOp>;
+  kernels.mul = &binaryLoop<V, MulOp>;
+  kernels.scale = &scaleKernel<V>;
+  kernels.axpy = &axpyKernel<V>;
+  kernels.maximum = &maximumKernel<V>;
+  kernels.sum = &sumKernel<V>;
+  kernels.relu = &unaryLoop<V, ReluOp>;
+  kernels.reluDerivative = &unaryLoop<V, ReluDerivativeOp>;
+  kernels.step = &unaryLoop<V, StepOp>;
+  kernels.sgdUpdate = &sgdUpdateKernel<V>;
+  kernels.momentumUpdate = &momentumUpdateKernel<V>;
+  kernels.adamUpdate = &adamUpdateKernel<V>;
+}
+
+// Returns the float kernels of this instruction set.
+const SimdKernels<float> *floatKernels() {
+  static const SimdKernels<float> kernels = [] {
+    SimdKernels<float> k = scalarKernels<float>();
+    fillCommon<VecF>(k);
+    k.exp = &unaryLoop<VecF, ExpOp>;
+    k.sigmoid = &unaryLoop<VecF, SigmoidOp>;
+    k.sigmoidDerivative = &unaryLoop<VecF, SigmoidDerivativeOp>;
+    k.tanh = &unaryLoop<VecF, TanhOp>;
+    k.tanhDerivative = &unaryLoop<VecF, TanhDerivativeOp>;
+    k.softmax = &softmaxKernel<VecF>;
+    k.softmaxCrossEntropy = &softmaxCrossEntropyKernel<VecF>;
+    k.gemmMR = kGemmRowsF;
+    k.gemmNR = 2 * VecF::kWidth;
+    k.gemmMicroKernel = &gemmMicroKernel<VecF, kGemmRowsF>;
+    return k;
+  }();
+  return &kernels;
+}
+
+// Returns the double kernels of this instruction set. exp, sigmoid, tanh
+// and the softmax kernels stay scalar (std::exp / std::tanh) for double.
+const SimdKernels<double> *doubleKernels() {
+  static const SimdKernels<double> kernels = [] {
+    SimdKernels<double> k = scalarKernels<double>();
+    fillCommon<VecD>(k);
+    k.gemmMR = kGemmRowsD;
+    k.gemmNR = 2 * VecD::kWidth;
+    k.gemmMicroKernel = &gemmMicroKernel<VecD, kGemmRowsD>;
+    return k;
+  }();
+  return &kernels;
+}
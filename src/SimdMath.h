@@ -0,0 +1,58 @@
+// Vector approximations of exp, sigmoid and tanh for float.
+//
+// Intentionally no include guard, like SimdKernels.h (which includes this
+// file): included once inside the namespace of every instruction set, after
+// defining NN_SIMD_TARGET and the vector wrappers (see SimdKernels.h). Also
+// used by the activations of FixedNetwork.h with the SSE2 wrappers, so both
+// round the same.
+
+// ____________________________________________________________________________
+// exp(x) for float vectors (Cephes expf):
+// x = n * ln(2) + r with |r| <= ln(2) / 2, exp(r) by a degree 6 polynomial,
+// 2^n assembled in the exponent bits. ln(2) is split in two constants so
+// n * ln(2) is exact.
+template <typename V>
+NN_SIMD_TARGET typename V::Reg expApprox(typename V::Reg x) {
+  using Reg = typename V::Reg;
+  x = V::max(V::min(x, V::set1(88.3762626647949f)),
+             V::set1(-88.3762626647949f));
+  const Reg log2e = V::set1(1.44269504088896341f);
+  Reg n = V::floor(V::fmadd(x, log2e, V::set1(0.5f)));
+  Reg r = V::fmadd(n, V::set1(-0.693359375f), x);
+  r = V::fmadd(n, V::set1(2.12194440e-4f), r);
+  Reg p = V::set1(1.9875691500e-4f);
+  p = V::fmadd(p, r, V::set1(1.3981999507e-3f));
+  p = V::fmadd(p, r, V::set1(8.3334519073e-3f));
+  p = V::fmadd(p, r, V::set1(4.1665795894e-2f));
+  p = V::fmadd(p, r, V::set1(1.6666665459e-1f));
+  p = V::fmadd(p, r, V::set1(5.0000001201e-1f));
+  p = V::fmadd(p, V::mul(r, r), V::add(r, V::set1(1.0f)));
+  return V::mul(p, V::pow2n(n));
+}
+
+// sigmoid(x) = 1 / (1 + exp(-x)).
+template <typename V>
+NN_SIMD_TARGET typename V::Reg sigmoidApprox(typename V::Reg x) {
+  const typename V::Reg one = V::set1(1.0f);
+  return V::div(one, V::add(one, expApprox<V>(V::sub(V::set1(0.0f), x))));
+}
+
+// tanh(x): odd polynomial (Cephes tanhf) for |x| < 0.625, where the exp form
+// would cancel, and 1 - 2 / (exp(2|x|) + 1) with the sign of x otherwise.
+template <typename V>
+NN_SIMD_TARGET typename V::Reg tanhApprox(typename V::Reg x) {
+  using Reg = typename V::Reg;
+  const Reg one = V::set1(1.0f);
+  Reg ax = V::abs(x);
+  Reg z = V::mul(x, x);
+  Reg p = V::set1(-5.70498872745e-3f);
+  p = V::fmadd(p, z, V::set1(2.06390887954e-2f));
+  p = V::fmadd(p, z, V::set1(-5.37397155531e-2f));
+  p = V::fmadd(p, z, V::set1(1.33314422036e-1f));
+  p = V::fmadd(p, z, V::set1(-3.33332819422e-1f));
+  Reg small = V::fmadd(V::mul(p, z), x, x);
+  Reg e = expApprox<V>(V::add(ax, ax));
+  Reg large = V::sub(one, V::div(V::set1(2.0f), V::add(e, one)));
+  large = V::copySign(large, x);
+  return V::greaterEqual(ax, V::set1(0.625f), large, small);
+}
@@ -0,0 +1,43 @@
+// SSE2 kernels (the x86-64 baseline), see SimdKernels.h.
+
+#include <cmath>
+#include <cstring>
+
+#include "./Simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include "./SimdSse2.h"
+
+namespace simd_sse2 {
+
+#define NN_SIMD_TARGET __attribute__((target("sse2")))
+
+// 6 x 8 float and 6 x 4 double tiles: 12 accumulators of 16 registers.
+constexpr std::size_t kGemmRowsF = 6;
+constexpr std::size_t kGemmRowsD = 6;
+
+#include "./SimdKernels.h"
+
+#undef NN_SIMD_TARGET
+
+} // namespace simd_sse2
+
+// ____________________________________________________________________________
+template <> const SimdKernels<float> *sse2Kernels<float>() {
+  return simd_sse2::floatKernels();
+}
+
+// ____________________________________________________________________________
+template <> const SimdKernels<double> *sse2Kernels<double>() {
+  return simd_sse2::doubleKernels();
+}
+
+#else
+
+template <> const SimdKernels<float> *sse2Kernels<float>() { return nullptr; }
+template <> const SimdKernels<double> *sse2Kernels<double>() {
+  return nullptr;
+}
+
+#endif
@@ -0,0 +1,101 @@
+#pragma once
+
+// SSE2 vector wrappers (see SimdKernels.h) for float and double, used by
+// the SSE2 kernels (SimdSse2.cpp) and the activations of FixedNetwork.h.
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cstddef>
+#include <immintrin.h>
+
+namespace simd_sse2 {
+
+#define NN_SIMD_TARGET __attribute__((target("sse2")))
+
+// ____________________________________________________________________________
+struct VecF {
+  using Scalar = float;
+  using Reg = __m128;
+  static constexpr std::size_t kWidth = 4;
+
+  NN_SIMD_TARGET static Reg load(const float *p) { return _mm_loadu_ps(p); }
+  NN_SIMD_TARGET static void store(float *p, Reg x) { _mm_storeu_ps(p, x); }
+  NN_SIMD_TARGET static Reg set1(float s) { return _mm_set1_ps(s); }
+  NN_SIMD_TARGET static Reg add(Reg a, Reg b) { return _mm_add_ps(a, b); }
+  NN_SIMD_TARGET static Reg sub(Reg a, Reg b) { return _mm_sub_ps(a, b); }
+  NN_SIMD_TARGET static Reg mul(Reg a, Reg b) { return _mm_mul_ps(a, b); }
+  NN_SIMD_TARGET static Reg div(Reg a, Reg b) { return _mm_div_ps(a, b); }
+  NN_SIMD_TARGET static Reg sqrt(Reg x) { return _mm_sqrt_ps(x); }
+  NN_SIMD_TARGET static Reg min(Reg a, Reg b) { return _mm_min_ps(a, b); }
+  NN_SIMD_TARGET static Reg max(Reg a, Reg b) { return _mm_max_ps(a, b); }
+  // No FMA in SSE2.
+  NN_SIMD_TARGET static Reg fmadd(Reg a, Reg b, Reg c) {
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+  }
+  // No roundps in SSE2: truncate and correct negative values.
+  NN_SIMD_TARGET static Reg floor(Reg x) {
+    Reg t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f)));
+  }
+  NN_SIMD_TARGET static Reg pow2n(Reg n) {
+    __m128i e = _mm_add_epi32(_mm_cvttps_epi32(n), _mm_set1_epi32(127));
+    return _mm_castsi128_ps(_mm_slli_epi32(e, 23));
+  }
+  NN_SIMD_TARGET static Reg select(Reg mask, Reg a, Reg b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+  }
+  NN_SIMD_TARGET static Reg greater(Reg x, Reg y, Reg a, Reg b) {
+    return select(_mm_cmpgt_ps(x, y), a, b);
+  }
+  NN_SIMD_TARGET static Reg greaterEqual(Reg x, Reg y, Reg a, Reg b) {
+    return select(_mm_cmpge_ps(x, y), a, b);
+  }
+  NN_SIMD_TARGET static Reg abs(Reg x) {
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+  }
+  NN_SIMD_TARGET static Reg copySign(Reg magnitude, Reg sign) {
+    return select(_mm_set1_ps(-0.0f), sign, magnitude);
+  }
+  NN_SIMD_TARGET static float reduceAdd(Reg x) {
+    Reg s = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+  }
+};
+
+// ____________________________________________________________________________
+struct VecD {
+  using Scalar = double;
+  using Reg = __m128d;
+  static constexpr std::size_t kWidth = 2;
+
+  NN_SIMD_TARGET static Reg load(const double *p) { return _mm_loadu_pd(p); }
+  NN_SIMD_TARGET static void store(double *p, Reg x) { _mm_storeu_pd(p, x); }
+  NN_SIMD_TARGET static Reg set1(double s) { return _mm_set1_pd(s); }
+  NN_SIMD_TARGET static Reg add(Reg a, Reg b) { return _mm_add_pd(a, b); }
+  NN_SIMD_TARGET static Reg sub(Reg a, Reg b) { return _mm_sub_pd(a, b); }
+  NN_SIMD_TARGET static Reg mul(Reg a, Reg b) { return _mm_mul_pd(a, b); }
+  NN_SIMD_TARGET static Reg div(Reg a, Reg b) { return _mm_div_pd(a, b); }
+  NN_SIMD_TARGET static Reg sqrt(Reg x) { return _mm_sqrt_pd(x); }
+  NN_SIMD_TARGET static Reg fmadd(Reg a, Reg b, Reg c) {
+    return _mm_add_pd(_mm_mul_pd(a, b), c);
+  }
+  NN_SIMD_TARGET static Reg select(Reg mask, Reg a, Reg b) {
+    return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+  }
+  NN_SIMD_TARGET static Reg greater(Reg x, Reg y, Reg a, Reg b) {
+    return select(_mm_cmpgt_pd(x, y), a, b);
+  }
+  NN_SIMD_TARGET static Reg greaterEqual(Reg x, Reg y, Reg a, Reg b) {
+    return select(_mm_cmpge_pd(x, y), a, b);
+  }
+  NN_SIMD_TARGET static double reduceAdd(Reg x) {
+    return _mm_cvtsd_f64(_mm_add_sd(x, _mm_unpackhi_pd(x, x)));
+  }
+};
+
+#undef NN_SIMD_TARGET
+
+} // namespace simd_sse2
+
+#endif
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "./Half.h"
+#include "./Simd.h"
+#include "./SparseMatrix.h"
+#include "./ThreadPool.h"
+#include "./Utils.h"
+
+// ____________________________________________________________________________
+template <typename T>
+SparseMatrix<T>::SparseMatrix(std::size_t rows, std::size_t cols,
+                              std::vector<std::size_t> rowOffsets,
+                              std::vector<std::uint32_t> columns,
+                              std::vector<T> values)
+    : rows_(rows), cols_(cols), rowOffsets_(std::move(rowOffsets)),
+      columns_(std::move(columns)), values_(std::move(values)) {
+  if (rowOffsets_.size() != rows + 1 || rowOffsets_.front() != 0 ||
+      rowOffsets_.back() != values_.size() ||
+      columns_.size() != values_.size()) {
+    throw std::invalid_argument("Sparse matrix arrays do not match.");
+  }
+  if (cols > std::numeric_limits<std::uint32_t>::max()) {
+    throw std::invalid_argument("Sparse matrix has too many columns.");
+  }
+  for (std::size_t row = 0; row < rows; ++row) {
+    if (rowOffsets_[row] > rowOffsets_[row + 1]) {
+      throw std::invalid_argument("Sparse matrix row offsets decrease.");
+    }
+    for (std::size_t k = rowOffsets_[row]; k < rowOffsets_[row + 1]; ++k) {
+      if (columns_[k] >= cols ||
+          (k > rowOffsets_[row] && columns_[k] <= columns_[k - 1])) {
+        throw std::invalid_argument(
+            "Sparse matrix columns out of range or not increasing.");
+      }
+    }
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T>
+SparseMatrix<T>::SparseMatrix(const Matrix<T> &dense)
+    : rows_(dense.getRows()), cols_(dense.getCols()) {
+  if (cols_ > std::numeric_limits<std::uint32_t>::max()) {
+    throw std::invalid_argument("Sparse matrix has too many columns.");
+  }
+  rowOffsets_.reserve(rows_ + 1);
+  for (std::size_t row = 0; row < rows_; ++row) {
+    const T *values = dense[row];
+    for (std::size_t col = 0; col < cols_; ++col) {
+      if (values[col] != value<T>::zero()) {
+        columns_.push_back(static_cast<std::uint32_t>(col));
+        values_.push_back(values[col]);
+      }
+    }
+    rowOffsets_.push_back(values_.size());
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T> Matrix<T> SparseMatrix<T>::toDense() const {
+  Matrix<T> dense(rows_, cols_, InitState::ZERO);
+  for (std::size_t row = 0; row < rows_; ++row) {
+    for (std::size_t k = rowOffsets_[row]; k < rowOffsets_[row + 1]; ++k) {
+      dense[row][columns_[k]] = values_[k];
+    }
+  }
+  return dense;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void SparseMatrix<T>::selectRows(const std::size_t *indices, std::size_t count,
+                                 SparseMatrix<T> &out) const {
+  out.rows_ = count;
+  out.cols_ = cols_;
+  out.rowOffsets_.resize(1);
+  out.columns_.clear();
+  out.values_.clear();
+  for (std::size_t i = 0; i < count; ++i) {
+    if (indices[i] >= rows_) {
+      throw std::invalid_argument("Sparse matrix row out of range.");
+    }
+    const std::size_t begin = rowOffsets_[indices[i]];
+    const std::size_t end = rowOffsets_[indices[i] + 1];
+    out.columns_.insert(out.columns_.end(), columns_.begin() + begin,
+                        columns_.begin() + end);
+    out.values_.insert(out.values_.end(), values_.begin() + begin,
+                       values_.begin() + end);
+    out.rowOffsets_.push_back(out.values_.size());
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T, typename TB>
+void sparseDot(const SparseMatrix<T> &A, const Matrix<TB> &B, Matrix<T> &C,
+               const GemmEpilogue<T> *epilogue) {
+  if (A.getCols() != B.getRows()) {
+    throw std::invalid_argument(
+        "Matrices dimensions do not match for multiplication.");
+  }
+  const std::size_t m = A.getRows();
+  const std::size_t n = B.getCols();
+  if (C.getRows() != m || C.getCols() != n) {
+    C.resize(m, n);
+  }
+  const std::vector<std::size_t> &offsets = A.getRowOffsets();
+  const std::vector<std::uint32_t> &columns = A.getColumns();
+  const std::vector<T> &values = A.getValues();
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  const T *bias = epilogue != nullptr ? epilogue->bias : nullptr;
+
+  // About kParallelGrain multiply-adds per range of rows.
+  const std::size_t nonZerosPerRow =
+      std::max<std::size_t>(1, A.getNonZeros() / std::max<std::size_t>(1, m));
+  const std::size_t grain =
+      std::max<std::size_t>(1, kParallelGrain / (n * nonZerosPerRow));
+  parallelFor(m, grain, [&](std::size_t begin, std::size_t end) {
+    // Half width rows of B are widened here first, into a buffer of the
+    // thread that only grows.
+    [[maybe_unused]] T *widened = nullptr;
+    if constexpr (!std::is_same_v<TB, T>) {
+      thread_local std::vector<T> buffer;
+      if (buffer.size() < n) {
+        buffer.resize(n);
+      }
+      widened = buffer.data();
+    }
+    for (std::size_t row = begin; row < end; ++row) {
+      T *c = C[row];
+      if (bias != nullptr) {
+        std::copy_n(bias, n, c);
+      } else {
+        std::fill_n(c, n, value<T>::zero());
+      }
+      for (std::size_t k = offsets[row]; k < offsets[row + 1]; ++k) {
+        if constexpr (std::is_same_v<TB, T>) {
+          kernels.axpy(B[columns[k]], values[k], c, n);
+        } else {
+          convert(B[columns[k]], widened, n);
+          kernels.axpy(widened, values[k], c, n);
+        }
+      }
+      if (epilogue != nullptr) {
+        if (epilogue->Z != nullptr) {
+          std::copy_n(c, n, epilogue->Z + row * epilogue->ldz);
+        }
+        if (epilogue->activation != nullptr) {
+          epilogue->activation(c, c, n);
+        }
+      }
+    }
+  });
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void sparseTransposeDot(const SparseMatrix<T> &A, const Matrix<T> &D,
+                        SparseRows<T> &out) {
+  if (D.getRows() != A.getRows()) {
+    throw std::invalid_argument(
+        "Matrices dimensions do not match for multiplication.");
+  }
+  const std::vector<std::size_t> &offsets = A.getRowOffsets();
+  const std::vector<std::uint32_t> &columns = A.getColumns();
+  const std::vector<T> &values = A.getValues();
+  const std::size_t n = D.getCols();
+
+  // The rows of the gradient: the columns A uses.
+  out.rows.assign(columns.begin(), columns.end());
+  std::sort(out.rows.begin(), out.rows.end());
+  out.rows.erase(std::unique(out.rows.begin(), out.rows.end()),
+                 out.rows.end());
+  const std::size_t numRows = out.rows.size();
+  if (numRows == 0) {
+    return;
+  }
+  auto position = [&](std::uint32_t column) {
+    return static_cast<std::size_t>(
+        std::lower_bound(out.rows.begin(), out.rows.end(), column) -
+        out.rows.begin());
+  };
+
+  // Counting sort of the non-zeros by row of the gradient, keeping the
+  // order of the rows of A (and so of D) within each.
+  out.offsets.assign(numRows + 1, 0);
+  for (std::uint32_t column : columns) {
+    ++out.offsets[position(column) + 1];
+  }
+  for (std::size_t i = 0; i < numRows; ++i) {
+    out.offsets[i + 1] += out.offsets[i];
+  }
+  out.sources.resize(A.getNonZeros());
+  out.scales.resize(A.getNonZeros());
+  for (std::size_t row = 0; row < A.getRows(); ++row) {
+    for (std::size_t k = offsets[row]; k < offsets[row + 1]; ++k) {
+      const std::size_t target = out.offsets[position(columns[k])]++;
+      out.sources[target] = static_cast<std::uint32_t>(row);
+      out.scales[target] = values[k];
+    }
+  }
+  // (Every offset moved to the end of its group, shift them back.)
+  for (std::size_t i = numRows; i > 0; --i) {
+    out.offsets[i] = out.offsets[i - 1];
+  }
+  out.offsets[0] = 0;
+
+  if (out.values.getRows() != numRows || out.values.getCols() != n) {
+    out.values.resize(numRows, n);
+  }
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  const std::size_t nonZerosPerRow =
+      std::max<std::size_t>(1, A.getNonZeros() / numRows);
+  const std::size_t grain =
+      std::max<std::size_t>(1, kParallelGrain / (n * nonZerosPerRow));
+  parallelFor(numRows, grain, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      T *gradient = out.values[i];
+      std::fill_n(gradient, n, value<T>::zero());
+      for (std::size_t k = out.offsets[i]; k < out.offsets[i + 1]; ++k) {
+        kernels.axpy(D[out.sources[k]], out.scales[k], gradient, n);
+      }
+    }
+  });
+}
+
+// ____________________________________________________________________________
+// Explicit instantiations for float (with float, bfloat16 and float16
+// weights).
+template class SparseMatrix<float>;
+template void sparseDot<float>(const SparseMatrix<float> &A,
+                               const Matrix<float> &B, Matrix<float> &C,
+                               const GemmEpilogue<float> *epilogue);
+template void sparseDot<float, bfloat16>(const SparseMatrix<float> &A,
+                                         const Matrix<bfloat16> &B,
+                                         Matrix<float> &C,
+                                         const GemmEpilogue<float> *epilogue);
+template void sparseDot<float, float16>(const SparseMatrix<float> &A,
+                                        const Matrix<float16> &B,
+                                        Matrix<float> &C,
+                                        const GemmEpilogue<float> *epilogue);
+template void sparseTransposeDot<float>(const SparseMatrix<float> &A,
+                                        const Matrix<float> &D,
+                                        SparseRows<float> &out);
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "./Gemm.h"
+#include "./Matrix.h"
+
+// ____________________________________________________________________________
+// Sparse matrix in compressed sparse row (CSR) format, for inputs that are
+// mostly zero (e.g. hashed bag-of-words or one-hot features):
+//
+//   the non-zeros of row r are values[k] in column columns[k] for
+//   rowOffsets[r] <= k < rowOffsets[r + 1], with increasing columns.
+//
+// Memory and the work of sparseDot are proportional to the number of
+// non-zeros, not to rows x cols. NeuralNetwork::train and act take sparse
+// inputs directly.
+template <typename T> class SparseMatrix {
+public:
+  // A 0 x 0 matrix.
+  SparseMatrix() = default;
+
+  // Takes the CSR arrays. Throws std::invalid_argument if they are not
+  // consistent (rows + 1 increasing offsets starting at 0, as many columns
+  // as values, columns < cols and increasing within every row).
+  SparseMatrix(std::size_t rows, std::size_t cols,
+               std::vector<std::size_t> rowOffsets,
+               std::vector<std::uint32_t> columns, std::vector<T> values);
+
+  // The non-zeros of dense.
+  explicit SparseMatrix(const Matrix<T> &dense);
+
+  // Returns the dense matrix.
+  Matrix<T> toDense() const;
+
+  // Copies the rows indices[0], ..., indices[count - 1] to out (a
+  // mini-batch), reusing its buffers.
+  void selectRows(const std::size_t *indices, std::size_t count,
+                  SparseMatrix<T> &out) const;
+
+  // Returns the number of rows, columns and non-zeros.
+  std::size_t getRows() const { return rows_; }
+  std::size_t getCols() const { return cols_; }
+  std::size_t getNonZeros() const { return values_.size(); }
+
+  // Returns the CSR arrays.
+  const std::vector<std::size_t> &getRowOffsets() const { return rowOffsets_; }
+  const std::vector<std::uint32_t> &getColumns() const { return columns_; }
+  const std::vector<T> &getValues() const { return values_; }
+
+private:
+  std::size_t rows_ = 0;
+  std::size_t cols_ = 0;
+  std::vector<std::size_t> rowOffsets_ = {0};
+  std::vector<std::uint32_t> columns_;
+  std::vector<T> values_;
+};
+
+// ____________________________________________________________________________
+// Rows of a matrix (e.g. a weight gradient) of which only a few are not
+// zero: the gradient of the weights a sparse input is multiplied with only
+// has rows for the columns the input uses (see sparseTransposeDot).
+template <typename T> struct SparseRows {
+  // Indices of the rows, increasing.
+  std::vector<std::uint32_t> rows;
+  // The rows, rows.size() x cols (not resized if rows is empty).
+  Matrix<T> values;
+  // Scratch: the non-zeros of the input grouped by the row of values they
+  // add to (the transposed input), row i of the input and its value for
+  // offsets[i] <= k < offsets[i + 1].
+  std::vector<std::size_t> offsets;
+  std::vector<std::uint32_t> sources;
+  std::vector<T> scales;
+};
+
+// ____________________________________________________________________________
+// Sparse x dense product, C = dot(A, B) (resized to A.getRows() x
+// B.getCols() if needed), followed by the epilogue, if given (see Gemm.h).
+// Every row of C is the sum of the rows of B picked by the non-zeros of the
+// row of A, scaled by them (SimdKernels::axpy), while it stays in cache;
+// the epilogue runs on it right after. The rows of C are split between the
+// threads of the pool. B may be stored as bfloat16 or float16 (TB, see
+// Half.h); its rows are converted to float before they are added.
+template <typename T, typename TB = T>
+void sparseDot(const SparseMatrix<T> &A, const Matrix<TB> &B, Matrix<T> &C,
+               const GemmEpilogue<T> *epilogue = nullptr);
+
+// Gradient of the B of sparseDot: dot(A^T, D) for D of A.getRows() rows.
+// Only the rows of the columns A uses can be non-zero, so only those are
+// computed, into out (see SparseRows). The non-zeros of A are first
+// grouped by column (a counting sort, which transposes A); then every row
+// of out is the sum of the rows of D its non-zeros pick, built while it
+// stays in cache. The rows of out are split between the threads of the pool, so
+// no two threads write to the same row.
+template <typename T>
+void sparseTransposeDot(const SparseMatrix<T> &A, const Matrix<T> &D,
+                        SparseRows<T> &out);
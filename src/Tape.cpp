@@ -0,0 +1,770 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include "./Gemm.h"
+#include "./Simd.h"
+#include "./Tape.h"
+#include "./Utils.h"
+
+namespace {
+
+// Step after every step of a run (values that must outlive the run).
+constexpr std::size_t kEndOfRun = std::numeric_limits<std::size_t>::max();
+
+// ____________________________________________________________________________
+// Copies X to out (same shape).
+template <typename T> void copyRows(const Matrix<T> &X, Matrix<T> &out) {
+  forEachRow(X, out,
+             [](const T *a, T *o, std::size_t n) { std::copy(a, a + n, o); });
+}
+
+// ____________________________________________________________________________
+// Writes the sums of the columns of X to out (1 x cols).
+template <typename T> void sumColumns(const Matrix<T> &X, Matrix<T> &out) {
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  std::fill(out.data(), out.data() + X.getCols(), value<T>::zero());
+  for (std::size_t row = 0; row < X.getRows(); ++row) {
+    kernels.add(out.data(), X[row], out.data(), X.getCols());
+  }
+}
+
+} // namespace
+
+// ____________________________________________________________________________
+// Recording:
+// ____________________________________________________________________________
+
+// ____________________________________________________________________________
+template <typename T>
+typename Tape<T>::Var Tape<T>::input(const Matrix<T> &X) {
+  Node n{Op::INPUT};
+  n.rows = X.getRows();
+  n.cols = X.getCols();
+  n.input = &X;
+  return record(n);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+typename Tape<T>::Var Tape<T>::parameter(Matrix<T> &W) {
+  Node n{Op::PARAMETER};
+  n.rows = W.getRows();
+  n.cols = W.getCols();
+  n.parameter = &W;
+  return record(n);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+typename Tape<T>::Var Tape<T>::dot(Var a, Var b) {
+  if (node(a).cols != node(b).rows) {
+    throw std::invalid_argument(
+        "Matrices dimensions do not match for multiplication.");
+  }
+  Node n{Op::DOT, a.id, b.id};
+  n.rows = node(a).rows;
+  n.cols = node(b).cols;
+  return record(n);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+typename Tape<T>::Var Tape<T>::add(Var a, Var b) {
+  const Node &A = node(a);
+  const Node &B = node(b);
+  if (A.cols != B.cols || (A.rows != B.rows && B.rows != 1)) {
+    throw std::invalid_argument(
+        "Matrices dimensions do not match for addition.");
+  }
+  Node n{Op::ADD, a.id, b.id};
+  n.rows = A.rows;
+  n.cols = A.cols;
+  return record(n);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+typename Tape<T>::Var Tape<T>::sub(Var a, Var b) {
+  const Node &A = node(a);
+  const Node &B = node(b);
+  if (A.cols != B.cols || (A.rows != B.rows && B.rows != 1)) {
+    throw std::invalid_argument(
+        "Matrices dimensions do not match for subtraction.");
+  }
+  Node n{Op::SUB, a.id, b.id};
+  n.rows = A.rows;
+  n.cols = A.cols;
+  return record(n);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+typename Tape<T>::Var Tape<T>::mul(Var a, Var b) {
+  if (node(a).rows != node(b).rows || node(a).cols != node(b).cols) {
+    throw std::invalid_argument(
+        "Matrices dimensions do not match for elementwise multiplication.");
+  }
+  Node n{Op::MUL, a.id, b.id};
+  n.rows = node(a).rows;
+  n.cols = node(a).cols;
+  return record(n);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+typename Tape<T>::Var Tape<T>::scale(Var a, T scalar) {
+  Node n{Op::SCALE, a.id};
+  n.rows = node(a).rows;
+  n.cols = node(a).cols;
+  n.scalar = scalar;
+  return record(n);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+typename Tape<T>::Var Tape<T>::maximum(Var a, T inf) {
+  Node n{Op::MAXIMUM, a.id};
+  n.rows = node(a).rows;
+  n.cols = node(a).cols;
+  n.scalar = inf;
+  return record(n);
+}
+
+// ____________________________________________________________________________
+template <typename T> typename Tape<T>::Var Tape<T>::transpose(Var a) {
+  Node n{Op::TRANSPOSE, a.id};
+  n.rows = node(a).cols;
+  n.cols = node(a).rows;
+  return record(n);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+typename Tape<T>::Var Tape<T>::activation(Var a, Activation activation) {
+  Node n{Op::ACTIVATION, a.id};
+  n.rows = node(a).rows;
+  n.cols = node(a).cols;
+  n.activation = activation;
+  return record(n);
+}
+
+// ____________________________________________________________________________
+template <typename T> typename Tape<T>::Var Tape<T>::sum(Var a) {
+  node(a);
+  Node n{Op::SUM, a.id};
+  n.rows = 1;
+  n.cols = 1;
+  return record(n);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+typename Tape<T>::Var Tape<T>::softmaxCrossEntropy(Var logits, Var targets) {
+  if (node(logits).rows != node(targets).rows ||
+      node(logits).cols != node(targets).cols) {
+    throw std::invalid_argument(
+        "Dimensions of logits and targets do not match.");
+  }
+  if (node(targets).requiresGrad) {
+    throw std::invalid_argument(
+        "Targets of the cross-entropy must not depend on a parameter.");
+  }
+  Node n{Op::SOFTMAX_CROSS_ENTROPY, logits.id, targets.id};
+  n.rows = 1;
+  n.cols = 1;
+  return record(n);
+}
+
+// ____________________________________________________________________________
+template <typename T> void Tape<T>::keep(Var v) {
+  node(v);
+  nodes_[v.id].kept = true;
+  // The lifetimes change, plan again.
+  forwardPlan_.numNodes = 0;
+  backwardPlan_.numNodes = 0;
+}
+
+// ____________________________________________________________________________
+template <typename T> typename Tape<T>::Var Tape<T>::record(Node n) {
+  n.requiresGrad = n.op == Op::PARAMETER ||
+                   (n.a != kNone && nodes_[n.a].requiresGrad) ||
+                   (n.b != kNone && nodes_[n.b].requiresGrad);
+  nodes_.push_back(n);
+  return Var{nodes_.size() - 1};
+}
+
+// ____________________________________________________________________________
+template <typename T>
+const typename Tape<T>::Node &Tape<T>::node(Var v) const {
+  if (v.id >= nodes_.size()) {
+    throw std::invalid_argument("Not a node of this tape");
+  }
+  return nodes_[v.id];
+}
+
+// ____________________________________________________________________________
+// Planning:
+// ____________________________________________________________________________
+
+// ____________________________________________________________________________
+template <typename T>
+void Tape<T>::makePlan(Plan &plan, std::size_t root, bool training) {
+  const std::size_t numNodes = nodes_.size();
+  auto isLeaf = [&](std::size_t n) {
+    return nodes_[n].op == Op::INPUT || nodes_[n].op == Op::PARAMETER;
+  };
+
+  // Nodes the root depends on (inputs are always recorded before).
+  std::vector<char> needed(numNodes, 0);
+  needed[root] = 1;
+  for (std::size_t n = root + 1; n-- > 0;) {
+    if (needed[n]) {
+      if (nodes_[n].a != kNone) {
+        needed[nodes_[n].a] = 1;
+      }
+      if (nodes_[n].b != kNone) {
+        needed[nodes_[n].b] = 1;
+      }
+    }
+  }
+
+  // Steps: the forward steps in recording order, then the backward steps in
+  // reverse order.
+  std::vector<std::size_t> forwardStep(numNodes, kNone);
+  std::vector<std::size_t> backwardStep(numNodes, kNone);
+  plan.forwardSteps.clear();
+  plan.backwardSteps.clear();
+  for (std::size_t n = 0; n <= root; ++n) {
+    if (needed[n] && !isLeaf(n)) {
+      forwardStep[n] = plan.forwardSteps.size();
+      plan.forwardSteps.push_back(n);
+    }
+  }
+  if (training) {
+    for (std::size_t n = root + 1; n-- > 0;) {
+      if (needed[n] && !isLeaf(n) && nodes_[n].requiresGrad) {
+        backwardStep[n] =
+            plan.forwardSteps.size() + plan.backwardSteps.size();
+        plan.backwardSteps.push_back(n);
+      }
+    }
+  }
+
+  // Lifetimes of the values and gradients.
+  plan.valueBuffer.assign(numNodes, kNone);
+  plan.gradBuffer.assign(numNodes, kNone);
+  std::vector<std::size_t> valueLast(numNodes, kNone);
+  std::vector<std::size_t> gradFirst(numNodes, kNone);
+  for (std::size_t n : plan.forwardSteps) {
+    valueLast[n] = forwardStep[n];
+  }
+  auto extend = [](std::size_t &last, std::size_t step) {
+    if (last == kNone || step > last) {
+      last = step;
+    }
+  };
+  for (std::size_t c : plan.forwardSteps) {
+    const Node &C = nodes_[c];
+    for (std::size_t i : {C.a, C.b}) {
+      if (i == kNone) {
+        continue;
+      }
+      if (!isLeaf(i)) {
+        extend(valueLast[i], forwardStep[c]);
+      }
+      if (backwardStep[c] == kNone) {
+        continue;
+      }
+      // The backward step of c writes the gradient of i and may read the
+      // value of i.
+      const std::size_t other = i == C.a ? C.b : C.a;
+      const bool otherNeedsGrad =
+          other != kNone && nodes_[other].requiresGrad;
+      bool readsValue = false;
+      switch (C.op) {
+      case Op::DOT:
+      case Op::MUL:
+        readsValue = otherNeedsGrad || C.a == C.b;
+        break;
+      case Op::MAXIMUM:
+      case Op::SOFTMAX_CROSS_ENTROPY:
+        readsValue = true;
+        break;
+      case Op::ACTIVATION:
+        readsValue = C.activation != Activation::linear &&
+                     C.activation != Activation::step &&
+                     C.activation != Activation::softmax;
+        break;
+      default:
+        break;
+      }
+      if (readsValue && !isLeaf(i)) {
+        extend(valueLast[i], backwardStep[c]);
+      }
+      if (nodes_[i].requiresGrad && !isLeaf(i) &&
+          (gradFirst[i] == kNone || backwardStep[c] < gradFirst[i])) {
+        gradFirst[i] = backwardStep[c];
+      }
+    }
+    // Softmax backpropagates through its output.
+    if (backwardStep[c] != kNone && C.op == Op::ACTIVATION &&
+        C.activation == Activation::softmax) {
+      extend(valueLast[c], backwardStep[c]);
+    }
+  }
+  for (std::size_t n : plan.forwardSteps) {
+    if (n == root || nodes_[n].kept) {
+      valueLast[n] = kEndOfRun;
+    }
+  }
+  if (backwardStep[root] != kNone) {
+    gradFirst[root] = backwardStep[root];
+  }
+
+  std::vector<Lifetime> lifetimes;
+  for (std::size_t n : plan.forwardSteps) {
+    lifetimes.push_back(Lifetime{forwardStep[n], valueLast[n],
+                                 nodes_[n].rows * nodes_[n].cols,
+                                 &plan.valueBuffer[n]});
+  }
+  for (std::size_t n : plan.backwardSteps) {
+    lifetimes.push_back(Lifetime{gradFirst[n], backwardStep[n],
+                                 nodes_[n].rows * nodes_[n].cols,
+                                 &plan.gradBuffer[n]});
+  }
+  assignBuffers(lifetimes);
+
+  // Gradients of the parameters live outside of the pool.
+  grads_.resize(numNodes);
+  for (std::size_t n = 0; n < numNodes; ++n) {
+    if (nodes_[n].op == Op::PARAMETER) {
+      grads_[n].resize(nodes_[n].rows, nodes_[n].cols);
+    }
+  }
+  plan.root = root;
+  plan.numNodes = numNodes;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+void Tape<T>::assignBuffers(std::vector<Lifetime> &lifetimes) {
+  std::sort(lifetimes.begin(), lifetimes.end(),
+            [](const Lifetime &x, const Lifetime &y) {
+              return x.first < y.first;
+            });
+  // Buffers in use (last step, buffer) and free buffers. A buffer is free
+  // again after its last step, so no step writes a buffer it reads.
+  std::vector<std::pair<std::size_t, std::size_t>> active;
+  std::vector<std::size_t> free(buffers_.size());
+  for (std::size_t b = 0; b < free.size(); ++b) {
+    free[b] = b;
+  }
+  for (const Lifetime &lifetime : lifetimes) {
+    for (std::size_t i = 0; i < active.size();) {
+      if (active[i].first < lifetime.first) {
+        free.push_back(active[i].second);
+        active[i] = active.back();
+        active.pop_back();
+      } else {
+        ++i;
+      }
+    }
+    // Best fit: the smallest free buffer that is large enough, otherwise
+    // the largest one (which grows), otherwise a new buffer.
+    std::size_t best = kNone;
+    for (std::size_t i = 0; i < free.size(); ++i) {
+      const std::size_t size = bufferSizes_[free[i]];
+      if (best == kNone) {
+        best = i;
+        continue;
+      }
+      const std::size_t bestSize = bufferSizes_[free[best]];
+      const bool fits = size >= lifetime.size;
+      const bool bestFits = bestSize >= lifetime.size;
+      if ((fits && (!bestFits || size < bestSize)) ||
+          (!fits && !bestFits && size > bestSize)) {
+        best = i;
+      }
+    }
+    std::size_t buffer;
+    if (best == kNone) {
+      buffer = buffers_.size();
+      buffers_.emplace_back();
+      bufferSizes_.push_back(lifetime.size);
+    } else {
+      buffer = free[best];
+      free[best] = free.back();
+      free.pop_back();
+      bufferSizes_[buffer] = std::max(bufferSizes_[buffer], lifetime.size);
+    }
+    *lifetime.buffer = buffer;
+    active.emplace_back(lifetime.last, buffer);
+  }
+}
+
+// ____________________________________________________________________________
+// Running:
+// ____________________________________________________________________________
+
+// ____________________________________________________________________________
+template <typename T> const Matrix<T> &Tape<T>::forward(Var output) {
+  node(output);
+  if (forwardPlan_.root != output.id ||
+      forwardPlan_.numNodes != nodes_.size()) {
+    makePlan(forwardPlan_, output.id, false);
+  }
+  checkShapes();
+  plan_ = &forwardPlan_;
+  for (std::size_t n : forwardPlan_.forwardSteps) {
+    computeValue(n);
+  }
+  return valueOf(output.id);
+}
+
+// ____________________________________________________________________________
+template <typename T> void Tape<T>::backward(Var loss) {
+  node(loss);
+  if (backwardPlan_.root != loss.id ||
+      backwardPlan_.numNodes != nodes_.size()) {
+    makePlan(backwardPlan_, loss.id, true);
+  }
+  checkShapes();
+  plan_ = &backwardPlan_;
+  for (std::size_t n : backwardPlan_.forwardSteps) {
+    computeValue(n);
+  }
+
+  // The gradient of the sum of the elements of the loss is one everywhere.
+  hasGrad_.assign(nodes_.size(), 0);
+  if (nodes_[loss.id].requiresGrad) {
+    Matrix<T> &seed = contribution(loss.id);
+    std::fill(seed.data(), seed.data() + seed.getRows() * seed.getStride(),
+              static_cast<T>(1));
+    addContribution(loss.id);
+  }
+  for (std::size_t n : backwardPlan_.backwardSteps) {
+    backpropagate(n);
+  }
+  // Parameters the loss does not depend on.
+  for (std::size_t n = 0; n < nodes_.size(); ++n) {
+    if (nodes_[n].op == Op::PARAMETER && !hasGrad_[n]) {
+      Matrix<T> &g = grads_[n];
+      std::fill(g.data(), g.data() + g.getRows() * g.getStride(),
+                ::value<T>::zero());
+    }
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T> void Tape<T>::checkShapes() const {
+  for (const Node &n : nodes_) {
+    const Matrix<T> *M = n.op == Op::INPUT       ? n.input
+                         : n.op == Op::PARAMETER ? n.parameter
+                                                 : nullptr;
+    if (M != nullptr && (M->getRows() != n.rows || M->getCols() != n.cols)) {
+      throw std::invalid_argument(
+          "Shape of an input or parameter changed since recording");
+    }
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T> void Tape<T>::computeValue(std::size_t n) {
+  const Node &node = nodes_[n];
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  Matrix<T> &out = buffers_[plan_->valueBuffer[n]];
+  out.resize(node.rows, node.cols);
+  const Matrix<T> &A = valueOf(node.a);
+  switch (node.op) {
+  case Op::DOT: {
+    const Matrix<T> &B = valueOf(node.b);
+    gemm(A.getRows(), B.getCols(), A.getCols(), A.data(), A.getStride(),
+         B.data(), B.getStride(), out.data(), out.getStride());
+    break;
+  }
+  case Op::ADD:
+  case Op::SUB: {
+    const Matrix<T> &B = valueOf(node.b);
+    auto kernel = node.op == Op::ADD ? kernels.add : kernels.sub;
+    if (B.getRows() == A.getRows()) {
+      forEachRow(A, B, out, kernel);
+    } else {
+      for (std::size_t row = 0; row < A.getRows(); ++row) {
+        kernel(A[row], B.data(), out[row], A.getCols());
+      }
+    }
+    break;
+  }
+  case Op::MUL:
+    forEachRow(A, valueOf(node.b), out, kernels.mul);
+    break;
+  case Op::SCALE:
+    forEachRow(A, out, [&](const T *a, T *o, std::size_t size) {
+      kernels.scale(a, node.scalar, o, size);
+    });
+    break;
+  case Op::MAXIMUM:
+    forEachRow(A, out, [&](const T *a, T *o, std::size_t size) {
+      kernels.maximum(a, node.scalar, o, size);
+    });
+    break;
+  case Op::TRANSPOSE:
+    for (std::size_t row = 0; row < A.getRows(); ++row) {
+      const T *a = A[row];
+      for (std::size_t col = 0; col < A.getCols(); ++col) {
+        out[col][row] = a[col];
+      }
+    }
+    break;
+  case Op::ACTIVATION:
+    if (UnaryKernel<T> kernel = activationKernel<T>(node.activation)) {
+      forEachRow(A, out, kernel);
+    } else if (node.activation == Activation::softmax) {
+      softmax(A, out);
+    } else {
+      copyRows(A, out);
+    }
+    break;
+  case Op::SUM:
+    out[0][0] = ::sum(A);
+    break;
+  case Op::SOFTMAX_CROSS_ENTROPY:
+    // The gradient is not needed yet, scratch_ takes it.
+    out[0][0] = ::softmaxCrossEntropy(A, valueOf(node.b), scratch_);
+    break;
+  case Op::INPUT:
+  case Op::PARAMETER:
+    break;
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T> void Tape<T>::backpropagate(std::size_t n) {
+  const Node &node = nodes_[n];
+  const SimdKernels<T> &kernels = simdKernels<T>();
+  const Matrix<T> &g = gradOf(n);
+  auto needsGrad = [&](std::size_t i) {
+    return i != kNone && nodes_[i].requiresGrad;
+  };
+  // (Operand values are only read where the plan keeps them, see makePlan.)
+
+  switch (node.op) {
+  case Op::DOT: {
+    // C = A B: dA = dC B^T, dB = A^T dC (accumulated by the GEMM). Each
+    // product reads the value of the other operand only.
+    const std::size_t m = nodes_[node.a].rows;
+    const std::size_t k = nodes_[node.a].cols;
+    const std::size_t cols = nodes_[node.b].cols;
+    if (needsGrad(node.a)) {
+      const Matrix<T> &B = valueOf(node.b);
+      const bool accumulate = hasGrad_[node.a];
+      Matrix<T> &dA = gradOf(node.a);
+      dA.resize(m, k);
+      gemm(Transpose::NO, Transpose::YES, m, k, cols, g.data(), g.getStride(),
+           B.data(), B.getStride(), dA.data(), dA.getStride(), accumulate);
+      hasGrad_[node.a] = 1;
+    }
+    if (needsGrad(node.b)) {
+      const Matrix<T> &A = valueOf(node.a);
+      const bool accumulate = hasGrad_[node.b];
+      Matrix<T> &dB = gradOf(node.b);
+      dB.resize(k, cols);
+      gemm(Transpose::YES, Transpose::NO, k, cols, m, A.data(), A.getStride(),
+           g.data(), g.getStride(), dB.data(), dB.getStride(), accumulate);
+      hasGrad_[node.b] = 1;
+    }
+    break;
+  }
+  case Op::ADD:
+  case Op::SUB: {
+    if (needsGrad(node.a)) {
+      copyRows(g, contribution(node.a));
+      addContribution(node.a);
+    }
+    if (needsGrad(node.b)) {
+      Matrix<T> &dB = contribution(node.b);
+      if (nodes_[node.b].rows == node.rows) {
+        copyRows(g, dB);
+      } else {
+        // Broadcast row: the gradient is the sum over the rows.
+        sumColumns(g, dB);
+      }
+      if (node.op == Op::SUB) {
+        forEachRow(dB, dB, [&](const T *a, T *o, std::size_t size) {
+          kernels.scale(a, static_cast<T>(-1), o, size);
+        });
+      }
+      addContribution(node.b);
+    }
+    break;
+  }
+  case Op::MUL:
+    if (needsGrad(node.a)) {
+      forEachRow(g, valueOf(node.b), contribution(node.a), kernels.mul);
+      addContribution(node.a);
+    }
+    if (needsGrad(node.b)) {
+      forEachRow(g, valueOf(node.a), contribution(node.b), kernels.mul);
+      addContribution(node.b);
+    }
+    break;
+  case Op::SCALE:
+    forEachRow(g, contribution(node.a),
+               [&](const T *a, T *o, std::size_t size) {
+                 kernels.scale(a, node.scalar, o, size);
+               });
+    addContribution(node.a);
+    break;
+  case Op::MAXIMUM: {
+    // Passes the gradient where a > inf.
+    forEachRow(valueOf(node.a), g, contribution(node.a),
+               [&](const T *a, const T *d, T *o, std::size_t size) {
+                 for (std::size_t i = 0; i < size; ++i) {
+                   o[i] = a[i] > node.scalar ? d[i] : ::value<T>::zero();
+                 }
+               });
+    addContribution(node.a);
+    break;
+  }
+  case Op::TRANSPOSE: {
+    Matrix<T> &dA = contribution(node.a);
+    for (std::size_t row = 0; row < g.getRows(); ++row) {
+      const T *d = g[row];
+      for (std::size_t col = 0; col < g.getCols(); ++col) {
+        dA[col][row] = d[col];
+      }
+    }
+    addContribution(node.a);
+    break;
+  }
+  case Op::ACTIVATION: {
+    Matrix<T> &dA = contribution(node.a);
+    if (node.activation == Activation::softmax) {
+      // Product with the Jacobian of every row, through the output.
+      softmaxBackward(valueOf(n), g, dA);
+    } else if (node.activation == Activation::linear) {
+      copyRows(g, dA);
+    } else {
+      activationDerivative(node.activation, valueOf(node.a), dA);
+      forEachRow(dA, g, dA, kernels.mul);
+    }
+    addContribution(node.a);
+    break;
+  }
+  case Op::SUM: {
+    Matrix<T> &dA = contribution(node.a);
+    const T d = g[0][0];
+    for (std::size_t row = 0; row < dA.getRows(); ++row) {
+      std::fill(dA[row], dA[row] + dA.getCols(), d);
+    }
+    addContribution(node.a);
+    break;
+  }
+  case Op::SOFTMAX_CROSS_ENTROPY: {
+    Matrix<T> &dA = contribution(node.a);
+    ::softmaxCrossEntropy(valueOf(node.a), valueOf(node.b), dA);
+    const T d = g[0][0];
+    if (d != static_cast<T>(1)) {
+      forEachRow(dA, dA, [&](const T *a, T *o, std::size_t size) {
+        kernels.scale(a, d, o, size);
+      });
+    }
+    addContribution(node.a);
+    break;
+  }
+  case Op::INPUT:
+  case Op::PARAMETER:
+    break;
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T> Matrix<T> &Tape<T>::contribution(std::size_t n) {
+  Matrix<T> &target = hasGrad_[n] ? scratch_ : gradOf(n);
+  target.resize(nodes_[n].rows, nodes_[n].cols);
+  return target;
+}
+
+// ____________________________________________________________________________
+template <typename T> void Tape<T>::addContribution(std::size_t n) {
+  if (hasGrad_[n]) {
+    Matrix<T> &g = gradOf(n);
+    forEachRow(g, scratch_, g, simdKernels<T>().add);
+  }
+  hasGrad_[n] = 1;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+const Matrix<T> &Tape<T>::valueOf(std::size_t n) const {
+  const Node &node = nodes_[n];
+  if (node.op == Op::INPUT) {
+    return *node.input;
+  }
+  if (node.op == Op::PARAMETER) {
+    return *node.parameter;
+  }
+  return buffers_[plan_->valueBuffer[n]];
+}
+
+// ____________________________________________________________________________
+template <typename T> Matrix<T> &Tape<T>::gradOf(std::size_t n) {
+  if (nodes_[n].op == Op::PARAMETER) {
+    return grads_[n];
+  }
+  return buffers_[plan_->gradBuffer[n]];
+}
+
+// ____________________________________________________________________________
+// Results:
+// ____________________________________________________________________________
+
+// ____________________________________________________________________________
+template <typename T> const Matrix<T> &Tape<T>::value(Var v) const {
+  const Node &n = node(v);
+  if (n.op == Op::INPUT || n.op == Op::PARAMETER) {
+    return valueOf(v.id);
+  }
+  if (plan_ == nullptr || plan_->valueBuffer.size() <= v.id ||
+      plan_->valueBuffer[v.id] == kNone || (v.id != plan_->root && !n.kept)) {
+    throw std::invalid_argument(
+        "Value is not available (not computed or not kept)");
+  }
+  return valueOf(v.id);
+}
+
+// ____________________________________________________________________________
+template <typename T> const Matrix<T> &Tape<T>::grad(Var p) const {
+  if (node(p).op != Op::PARAMETER) {
+    throw std::invalid_argument("Gradients are only kept for parameters");
+  }
+  if (p.id >= grads_.size()) {
+    throw std::invalid_argument("No gradient computed yet");
+  }
+  return grads_[p.id];
+}
+
+// ____________________________________________________________________________
+template <typename T> std::size_t Tape<T>::getNumNodes() const {
+  return nodes_.size();
+}
+
+// ____________________________________________________________________________
+template <typename T> std::size_t Tape<T>::getNumBuffers() const {
+  return buffers_.size();
+}
+
+// ____________________________________________________________________________
+template <typename T> std::size_t Tape<T>::getBufferBytes() const {
+  std::size_t bytes = 0;
+  for (std::size_t size : bufferSizes_) {
+    bytes += size * sizeof(T);
+  }
+  return bytes;
+}
+
+// ____________________________________________________________________________
+// Explicit instantiation for float.
+template class Tape<float>;
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "./Activation.h"
+#include "./Matrix.h"
+
+// ____________________________________________________________________________
+// Reverse-mode automatic differentiation over Matrix operations.
+//
+// A Tape records a computation graph once, e.g. the loss of a model:
+//
+//   Tape<float> tape;
+//   auto x = tape.input(X);
+//   auto w = tape.parameter(W);
+//   auto b = tape.parameter(B);
+//   auto out = tape.activation(tape.add(tape.dot(x, w), b),
+//                              Activation::sigmoid);
+//   auto diff = tape.sub(out, tape.input(y));
+//   auto loss = tape.sum(tape.mul(diff, diff));
+//
+// and then runs it as often as needed: backward(loss) computes all values
+// and the gradients of the loss with respect to every parameter (grad(w),
+// grad(b)). Inputs and parameters are referenced, not copied, so a training
+// loop changes their contents between runs (their shapes must not change).
+//
+// Memory planning: before the first run the tape schedules the forward and
+// backward steps and computes for every intermediate buffer (values and
+// gradients) the step that writes it first and the step that reads it
+// last. Buffers that are no longer live are reused for later ones (best
+// fit), so the tape only holds what is live at the same time, and the
+// buffers are allocated once: later runs do not allocate.
+template <typename T> class Tape {
+public:
+  Tape() = default;
+
+  // Runs refer to the tape's own plans and buffers.
+  Tape(const Tape &) = delete;
+  Tape &operator=(const Tape &) = delete;
+
+  // Handle of a node of the tape.
+  struct Var {
+    std::size_t id;
+  };
+
+  // ____________________________________________________________________________
+  // Recording. Throws std::invalid_argument if the shapes do not match.
+
+  // Matrix without a gradient (data, labels).
+  Var input(const Matrix<T> &X);
+
+  // Matrix the gradient is computed for (weights, biases).
+  Var parameter(Matrix<T> &W);
+
+  // Matrix multiplication, m x k * k x n = m x n.
+  Var dot(Var a, Var b);
+
+  // Sum and difference, b has the shape of a or is a 1 x cols row added to
+  // (subtracted from) every row of a.
+  Var add(Var a, Var b);
+  Var sub(Var a, Var b);
+
+  // Elementwise product (see dotElementWise).
+  Var mul(Var a, Var b);
+
+  // Product with a scalar.
+  Var scale(Var a, T scalar);
+
+  // max(a, inf) elementwise (see Matrix::maximum).
+  Var maximum(Var a, T inf);
+
+  // Transposed a.
+  Var transpose(Var a);
+
+  // Activation function applied to a (see Activation.h).
+  Var activation(Var a, Activation activation);
+
+  // Sum of all elements (1 x 1).
+  Var sum(Var a);
+
+  // Cross-entropy of the softmax of the rows of logits with targets (same
+  // shape), summed over the rows (1 x 1, see softmaxCrossEntropy in
+  // Activation.h). Backpropagates softmax(logits) - targets in one fused
+  // pass. targets must not depend on a parameter.
+  Var softmaxCrossEntropy(Var logits, Var targets);
+
+  // Keeps the value of v available after a run (see value). Outputs of
+  // forward and the loss of backward are always kept.
+  void keep(Var v);
+
+  // ____________________________________________________________________________
+  // Running.
+
+  // Computes the value of output (and the nodes it depends on) without
+  // gradients.
+  const Matrix<T> &forward(Var output);
+
+  // Computes the value of loss and backpropagates the gradient of the sum
+  // of its elements to the parameters.
+  void backward(Var loss);
+
+  // Returns the value of v after the last run. v must be an input, a
+  // parameter, the output (loss) of the run or kept.
+  const Matrix<T> &value(Var v) const;
+
+  // Returns the gradient of the loss of the last backward with respect to
+  // parameter p (shape of p).
+  const Matrix<T> &grad(Var p) const;
+
+  // Returns the number of recorded nodes.
+  std::size_t getNumNodes() const;
+
+  // Returns the number and the total size (in bytes) of the intermediate
+  // buffers planned so far.
+  std::size_t getNumBuffers() const;
+  std::size_t getBufferBytes() const;
+
+private:
+  enum class Op {
+    INPUT,
+    PARAMETER,
+    DOT,
+    ADD,
+    SUB,
+    MUL,
+    SCALE,
+    MAXIMUM,
+    TRANSPOSE,
+    ACTIVATION,
+    SUM,
+    SOFTMAX_CROSS_ENTROPY
+  };
+
+  static constexpr std::size_t kNone = static_cast<std::size_t>(-1);
+
+  struct Node {
+    Op op;
+    // Inputs (kNone if unused).
+    std::size_t a = kNone;
+    std::size_t b = kNone;
+    // Shape of the value.
+    std::size_t rows = 0;
+    std::size_t cols = 0;
+    // Operands of SCALE, MAXIMUM and ACTIVATION.
+    T scalar = T();
+    Activation activation = Activation::linear;
+    // The matrix of an INPUT or PARAMETER.
+    const Matrix<T> *input = nullptr;
+    Matrix<T> *parameter = nullptr;
+    // Whether a parameter depends on the node (so it has a gradient).
+    bool requiresGrad = false;
+    bool kept = false;
+  };
+
+  // Order of the steps of a run and the buffer of every value and gradient.
+  struct Plan {
+    // Root (output or loss) and number of nodes the plan was made for.
+    std::size_t root = kNone;
+    std::size_t numNodes = 0;
+    // Nodes to compute, in order, and nodes to backpropagate through, in
+    // order (empty for forward).
+    std::vector<std::size_t> forwardSteps;
+    std::vector<std::size_t> backwardSteps;
+    // Index into buffers_ of the value and the gradient of every node (kNone
+    // for inputs, parameters and nodes without gradient).
+    std::vector<std::size_t> valueBuffer;
+    std::vector<std::size_t> gradBuffer;
+  };
+
+  // Appends a node and returns its handle.
+  Var record(Node node);
+
+  // Returns node v, throws if v is not a node of this tape.
+  const Node &node(Var v) const;
+
+  // Makes plan for root (forward only unless training).
+  void makePlan(Plan &plan, std::size_t root, bool training);
+
+  // Assigns buffers to values or gradients, given as (first step, last
+  // step, elements, slot to store the buffer index in).
+  struct Lifetime {
+    std::size_t first;
+    std::size_t last;
+    std::size_t size;
+    std::size_t *buffer;
+  };
+  void assignBuffers(std::vector<Lifetime> &lifetimes);
+
+  // Checks the shapes of the inputs and parameters.
+  void checkShapes() const;
+
+  // Computes the value of node n.
+  void computeValue(std::size_t n);
+
+  // Backpropagates the gradient of node n to its inputs.
+  void backpropagate(std::size_t n);
+
+  // Returns the matrix to write a gradient contribution for node n to (of
+  // shape rows x cols): the gradient itself for the first contribution,
+  // scratch_ otherwise. Call addContribution(n) after writing it.
+  Matrix<T> &contribution(std::size_t n);
+  void addContribution(std::size_t n);
+
+  // Value and gradient of node n in the current plan.
+  const Matrix<T> &valueOf(std::size_t n) const;
+  Matrix<T> &gradOf(std::size_t n);
+
+  std::vector<Node> nodes_;
+  Plan forwardPlan_;
+  Plan backwardPlan_;
+  // Plan of the last run.
+  const Plan *plan_ = nullptr;
+
+  // Intermediate buffers shared by the plans, and their planned sizes.
+  std::vector<Matrix<T>> buffers_;
+  std::vector<std::size_t> bufferSizes_;
+  // Gradients of the parameters (empty for other nodes).
+  std::vector<Matrix<T>> grads_;
+  // Whether the gradient of a node received its first contribution.
+  std::vector<char> hasGrad_;
+  // Temporaries of the backward pass.
+  Matrix<T> scratch_;
+};
@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "./ThreadPool.h"
+
+namespace {
+
+// Whether the current thread is running the body of a parallelFor.
+thread_local bool insideLoop = false;
+
+// Settings of the library wide pool.
+std::mutex poolMutex;
+std::unique_ptr<ThreadPool> pool;
+std::atomic<ThreadPool *> currentPool{nullptr};
+std::atomic<std::size_t> numThreads{0};
+
+// Functions of addWorkerInit (function local, they are added by static
+// initializers of other translation units).
+std::vector<void (*)()> &workerInits() {
+  static std::vector<void (*)()> inits;
+  return inits;
+}
+
+// Parses NN_NUM_THREADS, falls back to the number of hardware threads.
+std::size_t defaultNumThreads() {
+  if (const char *env = std::getenv("NN_NUM_THREADS")) {
+    try {
+      long value = std::stol(env);
+      if (value > 0) {
+        return static_cast<std::size_t>(value);
+      }
+    } catch (const std::exception &) {
+    }
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+} // namespace
+
+// ____________________________________________________________________________
+// Queue:
+// ____________________________________________________________________________
+
+// ____________________________________________________________________________
+bool ThreadPool::Queue::push(Range range) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (size == kCapacity) {
+    return false;
+  }
+  ranges[(head + size) % kCapacity] = range;
+  ++size;
+  return true;
+}
+
+// ____________________________________________________________________________
+bool ThreadPool::Queue::popBack(Range &range) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (size == 0) {
+    return false;
+  }
+  --size;
+  range = ranges[(head + size) % kCapacity];
+  return true;
+}
+
+// ____________________________________________________________________________
+bool ThreadPool::Queue::popFront(Range &range) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (size == 0) {
+    return false;
+  }
+  range = ranges[head];
+  head = (head + 1) % kCapacity;
+  --size;
+  return true;
+}
+
+// ____________________________________________________________________________
+// ThreadPool:
+// ____________________________________________________________________________
+
+// ____________________________________________________________________________
+ThreadPool::ThreadPool(std::size_t numThreads)
+    : queues_(new Queue[std::max<std::size_t>(numThreads, 1)]),
+      numThreads_(std::max<std::size_t>(numThreads, 1)) {
+  for (std::size_t id = 1; id < numThreads_; ++id) {
+    workers_.emplace_back(&ThreadPool::workerLoop, this, id);
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  startedWake_.wait(lock, [&] { return started_ + 1 == numThreads_; });
+}
+
+// ____________________________________________________________________________
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (std::thread &worker : workers_) {
+    worker.join();
+  }
+}
+
+// ____________________________________________________________________________
+std::size_t ThreadPool::getNumThreads() const { return numThreads_; }
+
+// ____________________________________________________________________________
+void ThreadPool::run(std::size_t n, std::size_t grain, RangeFunction body) {
+  if (n == 0) {
+    return;
+  }
+  if (insideLoop || numThreads_ == 1 || n <= grain ||
+      busy_.exchange(true, std::memory_order_acquire)) {
+    body.call(body.function, 0, n);
+    return;
+  }
+  // Frees the pool for the next loop however this one ends.
+  struct Release {
+    std::atomic<bool> &busy;
+    ~Release() { busy.store(false, std::memory_order_release); }
+  } release{busy_};
+  body_ = body;
+  grain_ = std::max<std::size_t>(grain, 1);
+  error_ = nullptr;
+  failed_.store(false, std::memory_order_relaxed);
+  remaining_.store(n, std::memory_order_release);
+
+  // Give every thread an equal share to start with.
+  const std::size_t share = (n + numThreads_ - 1) / numThreads_;
+  for (std::size_t id = 0; id < numThreads_ && id * share < n; ++id) {
+    queues_[id].push({id * share, std::min(n, (id + 1) * share)});
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++generation_;
+  }
+  wake_.notify_all();
+
+  // The caller works as thread 0 until every range is done.
+  work(0);
+  if (failed_.load(std::memory_order_acquire)) {
+    std::exception_ptr error;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::swap(error, error_);
+    }
+    std::rethrow_exception(error);
+  }
+}
+
+// ____________________________________________________________________________
+void ThreadPool::work(std::size_t id) {
+  insideLoop = true;
+  struct Leave {
+    ~Leave() { insideLoop = false; }
+  } leave;
+  Range range;
+  while (remaining_.load(std::memory_order_acquire) > 0) {
+    bool found = queues_[id].popBack(range);
+    // Steal from the others, starting with the next thread.
+    for (std::size_t i = 1; !found && i < numThreads_; ++i) {
+      found = queues_[(id + i) % numThreads_].popFront(range);
+    }
+    if (!found) {
+      std::this_thread::yield();
+      continue;
+    }
+    // Split off the upper halves for others to steal, keep the lower one.
+    const std::size_t grain = grain_;
+    while (range.end - range.begin >= 2 * grain) {
+      const std::size_t mid = range.begin + (range.end - range.begin) / 2;
+      if (!queues_[id].push({mid, range.end})) {
+        break;
+      }
+      range.end = mid;
+    }
+    // After a body threw, the remaining ranges are only counted as done.
+    if (!failed_.load(std::memory_order_acquire)) {
+      try {
+        const RangeFunction body = body_;
+        body.call(body.function, range.begin, range.end);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_) {
+          error_ = std::current_exception();
+          failed_.store(true, std::memory_order_release);
+        }
+      }
+    }
+    remaining_.fetch_sub(range.end - range.begin, std::memory_order_acq_rel);
+  }
+}
+
+// ____________________________________________________________________________
+void ThreadPool::workerLoop(std::size_t id) {
+  for (void (*init)() : workerInits()) {
+    init();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++started_;
+  }
+  startedWake_.notify_one();
+  std::size_t seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+      if (stop_) {
+        return;
+      }
+      seen = generation_;
+    }
+    work(id);
+  }
+}
+
+// ____________________________________________________________________________
+// Library wide pool:
+// ____________________________________________________________________________
+
+// ____________________________________________________________________________
+ThreadPool &threadPool() {
+  ThreadPool *current = currentPool.load(std::memory_order_acquire);
+  if (current != nullptr) {
+    return *current;
+  }
+  std::lock_guard<std::mutex> lock(poolMutex);
+  if (pool == nullptr) {
+    pool = std::make_unique<ThreadPool>(getNumThreads());
+    currentPool.store(pool.get(), std::memory_order_release);
+  }
+  return *pool;
+}
+
+// ____________________________________________________________________________
+std::size_t getNumThreads() {
+  std::size_t threads = numThreads.load(std::memory_order_acquire);
+  if (threads == 0) {
+    threads = defaultNumThreads();
+    numThreads.store(threads, std::memory_order_release);
+  }
+  return threads;
+}
+
+// ____________________________________________________________________________
+void addWorkerInit(void (*init)()) { workerInits().push_back(init); }
+
+// ____________________________________________________________________________
+void setNumThreads(std::size_t threads) {
+  if (threads == 0) {
+    throw std::invalid_argument("Number of threads must be > 0.");
+  }
+  std::lock_guard<std::mutex> lock(poolMutex);
+  currentPool.store(nullptr, std::memory_order_release);
+  pool.reset();
+  numThreads.store(threads, std::memory_order_release);
+}
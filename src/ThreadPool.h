@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// ____________________________________________________________________________
+// Persistent pool of worker threads with work stealing.
+//
+// parallelFor(n, grain, body) calls body(begin, end) on disjoint ranges
+// covering [0, n). Each thread (the caller takes part as thread 0) starts
+// with an equal share of the range in its own queue. It takes ranges from
+// the back of its queue, splitting off halves larger than grain for others
+// to steal, and steals from the front of other queues when its own runs
+// empty. So uneven work balances without a shared counter being hammered.
+//
+// If a body throws, the ranges not started yet are skipped and parallelFor
+// rethrows the first exception on the caller once the loop is done.
+//
+// parallelFor does not allocate. Calls from inside a running body (e.g. a
+// GEMM inside a parallel loop) run serially on the calling thread, and so do
+// calls from other threads while the pool is busy with a loop (e.g. several
+// threads serving requests at once).
+class ThreadPool {
+public:
+  // Starts numThreads - 1 workers (the caller of parallelFor is the other)
+  // and waits until each has run the functions of addWorkerInit.
+  explicit ThreadPool(std::size_t numThreads);
+
+  // Stops and joins the workers.
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Returns the number of threads, including the caller.
+  std::size_t getNumThreads() const;
+
+  // Calls body(begin, end) on ranges covering [0, n), in parallel, and
+  // returns when all of them are done. Ranges are at least grain long
+  // (except at the end). Thread safe.
+  template <typename F>
+  void parallelFor(std::size_t n, std::size_t grain, F &&body) {
+    auto call = [](void *f, std::size_t begin, std::size_t end) {
+      (*static_cast<std::remove_reference_t<F> *>(f))(begin, end);
+    };
+    run(n, grain,
+        RangeFunction{const_cast<void *>(static_cast<const void *>(&body)),
+                      call});
+  }
+
+private:
+  // Non-owning reference to the body of a parallelFor.
+  struct RangeFunction {
+    void *function;
+    void (*call)(void *function, std::size_t begin, std::size_t end);
+  };
+
+  // A range [begin, end) of the current loop.
+  struct Range {
+    std::size_t begin;
+    std::size_t end;
+  };
+
+  // Fixed size double ended queue of ranges of one thread (owner pushes and
+  // pops at the back, thieves take from the front). Splitting only ever
+  // pushes O(log n) ranges, if it is full the range is not split further.
+  struct Queue {
+    static constexpr std::size_t kCapacity = 64;
+    std::mutex mutex;
+    Range ranges[kCapacity];
+    std::size_t head = 0;
+    std::size_t size = 0;
+
+    bool push(Range range);
+    bool popBack(Range &range);
+    bool popFront(Range &range);
+  };
+
+  // Runs a parallelFor.
+  void run(std::size_t n, std::size_t grain, RangeFunction body);
+
+  // Works on the current loop as thread id until no range is left.
+  void work(std::size_t id);
+
+  // Main loop of worker id.
+  void workerLoop(std::size_t id);
+
+  std::vector<std::thread> workers_;
+  std::unique_ptr<Queue[]> queues_;
+  std::size_t numThreads_;
+
+  // Current loop.
+  RangeFunction body_{nullptr, nullptr};
+  std::size_t grain_ = 1;
+  // Number of elements of the current loop not processed yet.
+  std::atomic<std::size_t> remaining_{0};
+  // Whether a thread is running a loop on the pool.
+  std::atomic<bool> busy_{false};
+  // First exception a body of the current loop threw (guarded by mutex_).
+  std::exception_ptr error_;
+  std::atomic<bool> failed_{false};
+
+  // Wakes the workers for a new loop (generation_ changes) or to stop.
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::size_t generation_ = 0;
+  bool stop_ = false;
+
+  // Workers that have run the functions of addWorkerInit.
+  std::size_t started_ = 0;
+  std::condition_variable startedWake_;
+};
+
+// ____________________________________________________________________________
+// Registers init to be called once on every worker of the pools created
+// afterwards, before the worker runs any loop (e.g. to allocate per-thread
+// buffers up front, so that no later loop allocates on a worker that did not
+// happen to get work before). Meant for static initializers.
+void addWorkerInit(void (*init)());
+
+// ____________________________________________________________________________
+// Library wide pool used by the GEMM, the elementwise kernels and the
+// reductions.
+
+// Returns the pool. Created on first use with getNumThreads() threads.
+ThreadPool &threadPool();
+
+// Returns the number of threads the library uses. Defaults to the
+// environment variable NN_NUM_THREADS if set, otherwise to the number of
+// hardware threads.
+std::size_t getNumThreads();
+
+// Sets the number of threads the library uses (>= 1), replacing the pool.
+// Not meant to be called while the library is running.
+void setNumThreads(std::size_t numThreads);
+
+// Convenience wrapper for threadPool().parallelFor(). Runs body(0, n)
+// directly if the loop is shorter than two grains or there is only one
+// thread.
+template <typename F>
+void parallelFor(std::size_t n, std::size_t grain, F &&body) {
+  if (n < 2 * grain || getNumThreads() == 1) {
+    if (n > 0) {
+      body(std::size_t(0), n);
+    }
+    return;
+  }
+  threadPool().parallelFor(n, grain, body);
+}
@@ -3,6 +3,8 @@
 #include <random>
 #include <type_traits>
 
+#include "./Half.h"
+
 // ____________________________________________________________________________
 // value struct, to create zero, one, random, exp values for templated types.
 template <typename T> struct value {};
@@ -51,4 +53,16 @@ template <> struct value<double> {
   }
   static double e(double x) { return std::exp(x); }
   static double tanh(double x) { return std::tanh(x); }
-};
\ No newline at end of file
+};
+
+// ____________________________________________________________________________
+// BFLOAT16 and FLOAT16 (storage types, computed in float, see Half.h):
+template <typename H> struct halfValue {
+  static H zero() { return H(0.0f); }
+  static H one() { return H(1.0f); }
+  static H random() { return H(value<float>::random()); }
+  static H e(H x) { return H(std::exp(static_cast<float>(x))); }
+  static H tanh(H x) { return H(std::tanh(static_cast<float>(x))); }
+};
+template <> struct value<bfloat16> : halfValue<bfloat16> {};
+template <> struct value<float16> : halfValue<float16> {};
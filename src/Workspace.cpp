@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include "./Workspace.h"
+
+namespace {
+
+// ____________________________________________________________________________
+// Returns the segment boundaries 0, checkpoints..., L of L layers. Throws
+// std::invalid_argument if the checkpoints are not increasing in (0, L).
+std::vector<size_t> segmentsOf(const std::vector<size_t> &checkpoints,
+                               size_t numLayers) {
+  std::vector<size_t> segments = {0};
+  for (size_t checkpoint : checkpoints) {
+    if (checkpoint <= segments.back() || checkpoint >= numLayers) {
+      throw std::invalid_argument(
+          "Checkpoints must be increasing layers between the first and the "
+          "last.");
+    }
+    segments.push_back(checkpoint);
+  }
+  segments.push_back(numLayers);
+  return segments;
+}
+
+} // namespace
+
+// ____________________________________________________________________________
+template <typename T>
+void Workspace<T>::reserve(const std::vector<size_t> &layerSizes,
+                           size_t batchSize, bool sparseInput,
+                           const Checkpointing &checkpointing) {
+  const bool sameLayout = layerSizes == layerSizes_ &&
+                          sparseInput == sparseInput_ &&
+                          checkpointing == checkpointing_;
+  if (sameLayout && batchSize == batchSize_) {
+    return;
+  }
+  if (layerSizes.size() < 2 || batchSize == 0) {
+    throw std::invalid_argument("Workspace needs >= 2 layers and a batch.");
+  }
+  // (Checkpoints planned for a budget stay for smaller batches.)
+  if (sameLayout && (checkpointing.memoryBudget == 0 ||
+                     batchSize <= plannedBatchSize_)) {
+    // Only the batch size changed, resize the per sample buffers (those
+    // that are not empty, with the pool buffers back in the pool).
+    if (segmentActive_) {
+      swapSegment(activeSegment_);
+      segmentActive_ = false;
+    }
+    for (std::vector<Matrix<T>> *buffers : {&A, &Z, &deltas, &derivatives}) {
+      for (Matrix<T> &buffer : *buffers) {
+        if (buffer.getRows() > 0) {
+          buffer.resize(batchSize, buffer.getCols());
+        }
+      }
+    }
+    for (size_t t = 0; t < poolWidths_.size(); ++t) {
+      poolA_[t].resize(batchSize, poolWidths_[t]);
+      poolDeltas_[t].resize(batchSize, poolWidths_[t]);
+      poolDerivatives_[t].resize(batchSize, poolWidths_[t]);
+    }
+    batchSize_ = batchSize;
+    return;
+  }
+  const size_t numLayers = layerSizes.size() - 1;
+  segments_ = segmentsOf(checkpointing.memoryBudget > 0
+                             ? planCheckpoints<T>(layerSizes, batchSize,
+                                                  checkpointing.memoryBudget)
+                             : checkpointing.checkpoints,
+                         numLayers);
+  const bool checkpointed = segments_.size() > 2;
+  // Which activations are kept (the others live in the pool).
+  std::vector<bool> kept(numLayers + 1, !checkpointed);
+  for (size_t boundary : segments_) {
+    kept[boundary] = true;
+  }
+  A.clear();
+  Z.clear();
+  deltas.clear();
+  derivatives.clear();
+  dW.clear();
+  dB.clear();
+
+  if (sparseInput) {
+    A.emplace_back();
+  } else {
+    A.emplace_back(batchSize, layerSizes[0], InitState::EMPTY);
+  }
+  for (size_t i = 0; i < numLayers; ++i) {
+    const size_t in = layerSizes[i];
+    const size_t out = layerSizes[i + 1];
+    if (kept[i + 1]) {
+      A.emplace_back(batchSize, out, InitState::EMPTY);
+      deltas.emplace_back(batchSize, out, InitState::EMPTY);
+      derivatives.emplace_back(batchSize, out, InitState::EMPTY);
+    } else {
+      A.emplace_back();
+      deltas.emplace_back();
+      derivatives.emplace_back();
+    }
+    if (!checkpointed || i + 1 == numLayers) {
+      Z.emplace_back(batchSize, out, InitState::EMPTY);
+    } else {
+      Z.emplace_back();
+    }
+    if (sparseInput && i == 0) {
+      dW.emplace_back();
+    } else {
+      dW.emplace_back(in, out, InitState::EMPTY);
+    }
+    dB.emplace_back(1, out, InitState::EMPTY);
+  }
+
+  // The pool, as wide as the widest layer at every position of a segment.
+  poolWidths_.clear();
+  for (size_t s = 0; checkpointed && s + 1 < segments_.size(); ++s) {
+    for (size_t i = segments_[s]; i + 1 < segments_[s + 1]; ++i) {
+      const size_t t = i - segments_[s];
+      if (t == poolWidths_.size()) {
+        poolWidths_.push_back(0);
+      }
+      poolWidths_[t] = std::max(poolWidths_[t], layerSizes[i + 1]);
+    }
+  }
+  poolA_.clear();
+  poolDeltas_.clear();
+  poolDerivatives_.clear();
+  for (size_t width : poolWidths_) {
+    poolA_.emplace_back(batchSize, width, InitState::EMPTY);
+    poolDeltas_.emplace_back(batchSize, width, InitState::EMPTY);
+    poolDerivatives_.emplace_back(batchSize, width, InitState::EMPTY);
+  }
+  segmentActive_ = false;
+
+  layerSizes_ = layerSizes;
+  batchSize_ = batchSize;
+  sparseInput_ = sparseInput;
+  checkpointing_ = checkpointing;
+  plannedBatchSize_ = batchSize;
+}
+
+// ____________________________________________________________________________
+template <typename T> size_t Workspace<T>::getBatchSize() const {
+  return batchSize_;
+}
+
+// ____________________________________________________________________________
+template <typename T>
+const std::vector<size_t> &Workspace<T>::getSegments() const {
+  return segments_;
+}
+
+// ____________________________________________________________________________
+template <typename T> void Workspace<T>::activateSegment(size_t segment) {
+  if (segments_.size() <= 2 || (segmentActive_ && activeSegment_ == segment)) {
+    return;
+  }
+  if (segmentActive_) {
+    swapSegment(activeSegment_);
+  }
+  swapSegment(segment);
+  activeSegment_ = segment;
+  segmentActive_ = true;
+}
+
+// ____________________________________________________________________________
+template <typename T> void Workspace<T>::swapSegment(size_t segment) {
+  for (size_t i = segments_[segment]; i + 1 < segments_[segment + 1]; ++i) {
+    const size_t t = i - segments_[segment];
+    std::swap(A[i + 1], poolA_[t]);
+    std::swap(deltas[i], poolDeltas_[t]);
+    std::swap(derivatives[i], poolDerivatives_[t]);
+    // (Swapped in, the buffers get the width of the layer; that does not
+    // reallocate, the pool is as wide as the widest.)
+    const size_t width = layerSizes_[i + 1];
+    if (A[i + 1].getRows() > 0 && A[i + 1].getCols() != width) {
+      A[i + 1].resize(batchSize_, width);
+      deltas[i].resize(batchSize_, width);
+      derivatives[i].resize(batchSize_, width);
+    }
+  }
+}
+
+// ____________________________________________________________________________
+template <typename T> size_t Workspace<T>::getBatchBytes() const {
+  size_t elements = 0;
+  for (const std::vector<Matrix<T>> *buffers :
+       {&A, &Z, &deltas, &derivatives, &poolA_, &poolDeltas_,
+        &poolDerivatives_}) {
+    for (const Matrix<T> &buffer : *buffers) {
+      elements += buffer.getRows() * buffer.getStride();
+    }
+  }
+  return elements * sizeof(T);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+size_t batchBytes(const std::vector<size_t> &layerSizes, size_t batchSize,
+                  const std::vector<size_t> &checkpoints) {
+  const size_t numLayers = layerSizes.size() - 1;
+  const std::vector<size_t> segments = segmentsOf(checkpoints, numLayers);
+  // The input, and A, Z, the error and the derivative of every layer.
+  size_t elements = layerSizes[0];
+  if (segments.size() <= 2) {
+    for (size_t i = 1; i <= numLayers; ++i) {
+      elements += 4 * layerSizes[i];
+    }
+    return elements * batchSize * sizeof(T);
+  }
+  // A, the error and the derivative at the boundaries, Z of the output
+  // layer and the pool.
+  std::vector<size_t> poolWidths;
+  for (size_t s = 0; s + 1 < segments.size(); ++s) {
+    elements += 3 * layerSizes[segments[s + 1]];
+    for (size_t i = segments[s]; i + 1 < segments[s + 1]; ++i) {
+      const size_t t = i - segments[s];
+      if (t == poolWidths.size()) {
+        poolWidths.push_back(0);
+      }
+      poolWidths[t] = std::max(poolWidths[t], layerSizes[i + 1]);
+    }
+  }
+  elements += layerSizes.back();
+  for (size_t width : poolWidths) {
+    elements += 3 * width;
+  }
+  return elements * batchSize * sizeof(T);
+}
+
+// ____________________________________________________________________________
+template <typename T>
+std::vector<size_t> planCheckpoints(const std::vector<size_t> &layerSizes,
+                                    size_t batchSize, size_t memoryBudget) {
+  if (layerSizes.size() < 2) {
+    throw std::invalid_argument("Workspace needs >= 2 layers and a batch.");
+  }
+  std::vector<size_t> best;
+  size_t bestBytes = batchBytes<T>(layerSizes, batchSize);
+  if (bestBytes <= memoryBudget) {
+    return best;
+  }
+  const size_t numLayers = layerSizes.size() - 1;
+  // Prefix sums of the widths of the layer outputs, to balance segments.
+  std::vector<size_t> widths(numLayers + 1, 0);
+  for (size_t i = 0; i < numLayers; ++i) {
+    widths[i + 1] = widths[i] + layerSizes[i + 1];
+  }
+  bool fits = false;
+  double bestRecomputed = std::numeric_limits<double>::max();
+  std::vector<size_t> checkpoints;
+  for (size_t numSegments = 2; numSegments <= numLayers; ++numSegments) {
+    // Boundary j at the first layer where the widths so far reach j /
+    // numSegments of all, leaving a layer for every later segment.
+    checkpoints.clear();
+    size_t previous = 0;
+    for (size_t j = 1; j < numSegments; ++j) {
+      size_t boundary = previous + 1;
+      while (boundary < numLayers - (numSegments - j) &&
+             widths[boundary] * numSegments < j * widths[numLayers]) {
+        ++boundary;
+      }
+      checkpoints.push_back(boundary);
+      previous = boundary;
+    }
+    // Multiply-adds per row recomputed in the backward pass.
+    double recomputed = 0.0;
+    for (size_t s = 0; s + 1 < numSegments; ++s) {
+      const size_t begin = s == 0 ? 0 : checkpoints[s - 1];
+      for (size_t i = begin; i + 1 < checkpoints[s]; ++i) {
+        recomputed += static_cast<double>(layerSizes[i]) *
+                      static_cast<double>(layerSizes[i + 1]);
+      }
+    }
+    const size_t bytes = batchBytes<T>(layerSizes, batchSize, checkpoints);
+    if (bytes <= memoryBudget) {
+      if (!fits || recomputed < bestRecomputed) {
+        best = checkpoints;
+        bestRecomputed = recomputed;
+        fits = true;
+      }
+    } else if (!fits && bytes < bestBytes) {
+      best = checkpoints;
+      bestBytes = bytes;
+    }
+  }
+  return best;
+}
+
+// ____________________________________________________________________________
+// Explicit instantiation for float.
+template struct Workspace<float>;
+template size_t batchBytes<float>(const std::vector<size_t> &layerSizes,
+                                  size_t batchSize,
+                                  const std::vector<size_t> &checkpoints);
+template std::vector<size_t>
+planCheckpoints<float>(const std::vector<size_t> &layerSizes,
+                       size_t batchSize, size_t memoryBudget);
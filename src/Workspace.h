@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "./Matrix.h"
+#include "./SparseMatrix.h"
+
+// ____________________________________________________________________________
+// Gradient checkpointing of the training steps of a NeuralNetwork (see
+// NeuralNetwork::setCheckpointing): the forward pass keeps the activations
+// only at the checkpoints, the backward pass recomputes the others.
+struct Checkpointing {
+  // Layers whose inputs are kept (besides the input and output of the
+  // network), increasing, each in (0, number of layers). They split the
+  // layers into segments. Empty: every activation is kept.
+  std::vector<size_t> checkpoints;
+  // If > 0, checkpoints is ignored: the checkpoints are chosen by
+  // planCheckpoints so the batch buffers of a step fit into this many bytes
+  // (planned for the largest batch size trained on so far).
+  size_t memoryBudget = 0;
+
+  bool operator==(const Checkpointing &other) const {
+    return checkpoints == other.checkpoints &&
+           memoryBudget == other.memoryBudget;
+  }
+  bool operator!=(const Checkpointing &other) const {
+    return !(*this == other);
+  }
+};
+
+// ____________________________________________________________________________
+// Preallocated buffers for every temporary of a training step (forward and
+// backward pass) of a NeuralNetwork. They are sized once from the layer sizes
+// and the batch size; after that a training step does not allocate.
+//
+// With checkpoints c_1 < ... < c_k-1 (see Checkpointing; c_0 = 0 and c_k is
+// the number of layers) the layers form the segments [c_j, c_j+1). Kept for
+// the whole step are only A[c_j], the errors and derivatives of the last
+// layer of every segment and Z of the output layer; the others of Z stay
+// empty. The activations, errors and derivatives of the layers inside a
+// segment live in a pool sized for the longest segment and are swapped into
+// A, deltas and derivatives while the segment is active (see
+// activateSegment), so only those of one segment exist at a time.
+//
+// With L = layerSizes.size() - 1 layers and batch size N, layer i
+// (0 <= i < L) maps layerSizes[i] inputs to layerSizes[i + 1] outputs:
+template <typename T> struct Workspace {
+  // Activations, A[0] is the input batch: N x layerSizes[i] (L + 1 entries).
+  std::vector<Matrix<T>> A;
+  // Weighted sums: N x layerSizes[i + 1].
+  std::vector<Matrix<T>> Z;
+  // Errors propagated back to the layer outputs: N x layerSizes[i + 1].
+  std::vector<Matrix<T>> deltas;
+  // Activation derivatives: N x layerSizes[i + 1].
+  std::vector<Matrix<T>> derivatives;
+  // Weight gradients: layerSizes[i] x layerSizes[i + 1].
+  std::vector<Matrix<T>> dW;
+  // Bias gradients: 1 x layerSizes[i + 1].
+  std::vector<Matrix<T>> dB;
+
+  // With sparse inputs: the input batch (instead of A[0]) and the rows of
+  // the first weight gradient it touches (instead of dW[0]).
+  const SparseMatrix<T> *sparseInput = nullptr;
+  SparseRows<T> sparseDW;
+
+  // Sizes all buffers for the given layer sizes and batch size. Does not
+  // allocate if the buffers are already that large, so alternating between
+  // batch sizes (e.g. a smaller last batch of an epoch) stays free of
+  // allocations after the first time. For sparse inputs A[0] and dW[0],
+  // which would be as large as the dense inputs and the first weights, stay
+  // empty. Throws std::invalid_argument if the checkpoints do not fit the
+  // layers.
+  void reserve(const std::vector<size_t> &layerSizes, size_t batchSize,
+               bool sparseInput = false,
+               const Checkpointing &checkpointing = Checkpointing());
+
+  // Returns the batch size the buffers are sized for (0 if none).
+  size_t getBatchSize() const;
+
+  // Returns the segment boundaries 0, checkpoints..., L ({0, L} without
+  // checkpoints).
+  const std::vector<size_t> &getSegments() const;
+
+  // Swaps the buffers of the layers inside segment (see getSegments) in
+  // from the pool, and those of the segment that was active back. Does
+  // nothing if it is active already or there are no checkpoints.
+  void activateSegment(size_t segment);
+
+  // Returns the bytes of the batch buffers (activations, weighted sums,
+  // errors, derivatives and the pool), row padding included.
+  size_t getBatchBytes() const;
+
+private:
+  // Sizes the buffers are currently allocated for.
+  std::vector<size_t> layerSizes_;
+  size_t batchSize_ = 0;
+  bool sparseInput_ = false;
+  Checkpointing checkpointing_;
+  // Largest batch size the checkpoints were planned for (memory budget).
+  size_t plannedBatchSize_ = 0;
+
+  std::vector<size_t> segments_;
+  // The pool: slot t holds the activation, error and derivative of layer
+  // c_j + t of the active segment, up to poolWidths_[t] wide.
+  std::vector<size_t> poolWidths_;
+  std::vector<Matrix<T>> poolA_;
+  std::vector<Matrix<T>> poolDeltas_;
+  std::vector<Matrix<T>> poolDerivatives_;
+  size_t activeSegment_ = 0;
+  bool segmentActive_ = false;
+
+  // Swaps the buffers of segment with the pool (in and out).
+  void swapSegment(size_t segment);
+};
+
+// ____________________________________________________________________________
+// Bytes of the batch buffers of a Workspace<T> for the layer sizes, batch
+// size and checkpoints (row padding not included; for sparse inputs N x
+// layerSizes[0] fewer).
+template <typename T>
+size_t batchBytes(const std::vector<size_t> &layerSizes, size_t batchSize,
+                  const std::vector<size_t> &checkpoints = {});
+
+// Chooses the checkpoints for a memory budget (in bytes, see batchBytes):
+// none if every activation fits, otherwise of the splits into 2, 3, ..., L
+// segments (balanced by the widths of the layers) the one that fits and
+// recomputes the fewest multiply-adds (the layers of all segments but the
+// last, without the last layer of each). If none fits, the one that needs
+// the least memory.
+template <typename T>
+std::vector<size_t> planCheckpoints(const std::vector<size_t> &layerSizes,
+                                    size_t batchSize, size_t memoryBudget);
@@ -1,5 +1,6 @@
 
 #include <gtest/gtest.h>
+#include <stdexcept>
 
 #include "./Activation.h"
 
@@ -66,14 +67,18 @@ TEST(StepDerivative, Activation) {
 
 // ____________________________________________________________________________
 TEST(Softmax, Activation) {
-  Matrix<float> X =
-      std::vector<std::vector<float>>({{1.3f}, {5.1f}, {2.2f}, {0.7f}, {1.1f}});
+  // Every row is normalized, large logits do not overflow.
+  Matrix<float> X = std::vector<std::vector<float>>(
+      {{1.3f, 5.1f, 2.2f, 0.7f, 1.1f}, {1000.0f, 1000.0f, 0.0f, 0.0f, 0.0f}});
   Matrix<float> y = softmax(X);
   ASSERT_EQ(areAlmostEqual(y[0][0], 0.02f), true);
-  ASSERT_EQ(areAlmostEqual(y[1][0], 0.9f), true);
-  ASSERT_EQ(areAlmostEqual(y[2][0], 0.05f), true);
-  ASSERT_EQ(areAlmostEqual(y[3][0], 0.01f), true);
-  ASSERT_EQ(areAlmostEqual(y[4][0], 0.02f), true);
+  ASSERT_EQ(areAlmostEqual(y[0][1], 0.9f), true);
+  ASSERT_EQ(areAlmostEqual(y[0][2], 0.05f), true);
+  ASSERT_EQ(areAlmostEqual(y[0][3], 0.01f), true);
+  ASSERT_EQ(areAlmostEqual(y[0][4], 0.02f), true);
+  ASSERT_FLOAT_EQ(y[1][0], 0.5f);
+  ASSERT_FLOAT_EQ(y[1][1], 0.5f);
+  ASSERT_EQ(y[1][2], 0.0f);
 }
 
 // ____________________________________________________________________________
@@ -83,4 +88,47 @@ TEST(SoftmaxDerivative, Activation) {
   Matrix<float> y_expect = Matrix<float>(2, 3, InitState::ZERO);
   Matrix<float> y = step_derivative(X);
   EXPECT_EQ(y, y_expect);
-}
\ No newline at end of file
+}
+// ____________________________________________________________________________
+TEST(SoftmaxBackward, Activation) {
+  // Against the product with the Jacobian, diag(s) - s s^T.
+  Matrix<float> X = std::vector<std::vector<float>>(
+      {{0.5f, -1.0f, 2.0f, 0.0f}, {3.0f, 3.0f, -2.0f, 1.0f}});
+  Matrix<float> G = std::vector<std::vector<float>>(
+      {{1.0f, 0.0f, -1.0f, 2.0f}, {0.5f, -0.5f, 0.0f, 1.0f}});
+  Matrix<float> S = softmax(X);
+  Matrix<float> out(2, 4, InitState::EMPTY);
+  softmaxBackward(S, G, out);
+  for (size_t row = 0; row < 2; ++row) {
+    for (size_t i = 0; i < 4; ++i) {
+      float expected = 0.0f;
+      for (size_t j = 0; j < 4; ++j) {
+        const float jacobian =
+            (i == j ? S[row][i] : 0.0f) - S[row][i] * S[row][j];
+        expected += jacobian * G[row][j];
+      }
+      EXPECT_NEAR(out[row][i], expected, 1e-6f);
+    }
+  }
+}
+
+// ____________________________________________________________________________
+TEST(SoftmaxCrossEntropy, Activation) {
+  Matrix<float> Z = std::vector<std::vector<float>>(
+      {{2.0f, 1.0f, 0.1f}, {1000.0f, 0.0f, -1000.0f}});
+  Matrix<float> Y = std::vector<std::vector<float>>(
+      {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}});
+  Matrix<float> gradient;
+  // -log(softmax) of the labels: 0.417 and 1000 (the probability of the
+  // second one is below the float range, its log is not).
+  const float loss = softmaxCrossEntropy(Z, Y, gradient);
+  ASSERT_NEAR(loss, 0.41703f + 1000.0f, 1e-3f);
+  Matrix<float> P = softmax(Z);
+  for (size_t row = 0; row < 2; ++row) {
+    for (size_t col = 0; col < 3; ++col) {
+      ASSERT_NEAR(gradient[row][col], P[row][col] - Y[row][col], 1e-6f);
+    }
+  }
+  Matrix<float> wrong(2, 2, InitState::ZERO);
+  ASSERT_THROW(softmaxCrossEntropy(Z, wrong, gradient), std::invalid_argument);
+}
@@ -0,0 +1,202 @@
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "./Communicator.h"
+#include "./NeuralNetwork.h"
+
+extern char **environ;
+
+// ____________________________________________________________________________
+// The tests run as several processes on this machine: worker 0 (the test
+// as started) starts the workers 1 to size - 1 as copies of this binary that
+// only run the current test, with their rank and the group in environment
+// variables.
+
+// Rank of this process, 0 if it was not started as a worker.
+size_t testRank() {
+  const char *rank = std::getenv("NN_TEST_RANK");
+  return rank != nullptr ? std::stoul(rank) : 0;
+}
+
+// Settings of the group of the current test: a name and ports unique to
+// worker 0 (its process id) and the test.
+CommunicatorSettings testSettings(Transport transport) {
+  const char *group = std::getenv("NN_TEST_GROUP");
+  const long id = group != nullptr ? std::stol(group) : ::getpid();
+  const std::string test =
+      ::testing::UnitTest::GetInstance()->current_test_info()->name();
+  CommunicatorSettings settings;
+  settings.transport = transport;
+  settings.name = "nn-test-" + std::to_string(id) + "-" + test;
+  settings.basePort = static_cast<std::uint16_t>(
+      20000 + (id % 1000) * 16 + (transport == Transport::TCP ? 8 : 0));
+  settings.timeout = 30.0;
+  return settings;
+}
+
+// Runs worker(rank) on size processes. Worker 0 waits for the others and
+// checks that their tests passed.
+template <typename Worker> void runWorkers(size_t size, Worker worker) {
+  const size_t rank = testRank();
+  if (rank != 0) {
+    worker(rank);
+    return;
+  }
+  const ::testing::TestInfo *test =
+      ::testing::UnitTest::GetInstance()->current_test_info();
+  const std::string filter = std::string("--gtest_filter=") +
+                             test->test_suite_name() + "." + test->name();
+  std::vector<pid_t> workers;
+  for (size_t other = 1; other < size; ++other) {
+    // Everything the child needs is prepared before fork (only exec runs
+    // in the child).
+    std::vector<std::string> variables = {
+        "NN_TEST_RANK=" + std::to_string(other),
+        "NN_TEST_GROUP=" + std::to_string(::getpid())};
+    std::vector<char *> env;
+    for (char **variable = environ; *variable != nullptr; ++variable) {
+      env.push_back(*variable);
+    }
+    for (std::string &variable : variables) {
+      env.push_back(&variable[0]);
+    }
+    env.push_back(nullptr);
+    std::string program = "/proc/self/exe";
+    std::string brief = "--gtest_brief=1";
+    char *argv[] = {&program[0], const_cast<char *>(filter.c_str()),
+                    &brief[0], nullptr};
+    const pid_t pid = ::fork();
+    if (pid == 0) {
+      ::execve(argv[0], argv, env.data());
+      ::_exit(127);
+    }
+    ASSERT_GT(pid, 0);
+    workers.push_back(pid);
+  }
+  worker(0);
+  for (pid_t pid : workers) {
+    int status = 0;
+    ASSERT_EQ(::waitpid(pid, &status, 0), pid);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+}
+
+// ____________________________________________________________________________
+// Checks the collectives of one transport with size workers.
+void checkCollectives(Transport transport, size_t size) {
+  runWorkers(size, [&](size_t rank) {
+    CommunicatorSettings settings = testSettings(transport);
+    // Small chunks, so reductions are split.
+    settings.chunkBytes = 256;
+    auto communicator = Communicator::connect(rank, size, settings);
+    ASSERT_EQ(communicator->getRank(), rank);
+    ASSERT_EQ(communicator->getSize(), size);
+
+    // Parts of different length, and fewer elements than workers.
+    const double workers = static_cast<double>(size);
+    const double rankSum = workers * (workers + 1) / 2;
+    for (size_t n : {size_t(1001), size_t(2)}) {
+      std::vector<float> data(n);
+      for (size_t i = 0; i < n; ++i) {
+        data[i] = static_cast<float>((rank + 1) * i);
+      }
+      communicator->allReduce(data.data(), n);
+      for (size_t i = 0; i < n; ++i) {
+        ASSERT_FLOAT_EQ(data[i], static_cast<float>(rankSum * i));
+      }
+    }
+
+    std::vector<double> values(300, static_cast<double>(rank));
+    communicator->broadcast(values.data(), values.size(), size - 1);
+    for (double value : values) {
+      ASSERT_DOUBLE_EQ(value, workers - 1);
+    }
+
+    // Queued reductions run in order on the communication thread.
+    std::vector<float> a(100, 1.0f);
+    std::vector<double> b(7, static_cast<double>(rank));
+    communicator->allReduceAsync(a.data(), a.size());
+    communicator->allReduceAsync(b.data(), b.size());
+    communicator->wait();
+    ASSERT_FLOAT_EQ(a[99], static_cast<float>(workers));
+    ASSERT_DOUBLE_EQ(b[6], rankSum - workers);
+    communicator->barrier();
+  });
+}
+
+// ____________________________________________________________________________
+TEST(SharedMemory, Communicator) {
+  checkCollectives(Transport::SHARED_MEMORY, 3);
+}
+
+// ____________________________________________________________________________
+TEST(Tcp, Communicator) { checkCollectives(Transport::TCP, 3); }
+
+// ____________________________________________________________________________
+TEST(SingleWorker, Communicator) {
+  if (testRank() != 0) {
+    return;
+  }
+  ASSERT_THROW(Communicator::connect(2, 2), std::invalid_argument);
+  for (Transport transport : {Transport::SHARED_MEMORY, Transport::TCP}) {
+    auto communicator = Communicator::connect(0, 1, testSettings(transport));
+    std::vector<float> data = {1.0f, 2.0f};
+    communicator->allReduce(data.data(), data.size());
+    ASSERT_FLOAT_EQ(data[1], 2.0f);
+  }
+}
+
+// ____________________________________________________________________________
+TEST(DataParallelTraining, Communicator) {
+  // XOR, every worker trains on its half of the rows.
+  const std::vector<std::vector<float>> inputs = {
+      {0.0f, 0.0f}, {0.0f, 1.0f}, {1.0f, 0.0f}, {1.0f, 1.0f}};
+  const std::vector<std::vector<float>> labels = {
+      {0.0f}, {1.0f}, {1.0f}, {0.0f}};
+  const size_t numWorkers = 2;
+  runWorkers(numWorkers, [&](size_t rank) {
+    NeuralNetwork<float> nn({2, 8, 1},
+                            {Activation::relu, Activation::sigmoid});
+    // Worker 0 also trains alone on all rows, from the same weights.
+    NeuralNetwork<float> reference = nn;
+    nn.setCommunicator(Communicator::connect(
+        rank, numWorkers, testSettings(Transport::SHARED_MEMORY)));
+    Matrix<float> X(std::vector<std::vector<float>>(
+        inputs.begin() + 2 * rank, inputs.begin() + 2 * rank + 2));
+    Matrix<float> y(std::vector<std::vector<float>>(
+        labels.begin() + 2 * rank, labels.begin() + 2 * rank + 2));
+    nn.train(X, y, 0.2f, 20);
+
+    // The workers end with the same weights.
+    Communicator &communicator = *nn.getCommunicator();
+    for (const Matrix<float> &W : nn.getWeights()) {
+      Matrix<float> sum = W;
+      communicator.allReduce(sum.data(), sum.getRows() * sum.getStride());
+      for (size_t row = 0; row < W.getRows(); ++row) {
+        for (size_t col = 0; col < W.getCols(); ++col) {
+          ASSERT_EQ(sum[row][col], W[row][col] * numWorkers);
+        }
+      }
+    }
+
+    // And the weights of one network trained on all rows (up to rounding,
+    // the gradients are summed in a different order).
+    if (rank == 0) {
+      reference.train(Matrix<float>(inputs), Matrix<float>(labels), 0.2f, 20);
+      for (size_t i = 0; i < nn.getWeights().size(); ++i) {
+        const Matrix<float> &W = nn.getWeights()[i];
+        const Matrix<float> &expected = reference.getWeights()[i];
+        for (size_t row = 0; row < W.getRows(); ++row) {
+          for (size_t col = 0; col < W.getCols(); ++col) {
+            ASSERT_NEAR(W[row][col], expected[row][col], 1e-4f);
+          }
+        }
+      }
+    }
+  });
+}
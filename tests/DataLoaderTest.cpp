@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+#include "./DataLoader.h"
+
+// ____________________________________________________________________________
+// Data set where row i is {i, 2 * i} with label {-i}.
+void makeDataset(size_t rows, Matrix<float> &X, Matrix<float> &y) {
+  X = Matrix<float>(rows, 2, InitState::EMPTY);
+  y = Matrix<float>(rows, 1, InitState::EMPTY);
+  for (size_t i = 0; i < rows; ++i) {
+    X[i][0] = static_cast<float>(i);
+    X[i][1] = static_cast<float>(2 * i);
+    y[i][0] = -static_cast<float>(i);
+  }
+}
+
+// ____________________________________________________________________________
+// Runs one epoch of loader. Checks that every batch but one has batchSize
+// rows, that features and labels stay together and that every row of the
+// data set comes exactly once. Returns the row order.
+std::vector<size_t> runEpoch(DataLoader<float> &loader, size_t rows,
+                             size_t batchSize) {
+  std::vector<size_t> order;
+  size_t smallBatches = 0;
+  Matrix<float> X;
+  Matrix<float> y;
+  loader.reset();
+  while (loader.next(X, y)) {
+    EXPECT_LE(X.getRows(), batchSize);
+    smallBatches += X.getRows() < batchSize;
+    for (size_t i = 0; i < X.getRows(); ++i) {
+      EXPECT_EQ(X[i][1], 2 * X[i][0]);
+      EXPECT_EQ(y[i][0], -X[i][0]);
+      order.push_back(static_cast<size_t>(X[i][0]));
+    }
+  }
+  std::vector<int> seen(rows, 0);
+  for (size_t row : order) {
+    seen[row]++;
+  }
+  EXPECT_EQ(seen, std::vector<int>(rows, 1));
+  EXPECT_LE(smallBatches, 1);
+  return order;
+}
+
+// ____________________________________________________________________________
+TEST(MatrixLoader, DataLoader) {
+  Matrix<float> X;
+  Matrix<float> y;
+  makeDataset(103, X, y);
+
+  MatrixLoader<float> inOrder(X, y, 10, false);
+  std::vector<size_t> order = runEpoch(inOrder, 103, 10);
+  for (size_t i = 0; i < order.size(); ++i) {
+    ASSERT_EQ(order[i], i);
+  }
+
+  // Shuffled epochs visit the rows in different orders.
+  MatrixLoader<float> shuffled(X, y, 10);
+  ASSERT_NE(runEpoch(shuffled, 103, 10), runEpoch(shuffled, 103, 10));
+
+  ASSERT_THROW(MatrixLoader<float>(X, Matrix<float>(3, 1), 10),
+               std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+TEST(FileLoader, DataLoader) {
+  Matrix<float> X;
+  Matrix<float> y;
+  makeDataset(57, X, y);
+  saveDataset("dataset_test.bin", X, y);
+
+  FileLoader<float> inOrder("dataset_test.bin", 8, false);
+  ASSERT_EQ(inOrder.getRows(), 57);
+  ASSERT_EQ(inOrder.getFeatureCols(), 2);
+  ASSERT_EQ(inOrder.getLabelCols(), 1);
+  std::vector<size_t> order = runEpoch(inOrder, 57, 8);
+  for (size_t i = 0; i < order.size(); ++i) {
+    ASSERT_EQ(order[i], i);
+  }
+
+  // Batches come in random order, rows of the last batch stay together.
+  FileLoader<float> shuffled("dataset_test.bin", 8);
+  runEpoch(shuffled, 57, 8);
+
+  ASSERT_THROW(FileLoader<float>("does_not_exist.bin", 8),
+               std::runtime_error);
+  saveDataset("dataset_test.bin", Matrix<double>(2, 2), Matrix<double>(2, 1));
+  ASSERT_THROW(FileLoader<float>("dataset_test.bin", 8), std::runtime_error);
+}
+
+// ____________________________________________________________________________
+TEST(PrefetchLoader, DataLoader) {
+  Matrix<float> X;
+  Matrix<float> y;
+  makeDataset(45, X, y);
+  MatrixLoader<float> source(X, y, 7, false);
+  PrefetchLoader<float> prefetch(source);
+  for (int epoch = 0; epoch < 3; ++epoch) {
+    std::vector<size_t> order = runEpoch(prefetch, 45, 7);
+    for (size_t i = 0; i < order.size(); ++i) {
+      ASSERT_EQ(order[i], i);
+    }
+  }
+}
@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+
+#include "./Dense.h"
+
+// ____________________________________________________________________________
+// Checks the fused layer against dot, add and the activation function.
+void expectMatchesUnfused(size_t rows, size_t in, size_t out,
+                          Activation activation) {
+  Matrix<float> X(rows, in, InitState::RANDOM);
+  Matrix<float> W(in, out, InitState::RANDOM);
+  Matrix<float> b(1, out, InitState::RANDOM);
+  // Keep the weighted sums small enough for the softmax not to overflow.
+  X.scalMul(1.0f / static_cast<float>(in));
+  Matrix<float> Z = add(dot(X, W), b);
+  Matrix<float> A(1, 1, InitState::EMPTY);
+  switch (activation) {
+  case Activation::linear:
+    A = linear(Z);
+    break;
+  case Activation::relu:
+    A = relu(Z);
+    break;
+  case Activation::step:
+    A = step(Z);
+    break;
+  case Activation::softmax:
+    A = softmax(Z);
+    break;
+  case Activation::sigmoid:
+    A = sigmoid(Z);
+    break;
+  case Activation::tanh:
+    A = tanh(Z);
+    break;
+  }
+
+  Matrix<float> fusedA;
+  Matrix<float> fusedZ;
+  dense(X, W, b, activation, fusedA, &fusedZ);
+  ASSERT_EQ(fusedA.getRows(), rows);
+  ASSERT_EQ(fusedA.getCols(), out);
+  for (size_t i = 0; i < rows; ++i) {
+    for (size_t j = 0; j < out; ++j) {
+      ASSERT_NEAR(fusedZ[i][j], Z[i][j], 1e-4f);
+      ASSERT_NEAR(fusedA[i][j], A[i][j], 1e-4f);
+    }
+  }
+
+  // Inference mode produces the same activations without Z.
+  Matrix<float> inferenceA;
+  dense(X, W, b, activation, inferenceA);
+  ASSERT_EQ(inferenceA, fusedA);
+}
+
+// ____________________________________________________________________________
+TEST(MatchesUnfused, Dense) {
+  // Small shapes use the unpacked GEMM, large ones the blocked one.
+  for (Activation activation :
+       {Activation::linear, Activation::relu, Activation::step,
+        Activation::softmax, Activation::sigmoid, Activation::tanh}) {
+    expectMatchesUnfused(4, 3, 5, activation);
+    expectMatchesUnfused(70, 300, 45, activation);
+  }
+}
+
+// ____________________________________________________________________________
+TEST(ReusesBuffers, Dense) {
+  Matrix<float> X(8, 16, InitState::RANDOM);
+  Matrix<float> W(16, 32, InitState::RANDOM);
+  Matrix<float> b(1, 32, InitState::RANDOM);
+  Matrix<float> A(8, 32, InitState::EMPTY);
+  const float *buffer = A.data();
+  dense(X, W, b, Activation::relu, A);
+  ASSERT_EQ(A.data(), buffer);
+  ASSERT_THROW(dense(W, W, b, Activation::relu, A), std::invalid_argument);
+}
@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+#include "./Expression.h"
+
+// ____________________________________________________________________________
+// Wider than a block (and padded), so rows are evaluated in several blocks.
+constexpr size_t kRows = 37;
+constexpr size_t kCols = kExpressionBlock + 45;
+
+// ____________________________________________________________________________
+TEST(MatchesEager, Expression) {
+  Matrix<float> A(kRows, kCols);
+  Matrix<float> B(kRows, kCols);
+  Matrix<float> C(kRows, kCols);
+  Matrix<float> D(kRows, kCols);
+
+  // Both operands of the outer sum need scratch blocks.
+  Matrix<float> res = evaluate((lazy(A) + lazy(B)) * (lazy(C) - lazy(D)) +
+                               (lazy(A) * lazy(B) - (lazy(C) + lazy(D))));
+  Matrix<float> expected =
+      add(dotElementWise(add(A, B), sub(C, D)),
+          sub(dotElementWise(A, B), add(C, D)));
+  ASSERT_EQ(res.getRows(), kRows);
+  ASSERT_EQ(res.getCols(), kCols);
+  for (size_t row = 0; row < kRows; ++row) {
+    for (size_t col = 0; col < kCols; ++col) {
+      ASSERT_FLOAT_EQ(res[row][col], expected[row][col]);
+    }
+  }
+}
+
+// ____________________________________________________________________________
+TEST(Scalars, Expression) {
+  using Rows = std::vector<std::vector<double>>;
+  Matrix<double> A(Rows({{1.0, -2.0, 3.0}, {-4.0, 5.0, -6.0}}));
+  ASSERT_EQ(evaluate(2.0 * lazy(A) + 1.0),
+            Matrix<double>(Rows({{3.0, -3.0, 7.0}, {-7.0, 11.0, -11.0}})));
+  ASSERT_EQ(evaluate(1.0 - lazy(A) * 0.5),
+            Matrix<double>(Rows({{0.5, 2.0, -0.5}, {3.0, -1.5, 4.0}})));
+  ASSERT_EQ(evaluate(maximum(lazy(A) - 1.0, 0.0)),
+            Matrix<double>(Rows({{0.0, 0.0, 2.0}, {0.0, 4.0, 0.0}})));
+
+  Matrix<int> I(std::vector<std::vector<int>>({{1, 2}, {3, 4}}));
+  ASSERT_EQ(evaluate(lazy(I) * I - 1),
+            Matrix<int>(std::vector<std::vector<int>>({{0, 3}, {8, 15}})));
+}
+
+// ____________________________________________________________________________
+TEST(Broadcast, Expression) {
+  Matrix<float> Z(kRows, kCols);
+  Matrix<float> b(1, kCols);
+  Matrix<float> res =
+      evaluate(activation(lazy(Z) + b, Activation::sigmoid));
+  Matrix<float> expected = sigmoid(add(Z, b));
+  for (size_t row = 0; row < kRows; ++row) {
+    for (size_t col = 0; col < kCols; ++col) {
+      ASSERT_FLOAT_EQ(res[row][col], expected[row][col]);
+    }
+  }
+  // The broadcast operand may be on either side.
+  ASSERT_EQ(evaluate(b - lazy(Z)).getRows(), kRows);
+
+  ASSERT_THROW(activation(lazy(Z), Activation::softmax),
+               std::invalid_argument);
+  Matrix<float> rows(2, kCols);
+  Matrix<float> column(kRows, 1);
+  ASSERT_THROW(lazy(Z) + rows, std::invalid_argument);
+  ASSERT_THROW(lazy(Z) * column, std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+TEST(AssignInPlace, Expression) {
+  Matrix<float> W(kRows, kCols);
+  Matrix<float> dW(kRows, kCols);
+  Matrix<float> expected = sub(W, Matrix<float>(dW).scalMul(0.5f));
+  const float *data = W.data();
+  assign(W, lazy(W) - lazy(dW) * 0.5f);
+  ASSERT_EQ(W.data(), data);
+  for (size_t row = 0; row < kRows; ++row) {
+    for (size_t col = 0; col < kCols; ++col) {
+      ASSERT_FLOAT_EQ(W[row][col], expected[row][col]);
+    }
+  }
+
+  // Resized to the shape of the expression.
+  Matrix<float> out;
+  assign(out, lazy(W));
+  ASSERT_EQ(out, W);
+}
+
+// ____________________________________________________________________________
+TEST(Sum, Expression) {
+  Matrix<double> y(kRows, kCols);
+  Matrix<double> out(kRows, kCols);
+  Matrix<double> diff = sub(y, out);
+  auto lazyDiff = lazy(y) - lazy(out);
+  ASSERT_NEAR(sum(lazyDiff * lazyDiff), sum(dotElementWise(diff, diff)),
+              1e-9);
+
+  // Large enough to be split between threads, the result stays the same.
+  Matrix<float> A(600, 100, InitState::ONES);
+  ASSERT_FLOAT_EQ(sum(lazy(A) * 3.0f), 180000.0f);
+  // Unpadded, summed as one array.
+  Matrix<float> narrow(4096, 10, InitState::ONES);
+  Matrix<float> bias(1, 10, InitState::ONES);
+  ASSERT_FLOAT_EQ(sum(lazy(narrow) * 3.0f), 122880.0f);
+  ASSERT_FLOAT_EQ(sum(lazy(narrow) + bias), 81920.0f);
+  Matrix<float> empty;
+  ASSERT_FLOAT_EQ(sum(lazy(empty)), 0.0f);
+}
@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+#include "./FixedNetwork.h"
+
+// ____________________________________________________________________________
+TEST(MatchesNeuralNetwork, FixedNetwork) {
+  NeuralNetwork<float> nn(std::vector<size_t>({5, 16, 8, 3}),
+                          std::vector<Activation>({Activation::relu,
+                                                   Activation::tanh,
+                                                   Activation::softmax}));
+  using Network =
+      FixedNetwork<float, FixedDense<5, 16, Activation::relu>,
+                   FixedDense<16, 8, Activation::tanh>,
+                   FixedDense<8, 3, Activation::softmax>>;
+  static_assert(Network::kInputs == 5 && Network::kOutputs == 3, "");
+  const Network fixed(nn);
+
+  Matrix<float> X(10, 5, InitState::RANDOM);
+  const Matrix<float> expected = nn.act(X);
+  const Matrix<float> out = fixed.act(X);
+  ASSERT_EQ(out.getRows(), 10);
+  ASSERT_EQ(out.getCols(), 3);
+  for (size_t row = 0; row < 10; ++row) {
+    Network::Input input;
+    std::copy_n(X[row], 5, input.begin());
+    const Network::Output sample = fixed.act(input);
+    for (size_t col = 0; col < 3; ++col) {
+      ASSERT_NEAR(out[row][col], expected[row][col], 1e-5f);
+      ASSERT_EQ(sample[col], out[row][col]);
+    }
+  }
+}
+
+// ____________________________________________________________________________
+TEST(XorGate, FixedNetwork) {
+  // The XOR network of NeuralNetworkMain.cpp, trained, saved and loaded.
+  Matrix<float> X_train =
+      std::vector<std::vector<float>>({{0, 0}, {0, 1}, {1, 0}, {1, 1}});
+  Matrix<float> y_train = std::vector<std::vector<float>>({{0}, {1}, {1}, {0}});
+  NeuralNetwork<float> xorGate(
+      std::vector<size_t>({2, 4, 1}),
+      std::vector<Activation>({Activation::sigmoid, Activation::sigmoid}));
+  xorGate.train(X_train, y_train, 0.5f, 200);
+  xorGate.save("fixed_xor.bin");
+
+  using Xor = FixedNetwork<float, FixedDense<2, 4, Activation::sigmoid>,
+                           FixedDense<4, 1, Activation::sigmoid>>;
+  const Xor fixed = Xor::load("fixed_xor.bin");
+  const Matrix<float> expected = xorGate.act(X_train);
+  for (size_t row = 0; row < 4; ++row) {
+    const Xor::Output out =
+        fixed.act(Xor::Input{X_train[row][0], X_train[row][1]});
+    ASSERT_NEAR(out[0], expected[row][0], 1e-5f);
+  }
+
+  // Shapes and activations must match.
+  using Wider = FixedNetwork<float, FixedDense<2, 8, Activation::sigmoid>,
+                             FixedDense<8, 1, Activation::sigmoid>>;
+  ASSERT_THROW(Wider{xorGate}, std::invalid_argument);
+  using Relu = FixedNetwork<float, FixedDense<2, 4, Activation::relu>,
+                            FixedDense<4, 1, Activation::sigmoid>>;
+  ASSERT_THROW(Relu{xorGate}, std::invalid_argument);
+  using Shallow = FixedNetwork<float, FixedDense<2, 1, Activation::sigmoid>>;
+  ASSERT_THROW(Shallow{xorGate}, std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+TEST(HalfWeights, FixedNetwork) {
+  // bfloat16 weights are widened when copied.
+  NeuralNetwork<float> nn(std::vector<size_t>({3, 2}),
+                          std::vector<Activation>({Activation::linear}));
+  nn.setPrecision(Precision::BFLOAT16);
+  const FixedNetwork<float, FixedDense<3, 2, Activation::linear>> fixed(nn);
+  Matrix<float> X(4, 3, InitState::RANDOM);
+  const Matrix<float> expected = nn.act(X);
+  const Matrix<float> out = fixed.act(X);
+  for (size_t row = 0; row < 4; ++row) {
+    for (size_t col = 0; col < 2; ++col) {
+      ASSERT_NEAR(out[row][col], expected[row][col], 1e-5f);
+    }
+  }
+}
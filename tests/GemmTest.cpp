@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "./Gemm.h"
+#include "./Matrix.h"
+
+// ____________________________________________________________________________
+// Naive reference multiplication.
+template <typename T>
+Matrix<T> referenceDot(const Matrix<T> &A, const Matrix<T> &B) {
+  Matrix<T> C(A.getRows(), B.getCols(), InitState::ZERO);
+  for (size_t i = 0; i < A.getRows(); ++i) {
+    for (size_t j = 0; j < B.getCols(); ++j) {
+      double sum = 0.0;
+      for (size_t p = 0; p < A.getCols(); ++p) {
+        sum += static_cast<double>(A[i][p]) * static_cast<double>(B[p][j]);
+      }
+      C[i][j] = static_cast<T>(sum);
+    }
+  }
+  return C;
+}
+
+// ____________________________________________________________________________
+// Checks C against the reference within a relative tolerance.
+template <typename T>
+void expectNear(const Matrix<T> &C, const Matrix<T> &expected, double tol) {
+  ASSERT_EQ(C.getRows(), expected.getRows());
+  ASSERT_EQ(C.getCols(), expected.getCols());
+  for (size_t i = 0; i < C.getRows(); ++i) {
+    for (size_t j = 0; j < C.getCols(); ++j) {
+      double e = expected[i][j];
+      ASSERT_NEAR(C[i][j], e, tol * (1.0 + std::abs(e)))
+          << "at (" << i << ", " << j << ")";
+    }
+  }
+}
+
+// ____________________________________________________________________________
+TEST(BlockedFloat, Gemm) {
+  // Shapes cover the unpacked path, edge tiles in every dimension and
+  // several KC / MC / NC blocks.
+  const size_t shapes[][3] = {{1, 1, 1},    {4, 1, 2},     {7, 9, 5},
+                              {33, 65, 17}, {97, 31, 300}, {130, 2100, 40},
+                              {1, 300, 513}};
+  for (const auto &shape : shapes) {
+    Matrix<float> A(shape[0], shape[2], InitState::RANDOM);
+    Matrix<float> B(shape[2], shape[1], InitState::RANDOM);
+    expectNear(dot(A, B), referenceDot(A, B), 1e-4);
+  }
+}
+
+// ____________________________________________________________________________
+TEST(BlockedDouble, Gemm) {
+  Matrix<double> A(101, 259, InitState::RANDOM);
+  Matrix<double> B(259, 67, InitState::RANDOM);
+  expectNear(dot(A, B), referenceDot(A, B), 1e-12);
+}
+
+// ____________________________________________________________________________
+TEST(BlockedInt, Gemm) {
+  Matrix<int> A(50, 70, InitState::ZERO);
+  Matrix<int> B(70, 45, InitState::ZERO);
+  for (size_t i = 0; i < 50; ++i) {
+    for (size_t j = 0; j < 70; ++j) {
+      A[i][j] = static_cast<int>((i * 7 + j * 3) % 11) - 5;
+      if (i < 45) {
+        B[j][i] = static_cast<int>((i + j * 5) % 13) - 6;
+      }
+    }
+  }
+  EXPECT_EQ(dot(A, B), referenceDot(A, B));
+}
+
+// ____________________________________________________________________________
+TEST(Accumulate, Gemm) {
+  Matrix<float> A(40, 300, InitState::RANDOM);
+  Matrix<float> B(300, 50, InitState::RANDOM);
+  Matrix<float> C(40, 50, InitState::ONES);
+  gemm(40, 50, 300, A.data(), A.getStride(), B.data(), B.getStride(),
+       C.data(), C.getStride(), true);
+  Matrix<float> expected = referenceDot(A, B);
+  expected.add(Matrix<float>(40, 50, InitState::ONES));
+  expectNear(C, expected, 1e-4);
+}
+
+// ____________________________________________________________________________
+TEST(Transposed, Gemm) {
+  // A^T * B and A * B^T against the product with explicit transposes, on the
+  // unpacked and the blocked path.
+  const size_t shapes[][3] = {{3, 5, 4}, {70, 45, 300}, {130, 2100, 40}};
+  for (const auto &shape : shapes) {
+    const size_t m = shape[0], n = shape[1], k = shape[2];
+    Matrix<float> At(k, m, InitState::RANDOM);
+    Matrix<float> B(k, n, InitState::RANDOM);
+    Matrix<float> A = At.transpose_copy();
+    Matrix<float> Bt = B.transpose_copy();
+    Matrix<float> expected = referenceDot(A, B);
+    expectNear(transposeDot(At, B), expected, 1e-4);
+    expectNear(dotTranspose(A, Bt), expected, 1e-4);
+
+    Matrix<float> C(m, n, InitState::EMPTY);
+    gemm(Transpose::YES, Transpose::YES, m, n, k, At.data(), At.getStride(),
+         Bt.data(), Bt.getStride(), C.data(), C.getStride());
+    expectNear(C, expected, 1e-4);
+  }
+  Matrix<float> A(3, 4, InitState::RANDOM);
+  ASSERT_THROW(transposeDot(A, Matrix<float>(4, 4)), std::invalid_argument);
+  ASSERT_THROW(dotTranspose(A, Matrix<float>(4, 3)), std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+TEST(Int8, Gemm) {
+  // More columns than one parallel block, with a partial group of 4.
+  const size_t m = 5, n = 70, k = 37;
+  std::vector<int8_t> A(m * k);
+  std::vector<int8_t> B(n * k);
+  for (size_t i = 0; i < A.size(); ++i) {
+    A[i] = static_cast<int8_t>((i * 29) % 255 - 127);
+  }
+  for (size_t i = 0; i < B.size(); ++i) {
+    B[i] = static_cast<int8_t>((i * 53) % 255 - 127);
+  }
+  Matrix<float> scales(1, n, InitState::RANDOM);
+  Matrix<float> bias(1, n, InitState::RANDOM);
+  Matrix<float> C(m, n, InitState::EMPTY);
+  std::vector<int8_t> Q(m * n);
+  QuantizedEpilogue<float> epilogue;
+  epilogue.scales = scales.data();
+  epilogue.bias = bias.data();
+  epilogue.Q = Q.data();
+  epilogue.ldq = n;
+  epilogue.outputScale = 0.5f;
+  gemmInt8(m, n, k, A.data(), k, B.data(), k, C.data(), C.getStride(),
+           epilogue);
+  for (size_t i = 0; i < m; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      int32_t acc = 0;
+      for (size_t p = 0; p < k; ++p) {
+        acc += A[i * k + p] * B[j * k + p];
+      }
+      const float expected =
+          static_cast<float>(acc) * scales[0][j] + bias[0][j];
+      ASSERT_FLOAT_EQ(C[i][j], expected) << "at (" << i << ", " << j << ")";
+      const float q = std::max(-127.0f, std::min(127.0f, expected / 0.5f));
+      ASSERT_NEAR(Q[i * n + j], q, 0.5f + 1e-4f);
+    }
+  }
+
+  int8_t quantized[4];
+  const float values[4] = {-1000.0f, -0.26f, 0.24f, 63.6f};
+  quantizeInt8(values, 4, 0.5f, quantized);
+  ASSERT_EQ(quantized[0], -127);
+  ASSERT_EQ(quantized[1], -1);
+  ASSERT_EQ(quantized[2], 0);
+  ASSERT_EQ(quantized[3], 127);
+}
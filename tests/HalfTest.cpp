@@ -0,0 +1,267 @@
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "./Gemm.h"
+#include "./Half.h"
+#include "./InferenceSession.h"
+#include "./NeuralNetwork.h"
+#include "./Simd.h"
+
+// ____________________________________________________________________________
+// Float values covering every class: zeros, subnormals, normals of both
+// half formats, ties, the float16 limits, infinities and NaN.
+std::vector<float> specialValues() {
+  std::vector<float> values = {0.0f,
+                               -0.0f,
+                               1.0f,
+                               -1.5f,
+                               1.0f + 0x1p-8f,
+                               1.0f + 0x3p-8f,
+                               1.0f + 0x1p-11f,
+                               1.0f + 0x3p-11f,
+                               65504.0f,
+                               65519.0f,
+                               65520.0f,
+                               -1e6f,
+                               0x1p-14f,
+                               0x1p-24f,
+                               0x1p-25f,
+                               0x3p-26f,
+                               1e-30f,
+                               std::numeric_limits<float>::denorm_min(),
+                               std::numeric_limits<float>::max(),
+                               std::numeric_limits<float>::infinity(),
+                               -std::numeric_limits<float>::infinity(),
+                               std::numeric_limits<float>::quiet_NaN()};
+  for (int i = 0; i < 1000; ++i) {
+    values.push_back(std::ldexp(std::sin(i * 0.37f), i % 80 - 40));
+  }
+  return values;
+}
+
+// ____________________________________________________________________________
+TEST(Rounding, Half) {
+  // Ties round to even.
+  ASSERT_EQ(static_cast<float>(bfloat16(1.0f + 0x1p-8f)), 1.0f);
+  ASSERT_EQ(static_cast<float>(bfloat16(1.0f + 0x3p-8f)), 1.0f + 0x1p-6f);
+  ASSERT_EQ(static_cast<float>(float16(1.0f + 0x1p-11f)), 1.0f);
+  ASSERT_EQ(static_cast<float>(float16(1.0f + 0x3p-11f)), 1.0f + 0x1p-9f);
+
+  // float16 range: overflow to infinity, subnormals, underflow to zero.
+  ASSERT_EQ(static_cast<float>(float16(65519.0f)), 65504.0f);
+  ASSERT_TRUE(std::isinf(static_cast<float>(float16(65520.0f))));
+  ASSERT_EQ(static_cast<float>(float16(0x3p-25f)), 0x1p-23f);
+  ASSERT_EQ(static_cast<float>(float16(0x1p-25f)), 0.0f);
+  ASSERT_EQ(static_cast<float>(float16(-0x1p-24f)), -0x1p-24f);
+  ASSERT_TRUE(std::isnan(static_cast<float>(
+      bfloat16(std::numeric_limits<float>::quiet_NaN()))));
+  ASSERT_TRUE(std::isnan(static_cast<float>(
+      float16(std::numeric_limits<float>::quiet_NaN()))));
+
+  // Every half value converts to float and back unchanged.
+  for (std::uint32_t bits = 0; bits <= 0xffff; ++bits) {
+    const auto h = static_cast<std::uint16_t>(bits);
+    const float b = bfloat16::fromBits(h);
+    const float f = float16::fromBits(h);
+    if (!std::isnan(b)) {
+      ASSERT_EQ(bfloat16(b).bits, h);
+    }
+    if (!std::isnan(f)) {
+      ASSERT_EQ(float16(f).bits, h);
+    }
+  }
+}
+
+// ____________________________________________________________________________
+TEST(KernelsMatchScalar, Half) {
+  const std::vector<float> values = specialValues();
+  const size_t n = values.size();
+  const HalfKernels scalar = scalarHalfKernels();
+  std::vector<const HalfKernels *> tables = {&scalar};
+  if (detectSimdLevel() >= SimdLevel::AVX2 && avx2HalfKernels() != nullptr) {
+    tables.push_back(avx2HalfKernels());
+  }
+  std::vector<std::uint16_t> halves(n);
+  std::vector<float> floats(n);
+  for (const HalfKernels *kernels : tables) {
+    kernels->floatToBf16(values.data(), halves.data(), n);
+    kernels->bf16ToFloat(halves.data(), floats.data(), n);
+    for (size_t i = 0; i < n; ++i) {
+      ASSERT_EQ(halves[i], bfloat16(values[i]).bits) << values[i];
+      ASSERT_EQ(floatBits(floats[i]), floatBits(bfloat16::fromBits(halves[i])));
+    }
+    kernels->floatToFp16(values.data(), halves.data(), n);
+    kernels->fp16ToFloat(halves.data(), floats.data(), n);
+    for (size_t i = 0; i < n; ++i) {
+      if (std::isnan(values[i])) {
+        ASSERT_TRUE(std::isnan(floats[i]));
+        continue;
+      }
+      ASSERT_EQ(halves[i], float16(values[i]).bits) << values[i];
+      ASSERT_EQ(floatBits(floats[i]), floatBits(float16::fromBits(halves[i])));
+    }
+  }
+}
+
+// ____________________________________________________________________________
+// Checks that gemm with half width A and B gives exactly the result of gemm
+// with the widened values.
+template <typename H> void checkMixedGemm() {
+  const size_t shapes[][3] = {{3, 5, 7}, {33, 65, 300}, {1, 300, 513}};
+  for (const auto &shape : shapes) {
+    const size_t m = shape[0], n = shape[1], k = shape[2];
+    for (Transpose transB : {Transpose::NO, Transpose::YES}) {
+      const size_t bRows = transB == Transpose::NO ? k : n;
+      const size_t bCols = transB == Transpose::NO ? n : k;
+      Matrix<float> A(m, k, InitState::RANDOM);
+      Matrix<float> B(bRows, bCols, InitState::RANDOM);
+      Matrix<H> halfA;
+      Matrix<H> halfB;
+      convert(A, halfA);
+      convert(B, halfB);
+      convert(halfA, A);
+      convert(halfB, B);
+
+      Matrix<float> expected(m, n, InitState::EMPTY);
+      Matrix<float> result(m, n, InitState::EMPTY);
+      gemm(Transpose::NO, transB, m, n, k, A.data(), A.getStride(), B.data(),
+           B.getStride(), expected.data(), expected.getStride());
+      gemm(Transpose::NO, transB, m, n, k, A.data(), A.getStride(),
+           halfB.data(), halfB.getStride(), result.data(), result.getStride());
+      ASSERT_EQ(result, expected);
+      gemm(Transpose::NO, transB, m, n, k, halfA.data(), halfA.getStride(),
+           halfB.data(), halfB.getStride(), result.data(), result.getStride());
+      ASSERT_EQ(result, expected);
+    }
+  }
+}
+
+// ____________________________________________________________________________
+TEST(MixedGemm, Half) {
+  checkMixedGemm<bfloat16>();
+  checkMixedGemm<float16>();
+}
+
+// ____________________________________________________________________________
+// Network with 32 inputs and 8 outputs.
+NeuralNetwork<float> makeNetwork() {
+  return NeuralNetwork<float>(
+      std::vector<size_t>({32, 64, 8}),
+      std::vector<Activation>({Activation::tanh, Activation::linear}));
+}
+
+// ____________________________________________________________________________
+TEST(Inference, Half) {
+  NeuralNetwork<float> nn = makeNetwork();
+  Matrix<float> X(20, 32, InitState::RANDOM);
+  const Matrix<float> expected = nn.act(X);
+  for (Precision precision : {Precision::BFLOAT16, Precision::FLOAT16}) {
+    nn.setPrecision(precision);
+    ASSERT_EQ(nn.getPrecision(), precision);
+    const Matrix<float> out = nn.act(X);
+    ASSERT_EQ(InferenceSession<float>(nn).run(X), out);
+    const float tolerance = precision == Precision::BFLOAT16 ? 0.05f : 0.01f;
+    for (size_t i = 0; i < out.getRows(); ++i) {
+      for (size_t j = 0; j < out.getCols(); ++j) {
+        ASSERT_NEAR(out[i][j], expected[i][j],
+                    tolerance * (1.0f + std::fabs(expected[i][j])));
+      }
+    }
+  }
+  nn.setPrecision(Precision::FLOAT32);
+  ASSERT_EQ(nn.act(X), expected);
+}
+
+// ____________________________________________________________________________
+TEST(MixedPrecisionTraining, Half) {
+  // Learns to halve a number with float16 weights and errors, the float
+  // weights stay the master copy.
+  Matrix<float> X = std::vector<std::vector<float>>(
+      {{0}, {1}, {2}, {3}, {4}, {5}, {6}, {7}});
+  Matrix<float> y = std::vector<std::vector<float>>(
+      {{0.0f}, {0.5f}, {1.0f}, {1.5f}, {2.0f}, {2.5f}, {3.0f}, {3.5f}});
+  NeuralNetwork<float> nn(std::vector<size_t>({1, 1}),
+                          std::vector<Activation>({Activation::linear}));
+  LossScaling lossScaling;
+  lossScaling.scale = 1024.0f;
+  lossScaling.dynamic = true;
+  lossScaling.growthInterval = 100;
+  nn.setPrecision(Precision::FLOAT16, lossScaling);
+  nn.train(X, y, 0.01f, 2000);
+  const Matrix<float> out = nn.act(X);
+  for (size_t i = 0; i < 8; ++i) {
+    ASSERT_NEAR(out[i][0], y[i][0], 0.05f);
+  }
+  nn.visitWeights([&](const auto &weights) {
+    ASSERT_EQ(static_cast<float>(weights[0][0][0]),
+              static_cast<float>(float16(nn.getWeights()[0][0][0])));
+  });
+  ASSERT_GT(nn.getLossScaling().scale, 1024.0f);
+}
+
+// ____________________________________________________________________________
+TEST(LossScalingOverflow, Half) {
+  NeuralNetwork<float> nn = makeNetwork();
+  Matrix<float> X(16, 32, InitState::RANDOM);
+  Matrix<float> y(16, 8, InitState::ZERO);
+  LossScaling lossScaling;
+  lossScaling.scale = 0x1p40f;
+  lossScaling.dynamic = true;
+  nn.setPrecision(Precision::FLOAT16, lossScaling);
+
+  // The scaled errors overflow float16: the step is skipped and the scale
+  // halved, the weights do not change.
+  const std::vector<Matrix<float>> weights = nn.getWeights();
+  nn.train(X, y, 0.1f, 1);
+  ASSERT_EQ(nn.getSkippedSteps(), 1);
+  ASSERT_EQ(nn.getLossScaling().scale, 0x1p39f);
+  ASSERT_EQ(nn.getWeights(), weights);
+
+  // Until the scale is small enough.
+  nn.train(X, y, 0.001f, 50);
+  ASSERT_GT(nn.getSkippedSteps(), 1);
+  ASSERT_LT(nn.getSkippedSteps(), 50);
+  ASSERT_NE(nn.getWeights(), weights);
+
+  ASSERT_THROW(nn.setPrecision(Precision::FLOAT16, LossScaling{0.0f}),
+               std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+TEST(SaveAndLoad, Half) {
+  NeuralNetwork<float> nn = makeNetwork();
+  Matrix<float> X(20, 32, InitState::RANDOM);
+  nn.save("float_model_test.bin");
+  for (Precision precision : {Precision::BFLOAT16, Precision::FLOAT16}) {
+    nn.setPrecision(precision);
+    nn.save("half_model_test.bin");
+    const Matrix<float> expected = nn.act(X);
+
+    // Loads with half width weights only.
+    NeuralNetwork<float> loaded;
+    loaded.load("half_model_test.bin", true);
+    ASSERT_EQ(loaded.getPrecision(), precision);
+    ASSERT_TRUE(loaded.getWeights().empty());
+    ASSERT_EQ(loaded.act(X), expected);
+
+    // The weights take half the space.
+    auto fileSize = [](const char *fileName) {
+      std::FILE *file = std::fopen(fileName, "rb");
+      std::fseek(file, 0, SEEK_END);
+      const long size = std::ftell(file);
+      std::fclose(file);
+      return size;
+    };
+    ASSERT_LT(fileSize("half_model_test.bin"),
+              fileSize("float_model_test.bin") * 6 / 10);
+
+    // Training recreates the float weights from the half width ones.
+    loaded.train(X, Matrix<float>(20, 8, InitState::ZERO), 0.001f, 1);
+    ASSERT_EQ(loaded.getWeights().size(), 2);
+  }
+}
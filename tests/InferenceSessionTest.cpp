@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "./InferenceSession.h"
+
+// ____________________________________________________________________________
+TEST(MatchesLayers, InferenceSession) {
+  NeuralNetwork<float> nn(std::vector<size_t>({5, 16, 3}),
+                          std::vector<Activation>(
+                              {Activation::relu, Activation::sigmoid}));
+  const InferenceSession<float> session(nn);
+  ASSERT_EQ(session.getInputSize(), 5);
+  ASSERT_EQ(session.getOutputSize(), 3);
+
+  Matrix<float> X(10, 5, InitState::RANDOM);
+  const std::vector<Matrix<float>> &W = nn.getWeights();
+  const std::vector<Matrix<float>> &b = nn.getBiases();
+  Matrix<float> expected =
+      sigmoid(add(dot(relu(add(dot(X, W[0]), b[0])), W[1]), b[1]));
+  Matrix<float> out = session.run(X);
+  ASSERT_EQ(out.getRows(), 10);
+  ASSERT_EQ(out.getCols(), 3);
+  for (size_t i = 0; i < 10; ++i) {
+    for (size_t j = 0; j < 3; ++j) {
+      ASSERT_NEAR(out[i][j], expected[i][j], 1e-5f);
+    }
+  }
+  ASSERT_EQ(nn.act(X), out);
+
+  // Training changes the weights the session runs on. (The sigmoid outputs
+  // of the random weights are close to 1, often 1.0f exactly, so the labels
+  // are 0.)
+  nn.train(X, Matrix<float>(10, 3, InitState::ZERO), 0.5f, 5);
+  ASSERT_FALSE(session.run(X) == out);
+  ASSERT_EQ(session.run(X), nn.act(X));
+}
+
+// ____________________________________________________________________________
+TEST(ManyThreads, InferenceSession) {
+  NeuralNetwork<float> nn(
+      std::vector<size_t>({8, 64, 64, 4}),
+      std::vector<Activation>(
+          {Activation::relu, Activation::tanh, Activation::linear}));
+  const InferenceSession<float> session(nn);
+
+  // Inputs of different batch sizes and their outputs on one thread.
+  std::vector<Matrix<float>> inputs;
+  std::vector<Matrix<float>> expected;
+  for (size_t rows : {1, 7, 32, 100}) {
+    inputs.push_back(Matrix<float>(rows, 8, InitState::RANDOM));
+    expected.push_back(session.run(inputs.back()));
+  }
+
+  // Every thread runs all inputs through the same session, into its own
+  // output matrix.
+  std::vector<int> mismatches(6, 0);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < mismatches.size(); ++t) {
+    threads.emplace_back([&, t] {
+      Matrix<float> out;
+      for (int round = 0; round < 50; ++round) {
+        const size_t i = (t + round) % inputs.size();
+        session.run(inputs[i], out);
+        mismatches[t] += !(out == expected[i]);
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(mismatches, std::vector<int>(6, 0));
+}
+
+// ____________________________________________________________________________
+TEST(Errors, InferenceSession) {
+  NeuralNetwork<float> nn(std::vector<size_t>({3, 2}),
+                          std::vector<Activation>({Activation::linear}));
+  const InferenceSession<float> session(nn);
+  ASSERT_THROW(session.run(Matrix<float>(4, 2)), std::invalid_argument);
+  ASSERT_THROW(InferenceSession<float>(NeuralNetwork<float>()),
+               std::invalid_argument);
+}
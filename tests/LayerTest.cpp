@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cmath>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+#include "./Layer.h"
+
+namespace {
+
+// ____________________________________________________________________________
+// Sum of Y * R over the outputs Y of layer for X: the loss whose gradient
+// with respect to Y is R.
+template <typename L>
+double weightedSum(L &layer, const Matrix<float> &X, const Matrix<float> &R) {
+  std::vector<Matrix<float>> buffers(
+      layer.getBufferWidths(X.getCols()).size());
+  Matrix<float> Y;
+  layer.forward(X, Y, buffers, true);
+  double sum = 0.0;
+  for (size_t row = 0; row < Y.getRows(); ++row) {
+    for (size_t col = 0; col < Y.getCols(); ++col) {
+      sum += static_cast<double>(Y[row][col]) * R[row][col];
+    }
+  }
+  return sum;
+}
+
+// ____________________________________________________________________________
+// Compares the gradients of backward (with respect to the inputs and the
+// parameters) with central differences of weightedSum, at inputs drawn from
+// [0, scale).
+template <typename L>
+void checkGradients(L &layer, size_t inputs, float scale = 1.0f) {
+  const size_t rows = 5;
+  Matrix<float> X(rows, inputs, InitState::RANDOM);
+  for (size_t row = 0; row < rows; ++row) {
+    for (size_t col = 0; col < inputs; ++col) {
+      X[row][col] *= scale;
+    }
+  }
+  Matrix<float> R(rows, layer.getOutputSize(inputs), InitState::RANDOM);
+  std::vector<Matrix<float>> buffers(layer.getBufferWidths(inputs).size());
+  Matrix<float> Y;
+  Matrix<float> dX;
+  layer.forward(X, Y, buffers, true);
+  Matrix<float> dY = R;
+  layer.backward(X, Y, dY, &dX, buffers);
+  ASSERT_EQ(dX.getRows(), rows);
+  ASSERT_EQ(dX.getCols(), inputs);
+
+  const float h = 1e-2f;
+  auto expectNear = [](double numeric, float analytic) {
+    ASSERT_NEAR(numeric, analytic, 2e-3 + 1e-2 * std::abs(numeric));
+  };
+  auto numericGradient = [&](float &x) {
+    const float original = x;
+    x = original + h;
+    const double plus = weightedSum(layer, X, R);
+    x = original - h;
+    const double minus = weightedSum(layer, X, R);
+    x = original;
+    return (plus - minus) / (2 * h);
+  };
+  for (size_t row = 0; row < rows; ++row) {
+    for (size_t col = 0; col < inputs; ++col) {
+      expectNear(numericGradient(X[row][col]), dX[row][col]);
+    }
+  }
+  layer.forEachParameter(
+      [&](Matrix<float> &parameter, const Matrix<float> &gradient, bool) {
+        const Matrix<float> analytic = gradient;
+        for (size_t row = 0; row < parameter.getRows(); ++row) {
+          for (size_t col = 0; col < parameter.getCols(); ++col) {
+            expectNear(numericGradient(parameter[row][col]),
+                       analytic[row][col]);
+          }
+        }
+      });
+}
+
+} // namespace
+
+// ____________________________________________________________________________
+TEST(Dense, Layer) {
+  DenseLayer<float> layer(4, 3, Activation::sigmoid);
+  ASSERT_EQ(layer.getOutputSize(4), 3u);
+  ASSERT_THROW(layer.getOutputSize(5), std::invalid_argument);
+  checkGradients(layer, 4);
+  DenseLayer<float> softmax(4, 3, Activation::softmax);
+  checkGradients(softmax, 4);
+  DenseLayer<float> linear(6, 2);
+  checkGradients(linear, 6);
+  ASSERT_THROW(DenseLayer<float>(Matrix<float>(3, 2), Matrix<float>(1, 3)),
+               std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+TEST(Activation, Layer) {
+  ActivationLayer<float> tanh(Activation::tanh);
+  ASSERT_EQ(tanh.getOutputSize(7), 7u);
+  checkGradients(tanh, 7);
+  ActivationLayer<float> softmax(Activation::softmax);
+  checkGradients(softmax, 4);
+
+  Matrix<float> X = std::vector<std::vector<float>>({{-1, 2}, {3, -4}});
+  Matrix<float> Y;
+  std::vector<Matrix<float>> buffers;
+  ActivationLayer<float>(Activation::relu).forward(X, Y, buffers, false);
+  ASSERT_EQ(Y, Matrix<float>(std::vector<std::vector<float>>({{0, 2},
+                                                              {3, 0}})));
+}
+
+// ____________________________________________________________________________
+TEST(Dropout, Layer) {
+  ASSERT_THROW(DropoutLayer<float>(1.0f), std::invalid_argument);
+  ASSERT_THROW(DropoutLayer<float>(-0.1f), std::invalid_argument);
+  DropoutLayer<float> layer(0.25f, 7);
+  Matrix<float> X(64, 32, InitState::ONES);
+  Matrix<float> Y;
+  std::vector<Matrix<float>> buffers(layer.getBufferWidths(32).size());
+
+  // Inference is the identity.
+  layer.forward(X, Y, buffers, false);
+  ASSERT_EQ(Y, X);
+
+  // In training a quarter of the inputs is dropped, the others are scaled
+  // so the expected value stays the same.
+  layer.forward(X, Y, buffers, true);
+  size_t dropped = 0;
+  for (size_t row = 0; row < 64; ++row) {
+    for (size_t col = 0; col < 32; ++col) {
+      if (Y[row][col] == 0.0f) {
+        ++dropped;
+      } else {
+        ASSERT_FLOAT_EQ(Y[row][col], 1.0f / 0.75f);
+      }
+    }
+  }
+  ASSERT_NEAR(static_cast<double>(dropped) / (64 * 32), 0.25, 0.05);
+
+  // The error flows through the kept inputs only.
+  Matrix<float> dY(64, 32, InitState::RANDOM);
+  Matrix<float> dX;
+  layer.backward(X, Y, dY, &dX, buffers);
+  for (size_t row = 0; row < 64; ++row) {
+    for (size_t col = 0; col < 32; ++col) {
+      ASSERT_FLOAT_EQ(dX[row][col], dY[row][col] * Y[row][col]);
+    }
+  }
+
+  // The same seed draws the same masks.
+  DropoutLayer<float> same(0.25f, 7);
+  Matrix<float> Z;
+  same.forward(X, Z, buffers, true);
+  ASSERT_EQ(Y, Z);
+}
+
+// ____________________________________________________________________________
+TEST(LayerNorm, Layer) {
+  LayerNormLayer<float> layer(6);
+  ASSERT_EQ(layer.getOutputSize(6), 6u);
+  ASSERT_THROW(layer.getOutputSize(5), std::invalid_argument);
+
+  // With gamma 1 and beta 0 every row has mean 0 and variance 1 (a bit
+  // less, epsilon is added to the variance).
+  Matrix<float> X(3, 6, InitState::RANDOM);
+  Matrix<float> Y;
+  std::vector<Matrix<float>> buffers(layer.getBufferWidths(6).size());
+  layer.forward(X, Y, buffers, false);
+  for (size_t row = 0; row < 3; ++row) {
+    float mean = 0.0f;
+    float variance = 0.0f;
+    for (size_t col = 0; col < 6; ++col) {
+      mean += Y[row][col] / 6;
+      variance += Y[row][col] * Y[row][col] / 6;
+    }
+    ASSERT_NEAR(mean, 0.0f, 1e-5f);
+    ASSERT_NEAR(variance, 1.0f, 1e-2f);
+  }
+
+  // Gradients of the inputs, gamma and beta (after a step moved them away
+  // from ones and zeros), at inputs spread wide enough that the steps of
+  // the differences are small against their standard deviation.
+  layer.forEachParameter([](Matrix<float> &parameter, const Matrix<float> &,
+                            bool) {
+    for (size_t col = 0; col < parameter.getCols(); ++col) {
+      parameter[0][col] += 0.1f * static_cast<float>(col);
+    }
+  });
+  checkGradients(layer, 6, 10.0f);
+}
@@ -1,5 +1,7 @@
 
+#include <cstdint>
 #include <gtest/gtest.h>
+#include <memory>
 #include <string>
 
 #include "./Matrix.h"
@@ -301,6 +303,58 @@ TEST(Print, Matrix) {
   EXPECT_EQ(B_as_string, "matrix([[1, 2, 3],\n[4, 5, 6],\n[7, 8, 9]])\n");
 }
 
+// ____________________________________________________________________________
+TEST(ContiguousStorage, Matrix) {
+  // Narrow rows are stored densely.
+  Matrix<float> A(5, 3, InitState::ZERO);
+  ASSERT_EQ(A.getStride(), size_t(3));
+  ASSERT_EQ(A[1], A.data() + 3);
+
+  // Wide rows are padded, every row starts on a cache line.
+  Matrix<float> B(3, 17, InitState::EMPTY);
+  ASSERT_EQ(B.getStride(), size_t(32));
+  for (size_t row = 0; row < B.getRows(); ++row) {
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(B[row]) % kMatrixAlignment,
+              size_t(0));
+    for (size_t col = 0; col < B.getCols(); ++col) {
+      B[row][col] = static_cast<float>(row * 100 + col);
+    }
+  }
+  std::vector<std::vector<float>> data = B.getData();
+  ASSERT_EQ(data.size(), size_t(3));
+  ASSERT_EQ(data[2].size(), size_t(17));
+  ASSERT_FLOAT_EQ(data[2][16], 216.0f);
+  EXPECT_EQ(Matrix<float>(data), B);
+  EXPECT_THROW(B[3], std::out_of_range);
+}
+
+// ____________________________________________________________________________
+TEST(View, Matrix) {
+  // 2 x 3 matrix with stride 4 in memory the matrix does not own.
+  auto buffer = std::make_shared<std::vector<int>>(
+      std::vector<int>{1, 2, 3, 0, 4, 5, 6, 0});
+  Matrix<int> A = Matrix<int>::view(buffer->data(), 2, 3, 4, buffer);
+  buffer.reset();
+  ASSERT_EQ(A.getStride(), size_t(4));
+  ASSERT_EQ(A, Matrix<int>(std::vector<std::vector<int>>{{1, 2, 3},
+                                                          {4, 5, 6}}));
+
+  // Writes go to the viewed memory, copies own their elements.
+  Matrix<int> B = A;
+  A[1][2] = 7;
+  ASSERT_EQ(A.data()[6], 7);
+  ASSERT_EQ(B[1][2], 6);
+
+  // Moves keep viewing the memory.
+  Matrix<int> C = std::move(A);
+  ASSERT_EQ(C[1][2], 7);
+  C.add(C);
+  ASSERT_EQ(C[1][2], 14);
+
+  EXPECT_THROW(Matrix<int>::view(B.data(), 2, 3, 2, nullptr),
+               std::invalid_argument);
+}
+
 // ____________________________________________________________________________
 // Linear algebra functions:
 // ____________________________________________________________________________
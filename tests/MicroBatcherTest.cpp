@@ -0,0 +1,93 @@
+#include <chrono>
+#include <future>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "./MicroBatcher.h"
+
+// ____________________________________________________________________________
+// Network with 6 inputs and 3 outputs.
+NeuralNetwork<float> makeNetwork() {
+  return NeuralNetwork<float>(
+      std::vector<size_t>({6, 32, 3}),
+      std::vector<Activation>({Activation::relu, Activation::sigmoid}));
+}
+
+// ____________________________________________________________________________
+TEST(MatchesAct, MicroBatcher) {
+  NeuralNetwork<float> nn = makeNetwork();
+  Matrix<float> X(40, 6, InitState::RANDOM);
+  Matrix<float> expected = nn.act(X);
+
+  MicroBatcher<float> batcher(nn, 8, std::chrono::microseconds(2000));
+  // Every thread submits its rows one at a time and waits for the output.
+  std::vector<std::thread> callers;
+  std::vector<Matrix<float>> outputs(X.getRows());
+  for (size_t t = 0; t < 4; ++t) {
+    callers.emplace_back([&, t] {
+      for (size_t i = t; i < X.getRows(); i += 4) {
+        Matrix<float> row(1, 6, InitState::EMPTY);
+        std::copy(X[i], X[i] + 6, row[0]);
+        outputs[i] = batcher.submit(row).get();
+      }
+    });
+  }
+  for (std::thread &caller : callers) {
+    caller.join();
+  }
+  for (size_t i = 0; i < X.getRows(); ++i) {
+    ASSERT_EQ(outputs[i].getRows(), 1);
+    ASSERT_EQ(outputs[i].getCols(), 3);
+    for (size_t j = 0; j < 3; ++j) {
+      ASSERT_NEAR(outputs[i][0][j], expected[i][j], 1e-5f);
+    }
+  }
+  ASSERT_EQ(batcher.getNumRequests(), 40);
+  ASSERT_LE(batcher.getNumBatches(), 40);
+}
+
+// ____________________________________________________________________________
+TEST(BatchesUpToMaxBatch, MicroBatcher) {
+  NeuralNetwork<float> nn = makeNetwork();
+  Matrix<float> row(1, 6, InitState::RANDOM);
+
+  // Full batches run right away, even with a long maxWait.
+  MicroBatcher<float> full(nn, 4, std::chrono::seconds(60));
+  std::vector<std::future<Matrix<float>>> outputs;
+  for (int i = 0; i < 8; ++i) {
+    outputs.push_back(full.submit(row));
+  }
+  for (std::future<Matrix<float>> &output : outputs) {
+    ASSERT_EQ(output.wait_for(std::chrono::seconds(30)),
+              std::future_status::ready);
+  }
+  ASSERT_EQ(full.getNumBatches(), 2);
+
+  // A single row runs once maxWait has passed.
+  MicroBatcher<float> single(nn, 4, std::chrono::microseconds(1000));
+  ASSERT_EQ(single.submit(row).get(), nn.act(row));
+  ASSERT_EQ(single.getNumBatches(), 1);
+}
+
+// ____________________________________________________________________________
+TEST(DestructorRunsWaitingRows, MicroBatcher) {
+  NeuralNetwork<float> nn = makeNetwork();
+  std::future<Matrix<float>> output;
+  {
+    MicroBatcher<float> batcher(nn, 16, std::chrono::seconds(60));
+    output = batcher.submit(Matrix<float>(1, 6, InitState::ONES));
+  }
+  ASSERT_EQ(output.get(), nn.act(Matrix<float>(1, 6, InitState::ONES)));
+}
+
+// ____________________________________________________________________________
+TEST(Errors, MicroBatcher) {
+  NeuralNetwork<float> nn = makeNetwork();
+  ASSERT_THROW(MicroBatcher<float>(nn, 0, std::chrono::microseconds(10)),
+               std::invalid_argument);
+  MicroBatcher<float> batcher(nn, 4, std::chrono::microseconds(10));
+  ASSERT_THROW(batcher.submit(Matrix<float>(1, 5)), std::invalid_argument);
+  ASSERT_THROW(batcher.submit(Matrix<float>(2, 6)), std::invalid_argument);
+}
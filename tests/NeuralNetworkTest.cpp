@@ -1,8 +1,12 @@
 
 #include <cmath>
+#include <fstream>
 #include <gtest/gtest.h>
+#include <stdexcept>
 
 #include "./NeuralNetwork.h"
+#include "./Tape.h"
+#include "./ThreadPool.h"
 
 // ____________________________________________________________________________
 // Compare two float values within an epsilon range.
@@ -118,6 +122,267 @@ TEST(NotGate, NeuralNetwork) {
   ASSERT_EQ(areAlmostEqual(y_out[1][0], 0.0f), true);
 }
 
+// ____________________________________________________________________________
+TEST(MiniBatchOrGate, NeuralNetwork) {
+  // Learns the OR-Gate problem with shuffled batches of two rows.
+  Matrix<float> X_train =
+      std::vector<std::vector<float>>({{0, 0}, {0, 1}, {1, 0}, {1, 1}});
+  Matrix<float> y_train = std::vector<std::vector<float>>({{0}, {1}, {1}, {1}});
+  NeuralNetwork<float> orGate(std::vector<size_t>({2, 1}),
+                              std::vector<Activation>({Activation::sigmoid}),
+                              0.1f, InitState::RANDOM);
+  orGate.train(X_train, y_train, 0.1f, 5000, false, 2);
+  Matrix<float> y_out = orGate.act(X_train);
+  ASSERT_EQ(areAlmostEqual(y_out[0][0], 0.0f), true);
+  ASSERT_EQ(areAlmostEqual(y_out[1][0], 1.0f), true);
+  ASSERT_EQ(areAlmostEqual(y_out[2][0], 1.0f), true);
+  ASSERT_EQ(areAlmostEqual(y_out[3][0], 1.0f), true);
+}
+
+// ____________________________________________________________________________
+TEST(StreamedAndGate, NeuralNetwork) {
+  // Learns the AND-Gate problem from a data set file, with prefetching.
+  Matrix<float> X_train =
+      std::vector<std::vector<float>>({{0, 0}, {0, 1}, {1, 0}, {1, 1}});
+  Matrix<float> y_train = std::vector<std::vector<float>>({{0}, {0}, {0}, {1}});
+  saveDataset("AND_dataset.bin", X_train, y_train);
+  FileLoader<float> file("AND_dataset.bin", 3);
+  PrefetchLoader<float> loader(file);
+  NeuralNetwork<float> andGate(std::vector<size_t>({2, 1}),
+                               std::vector<Activation>({Activation::sigmoid}),
+                               0.1f, InitState::RANDOM);
+  andGate.train(loader, 0.1f, 5000, false);
+  Matrix<float> y_out = andGate.act(X_train);
+  ASSERT_EQ(areAlmostEqual(y_out[0][0], 0.0f), true);
+  ASSERT_EQ(areAlmostEqual(y_out[1][0], 0.0f), true);
+  ASSERT_EQ(areAlmostEqual(y_out[2][0], 0.0f), true);
+  ASSERT_EQ(areAlmostEqual(y_out[3][0], 1.0f), true);
+}
+
+// ____________________________________________________________________________
+TEST(HiddenLayerGradients, NeuralNetwork) {
+  // One SGD step (full batch) moves every weight by -learningRate times the
+  // gradient of half the squared error, computed on a Tape. The hidden layer
+  // must use the derivative of its own activation (relu), not the one of the
+  // output layer (linear). (Both derivatives are the same whether taken at
+  // the weighted sums or the outputs.)
+  Matrix<float> X(6, 3, InitState::RANDOM);
+  Matrix<float> y(6, 2, InitState::RANDOM);
+  for (size_t row = 0; row < 6; ++row) {
+    for (size_t col = 0; col < 3; ++col) {
+      // Inputs of both signs, so some hidden units are off.
+      X[row][col] = 2.0f * X[row][col] - 1.0f;
+    }
+  }
+  NeuralNetwork<float> nn(
+      std::vector<size_t>({3, 5, 2}),
+      std::vector<Activation>({Activation::relu, Activation::linear}), 0.1f,
+      InitState::RANDOM);
+  std::vector<Matrix<float>> W = nn.getWeights();
+  std::vector<Matrix<float>> b = nn.getBiases();
+
+  Tape<float> tape;
+  std::vector<Tape<float>::Var> weights;
+  auto a = tape.input(X);
+  for (size_t i = 0; i < W.size(); ++i) {
+    weights.push_back(tape.parameter(W[i]));
+    a = tape.activation(
+        tape.add(tape.dot(a, weights.back()), tape.parameter(b[i])),
+        nn.getActivations()[i]);
+  }
+  auto diff = tape.sub(a, tape.input(y));
+  auto loss = tape.scale(tape.sum(tape.mul(diff, diff)), 0.5f);
+  tape.backward(loss);
+
+  nn.train(X, y, 0.1f, 1);
+  for (size_t i = 0; i < W.size(); ++i) {
+    const Matrix<float> &grad = tape.grad(weights[i]);
+    for (size_t row = 0; row < W[i].getRows(); ++row) {
+      for (size_t col = 0; col < W[i].getCols(); ++col) {
+        ASSERT_NEAR(nn.getWeights()[i][row][col],
+                    W[i][row][col] - 0.1f * grad[row][col], 1e-4f)
+            << "layer " << i << " at " << row << ", " << col;
+      }
+    }
+  }
+}
+
+// ____________________________________________________________________________
+TEST(CrossEntropy, NeuralNetwork) {
+  // Learns three classes with a softmax output and one-hot labels.
+  Matrix<float> X_train = std::vector<std::vector<float>>(
+      {{0, 0}, {-1, -1}, {1, 0}, {2, 0}, {0, 1}, {0, 2}});
+  Matrix<float> y_train = std::vector<std::vector<float>>(
+      {{1, 0, 0}, {1, 0, 0}, {0, 1, 0}, {0, 1, 0}, {0, 0, 1}, {0, 0, 1}});
+  NeuralNetwork<float> nn(std::vector<size_t>({2, 3}),
+                          std::vector<Activation>({Activation::softmax}),
+                          0.1f, InitState::RANDOM);
+  nn.setLoss(Loss::CROSS_ENTROPY);
+  ASSERT_EQ(nn.getLoss(), Loss::CROSS_ENTROPY);
+  const float before = nn.loss(nn.act(X_train), y_train);
+  nn.train(X_train, y_train, 0.1f, 2000, false);
+  Matrix<float> y_out = nn.act(X_train);
+  for (size_t row = 0; row < 6; ++row) {
+    ASSERT_GT(y_out[row][row / 2], 0.8f) << "row " << row;
+  }
+  ASSERT_LT(nn.loss(y_out, y_train), 0.2f);
+  ASSERT_LT(nn.loss(y_out, y_train), before);
+
+  // The cross-entropy is fused with a softmax output layer.
+  NeuralNetwork<float> sigmoidOutput(
+      std::vector<size_t>({2, 3}),
+      std::vector<Activation>({Activation::sigmoid}));
+  sigmoidOutput.setLoss(Loss::CROSS_ENTROPY);
+  ASSERT_THROW(sigmoidOutput.train(X_train, y_train), std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+TEST(Hogwild, NeuralNetwork) {
+  // Learns the index of a one-hot input (sparse, every batch updates few rows
+  // of the first weights) on four threads at once.
+  const size_t before = getNumThreads();
+  setNumThreads(4);
+  std::vector<std::vector<float>> inputs(64, std::vector<float>(16, 0.0f));
+  std::vector<std::vector<float>> labels(64, std::vector<float>(2, 0.0f));
+  for (size_t row = 0; row < 64; ++row) {
+    inputs[row][row % 16] = 1.0f;
+    labels[row][row % 16 < 8 ? 0 : 1] = 1.0f;
+  }
+  const Matrix<float> X_train(inputs);
+  const Matrix<float> y_train(labels);
+  NeuralNetwork<float> nn(std::vector<size_t>({16, 8, 2}),
+                          std::vector<Activation>(
+                              {Activation::relu, Activation::sigmoid}));
+  const float lossBefore = nn.loss(nn.act(X_train), y_train);
+  const HogwildStats stats = nn.trainHogwild(X_train, y_train, 0.1f, 200, 4);
+  setNumThreads(before);
+
+  ASSERT_LT(nn.loss(nn.act(X_train), y_train), lossBefore / 2);
+  ASSERT_EQ(stats.threads, 4u);
+  ASSERT_EQ(stats.steps, 200u * 16);
+  ASSERT_EQ(stats.rows, 200u * 64);
+  ASSERT_LE(stats.meanStaleness, static_cast<double>(stats.maxStaleness));
+  ASSERT_GT(stats.rowsPerSecond(), 0.0);
+
+  // The gradients are unscaled: with one thread and one batch an epoch
+  // changes the weights as without loss scaling.
+  setNumThreads(1);
+  NeuralNetwork<float> scaled = nn;
+  scaled.setPrecision(Precision::FLOAT32, LossScaling{1024.0f});
+  nn.trainHogwild(X_train, y_train, 0.1f, 1);
+  scaled.trainHogwild(X_train, y_train, 0.1f, 1);
+  setNumThreads(before);
+  for (size_t i = 0; i < nn.getWeights().size(); ++i) {
+    const Matrix<float> &W = nn.getWeights()[i];
+    for (size_t row = 0; row < W.getRows(); ++row) {
+      for (size_t col = 0; col < W.getCols(); ++col) {
+        ASSERT_NEAR(scaled.getWeights()[i][row][col], W[row][col], 1e-4f);
+      }
+    }
+  }
+
+  // Only plain SGD updates are applied without locks.
+  OptimizerSettings adam;
+  adam.type = OptimizerType::ADAM;
+  nn.setOptimizer(adam);
+  ASSERT_THROW(nn.trainHogwild(X_train, y_train), std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+TEST(SparseInputs, NeuralNetwork) {
+  // One or two non-zeros per row, inputs 40 to 49 are never used.
+  std::vector<std::vector<float>> inputs(24, std::vector<float>(50, 0.0f));
+  std::vector<std::vector<float>> labels(24, std::vector<float>(2, 0.0f));
+  for (size_t row = 0; row < 24; ++row) {
+    inputs[row][row * 7 % 40] = 1.0f;
+    inputs[row][(row * 3 + 1) % 40] += 0.5f;
+    labels[row][row % 2] = 1.0f;
+  }
+  const Matrix<float> X_train(inputs);
+  const Matrix<float> y_train(labels);
+  const SparseMatrix<float> sparseX(X_train);
+  NeuralNetwork<float> dense(std::vector<size_t>({50, 8, 2}),
+                             std::vector<Activation>(
+                                 {Activation::relu, Activation::sigmoid}));
+  NeuralNetwork<float> sparse = dense;
+  auto expectNear = [](const Matrix<float> &A, const Matrix<float> &B) {
+    ASSERT_EQ(A.getRows(), B.getRows());
+    ASSERT_EQ(A.getCols(), B.getCols());
+    for (size_t row = 0; row < A.getRows(); ++row) {
+      for (size_t col = 0; col < A.getCols(); ++col) {
+        ASSERT_NEAR(A[row][col], B[row][col], 1e-4f);
+      }
+    }
+  };
+  expectNear(sparse.act(sparseX), dense.act(X_train));
+
+  // Full batch SGD takes the same steps as on the dense inputs.
+  dense.train(X_train, y_train, 0.1f, 20);
+  sparse.train(sparseX, y_train, 0.1f, 20);
+  expectNear(sparse.act(sparseX), dense.act(X_train));
+  for (size_t i = 0; i < 2; ++i) {
+    expectNear(sparse.getWeights()[i], dense.getWeights()[i]);
+    expectNear(sparse.getBiases()[i], dense.getBiases()[i]);
+  }
+
+  // Mini-batches with Adam only touch the rows of the used inputs.
+  OptimizerSettings adam;
+  adam.type = OptimizerType::ADAM;
+  sparse.setOptimizer(adam);
+  const Matrix<float> before = sparse.getWeights()[0];
+  const float lossBefore = sparse.loss(sparse.act(sparseX), y_train);
+  sparse.train(sparseX, y_train, 0.01f, 50, false, 5);
+  ASSERT_LT(sparse.loss(sparse.act(sparseX), y_train), lossBefore);
+  const Matrix<float> &after = sparse.getWeights()[0];
+  for (size_t row = 40; row < 50; ++row) {
+    for (size_t col = 0; col < 8; ++col) {
+      ASSERT_EQ(after[row][col], before[row][col]);
+    }
+  }
+  ASSERT_FALSE(after == before);
+
+  // Training on dense inputs again.
+  sparse.train(X_train, y_train, 0.01f, 1);
+  ASSERT_THROW(sparse.train(sparseX, Matrix<float>(23, 2)),
+               std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+TEST(Checkpointing, NeuralNetwork) {
+  // Recomputing the activations between checkpoints takes the same steps.
+  Matrix<float> X_train(16, 6, InitState::RANDOM);
+  Matrix<float> y_train(16, 2, InitState::RANDOM);
+  NeuralNetwork<float> full(
+      std::vector<size_t>({6, 12, 10, 12, 8, 2}),
+      std::vector<Activation>({Activation::relu, Activation::tanh,
+                               Activation::relu, Activation::sigmoid,
+                               Activation::sigmoid}));
+  NeuralNetwork<float> checkpointed = full;
+  NeuralNetwork<float> budgeted = full;
+  Checkpointing checkpointing;
+  checkpointing.checkpoints = {1, 3};
+  checkpointed.setCheckpointing(checkpointing);
+  ASSERT_EQ(checkpointed.getCheckpointing(), checkpointing);
+  Checkpointing budget;
+  budget.memoryBudget =
+      batchBytes<float>(full.getLayerSizes(), X_train.getRows()) / 2;
+  budgeted.setCheckpointing(budget);
+
+  full.train(X_train, y_train, 0.1f, 10);
+  checkpointed.train(X_train, y_train, 0.1f, 10);
+  budgeted.train(X_train, y_train, 0.1f, 10);
+  for (size_t i = 0; i < 5; ++i) {
+    ASSERT_EQ(checkpointed.getWeights()[i], full.getWeights()[i]);
+    ASSERT_EQ(checkpointed.getBiases()[i], full.getBiases()[i]);
+    ASSERT_EQ(budgeted.getWeights()[i], full.getWeights()[i]);
+  }
+
+  checkpointing.checkpoints = {3, 1};
+  ASSERT_THROW(full.setCheckpointing(checkpointing), std::invalid_argument);
+  checkpointing.checkpoints = {5};
+  ASSERT_THROW(full.setCheckpointing(checkpointing), std::invalid_argument);
+}
+
 // ____________________________________________________________________________
 TEST(SaveAndLoad, NeuralNetwork) {
   // This neural network learns how to solve the XOR-Gate problem.
@@ -148,4 +413,84 @@ TEST(SaveAndLoad, NeuralNetwork) {
   ASSERT_EQ(areAlmostEqual(y_out[1][0], 1.0f, 0.2f), true);
   ASSERT_EQ(areAlmostEqual(y_out[2][0], 1.0f, 0.2f), true);
   ASSERT_EQ(areAlmostEqual(y_out[3][0], 0.0f, 0.2f), true);
-}
\ No newline at end of file
+}
+// ____________________________________________________________________________
+TEST(ModelFile, NeuralNetwork) {
+  Matrix<float> X(7, 3, InitState::RANDOM);
+  NeuralNetwork<float> nn(
+      std::vector<size_t>({3, 20, 2}),
+      std::vector<Activation>({Activation::sigmoid, Activation::linear}));
+  nn.save("model_test.bin");
+
+  // The loaded network (layer sizes and activations included) computes the
+  // same outputs, from weights used in place in the mapped file.
+  NeuralNetwork<float> loaded;
+  loaded.load("model_test.bin", true);
+  ASSERT_EQ(loaded.act(X), nn.act(X));
+
+  // Training changes the mapped weights, not the file.
+  Matrix<float> y(7, 2, InitState::ONES);
+  loaded.train(X, y, 0.5f, 10);
+  ASSERT_FALSE(loaded.act(X) == nn.act(X));
+  NeuralNetwork<float> reloaded;
+  reloaded.load("model_test.bin", true);
+  ASSERT_EQ(reloaded.act(X), nn.act(X));
+
+  // Saving over the file a network is mapped from.
+  loaded.save("model_test.bin");
+  reloaded.load("model_test.bin", true);
+  ASSERT_EQ(reloaded.act(X), loaded.act(X));
+
+  // Corrupt data is only found when verifying, a corrupt header always.
+  std::fstream file("model_test.bin",
+                    std::ios::binary | std::ios::in | std::ios::out);
+  auto flipByte = [&](std::streamoff offset, std::ios::seekdir dir) {
+    file.seekg(offset, dir);
+    const char byte = static_cast<char>(file.get());
+    file.seekp(offset, dir);
+    file.put(static_cast<char>(~byte));
+    file.flush();
+  };
+  flipByte(-64, std::ios::end);
+  reloaded.load("model_test.bin");
+  ASSERT_THROW(reloaded.load("model_test.bin", true), std::runtime_error);
+  flipByte(20, std::ios::beg);
+  file.close();
+  ASSERT_THROW(reloaded.load("model_test.bin"), std::runtime_error);
+  std::ofstream("model_test.bin", std::ios::binary) << "NNMF";
+  ASSERT_THROW(reloaded.load("model_test.bin"), std::runtime_error);
+}
+
+// ____________________________________________________________________________
+TEST(LegacyModelFile, NeuralNetwork) {
+  // File as written before the versioned format: number of layers, layer
+  // sizes, then rows, cols and values of the weights and the biases.
+  {
+    std::ofstream out("legacy_model_test.bin", std::ios::binary);
+    auto writeSize = [&](size_t value) {
+      out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    };
+    auto writeMatrix = [&](size_t rows, size_t cols, float value) {
+      writeSize(rows);
+      writeSize(cols);
+      for (size_t i = 0; i < rows * cols; ++i) {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+      }
+    };
+    writeSize(3);
+    writeSize(2);
+    writeSize(4);
+    writeSize(1);
+    writeMatrix(2, 4, 1.0f);
+    writeMatrix(4, 1, 1.0f);
+    writeMatrix(1, 4, 0.0f);
+    writeMatrix(1, 1, 0.5f);
+  }
+  NeuralNetwork<float> nn(
+      std::vector<size_t>({2, 4, 1}),
+      std::vector<Activation>({Activation::linear, Activation::linear}),
+      0.1f, InitState::EMPTY);
+  nn.load("legacy_model_test.bin");
+  Matrix<float> X = std::vector<std::vector<float>>({{1, 2}});
+  ASSERT_FLOAT_EQ(nn.act(X)[0][0], 12.5f);
+}
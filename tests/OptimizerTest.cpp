@@ -0,0 +1,199 @@
+#include <cmath>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+#include "./NeuralNetwork.h"
+#include "./Optimizer.h"
+#include "./Simd.h"
+
+// ____________________________________________________________________________
+// Returns the float kernel tables this machine can run.
+std::vector<const SimdKernels<float> *> availableFloatKernels() {
+  static const SimdKernels<float> scalar = scalarKernels<float>();
+  std::vector<const SimdKernels<float> *> tables = {&scalar};
+  SimdLevel level = detectSimdLevel();
+  if (level >= SimdLevel::SSE2 && sse2Kernels<float>() != nullptr) {
+    tables.push_back(sse2Kernels<float>());
+  }
+  if (level >= SimdLevel::AVX2 && avx2Kernels<float>() != nullptr) {
+    tables.push_back(avx2Kernels<float>());
+  }
+  if (level >= SimdLevel::AVX512 && avx512Kernels<float>() != nullptr) {
+    tables.push_back(avx512Kernels<float>());
+  }
+  return tables;
+}
+
+// ____________________________________________________________________________
+TEST(KernelsMatchReference, Optimizer) {
+  // Two steps of every update rule, computed in double.
+  OptimizerStep<float> step = {};
+  step.learningRate = 0.01f;
+  step.gradientScale = 0.5f;
+  step.weightDecay = 0.1f;
+  step.momentum = 0.9f;
+  step.beta1 = 0.9f;
+  step.beta2 = 0.999f;
+  step.epsilon = 1e-8f;
+  step.correction1 = 1.0f / (1.0f - 0.9f);
+  step.correction2 = 1.0f / (1.0f - 0.999f);
+  step.decoupledDecay = 0.01f;
+  const size_t n = 37;
+  for (const SimdKernels<float> *kernels : availableFloatKernels()) {
+    std::vector<float> p(n), g(n), m(n, 0.0f), v(n, 0.0f);
+    std::vector<double> pd(n), md(n, 0.0), vd(n, 0.0);
+    for (size_t i = 0; i < n; ++i) {
+      p[i] = std::sin(static_cast<float>(i));
+      g[i] = std::cos(static_cast<float>(3 * i));
+      pd[i] = p[i];
+    }
+    std::vector<float> sgd = p, momentum = p, velocity(n, 0.0f);
+    std::vector<double> sgdD = pd, momentumD = pd, velocityD(n, 0.0);
+    for (int t = 0; t < 2; ++t) {
+      kernels->sgdUpdate(sgd.data(), g.data(), n, step);
+      kernels->momentumUpdate(momentum.data(), g.data(), velocity.data(), n,
+                              step);
+      kernels->adamUpdate(p.data(), g.data(), m.data(), v.data(), n, step);
+      for (size_t i = 0; i < n; ++i) {
+        const double gs = g[i] * 0.5;
+        sgdD[i] -= 0.01 * (gs + 0.1 * sgdD[i]);
+        velocityD[i] = 0.9 * velocityD[i] + gs + 0.1 * momentumD[i];
+        momentumD[i] -= 0.01 * velocityD[i];
+        const double ga = gs + 0.1 * pd[i];
+        md[i] = 0.9 * md[i] + 0.1 * ga;
+        vd[i] = 0.999 * vd[i] + 0.001 * ga * ga;
+        const double update =
+            md[i] * step.correction1 /
+                (std::sqrt(vd[i] * step.correction2) + 1e-8) +
+            0.01 * pd[i];
+        pd[i] -= 0.01 * update;
+      }
+    }
+    for (size_t i = 0; i < n; ++i) {
+      ASSERT_NEAR(sgd[i], sgdD[i], 1e-6);
+      ASSERT_NEAR(momentum[i], momentumD[i], 1e-6);
+      ASSERT_NEAR(velocity[i], velocityD[i], 1e-5);
+      ASSERT_NEAR(p[i], pd[i], 1e-5);
+      ASSERT_NEAR(m[i], md[i], 1e-6);
+      ASSERT_NEAR(v[i], vd[i], 1e-6);
+    }
+  }
+}
+
+// ____________________________________________________________________________
+TEST(Update, Optimizer) {
+  OptimizerSettings settings;
+  settings.type = OptimizerType::ADAMW;
+  settings.weightDecay = 0.5f;
+  Optimizer<float> optimizer(settings);
+  ASSERT_EQ(optimizer.statesPerParameter(), 2);
+  Matrix<float> W(3, 70, InitState::ONES);
+  Matrix<float> b(1, 70, InitState::ONES);
+  Matrix<float> gradient(3, 70, InitState::ONES);
+  Matrix<float> biasGradient(1, 70, InitState::ONES);
+
+  // The first Adam step moves every parameter by the learning rate (the
+  // bias corrected m / sqrt(v) is 1), the weights also decay.
+  optimizer.beginStep(0.1f);
+  optimizer.update(0, W, gradient);
+  optimizer.update(1, b, biasGradient, false);
+  ASSERT_EQ(optimizer.getSteps(), 1);
+  ASSERT_EQ(optimizer.getState().size(), 4);
+  for (size_t j = 0; j < 70; ++j) {
+    ASSERT_NEAR(W[2][j], 1.0f - 0.1f * (1.0f + 0.5f), 1e-6f);
+    ASSERT_NEAR(b[0][j], 1.0f - 0.1f, 1e-6f);
+  }
+
+  ASSERT_THROW(optimizer.update(0, W, biasGradient), std::invalid_argument);
+  ASSERT_THROW(optimizer.update(1, W, gradient), std::invalid_argument);
+  ASSERT_THROW(optimizer.setState(0, std::vector<Matrix<float>>(3)),
+               std::invalid_argument);
+  settings.beta2 = 1.0f;
+  ASSERT_THROW(Optimizer<float>{settings}, std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+TEST(UpdateRows, Optimizer) {
+  // Only the given rows move (with their state), the others keep their
+  // values and state.
+  OptimizerSettings settings;
+  settings.type = OptimizerType::MOMENTUM;
+  Optimizer<float> optimizer(settings);
+  Matrix<float> W(4, 9, InitState::ONES);
+  const std::vector<std::uint32_t> rows = {1, 3};
+  Matrix<float> gradient(2, 9, InitState::ONES);
+  optimizer.beginStep(0.1f);
+  optimizer.updateRows(0, W, rows, gradient);
+  for (size_t j = 0; j < 9; ++j) {
+    ASSERT_EQ(W[0][j], 1.0f);
+    ASSERT_NEAR(W[1][j], 0.9f, 1e-6f);
+    ASSERT_EQ(W[2][j], 1.0f);
+    ASSERT_NEAR(W[3][j], 0.9f, 1e-6f);
+    ASSERT_EQ(optimizer.getState()[0][0][j], 0.0f);
+    ASSERT_NE(optimizer.getState()[0][1][j], 0.0f);
+  }
+
+  ASSERT_THROW(optimizer.updateRows(0, W, {1}, gradient),
+               std::invalid_argument);
+  ASSERT_THROW(optimizer.updateRows(0, W, {1, 4}, gradient),
+               std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+// Trains a network to halve a number with the given optimizer and returns
+// the mean squared error after epochs steps.
+float halvingLoss(OptimizerType type, float learningRate, int epochs) {
+  Matrix<float> X = std::vector<std::vector<float>>(
+      {{0}, {1}, {2}, {3}, {4}, {5}, {6}, {7}});
+  Matrix<float> y = std::vector<std::vector<float>>(
+      {{0.0f}, {0.5f}, {1.0f}, {1.5f}, {2.0f}, {2.5f}, {3.0f}, {3.5f}});
+  NeuralNetwork<float> nn(std::vector<size_t>({1, 1}),
+                          std::vector<Activation>({Activation::linear}));
+  OptimizerSettings settings;
+  settings.type = type;
+  nn.setOptimizer(settings);
+  nn.train(X, y, learningRate, epochs);
+  return nn.loss(nn.act(X), y);
+}
+
+// ____________________________________________________________________________
+TEST(Converges, Optimizer) {
+  ASSERT_LT(halvingLoss(OptimizerType::SGD, 0.01f, 500), 1e-3f);
+  ASSERT_LT(halvingLoss(OptimizerType::MOMENTUM, 0.005f, 200), 1e-3f);
+  ASSERT_LT(halvingLoss(OptimizerType::ADAM, 0.05f, 500), 1e-3f);
+  ASSERT_LT(halvingLoss(OptimizerType::ADAMW, 0.05f, 500), 1e-3f);
+}
+
+// ____________________________________________________________________________
+TEST(Checkpoint, Optimizer) {
+  Matrix<float> X(16, 4, InitState::RANDOM);
+  Matrix<float> y(16, 2, InitState::RANDOM);
+  NeuralNetwork<float> nn(
+      std::vector<size_t>({4, 8, 2}),
+      std::vector<Activation>({Activation::tanh, Activation::linear}));
+  OptimizerSettings settings;
+  settings.type = OptimizerType::ADAM;
+  settings.beta1 = 0.8f;
+  nn.setOptimizer(settings);
+  nn.train(X, y, 0.01f, 5);
+  nn.save("checkpoint_test.bin", true);
+  nn.save("model_test.bin");
+
+  // Training continues from the checkpoint exactly as without it.
+  NeuralNetwork<float> resumed;
+  resumed.load("checkpoint_test.bin", true);
+  ASSERT_EQ(resumed.getOptimizer().getSettings().type, OptimizerType::ADAM);
+  ASSERT_EQ(resumed.getOptimizer().getSettings().beta1, 0.8f);
+  ASSERT_EQ(resumed.getOptimizer().getSteps(), 5);
+  ASSERT_EQ(resumed.getOptimizer().getState().size(), 8);
+  nn.train(X, y, 0.01f, 5);
+  resumed.train(X, y, 0.01f, 5);
+  ASSERT_EQ(resumed.getWeights(), nn.getWeights());
+  ASSERT_EQ(resumed.getBiases(), nn.getBiases());
+
+  // A model file restarts the optimizer.
+  resumed.load("model_test.bin", true);
+  ASSERT_EQ(resumed.getOptimizer().getSteps(), 0);
+  ASSERT_TRUE(resumed.getOptimizer().getState().empty());
+}
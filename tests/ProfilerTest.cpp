@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "./NeuralNetwork.h"
+#include "./Profiler.h"
+
+// ____________________________________________________________________________
+TEST(Scopes, Profiler) {
+  Profiler &p = profiler();
+  {
+    ProfileScope ignored("ignored", "test", 0, 1.0, 1.0);
+  }
+  p.start();
+  ASSERT_TRUE(p.isRecording());
+  for (int layer = 0; layer < 2; ++layer) {
+    ProfileScope scope("step", "test", layer, 100.0, 400.0);
+  }
+  {
+    ProfileScope outer("outer", "test", -1, 0.0, 0.0);
+  }
+  p.stop();
+  {
+    ProfileScope ignored("ignored", "test", 0, 1.0, 1.0);
+  }
+
+  const std::vector<Profiler::Event> events = p.getEvents();
+  ASSERT_EQ(events.size(), 3u);
+  ASSERT_STREQ(events[0].name, "step");
+  ASSERT_STREQ(events[0].category, "test");
+  ASSERT_EQ(events[1].layer, 1);
+  ASSERT_EQ(events[1].flops, 100.0);
+  ASSERT_EQ(events[1].bytes, 400.0);
+  ASSERT_EQ(events[2].layer, -1);
+  for (const Profiler::Event &event : events) {
+    ASSERT_LE(event.begin, event.end);
+  }
+  ASSERT_LE(events[0].end, events[1].begin);
+
+  // One row per layer and step.
+  std::ostringstream summary;
+  p.printSummary(summary);
+  const std::string table = summary.str();
+  ASSERT_EQ(std::count(table.begin(), table.end(), '\n'), 4);
+  ASSERT_NE(table.find("GFLOP/s"), std::string::npos);
+  ASSERT_NE(table.find("outer"), std::string::npos);
+
+  p.clear();
+  ASSERT_TRUE(p.getEvents().empty());
+}
+
+// ____________________________________________________________________________
+TEST(ChromeTrace, Profiler) {
+  Profiler &p = profiler();
+  p.start();
+  {
+    ProfileScope scope("gemm dW", "backward", 3, 2e9, 1e6);
+  }
+  p.stop();
+  p.writeChromeTrace("profiler_trace.json");
+  std::ifstream file("profiler_trace.json");
+  std::stringstream contents;
+  contents << file.rdbuf();
+  const std::string trace = contents.str();
+  ASSERT_EQ(trace.rfind("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [", 0),
+            0u);
+  ASSERT_NE(trace.find("\"name\": \"gemm dW\", \"cat\": \"backward\", "
+                       "\"ph\": \"X\""),
+            std::string::npos);
+  ASSERT_NE(trace.find("\"args\": {\"layer\": 3, \"flops\": 2000000000, "
+                       "\"bytes\": 1000000}}"),
+            std::string::npos);
+  ASSERT_EQ(trace.substr(trace.size() - 4), "\n]}\n");
+  ASSERT_THROW(p.writeChromeTrace("/nonexistent/trace.json"),
+               std::runtime_error);
+}
+
+// ____________________________________________________________________________
+TEST(Training, Profiler) {
+  // The training steps are only timed if the library is built with
+  // NN_PROFILE.
+  Matrix<float> X(8, 3, InitState::RANDOM);
+  Matrix<float> y(8, 2, InitState::RANDOM);
+  NeuralNetwork<float> nn(std::vector<size_t>({3, 4, 2}),
+                          {Activation::relu, Activation::sigmoid});
+  profiler().start();
+  nn.train(X, y, 0.1f, 2);
+  profiler().stop();
+  const std::vector<Profiler::Event> events = profiler().getEvents();
+#ifdef NN_PROFILE
+  // Per step: dense (2), output error, activation derivative (2), gemm dW
+  // (2), bias gradient (2), gemm delta and update (2).
+  ASSERT_EQ(events.size(), 2u * 12);
+  size_t dense = 0;
+  for (const Profiler::Event &event : events) {
+    if (std::strcmp(event.name, "dense") == 0) {
+      ASSERT_EQ(event.flops, event.layer == 0 ? 2.0 * 8 * 3 * 4
+                                              : 2.0 * 8 * 4 * 2);
+      ++dense;
+    }
+  }
+  ASSERT_EQ(dense, 4u);
+#else
+  ASSERT_TRUE(events.empty());
+#endif
+}
@@ -0,0 +1,104 @@
+#include <cmath>
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+#include "./InferenceSession.h"
+#include "./NeuralNetwork.h"
+
+// ____________________________________________________________________________
+// Network with 64 inputs and 10 outputs.
+NeuralNetwork<float> makeNetwork(Activation output) {
+  return NeuralNetwork<float>(
+      std::vector<size_t>({64, 128, 48, 10}),
+      std::vector<Activation>({Activation::relu, Activation::tanh, output}));
+}
+
+// ____________________________________________________________________________
+// Returns the largest absolute difference of A and B.
+float maxDifference(const Matrix<float> &A, const Matrix<float> &B) {
+  float result = 0.0f;
+  for (size_t i = 0; i < A.getRows(); ++i) {
+    for (size_t j = 0; j < A.getCols(); ++j) {
+      result = std::max(result, std::fabs(A[i][j] - B[i][j]));
+    }
+  }
+  return result;
+}
+
+// ____________________________________________________________________________
+TEST(MatchesFloat, Quantization) {
+  Matrix<float> calibration(200, 64, InitState::RANDOM);
+  Matrix<float> X(50, 64, InitState::RANDOM);
+  for (Activation output : {Activation::sigmoid, Activation::linear}) {
+    NeuralNetwork<float> nn = makeNetwork(output);
+    const Matrix<float> expected = nn.act(X);
+    nn.quantize(calibration);
+    const QuantizedModel<float> *quantized = nn.getQuantized();
+    ASSERT_NE(quantized, nullptr);
+    ASSERT_EQ(quantized->getWeightBytes(), 64 * 128 + 128 * 48 + 48 * 10);
+
+    // Close to the float network, relative to the range of the outputs.
+    const Matrix<float> out = nn.act(X);
+    ASSERT_EQ(out.getRows(), 50);
+    ASSERT_EQ(out.getCols(), 10);
+    float range = 0.0f;
+    for (size_t i = 0; i < 50; ++i) {
+      for (size_t j = 0; j < 10; ++j) {
+        range = std::max(range, std::fabs(expected[i][j]));
+      }
+    }
+    ASSERT_LT(maxDifference(out, expected), 0.05f * range);
+    ASSERT_EQ(InferenceSession<float>(nn).run(X), out);
+  }
+}
+
+// ____________________________________________________________________________
+TEST(SaveAndLoad, Quantization) {
+  NeuralNetwork<float> nn = makeNetwork(Activation::linear);
+  Matrix<float> X(20, 64, InitState::RANDOM);
+  nn.save("float_model_test.bin");
+  nn.quantize(X);
+  nn.save("quantized_model_test.bin");
+  const Matrix<float> expected = nn.act(X);
+
+  // Loads quantized, without float weights.
+  NeuralNetwork<float> loaded;
+  loaded.load("quantized_model_test.bin", true);
+  ASSERT_NE(loaded.getQuantized(), nullptr);
+  ASSERT_TRUE(loaded.getWeights().empty());
+  ASSERT_EQ(loaded.getLayerSizes(), nn.getLayerSizes());
+  ASSERT_EQ(loaded.act(X), expected);
+  ASSERT_THROW(loaded.train(X, Matrix<float>(20, 10), 0.1f, 1),
+               std::runtime_error);
+  ASSERT_THROW(loaded.quantize(X), std::runtime_error);
+
+  // The weights take a quarter of the space.
+  auto fileSize = [](const char *fileName) {
+    std::FILE *file = std::fopen(fileName, "rb");
+    std::fseek(file, 0, SEEK_END);
+    const long size = std::ftell(file);
+    std::fclose(file);
+    return size;
+  };
+  ASSERT_LT(fileSize("quantized_model_test.bin"),
+            fileSize("float_model_test.bin") / 3);
+
+  // Loading a float model file replaces the quantized model.
+  loaded.load("float_model_test.bin");
+  ASSERT_EQ(loaded.getQuantized(), nullptr);
+
+  // Training works on the float weights and drops the quantized model.
+  nn.train(X, Matrix<float>(20, 10), 0.1f, 1);
+  ASSERT_EQ(nn.getQuantized(), nullptr);
+}
+
+// ____________________________________________________________________________
+TEST(Errors, Quantization) {
+  NeuralNetwork<float> nn = makeNetwork(Activation::linear);
+  ASSERT_THROW(nn.quantize(Matrix<float>(10, 63)), std::invalid_argument);
+  ASSERT_THROW(nn.quantize(Matrix<float>(0, 64)), std::invalid_argument);
+  nn.quantize(Matrix<float>(10, 64, InitState::RANDOM));
+  ASSERT_THROW(nn.act(Matrix<float>(1, 63)), std::invalid_argument);
+}
@@ -0,0 +1,94 @@
+#include <cmath>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <variant>
+#include <vector>
+
+#include "./Sequential.h"
+
+// ____________________________________________________________________________
+TEST(MatchesNeuralNetwork, Sequential) {
+  // The same dense layers compute the same outputs and, with activations
+  // whose derivatives follow from their outputs, take the same steps.
+  NeuralNetwork<float> nn(std::vector<size_t>({5, 16, 8, 3}),
+                          std::vector<Activation>({Activation::relu,
+                                                   Activation::linear,
+                                                   Activation::softmax}),
+                          0.05f);
+  Sequential<float> net(nn);
+  ASSERT_EQ(net.getLayers().size(), 3u);
+  ASSERT_EQ(net.getInputSize(), 5u);
+  ASSERT_EQ(net.getOutputSize(), 3u);
+
+  Matrix<float> X(12, 5, InitState::RANDOM);
+  Matrix<float> y(12, 3, InitState::RANDOM);
+  auto expectNear = [](const Matrix<float> &A, const Matrix<float> &B) {
+    ASSERT_EQ(A.getRows(), B.getRows());
+    ASSERT_EQ(A.getCols(), B.getCols());
+    for (size_t row = 0; row < A.getRows(); ++row) {
+      for (size_t col = 0; col < A.getCols(); ++col) {
+        ASSERT_NEAR(A[row][col], B[row][col], 1e-4f);
+      }
+    }
+  };
+  expectNear(net.act(X), nn.act(X));
+
+  nn.train(X, y, 0.05f, 10);
+  net.train(X, y, 0.05f, 10);
+  expectNear(net.act(X), nn.act(X));
+  for (size_t i = 0; i < 3; ++i) {
+    const DenseLayer<float> &layer =
+        std::get<DenseLayer<float>>(net.getLayers()[i]);
+    expectNear(layer.getWeights(), nn.getWeights()[i]);
+    expectNear(layer.getBiases(), nn.getBiases()[i]);
+  }
+}
+
+// ____________________________________________________________________________
+TEST(XorGate, Sequential) {
+  // Learns the XOR-Gate problem with normalization and dropout between the
+  // dense layers, in batches of two rows.
+  Matrix<float> X_train =
+      std::vector<std::vector<float>>({{0, 0}, {0, 1}, {1, 0}, {1, 1}});
+  Matrix<float> y_train = std::vector<std::vector<float>>({{0}, {1}, {1}, {0}});
+  Sequential<float> net(2);
+  net.add(DenseLayer<float>(2, 16))
+      .add(LayerNormLayer<float>(16))
+      .add(ActivationLayer<float>(Activation::tanh))
+      .add(DropoutLayer<float>(0.1f, 42))
+      .add(DenseLayer<float>(16, 1, Activation::sigmoid));
+  const float before = net.loss(net.act(X_train), y_train);
+  net.train(X_train, y_train, 0.1f, 2000, 2);
+  const Matrix<float> y_out = net.act(X_train);
+  ASSERT_LT(net.loss(y_out, y_train), before);
+  ASSERT_NEAR(y_out[0][0], 0.0f, 0.2f);
+  ASSERT_NEAR(y_out[1][0], 1.0f, 0.2f);
+  ASSERT_NEAR(y_out[2][0], 1.0f, 0.2f);
+  ASSERT_NEAR(y_out[3][0], 0.0f, 0.2f);
+
+  // Inference does not drop anything.
+  ASSERT_EQ(net.act(X_train), y_out);
+}
+
+// ____________________________________________________________________________
+TEST(Shapes, Sequential) {
+  Sequential<float> net(4);
+  net.add(DenseLayer<float>(4, 3));
+  ASSERT_THROW(net.add(DenseLayer<float>(4, 2)), std::invalid_argument);
+  ASSERT_THROW(net.add(LayerNormLayer<float>(4)), std::invalid_argument);
+  net.add(LayerNormLayer<float>(3));
+  ASSERT_EQ(net.getLayers().size(), 2u);
+  ASSERT_EQ(net.getOutputSize(), 3u);
+
+  // Inputs and labels must match the network.
+  ASSERT_THROW(net.act(Matrix<float>(2, 5)), std::invalid_argument);
+  ASSERT_THROW(net.train(Matrix<float>(2, 4), Matrix<float>(2, 2)),
+               std::invalid_argument);
+  ASSERT_THROW(net.train(Matrix<float>(2, 4), Matrix<float>(3, 3)),
+               std::invalid_argument);
+
+  // Growing and shrinking the batch replans the buffers.
+  net.reserve(8);
+  ASSERT_EQ(net.act(Matrix<float>(16, 4, InitState::ONES)).getRows(), 16u);
+  ASSERT_EQ(net.act(Matrix<float>(3, 4, InitState::ONES)).getRows(), 3u);
+}
@@ -0,0 +1,219 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "./Activation.h"
+#include "./Simd.h"
+
+// ____________________________________________________________________________
+// Returns the float kernel tables this machine can run.
+std::vector<const SimdKernels<float> *> availableFloatKernels() {
+  static const SimdKernels<float> scalar = scalarKernels<float>();
+  std::vector<const SimdKernels<float> *> tables = {&scalar};
+  SimdLevel level = detectSimdLevel();
+  if (level >= SimdLevel::SSE2 && sse2Kernels<float>() != nullptr) {
+    tables.push_back(sse2Kernels<float>());
+  }
+  if (level >= SimdLevel::AVX2 && avx2Kernels<float>() != nullptr) {
+    tables.push_back(avx2Kernels<float>());
+  }
+  if (level >= SimdLevel::AVX512 && avx512Kernels<float>() != nullptr) {
+    tables.push_back(avx512Kernels<float>());
+  }
+  return tables;
+}
+
+// ____________________________________________________________________________
+// Distance in units in the last place between two floats.
+int64_t ulpDistance(float a, float b) {
+  int32_t ia, ib;
+  std::memcpy(&ia, &a, sizeof(a));
+  std::memcpy(&ib, &b, sizeof(b));
+  // Map to a monotonic integer line.
+  int64_t la = ia < 0 ? int64_t(INT32_MIN) - ia : ia;
+  int64_t lb = ib < 0 ? int64_t(INT32_MIN) - ib : ib;
+  return la > lb ? la - lb : lb - la;
+}
+
+// ____________________________________________________________________________
+// Largest ULP error of kernel against reference on [lo, hi], skipping
+// reference values below FLT_MIN (flushed to zero by the kernels).
+int64_t maxUlpError(void (*kernel)(const float *, float *, size_t),
+                    double (*reference)(double), float lo, float hi) {
+  const size_t n = 200003;
+  std::vector<float> x(n), y(n);
+  for (size_t i = 0; i < n; ++i) {
+    x[i] = lo + (hi - lo) * static_cast<float>(i) / (n - 1);
+  }
+  kernel(x.data(), y.data(), n);
+  int64_t worst = 0;
+  for (size_t i = 0; i < n; ++i) {
+    double expected = reference(x[i]);
+    if (std::fabs(expected) < 1.17549435e-38) {
+      continue;
+    }
+    worst = std::max(worst, ulpDistance(y[i], static_cast<float>(expected)));
+  }
+  return worst;
+}
+
+double referenceSigmoid(double x) { return 1.0 / (1.0 + std::exp(-x)); }
+double referenceExp(double x) { return std::exp(x); }
+double referenceTanh(double x) { return std::tanh(x); }
+
+// ____________________________________________________________________________
+TEST(ExpUlpError, Simd) {
+  for (const SimdKernels<float> *kernels : availableFloatKernels()) {
+    EXPECT_LE(maxUlpError(kernels->exp, referenceExp, -87.0f, 88.0f), 2);
+  }
+}
+
+// ____________________________________________________________________________
+TEST(SigmoidUlpError, Simd) {
+  for (const SimdKernels<float> *kernels : availableFloatKernels()) {
+    EXPECT_LE(maxUlpError(kernels->sigmoid, referenceSigmoid, -80.0f, 80.0f),
+              3);
+  }
+}
+
+// ____________________________________________________________________________
+TEST(TanhUlpError, Simd) {
+  for (const SimdKernels<float> *kernels : availableFloatKernels()) {
+    EXPECT_LE(maxUlpError(kernels->tanh, referenceTanh, -10.0f, 10.0f), 3);
+    EXPECT_LE(maxUlpError(kernels->tanh, referenceTanh, -0.7f, 0.7f), 3);
+  }
+}
+
+// ____________________________________________________________________________
+TEST(ElementwiseMatchesScalar, Simd) {
+  // Odd lengths exercise the vector tails.
+  const size_t n = 1037;
+  std::vector<float> a(n), b(n), expected(n), out(n);
+  for (size_t i = 0; i < n; ++i) {
+    a[i] = std::sin(static_cast<float>(i)) * 3.0f;
+    b[i] = std::cos(static_cast<float>(i)) * 2.0f;
+  }
+  const SimdKernels<float> scalar = scalarKernels<float>();
+  for (const SimdKernels<float> *kernels : availableFloatKernels()) {
+    using Binary = void (*)(const float *, const float *, float *, size_t);
+    for (auto op : {&SimdKernels<float>::add, &SimdKernels<float>::sub,
+                    &SimdKernels<float>::mul}) {
+      Binary reference = scalar.*op;
+      Binary kernel = kernels->*op;
+      reference(a.data(), b.data(), expected.data(), n);
+      kernel(a.data(), b.data(), out.data(), n);
+      EXPECT_EQ(out, expected);
+    }
+    using Unary = void (*)(const float *, float *, size_t);
+    for (auto op : {&SimdKernels<float>::relu,
+                     &SimdKernels<float>::reluDerivative,
+                     &SimdKernels<float>::step}) {
+      Unary reference = scalar.*op;
+      Unary kernel = kernels->*op;
+      reference(a.data(), expected.data(), n);
+      kernel(a.data(), out.data(), n);
+      EXPECT_EQ(out, expected);
+    }
+    kernels->scale(a.data(), 0.5f, out.data(), n);
+    scalar.scale(a.data(), 0.5f, expected.data(), n);
+    EXPECT_EQ(out, expected);
+    out = b;
+    expected = b;
+    kernels->axpy(a.data(), -1.5f, out.data(), n);
+    scalar.axpy(a.data(), -1.5f, expected.data(), n);
+    EXPECT_EQ(out, expected);
+    kernels->maximum(a.data(), 0.25f, out.data(), n);
+    scalar.maximum(a.data(), 0.25f, expected.data(), n);
+    EXPECT_EQ(out, expected);
+    EXPECT_NEAR(kernels->sum(a.data(), n), scalar.sum(a.data(), n), 1e-3);
+  }
+}
+
+// ____________________________________________________________________________
+TEST(SoftmaxMatchesReference, Simd) {
+  // Rows with and without a tail, shifted far beyond the range of exp: the
+  // kernels subtract the maximum, so the shift does not change the results.
+  for (const SimdKernels<float> *kernels : availableFloatKernels()) {
+    for (size_t n : {1, 7, 16, 37}) {
+      for (float shift : {0.0f, 1000.0f, -1000.0f}) {
+        std::vector<float> z(n), y(n, 0.0f), p(n), gradient(n);
+        for (size_t i = 0; i < n; ++i) {
+          z[i] = 5.0f * std::sin(static_cast<float>(i)) + shift;
+        }
+        y[n / 2] = 0.75f;
+        y[0] += 0.25f;
+        double max = z[0], total = 0.0;
+        for (float x : z) {
+          max = std::max<double>(max, x);
+        }
+        for (float x : z) {
+          total += std::exp(x - max);
+        }
+        double expectedLoss = 0.0;
+        for (size_t i = 0; i < n; ++i) {
+          expectedLoss -= y[i] * (z[i] - max - std::log(total));
+        }
+        kernels->softmax(z.data(), p.data(), n);
+        const float loss = kernels->softmaxCrossEntropy(z.data(), y.data(),
+                                                        gradient.data(), n);
+        EXPECT_NEAR(loss, expectedLoss, 1e-5 * std::max(1.0, expectedLoss));
+        for (size_t i = 0; i < n; ++i) {
+          const double expected = std::exp(z[i] - max) / total;
+          EXPECT_NEAR(p[i], expected, 1e-6);
+          EXPECT_NEAR(gradient[i], expected - y[i], 1e-6);
+        }
+      }
+    }
+  }
+}
+
+// ____________________________________________________________________________
+TEST(SetSimdLevel, Simd) {
+  SimdLevel detected = detectSimdLevel();
+  setSimdLevel(SimdLevel::SCALAR);
+  EXPECT_EQ(simdLevel(), SimdLevel::SCALAR);
+  Matrix<float> X = std::vector<std::vector<float>>({{-1.0f, 0.0f, 2.0f}});
+  Matrix<float> scalarResult = sigmoid(X);
+  setSimdLevel(SimdLevel::AVX512);
+  EXPECT_EQ(simdLevel(), detected);
+  Matrix<float> simdResult = sigmoid(X);
+  for (size_t col = 0; col < 3; ++col) {
+    EXPECT_NEAR(simdResult[0][col], scalarResult[0][col], 1e-6);
+  }
+  EXPECT_STREQ(simdLevelName(SimdLevel::AVX2), "avx2");
+}
+
+// ____________________________________________________________________________
+TEST(Int8DotMatchesScalar, Simd) {
+  // Extreme values and lengths with and without a tail, for every number of
+  // rows.
+  const size_t ldb = 300;
+  std::vector<int8_t> a(ldb);
+  std::vector<int8_t> b(4 * ldb);
+  for (size_t i = 0; i < a.size(); ++i) {
+    a[i] = static_cast<int8_t>(i % 3 == 0 ? -127 : (i * 37) % 255 - 127);
+  }
+  for (size_t i = 0; i < b.size(); ++i) {
+    b[i] = static_cast<int8_t>(i % 5 == 0 ? 127 : (i * 91) % 255 - 127);
+  }
+  const Int8Kernels scalar = scalarInt8Kernels();
+  std::vector<const Int8Kernels *> tables = {&scalar};
+  if (detectSimdLevel() >= SimdLevel::AVX2 && avx2Int8Kernels() != nullptr) {
+    tables.push_back(avx2Int8Kernels());
+  }
+  for (const Int8Kernels *kernels : tables) {
+    for (size_t k : {1, 15, 16, 17, 64, 255, 300}) {
+      for (size_t nb = 1; nb <= 4; ++nb) {
+        int32_t expected[4] = {};
+        int32_t result[4] = {};
+        scalar.dot(k, a.data(), b.data(), ldb, nb, expected);
+        kernels->dot(k, a.data(), b.data(), ldb, nb, result);
+        for (size_t j = 0; j < nb; ++j) {
+          ASSERT_EQ(result[j], expected[j]) << "k " << k << ", row " << j;
+        }
+      }
+    }
+  }
+}
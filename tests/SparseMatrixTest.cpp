@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+#include "./Dense.h"
+#include "./Half.h"
+#include "./SparseMatrix.h"
+
+namespace {
+
+// ____________________________________________________________________________
+// Random rows x cols matrix with about density non-zeros.
+Matrix<float> randomSparse(size_t rows, size_t cols, float density) {
+  Matrix<float> X(rows, cols, InitState::RANDOM);
+  Matrix<float> keep(rows, cols, InitState::RANDOM);
+  for (size_t row = 0; row < rows; ++row) {
+    for (size_t col = 0; col < cols; ++col) {
+      if (keep[row][col] >= density) {
+        X[row][col] = 0.0f;
+      }
+    }
+  }
+  return X;
+}
+
+// ____________________________________________________________________________
+void expectNear(const Matrix<float> &A, const Matrix<float> &B,
+                float epsilon = 1e-4f) {
+  ASSERT_EQ(A.getRows(), B.getRows());
+  ASSERT_EQ(A.getCols(), B.getCols());
+  for (size_t row = 0; row < A.getRows(); ++row) {
+    for (size_t col = 0; col < A.getCols(); ++col) {
+      ASSERT_NEAR(A[row][col], B[row][col], epsilon);
+    }
+  }
+}
+
+} // namespace
+
+// ____________________________________________________________________________
+TEST(Construction, SparseMatrix) {
+  // [[0, 2, 0], [0, 0, 0], [1, 0, 3]]
+  const SparseMatrix<float> A(3, 3, {0, 1, 1, 3}, {1, 0, 2}, {2, 1, 3});
+  ASSERT_EQ(A.getRows(), 3u);
+  ASSERT_EQ(A.getCols(), 3u);
+  ASSERT_EQ(A.getNonZeros(), 3u);
+  const Matrix<float> dense = std::vector<std::vector<float>>(
+      {{0, 2, 0}, {0, 0, 0}, {1, 0, 3}});
+  ASSERT_EQ(A.toDense(), dense);
+
+  // From a dense matrix and back.
+  const SparseMatrix<float> B(dense);
+  ASSERT_EQ(B.getRowOffsets(), A.getRowOffsets());
+  ASSERT_EQ(B.getColumns(), A.getColumns());
+  ASSERT_EQ(B.getValues(), A.getValues());
+
+  // Inconsistent arrays.
+  ASSERT_THROW(SparseMatrix<float>(2, 3, {0, 1}, {0}, {1}),
+               std::invalid_argument);
+  ASSERT_THROW(SparseMatrix<float>(1, 3, {0, 2}, {0}, {1}),
+               std::invalid_argument);
+  ASSERT_THROW(SparseMatrix<float>(1, 3, {0, 1}, {3}, {1}),
+               std::invalid_argument);
+  ASSERT_THROW(SparseMatrix<float>(1, 3, {0, 2}, {2, 1}, {1, 1}),
+               std::invalid_argument);
+  ASSERT_THROW(SparseMatrix<float>(2, 3, {0, 1, 0}, {0}, {1}),
+               std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+TEST(SelectRows, SparseMatrix) {
+  const Matrix<float> dense = randomSparse(10, 20, 0.2f);
+  const SparseMatrix<float> A(dense);
+  SparseMatrix<float> batch;
+  const std::vector<size_t> rows = {7, 0, 7, 3};
+  A.selectRows(rows.data(), rows.size(), batch);
+  const Matrix<float> selected = batch.toDense();
+  ASSERT_EQ(selected.getRows(), rows.size());
+  for (size_t i = 0; i < rows.size(); ++i) {
+    for (size_t col = 0; col < 20; ++col) {
+      ASSERT_EQ(selected[i][col], dense[rows[i]][col]);
+    }
+  }
+  const size_t outOfRange = 10;
+  ASSERT_THROW(A.selectRows(&outOfRange, 1, batch), std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+TEST(SparseDot, SparseMatrix) {
+  for (float density : {0.0f, 0.05f, 0.5f}) {
+    const Matrix<float> X = randomSparse(33, 200, density);
+    const SparseMatrix<float> A(X);
+    Matrix<float> W(200, 17, InitState::RANDOM);
+    const Matrix<float> b(1, 17, InitState::RANDOM);
+
+    Matrix<float> C;
+    sparseDot(A, W, C);
+    expectNear(C, dot(X, W));
+    ASSERT_THROW(sparseDot(A, Matrix<float>(199, 17), C),
+                 std::invalid_argument);
+
+    // The fused layer (bias, Z and activation in the epilogue).
+    for (Activation activation :
+         {Activation::linear, Activation::sigmoid, Activation::softmax}) {
+      Matrix<float> denseA, denseZ, sparseA, sparseZ;
+      dense(X, W, b, activation, denseA, &denseZ);
+      dense(A, W, b, activation, sparseA, &sparseZ);
+      expectNear(sparseZ, denseZ);
+      expectNear(sparseA, denseA);
+    }
+
+    // Half width weights are widened before they are added.
+    Matrix<bfloat16> halfW;
+    convert(W, halfW);
+    Matrix<float> denseA, sparseA;
+    dense(X, halfW, b, Activation::relu, denseA);
+    dense(A, halfW, b, Activation::relu, sparseA);
+    expectNear(sparseA, denseA);
+  }
+}
+
+// ____________________________________________________________________________
+TEST(SparseTransposeDot, SparseMatrix) {
+  const Matrix<float> X = randomSparse(40, 300, 0.02f);
+  const SparseMatrix<float> A(X);
+  const Matrix<float> D(40, 9, InitState::RANDOM);
+  SparseRows<float> gradient;
+  sparseTransposeDot(A, D, gradient);
+
+  // The rows of the used columns hold dot(X^T, D), all others are zero.
+  const Matrix<float> expected = transposeDot(X, D);
+  ASSERT_EQ(gradient.values.getRows(), gradient.rows.size());
+  size_t next = 0;
+  for (size_t col = 0; col < 300; ++col) {
+    bool used = false;
+    for (size_t row = 0; row < 40; ++row) {
+      used = used || X[row][col] != 0.0f;
+    }
+    if (!used) {
+      for (size_t j = 0; j < 9; ++j) {
+        ASSERT_EQ(expected[col][j], 0.0f);
+      }
+      continue;
+    }
+    ASSERT_LT(next, gradient.rows.size());
+    ASSERT_EQ(gradient.rows[next], col);
+    for (size_t j = 0; j < 9; ++j) {
+      ASSERT_NEAR(gradient.values[next][j], expected[col][j], 1e-4f);
+    }
+    ++next;
+  }
+  ASSERT_EQ(next, gradient.rows.size());
+
+  // Reusing the buffers for another batch, and a batch without non-zeros.
+  const Matrix<float> Y = randomSparse(40, 300, 0.1f);
+  sparseTransposeDot(SparseMatrix<float>(Y), D, gradient);
+  ASSERT_EQ(gradient.values.getRows(), gradient.rows.size());
+  sparseTransposeDot(
+      SparseMatrix<float>(Matrix<float>(40, 300, InitState::ZERO)), D,
+      gradient);
+  ASSERT_TRUE(gradient.rows.empty());
+  ASSERT_THROW(sparseTransposeDot(A, Matrix<float>(39, 9), gradient),
+               std::invalid_argument);
+}
@@ -0,0 +1,232 @@
+#include <cmath>
+#include <gtest/gtest.h>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "./Tape.h"
+#include "./ThreadPool.h"
+
+// ____________________________________________________________________________
+// Matrix with reproducible values in [lo, hi].
+Matrix<float> randomMatrix(size_t rows, size_t cols, unsigned seed,
+                           float lo = -1.0f, float hi = 1.0f) {
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<float> distribution(lo, hi);
+  Matrix<float> M(rows, cols, InitState::EMPTY);
+  for (size_t row = 0; row < rows; ++row) {
+    for (size_t col = 0; col < cols; ++col) {
+      M[row][col] = distribution(random);
+    }
+  }
+  return M;
+}
+
+// ____________________________________________________________________________
+// Compares the gradients of loss (1 x 1) with respect to the parameters with
+// central differences.
+void checkGradients(Tape<float> &tape, Tape<float>::Var loss,
+                    const std::vector<Tape<float>::Var> &params,
+                    const std::vector<Matrix<float> *> &matrices) {
+  tape.backward(loss);
+  const float eps = 1e-2f;
+  for (size_t p = 0; p < params.size(); ++p) {
+    Matrix<float> &W = *matrices[p];
+    const Matrix<float> grad = tape.grad(params[p]);
+    ASSERT_EQ(grad.getRows(), W.getRows());
+    ASSERT_EQ(grad.getCols(), W.getCols());
+    for (size_t row = 0; row < W.getRows(); ++row) {
+      for (size_t col = 0; col < W.getCols(); ++col) {
+        const float w = W[row][col];
+        W[row][col] = w + eps;
+        const float plus = tape.forward(loss)[0][0];
+        W[row][col] = w - eps;
+        const float minus = tape.forward(loss)[0][0];
+        W[row][col] = w;
+        const float expected = (plus - minus) / (2 * eps);
+        EXPECT_NEAR(grad[row][col], expected,
+                    2e-2f * std::max(1.0f, std::fabs(expected)))
+            << "parameter " << p << " at " << row << ", " << col;
+      }
+    }
+  }
+}
+
+// ____________________________________________________________________________
+TEST(MeanSquaredErrorOfMLP, Tape) {
+  Matrix<float> X = randomMatrix(6, 3, 1);
+  Matrix<float> y = randomMatrix(6, 2, 2, 0.0f, 1.0f);
+  Matrix<float> W1 = randomMatrix(3, 5, 3);
+  Matrix<float> b1 = randomMatrix(1, 5, 4);
+  Matrix<float> W2 = randomMatrix(5, 2, 5);
+  Matrix<float> b2 = randomMatrix(1, 2, 6);
+
+  Tape<float> tape;
+  auto w1 = tape.parameter(W1);
+  auto bias1 = tape.parameter(b1);
+  auto w2 = tape.parameter(W2);
+  auto bias2 = tape.parameter(b2);
+  auto hidden = tape.activation(
+      tape.add(tape.dot(tape.input(X), w1), bias1), Activation::tanh);
+  auto out = tape.activation(tape.add(tape.dot(hidden, w2), bias2),
+                             Activation::sigmoid);
+  auto diff = tape.sub(out, tape.input(y));
+  auto loss = tape.scale(tape.sum(tape.mul(diff, diff)), 0.5f);
+  tape.keep(out);
+
+  checkGradients(tape, loss, {w1, bias1, w2, bias2}, {&W1, &b1, &W2, &b2});
+
+  // Values of the last run.
+  tape.backward(loss);
+  const Matrix<float> &o = tape.value(out);
+  float expected = 0;
+  for (size_t row = 0; row < 6; ++row) {
+    for (size_t col = 0; col < 2; ++col) {
+      const float d = o[row][col] - y[row][col];
+      expected += 0.5f * d * d;
+    }
+  }
+  ASSERT_NEAR(tape.value(loss)[0][0], expected, 1e-5f);
+  ASSERT_THROW(tape.value(hidden), std::invalid_argument);
+  ASSERT_THROW(tape.grad(hidden), std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+TEST(AllOperations, Tape) {
+  Matrix<float> X = randomMatrix(4, 3, 7);
+  Matrix<float> W = randomMatrix(3, 5, 8);
+  Matrix<float> b = randomMatrix(1, 5, 9);
+  Matrix<float> V = randomMatrix(4, 5, 10);
+
+  Tape<float> tape;
+  auto w = tape.parameter(W);
+  auto bias = tape.parameter(b);
+  auto v = tape.parameter(V);
+  auto z = tape.dot(tape.input(X), w);
+  auto s = tape.activation(tape.transpose(z), Activation::softmax);
+  auto m = tape.maximum(tape.add(z, v), 0.1f);
+  auto r = tape.activation(tape.sub(z, bias), Activation::relu);
+  auto l = tape.activation(tape.mul(m, r), Activation::linear);
+  auto q = tape.dot(l, s);
+  // q and z are used twice, so their gradients add up.
+  auto loss = tape.sum(tape.add(tape.scale(q, 0.5f), tape.mul(q, q)));
+  loss = tape.add(loss, tape.sum(tape.activation(z, Activation::sigmoid)));
+
+  checkGradients(tape, loss, {w, bias, v}, {&W, &b, &V});
+}
+
+// ____________________________________________________________________________
+TEST(SoftmaxCrossEntropy, Tape) {
+  Matrix<float> X = randomMatrix(5, 3, 12);
+  Matrix<float> W = randomMatrix(3, 4, 13, -2.0f, 2.0f);
+  Matrix<float> b = randomMatrix(1, 4, 14);
+  Matrix<float> Y(5, 4, InitState::ZERO);
+  for (size_t row = 0; row < 5; ++row) {
+    Y[row][row % 4] = 1.0f;
+  }
+
+  Tape<float> tape;
+  auto w = tape.parameter(W);
+  auto bias = tape.parameter(b);
+  auto logits = tape.add(tape.dot(tape.input(X), w), bias);
+  auto crossEntropy = tape.softmaxCrossEntropy(logits, tape.input(Y));
+  // The mean over the rows, so the gradient is scaled.
+  auto loss = tape.scale(crossEntropy, 0.2f);
+  tape.keep(logits);
+
+  checkGradients(tape, loss, {w, bias}, {&W, &b});
+
+  // Same as the softmax and log on the tape.
+  tape.backward(loss);
+  Matrix<float> P = softmax(tape.value(logits));
+  float expected = 0.0f;
+  for (size_t row = 0; row < 5; ++row) {
+    expected -= 0.2f * std::log(P[row][row % 4]);
+  }
+  ASSERT_NEAR(tape.value(loss)[0][0], expected, 1e-5f);
+  ASSERT_THROW(tape.softmaxCrossEntropy(logits, w), std::invalid_argument);
+  ASSERT_THROW(tape.softmaxCrossEntropy(logits, logits),
+               std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+TEST(DotWithInput, Tape) {
+  // Only W needs a gradient, so the value of h is not kept for the backward
+  // pass of the second product and its buffer is reused.
+  Matrix<float> X = randomMatrix(6, 3, 15);
+  Matrix<float> W = randomMatrix(3, 5, 16);
+  Matrix<float> X2 = randomMatrix(5, 4, 17);
+
+  Tape<float> tape;
+  auto w = tape.parameter(W);
+  auto h = tape.activation(tape.dot(tape.input(X), w), Activation::tanh);
+  auto loss = tape.sum(tape.dot(h, tape.input(X2)));
+
+  checkGradients(tape, loss, {w}, {&W});
+}
+
+// ____________________________________________________________________________
+TEST(ReusesBuffers, Tape) {
+  // Forward only: a chain needs two buffers, whatever its length.
+  Matrix<float> X = randomMatrix(100, 100, 11);
+  Tape<float> chain;
+  auto x = chain.input(X);
+  for (int i = 0; i < 20; ++i) {
+    x = chain.activation(chain.scale(x, 0.9f), Activation::tanh);
+  }
+  chain.forward(x);
+  ASSERT_EQ(chain.getNumBuffers(), 2);
+
+  // Training a deep MLP: the gradients reuse buffers of each other, the
+  // values needed by the backward pass stay.
+  const size_t layers = 8;
+  const size_t batch = 32;
+  const size_t width = 64;
+  Matrix<float> input = randomMatrix(batch, width, 12);
+  std::vector<Matrix<float>> weights;
+  for (size_t i = 0; i < layers; ++i) {
+    weights.push_back(randomMatrix(width, width, 13 + i, -0.2f, 0.2f));
+  }
+  Tape<float> mlp;
+  auto a = mlp.input(input);
+  size_t intermediates = 0;
+  for (size_t i = 0; i < layers; ++i) {
+    a = mlp.activation(mlp.dot(a, mlp.parameter(weights[i])),
+                       Activation::tanh);
+    intermediates += 2;
+  }
+  auto loss = mlp.sum(a);
+  mlp.backward(loss);
+  // Every intermediate has a value and a gradient.
+  const size_t naiveBytes = 2 * intermediates * batch * width * sizeof(float);
+  ASSERT_LT(mlp.getBufferBytes(), naiveBytes * 6 / 10);
+
+  // Later runs do not allocate, with several threads as well.
+  const size_t threads = getNumThreads();
+  setNumThreads(4);
+  mlp.backward(loss);
+  const size_t before = numAlignedAllocations.load();
+  mlp.backward(loss);
+  mlp.forward(loss);
+  mlp.backward(loss);
+  ASSERT_EQ(numAlignedAllocations.load(), before);
+  setNumThreads(threads);
+}
+
+// ____________________________________________________________________________
+TEST(Errors, Tape) {
+  Matrix<float> X(4, 3, InitState::ONES);
+  Matrix<float> W(2, 5, InitState::ONES);
+  Tape<float> tape;
+  auto x = tape.input(X);
+  auto w = tape.parameter(W);
+  ASSERT_THROW(tape.dot(x, w), std::invalid_argument);
+  ASSERT_THROW(tape.add(x, w), std::invalid_argument);
+  ASSERT_THROW(tape.mul(x, w), std::invalid_argument);
+  ASSERT_THROW(tape.sum(Tape<float>::Var{42}), std::invalid_argument);
+
+  auto loss = tape.sum(tape.dot(x, tape.transpose(tape.input(X))));
+  ASSERT_FLOAT_EQ(tape.forward(loss)[0][0], 48.0f);
+  X = Matrix<float>(5, 3, InitState::ONES);
+  ASSERT_THROW(tape.forward(loss), std::invalid_argument);
+}
@@ -0,0 +1,115 @@
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "./Gemm.h"
+#include "./Matrix.h"
+#include "./ThreadPool.h"
+
+// ____________________________________________________________________________
+TEST(CoversEveryIndexOnce, ThreadPool) {
+  ThreadPool pool(4);
+  ASSERT_EQ(pool.getNumThreads(), 4);
+  for (size_t n : {0, 1, 7, 1000, 100000}) {
+    std::vector<std::atomic<int>> hits(n);
+    pool.parallelFor(n, 3, [&](size_t begin, size_t end) {
+      ASSERT_LT(begin, end);
+      for (size_t i = begin; i < end; ++i) {
+        hits[i].fetch_add(1);
+      }
+    });
+    for (size_t i = 0; i < n; ++i) {
+      ASSERT_EQ(hits[i].load(), 1) << "at " << i;
+    }
+  }
+}
+
+// ____________________________________________________________________________
+TEST(NestedLoopsRunSerially, ThreadPool) {
+  ThreadPool pool(3);
+  std::atomic<size_t> total{0};
+  pool.parallelFor(64, 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      pool.parallelFor(10, 1, [&](size_t b, size_t e) { total += e - b; });
+    }
+  });
+  ASSERT_EQ(total.load(), 640);
+}
+
+// ____________________________________________________________________________
+TEST(ConcurrentCallers, ThreadPool) {
+  ThreadPool pool(3);
+  std::vector<size_t> totals(4, 0);
+  std::vector<std::thread> callers;
+  for (size_t t = 0; t < totals.size(); ++t) {
+    callers.emplace_back([&, t] {
+      for (int round = 0; round < 200; ++round) {
+        std::atomic<size_t> total{0};
+        pool.parallelFor(100, 1, [&](size_t begin, size_t end) {
+          total += end - begin;
+        });
+        totals[t] += total.load();
+      }
+    });
+  }
+  for (std::thread &caller : callers) {
+    caller.join();
+  }
+  ASSERT_EQ(totals, std::vector<size_t>(4, 20000));
+}
+
+// ____________________________________________________________________________
+TEST(RethrowsExceptions, ThreadPool) {
+  ThreadPool pool(4);
+  // Every range throws, on the caller and on the workers.
+  ASSERT_THROW(pool.parallelFor(1000, 1,
+                                [](size_t, size_t) {
+                                  throw std::runtime_error("body");
+                                }),
+               std::runtime_error);
+
+  // The pool is free again: later loops cover every index and still run on
+  // several threads.
+  std::mutex mutex;
+  std::set<std::thread::id> threads;
+  std::atomic<size_t> total{0};
+  pool.parallelFor(64, 1, [&](size_t begin, size_t end) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    total += end - begin;
+    std::lock_guard<std::mutex> lock(mutex);
+    threads.insert(std::this_thread::get_id());
+  });
+  ASSERT_EQ(total.load(), 64);
+  ASSERT_GT(threads.size(), 1);
+}
+
+// ____________________________________________________________________________
+TEST(SetNumThreads, ThreadPool) {
+  const size_t before = getNumThreads();
+  setNumThreads(4);
+  ASSERT_EQ(getNumThreads(), 4);
+  ASSERT_EQ(threadPool().getNumThreads(), 4);
+  ASSERT_THROW(setNumThreads(0), std::invalid_argument);
+
+  // GEMM, elementwise kernels and reductions give the same results with
+  // several threads as with one.
+  Matrix<float> A(70, 300, InitState::RANDOM);
+  Matrix<float> B(300, 2100, InitState::RANDOM);
+  Matrix<float> C = dot(A, B);
+  Matrix<float> D = add(C, C);
+  Matrix<float> colSums = C.sum(1);
+  Matrix<float> rowSums = C.sum(0);
+  float total = sum(C);
+  setNumThreads(1);
+  ASSERT_EQ(dot(A, B), C);
+  ASSERT_EQ(add(C, C), D);
+  ASSERT_EQ(C.sum(1), colSums);
+  ASSERT_EQ(C.sum(0), rowSums);
+  ASSERT_EQ(sum(C), total);
+  setNumThreads(before);
+}
@@ -0,0 +1,182 @@
+#include <atomic>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <new>
+
+#include "./NeuralNetwork.h"
+#include "./ThreadPool.h"
+#include "./Workspace.h"
+
+// ____________________________________________________________________________
+// Counting allocator: every operator new in this test binary goes through
+// here. (GCC does not see that operator delete is replaced as well.)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+std::atomic<size_t> numAllocations{0};
+
+void *operator new(size_t size) {
+  numAllocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+// Returns the number of allocations so far, matrix buffers included.
+size_t allocations() {
+  return numAllocations.load() + numAlignedAllocations.load();
+}
+
+// ____________________________________________________________________________
+TEST(Reserve, Workspace) {
+  Workspace<float> ws;
+  std::vector<size_t> layerSizes({3, 5, 2});
+  ws.reserve(layerSizes, 4);
+  ASSERT_EQ(ws.getBatchSize(), 4);
+  ASSERT_EQ(ws.A.size(), 3);
+  ASSERT_EQ(ws.A[0].getCols(), 3);
+  ASSERT_EQ(ws.dW[1].getRows(), 5);
+  ASSERT_EQ(ws.dW[1].getCols(), 2);
+  ASSERT_EQ(ws.deltas[1].getRows(), 4);
+
+  // Same sizes: nothing is reallocated.
+  size_t before = allocations();
+  ws.reserve(layerSizes, 4);
+  ASSERT_EQ(allocations(), before);
+
+  ws.reserve(layerSizes, 8);
+  ASSERT_EQ(ws.Z[0].getRows(), 8);
+  ASSERT_THROW(ws.reserve({3}, 8), std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+TEST(Checkpoints, Workspace) {
+  Workspace<float> ws;
+  const std::vector<size_t> layerSizes({16, 32, 32, 32, 32, 32, 16});
+  Checkpointing checkpointing;
+  checkpointing.checkpoints = {2, 4};
+  ws.reserve(layerSizes, 8, false, checkpointing);
+  ASSERT_EQ(ws.getSegments(), std::vector<size_t>({0, 2, 4, 6}));
+
+  // Only the boundaries, the output Z and the pool of one segment exist.
+  ASSERT_EQ(ws.A[2].getRows(), 8);
+  ASSERT_EQ(ws.A[6].getRows(), 8);
+  ASSERT_EQ(ws.deltas[3].getRows(), 8);
+  ASSERT_EQ(ws.A[1].getRows(), 0);
+  ASSERT_EQ(ws.deltas[2].getRows(), 0);
+  ASSERT_EQ(ws.Z[4].getRows(), 0);
+  ASSERT_EQ(ws.Z[5].getRows(), 8);
+  ASSERT_EQ(ws.getBatchBytes(),
+            batchBytes<float>(layerSizes, 8, checkpointing.checkpoints));
+  ASSERT_LT(ws.getBatchBytes(), batchBytes<float>(layerSizes, 8) * 3 / 5);
+
+  // Activating a segment swaps its buffers in, the others out.
+  ws.activateSegment(1);
+  ASSERT_EQ(ws.A[3].getRows(), 8);
+  ASSERT_EQ(ws.A[3].getCols(), 32);
+  ASSERT_EQ(ws.derivatives[2].getCols(), 32);
+  ws.activateSegment(0);
+  ASSERT_EQ(ws.A[3].getRows(), 0);
+  ASSERT_EQ(ws.A[1].getRows(), 8);
+
+  // Switching batch sizes does not allocate after the first time.
+  ws.reserve(layerSizes, 4, false, checkpointing);
+  ws.reserve(layerSizes, 8, false, checkpointing);
+  const size_t before = allocations();
+  ws.reserve(layerSizes, 4, false, checkpointing);
+  ws.activateSegment(2);
+  ws.reserve(layerSizes, 8, false, checkpointing);
+  ASSERT_EQ(allocations(), before);
+
+  checkpointing.checkpoints = {4, 2};
+  ASSERT_THROW(ws.reserve(layerSizes, 8, false, checkpointing),
+               std::invalid_argument);
+  checkpointing.checkpoints = {6};
+  ASSERT_THROW(ws.reserve(layerSizes, 8, false, checkpointing),
+               std::invalid_argument);
+}
+
+// ____________________________________________________________________________
+TEST(PlanCheckpoints, Workspace) {
+  const std::vector<size_t> layerSizes(17, 64);
+  const size_t all = batchBytes<float>(layerSizes, 32);
+  ASSERT_TRUE(planCheckpoints<float>(layerSizes, 32, all).empty());
+
+  // Half the memory: the plan fits, and needs more than the split needing
+  // the least memory (four segments, about a third).
+  const std::vector<size_t> plan =
+      planCheckpoints<float>(layerSizes, 32, all / 2);
+  ASSERT_FALSE(plan.empty());
+  ASSERT_LE(batchBytes<float>(layerSizes, 32, plan), all / 2);
+  const std::vector<size_t> smallest =
+      planCheckpoints<float>(layerSizes, 32, 1);
+  ASSERT_LT(batchBytes<float>(layerSizes, 32, smallest),
+            batchBytes<float>(layerSizes, 32, plan));
+  ASSERT_EQ(smallest, std::vector<size_t>({4, 8, 12}));
+
+  // The workspace plans for the largest batch so far.
+  Workspace<float> ws;
+  Checkpointing checkpointing;
+  checkpointing.memoryBudget = all / 2;
+  ws.reserve(layerSizes, 32, false, checkpointing);
+  ASSERT_LE(ws.getBatchBytes(), all / 2);
+  ASSERT_GT(ws.getSegments().size(), 2);
+  ws.reserve(layerSizes, 16, false, checkpointing);
+  ASSERT_LE(ws.getBatchBytes(), all / 2);
+}
+
+// ____________________________________________________________________________
+TEST(SteadyStateTrainingDoesNotAllocate, Workspace) {
+  // With several threads (any of them may get its first GEMM tile late).
+  const size_t threads = getNumThreads();
+  setNumThreads(4);
+  Matrix<float> X(64, 20, InitState::RANDOM);
+  Matrix<float> y(64, 3, InitState::RANDOM);
+  NeuralNetwork<float> nn(
+      std::vector<size_t>({20, 40, 30, 3}),
+      std::vector<Activation>(
+          {Activation::relu, Activation::tanh, Activation::sigmoid}),
+      0.01f, InitState::RANDOM);
+
+  // Warm up (sizes the workspace and the GEMM packing buffers).
+  nn.train(X, y, 0.01f, 1);
+
+  // The epochs themselves must not allocate: train() with 1 epoch and with
+  // 20 epochs allocates the same amount.
+  size_t before = allocations();
+  nn.train(X, y, 0.01f, 1);
+  size_t oneEpoch = allocations() - before;
+  before = allocations();
+  nn.train(X, y, 0.01f, 20);
+  size_t manyEpochs = allocations() - before;
+  ASSERT_EQ(manyEpochs, oneEpoch);
+
+  // Same with shuffled mini-batches (the last batch of an epoch is smaller).
+  nn.train(X, y, 0.01f, 1, false, 24);
+  before = allocations();
+  nn.train(X, y, 0.01f, 1, false, 24);
+  oneEpoch = allocations() - before;
+  before = allocations();
+  nn.train(X, y, 0.01f, 20, false, 24);
+  manyEpochs = allocations() - before;
+  ASSERT_EQ(manyEpochs, oneEpoch);
+
+  // Same with checkpointing.
+  Checkpointing checkpointing;
+  checkpointing.checkpoints = {1};
+  nn.setCheckpointing(checkpointing);
+  nn.train(X, y, 0.01f, 1, false, 24);
+  before = allocations();
+  nn.train(X, y, 0.01f, 1, false, 24);
+  oneEpoch = allocations() - before;
+  before = allocations();
+  nn.train(X, y, 0.01f, 20, false, 24);
+  manyEpochs = allocations() - before;
+  ASSERT_EQ(manyEpochs, oneEpoch);
+  setNumThreads(threads);
+}